@@ -1067,18 +1067,18 @@ int CDemoCamera::InsertImage()
    this->GetLabel(label);
  
    // Important:  metadata about the image are generated here:
-   Metadata md;
-   md.put("Camera", label);
-   md.put(MM::g_Keyword_Metadata_StartTime, CDeviceUtils::ConvertToString(sequenceStartTime_.getMsec()));
-   md.put(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString((timeStamp - sequenceStartTime_).getMsec()));
-   md.put(MM::g_Keyword_Metadata_ROI_X, CDeviceUtils::ConvertToString( (long) roiX_)); 
-   md.put(MM::g_Keyword_Metadata_ROI_Y, CDeviceUtils::ConvertToString( (long) roiY_)); 
+   FrameMetadata md;
+   md.PutString(FrameMetadata::KeyCamera, label);
+   md.PutDouble(FrameMetadata::KeyStartTimeMs, sequenceStartTime_.getMsec());
+   md.PutDouble(FrameMetadata::KeyElapsedTimeMs, (timeStamp - sequenceStartTime_).getMsec());
+   md.PutInteger(FrameMetadata::KeyROIX, roiX_);
+   md.PutInteger(FrameMetadata::KeyROIY, roiY_);
 
    imageCounter_++;
 
    char buf[MM::MaxStrLength];
    GetProperty(MM::g_Keyword_Binning, buf);
-   md.put(MM::g_Keyword_Binning, buf);
+   md.PutString(FrameMetadata::KeyBinning, buf);
 
    MMThreadGuard g(imgPixelsLock_);
 
@@ -1089,18 +1089,21 @@ int CDemoCamera::InsertImage()
    unsigned int h = GetImageHeight();
    unsigned int b = GetImageBytesPerPixel();
 
-   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str());
+   // Reserve the next frame of the circular buffer and write the image
+   // directly into it, so that the core does not need to copy it again
+   unsigned char* slot = 0;
+   int ret = GetCoreCallback()->AcquireImageSlot(this, w, h, b, nComponents_, &slot);
    if (!stopOnOverflow_ && ret == DEVICE_BUFFER_OVERFLOW)
    {
       // do not stop on overflow - just reset the buffer
       GetCoreCallback()->ClearImageBuffer(this);
-      // don't process this same image again...
-      return GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str(), false);
+      ret = GetCoreCallback()->AcquireImageSlot(this, w, h, b, nComponents_, &slot);
    }
-   else
-   {
+   if (ret != DEVICE_OK)
       return ret;
-   }
+
+   memcpy(slot, pI, w * h * b);
+   return GetCoreCallback()->CommitImageSlot(this, md);
 }
 
 /*
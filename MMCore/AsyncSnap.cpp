@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          AsyncSnap.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Snap running on its own thread, for snapImageAsync()
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "AsyncSnap.h"
+
+#include "ErrorCodes.h"
+#include "FrameBuffer.h"
+
+#include <boost/bind.hpp>
+
+
+namespace mm {
+
+AsyncSnap::AsyncSnap(SnapFunction snap) :
+   snap_(snap),
+   done_(false),
+   thread_(boost::bind(&AsyncSnap::Run, this))
+{
+}
+
+AsyncSnap::~AsyncSnap()
+{
+   thread_.join();
+}
+
+bool AsyncSnap::IsDone() const
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   return done_;
+}
+
+boost::shared_ptr<FrameBuffer> AsyncSnap::Wait() throw (CMMError)
+{
+   boost::unique_lock<boost::mutex> lock(mutex_);
+   while (!done_)
+      doneCondVar_.wait(lock);
+   if (error_)
+      throw *error_;
+   return frame_;
+}
+
+void AsyncSnap::Run()
+{
+   boost::shared_ptr<FrameBuffer> frame;
+   boost::shared_ptr<CMMError> error;
+   try
+   {
+      frame = snap_();
+   }
+   catch (const CMMError& e)
+   {
+      error.reset(new CMMError(e));
+   }
+   catch (...)
+   {
+      error.reset(new CMMError("Unhandled exception during snap",
+               MMERR_UnhandledException));
+   }
+
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   frame_ = frame;
+   error_ = error;
+   done_ = true;
+   doneCondVar_.notify_all();
+}
+
+} // namespace mm
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          AsyncSnap.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Snap running on its own thread, for snapImageAsync()
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+namespace mm {
+
+class FrameBuffer;
+
+/**
+ * The result of a snap that runs on a thread of its own: either the frame
+ * (all channels, copied out of the camera) or the error thrown by the snap.
+ *
+ * The destructor waits for the snap to finish.
+ */
+class AsyncSnap : boost::noncopyable
+{
+public:
+   typedef boost::function<boost::shared_ptr<FrameBuffer> ()> SnapFunction;
+
+   // Starts calling snap on a new thread. snap returns the frame or throws
+   // CMMError.
+   explicit AsyncSnap(SnapFunction snap);
+   ~AsyncSnap();
+
+   bool IsDone() const;
+
+   // Blocks until the snap is done. Throws the snap's error, if any.
+   boost::shared_ptr<FrameBuffer> Wait() throw (CMMError);
+
+private:
+   void Run();
+
+   SnapFunction snap_;
+
+   mutable boost::mutex mutex_;
+   boost::condition_variable doneCondVar_;
+   bool done_;
+   boost::shared_ptr<FrameBuffer> frame_;
+   boost::shared_ptr<CMMError> error_;
+
+   boost::thread thread_; // Last, so that it starts after the rest is set up
+};
+
+} // namespace mm
@@ -1,310 +1,870 @@
-///////////////////////////////////////////////////////////////////////////////
-// FILE:          CircularBuffer.cpp
-// PROJECT:       Micro-Manager
-// SUBSYSTEM:     MMCore
-//-----------------------------------------------------------------------------
-// DESCRIPTION:   Generic implementation of the circular buffer. The buffer
-//                allows only one thread to enter at a time by using a mutex lock.
-//                This makes the buffer susceptible to race conditions if the
-//                calling threads are mutually dependent.
-//              
-// COPYRIGHT:     University of California, San Francisco, 2007,
-//
-// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
-//                License text is included with the source distribution.
-//
-//                This file is distributed in the hope that it will be useful,
-//                but WITHOUT ANY WARRANTY; without even the implied warranty
-//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
-//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
-//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
-//
-// AUTHOR:        Nenad Amodaj, nenad@amodaj.com, 01/05/2007
-// 
-#include "CircularBuffer.h"
-#include "CoreUtils.h"
-
-#include "../MMDevice/DeviceUtils.h"
-
-
-const long long bytesInMB = 1 << 20;
-const long adjustThreshold = LONG_MAX / 2;
-const unsigned long maxCBSize = 100000;    //a reasonable limit to circular buffer size
-
-CircularBuffer::CircularBuffer(unsigned int memorySizeMB) :
-   width_(0), 
-   height_(0), 
-   pixDepth_(0), 
-   imageCounter_(0), 
-   insertIndex_(0), 
-   saveIndex_(0), 
-   memorySizeMB_(memorySizeMB), 
-   overflow_(false)
-{
-}
-
-CircularBuffer::~CircularBuffer() {}
-
-bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int h, unsigned int pixDepth)
-{
-   MMThreadGuard guard(g_bufferLock);
-   imageNumbers_.clear();
-
-   bool ret = true;
-   try
-   {
-      if (w == 0 || h==0 || pixDepth == 0 || channels == 0)
-         return false; // does not make sense
-
-      if (w == width_ && height_ == h && pixDepth_ == pixDepth && channels == numChannels_)
-         if (frameArray_.size() > 0)
-            return true; // nothing to change
-
-      width_ = w;
-      height_ = h;
-      pixDepth_ = pixDepth;
-      numChannels_ = channels;
-
-      insertIndex_ = 0;
-      saveIndex_ = 0;
-      overflow_ = false;
-
-      // calculate the size of the entire buffer array once all images get allocated
-      // the actual size at the time of the creation is going to be less, because
-      // images are not allocated until pixels become available
-      unsigned long frameSizeBytes = width_ * height_ * pixDepth_ * numChannels_;
-      unsigned long cbSize = (unsigned long) ((memorySizeMB_ * bytesInMB) / frameSizeBytes);
-
-      if (cbSize == 0) 
-      {
-         frameArray_.resize(0);
-         return false; // memory footprint too small
-      }
-
-      // set a reasonable limit to circular buffer capacity 
-      if (cbSize > maxCBSize)
-         cbSize = maxCBSize; 
-
-      // TODO: verify if we have enough RAM to satisfy this request
-
-      for (unsigned long i=0; i<frameArray_.size(); i++)
-         frameArray_[i].Clear();
-
-      // allocate buffers  - could conceivably throw an out-of-memory exception
-      frameArray_.resize(cbSize);
-      for (unsigned long i=0; i<frameArray_.size(); i++)
-      {
-         frameArray_[i].Resize(w, h, pixDepth);
-         frameArray_[i].Preallocate(numChannels_);
-      }
-   }
-
-   catch( ... /* std::bad_alloc& ex */)
-   {
-      frameArray_.resize(0);
-      ret = false;
-   }
-   return ret;
-}
-
-unsigned long CircularBuffer::GetSize() const
-{
-   MMThreadGuard guard(g_bufferLock);
-   return (unsigned long)frameArray_.size();
-}
-
-unsigned long CircularBuffer::GetFreeSize() const
-{
-   MMThreadGuard guard(g_bufferLock);
-   long freeSize = (long)frameArray_.size() - (insertIndex_ - saveIndex_);
-   if (freeSize < 0)
-      return 0;
-   else
-      return (unsigned long)freeSize;
-}
-
-unsigned long CircularBuffer::GetRemainingImageCount() const
-{
-   MMThreadGuard guard(g_bufferLock);
-   return (unsigned long)(insertIndex_ - saveIndex_);
-}
-
-/**
-* Inserts a single image in the buffer.
-*/
-bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError)
-{
-   return InsertMultiChannel(pixArray, 1, width, height, byteDepth, pMd);
-}
-
-/**
-* Inserts a single image, possibly with multiple channels, but with 1 component, in the buffer.
-*/
-bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd) throw (CMMError)
-{
-   return InsertMultiChannel(pixArray, numChannels, width, height, byteDepth, 1, pMd);
-}
-
-/**
-* Inserts a single image, possibly with multiple components, in the buffer.
-*/
-bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
-{
-    return InsertMultiChannel(pixArray, 1, width, height, byteDepth, nComponents, pMd);
-}
- 
-/**
-* Inserts a multi-channel frame in the buffer.
-*/
-bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd) throw (CMMError)
-{
-    MMThreadGuard guard(g_insertLock);
- 
-    mm::ImgBuffer* pImg;
-    unsigned long singleChannelSize = (unsigned long)width * height * byteDepth;
- 
-    {
-       MMThreadGuard guard(g_bufferLock);
- 
-       // check image dimensions
-       if (width != width_ || height != height_ || byteDepth != pixDepth_)
-          throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
- 
-       bool overflowed = (insertIndex_ - saveIndex_) >= static_cast<long>(frameArray_.size());
-       if (overflowed) {
-          overflow_ = true;
-          return false;
-       }
-    }
- 
-    for (unsigned i=0; i<numChannels; i++)
-    {
-       Metadata md;
-       {
-          MMThreadGuard guard(g_bufferLock);
-          // we assume that all buffers are pre-allocated
-          pImg = frameArray_[insertIndex_ % frameArray_.size()].FindImage(i);
-          if (!pImg)
-             return false;
- 
-          if (pMd)
-          {
-             // TODO: the same metadata is inserted for each channel ???
-             // Perhaps we need to add specific tags to each channel
-             md = *pMd;
-          }
-
-         std::string cameraName = md.GetSingleTag("Camera").GetValue();
-         if (imageNumbers_.end() == imageNumbers_.find(cameraName))
-         {
-            imageNumbers_[cameraName] = 0;
-         }
-
-         // insert image number. 
-         md.put(MM::g_Keyword_Metadata_ImageNumber, CDeviceUtils::ConvertToString(imageNumbers_[cameraName]));
-         ++imageNumbers_[cameraName];
-      }
-
-      if (!md.HasTag(MM::g_Keyword_Elapsed_Time_ms))
-      {
-         // if time tag was not supplied by the camera insert current timestamp
-         MM::MMTime timestamp = GetMMTimeNow();
-         md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString(timestamp.getMsec()));
-      }
-
-      md.PutImageTag("Width",width);
-      md.PutImageTag("Height",height);
-      if (byteDepth == 1)
-         md.PutImageTag("PixelType","GRAY8");
-      else if (byteDepth == 2)
-         md.PutImageTag("PixelType","GRAY16");
-      else if (byteDepth == 4)
-      {
-         if (nComponents == 1)
-            md.PutImageTag("PixelType","GRAY32");
-         else
-            md.PutImageTag("PixelType","RGB32");
-      }
-      else if (byteDepth == 8)
-         md.PutImageTag("PixelType","RGB64");
-      else
-         md.PutImageTag("PixelType","Unknown"); 
-
-      pImg->SetMetadata(md);
-      pImg->SetPixels(pixArray + i*singleChannelSize);
-   }
-
-   {
-      MMThreadGuard guard(g_bufferLock);
-
-      imageCounter_++;
-      insertIndex_++;
-      if ((insertIndex_ - (long)frameArray_.size()) > adjustThreshold && (saveIndex_- (long)frameArray_.size()) > adjustThreshold)
-      {
-         // adjust buffer indices to avoid overflowing integer size
-         insertIndex_ -= adjustThreshold;
-         saveIndex_ -= adjustThreshold;
-      }
-   }
-
-   return true;
-}
- 
-
-const unsigned char* CircularBuffer::GetTopImage() const
-{
-   const mm::ImgBuffer* img = GetNthFromTopImageBuffer(0, 0);
-   if (!img)
-      return 0;
-   return img->GetPixels();
-}
-
-const mm::ImgBuffer* CircularBuffer::GetTopImageBuffer(unsigned channel) const
-{
-   return GetNthFromTopImageBuffer(0, channel);
-}
-
-const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(unsigned long n) const
-{
-   return GetNthFromTopImageBuffer(static_cast<long>(n), 0);
-}
-
-const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(long n,
-      unsigned channel) const
-{
-   MMThreadGuard guard(g_bufferLock);
-
-   long availableImages = insertIndex_ - saveIndex_;
-   if (n + 1 > availableImages)
-      return 0;
-
-   long targetIndex = insertIndex_ - n - 1L;
-   while (targetIndex < 0)
-      targetIndex += (long) frameArray_.size();
-   targetIndex %= frameArray_.size();
-
-   return frameArray_[targetIndex].FindImage(channel);
-}
-
-const unsigned char* CircularBuffer::GetNextImage()
-{
-   const mm::ImgBuffer* img = GetNextImageBuffer(0);
-   if (!img)
-      return 0;
-   return img->GetPixels();
-}
-
-const mm::ImgBuffer* CircularBuffer::GetNextImageBuffer(unsigned channel)
-{
-   MMThreadGuard guard(g_bufferLock);
-
-   long availableImages = insertIndex_ - saveIndex_;
-   if (availableImages < 1)
-      return 0;
-
-   long targetIndex = saveIndex_ % frameArray_.size();
-   ++saveIndex_;
-   return frameArray_[targetIndex].FindImage(channel);
-}
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          CircularBuffer.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Generic implementation of the circular buffer. The buffer
+//                allows only one thread to enter at a time by using a mutex lock.
+//                This makes the buffer susceptible to race conditions if the
+//                calling threads are mutually dependent.
+//              
+// COPYRIGHT:     University of California, San Francisco, 2007,
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+//
+// AUTHOR:        Nenad Amodaj, nenad@amodaj.com, 01/05/2007
+// 
+#include "CircularBuffer.h"
+#include "CoreUtils.h"
+
+#include "../MMDevice/DeviceUtils.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/thread.hpp>
+
+
+const long long bytesInMB = 1 << 20;
+const long adjustThreshold = LONG_MAX / 2;
+const unsigned long maxCBSize = 100000;    //a reasonable limit to circular buffer size
+const size_t cacheLineSize = 64;
+const long pinnedPollMs = 1; // Overflow blocking on a slot held by a FrameHandle
+
+CircularBuffer::CircularBuffer(unsigned int memorySizeMB) :
+   width_(0), 
+   height_(0), 
+   pixDepth_(0), 
+   imageCounter_(0), 
+   insertIndex_(0), 
+   saveIndex_(0), 
+   memorySizeMB_(memorySizeMB), 
+   overflow_(false),
+   lockFree_(false),
+   pendingSlot_(0),
+   pendingComponents_(1),
+   pendingDropped_(false),
+   overflowPolicy_(OverflowReport),
+   blockTimeoutMs_(0)
+{
+}
+
+CircularBuffer::~CircularBuffer() {}
+
+bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int h, unsigned int pixDepth)
+{
+   MMThreadGuard guard(g_bufferLock);
+   imageNumbers_.clear();
+   droppedFrames_.clear();
+
+   bool ret = true;
+   try
+   {
+      if (w == 0 || h==0 || pixDepth == 0 || channels == 0)
+         return false; // does not make sense
+
+      if (w == width_ && height_ == h && pixDepth_ == pixDepth && channels == numChannels_)
+         if (frameArray_.size() > 0)
+            return true; // nothing to change
+
+      width_ = w;
+      height_ = h;
+      pixDepth_ = pixDepth;
+      numChannels_ = channels;
+
+      insertIndex_ = 0;
+      saveIndex_ = 0;
+      overflow_ = false;
+      // Each channel starts on a cache line boundary; all slots are carved
+      // out of one mapping of the full memory footprint
+      const size_t channelSize = (size_t)width_ * height_ * pixDepth_;
+      const size_t channelStride = (channelSize + cacheLineSize - 1) / cacheLineSize * cacheLineSize;
+      const size_t slotSize = channelStride * numChannels_;
+      const size_t memorySize = (size_t)(memorySizeMB_ * bytesInMB);
+      unsigned long cbSize = (unsigned long) (memorySize / slotSize);
+
+      if (cbSize == 0) 
+      {
+         frameArray_.clear();
+         return false; // memory footprint too small
+      }
+
+      // set a reasonable limit to circular buffer capacity 
+      if (cbSize > maxCBSize)
+         cbSize = maxCBSize; 
+
+      // Drop the old frames; any that are pinned by a FrameHandle stay
+      // alive (together with their memory) until released.
+      frameArray_.clear();
+
+      // Reuse the existing mapping, whose pages are already faulted in,
+      // unless pinned frames still refer to it. Mapping could conceivably
+      // throw an out-of-memory exception.
+      if (!memory_ || !memory_.unique() || memory_->GetSize() < cbSize * slotSize)
+      {
+         memory_.reset();
+         memory_.reset(new mm::RingMemory(memorySize, memoryOptions_));
+      }
+
+      frameArray_.reserve(cbSize);
+      for (unsigned long i=0; i<cbSize; i++)
+      {
+         boost::shared_ptr<mm::FrameBuffer> frame(new mm::FrameBuffer(w, h, pixDepth));
+         frame->Preallocate(numChannels_, memory_->GetData() + i * slotSize,
+               channelStride, memory_);
+         frameArray_.push_back(frame);
+      }
+   }
+
+   catch( ... /* std::bad_alloc& ex */)
+   {
+      frameArray_.clear();
+      memory_.reset();
+      ret = false;
+   }
+   return ret;
+}
+
+void CircularBuffer::SetMemoryOptions(const mm::RingMemoryOptions& options)
+{
+   MMThreadGuard guard(g_bufferLock);
+   if (options == memoryOptions_)
+      return;
+
+   memoryOptions_ = options;
+   frameArray_.clear();
+   memory_.reset();
+   // Reject images until the next Initialize()
+   width_ = 0;
+   height_ = 0;
+   pixDepth_ = 0;
+   insertIndex_ = 0;
+   saveIndex_ = 0;
+}
+
+void CircularBuffer::SetOverflowPolicy(OverflowPolicy policy, long blockTimeoutMs)
+{
+   MMThreadGuard guard(g_bufferLock);
+   overflowPolicy_ = policy;
+   blockTimeoutMs_ = blockTimeoutMs;
+}
+
+/**
+* Returns the number of frames from the given camera that were discarded by
+* the overflow policy since the last Initialize().
+*/
+unsigned long CircularBuffer::GetDroppedFrameCount(const std::string& camera) const
+{
+   MMThreadGuard guard(g_bufferLock);
+   std::map<std::string, unsigned long>::const_iterator it = droppedFrames_.find(camera);
+   return it == droppedFrames_.end() ? 0 : it->second;
+}
+
+unsigned long CircularBuffer::GetDroppedFrameCount() const
+{
+   MMThreadGuard guard(g_bufferLock);
+   unsigned long count = 0;
+   for (std::map<std::string, unsigned long>::const_iterator it = droppedFrames_.begin(),
+         end = droppedFrames_.end(); it != end; ++it)
+      count += it->second;
+   return count;
+}
+
+unsigned long CircularBuffer::GetSize() const
+{
+   MMThreadGuard guard(g_bufferLock);
+   return (unsigned long)frameArray_.size();
+}
+
+unsigned long CircularBuffer::GetFreeSize() const
+{
+   MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+   long long freeSize = (long long)frameArray_.size() - (long long)GetRemainingImageCount();
+   if (freeSize < 0)
+      return 0;
+   else
+      return (unsigned long)freeSize;
+}
+
+unsigned long CircularBuffer::GetRemainingImageCount() const
+{
+   MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+   // Load saveIndex_ first: it can only grow, so the difference is never
+   // negative even if the producer advances insertIndex_ in between.
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+   return (unsigned long)(insertIndex - saveIndex);
+}
+
+/**
+* Discards all images currently in the buffer.
+*/
+void CircularBuffer::Clear()
+{
+   {
+      MMThreadGuard guard(g_bufferLock);
+      if (lockFree_)
+      {
+         // Only move the consumer index forward; the producer may be inserting
+         // and the consumer popping concurrently. If the consumer has already
+         // moved past the frames seen here, leave its index alone.
+         const long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+         long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+         while (saveIndex < insertIndex &&
+               !saveIndex_.compare_exchange_weak(saveIndex, insertIndex,
+                  boost::memory_order_acq_rel, boost::memory_order_acquire))
+            ;
+         // The producer owns occupancy_ in this mode and refreshes it with the
+         // next frame
+      }
+      else
+      {
+         insertIndex_ = 0;
+         saveIndex_ = 0;
+         occupancy_.Set(0);
+      }
+      overflow_ = false;
+   }
+   popSignal_.Notify();
+}
+
+/**
+* Inserts a single image in the buffer.
+*/
+bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError)
+{
+   return InsertMultiChannel(pixArray, 1, width, height, byteDepth, pMd);
+}
+
+/**
+* Inserts a single image, possibly with multiple channels, but with 1 component, in the buffer.
+*/
+bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd) throw (CMMError)
+{
+   return InsertMultiChannel(pixArray, numChannels, width, height, byteDepth, 1, pMd);
+}
+
+/**
+* Inserts a single image, possibly with multiple components, in the buffer.
+*/
+bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
+{
+    return InsertMultiChannel(pixArray, 1, width, height, byteDepth, nComponents, pMd);
+}
+ 
+/**
+* Inserts a multi-channel frame in the buffer.
+*/
+bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd) throw (CMMError)
+{
+   if (lockFree_)
+      return InsertLockFree(pixArray, numChannels, width, height, byteDepth, nComponents, pMd);
+   return InsertLocked(pixArray, numChannels, width, height, byteDepth, nComponents, pMd);
+}
+
+bool CircularBuffer::InsertLocked(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd) throw (CMMError)
+{
+    MMThreadGuard guard(g_insertLock);
+    ReleaseStaleSlot();
+ 
+    mm::ImgBuffer* pImg;
+    unsigned long singleChannelSize = (unsigned long)width * height * byteDepth;
+ 
+    {
+       MMThreadGuard guard(g_bufferLock);
+ 
+       // check image dimensions
+       if (width != width_ || height != height_ || byteDepth != pixDepth_)
+          throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+    }
+
+    switch (FindFreeSlot())
+    {
+       case SlotOverflow:
+          return false;
+       case SlotDropNew:
+          CountDroppedFrame(GetCameraLabel(FrameMetadata(), pMd));
+          return true;
+       default:
+          break;
+    }
+ 
+    // TODO: the same metadata is inserted for each channel ???
+    // Perhaps we need to add specific tags to each channel
+    boost::shared_ptr<const Metadata> baseMd;
+    if (pMd)
+       baseMd.reset(new Metadata(*pMd));
+
+    for (unsigned i=0; i<numChannels; i++)
+    {
+       FrameMetadata md;
+       {
+          MMThreadGuard guard(g_bufferLock);
+          // we assume that all buffers are pre-allocated
+          pImg = frameArray_[insertIndex_ % frameArray_.size()]->FindImage(i);
+          if (!pImg)
+             return false;
+
+         AddImageNumber(md, baseMd.get());
+      }
+
+      AddImageTags(md, baseMd.get(), width, height, byteDepth, nComponents);
+      pImg->SetMetadata(baseMd, md);
+      pImg->SetPixels(pixArray + i*singleChannelSize);
+   }
+
+   PublishFrame();
+   return true;
+}
+
+/**
+* Single-producer insertion that does not take any lock. The slot at
+* insertIndex_ is owned by the producer until insertIndex_ is published.
+*/
+bool CircularBuffer::InsertLockFree(const unsigned char* pixArray, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd) throw (CMMError)
+{
+   ReleaseStaleSlot();
+
+   // Geometry only changes in Initialize(), which must not run concurrently
+   // with insertion.
+   if (width != width_ || height != height_ || byteDepth != pixDepth_)
+      throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+
+   switch (FindFreeSlot())
+   {
+      case SlotOverflow:
+         return false;
+      case SlotDropNew:
+         CountDroppedFrame(GetCameraLabel(FrameMetadata(), pMd));
+         return true;
+      default:
+         break;
+   }
+
+   const long long size = static_cast<long long>(frameArray_.size());
+   const long long insertIndex = insertIndex_.load(boost::memory_order_relaxed);
+
+   boost::shared_ptr<const Metadata> baseMd;
+   if (pMd)
+      baseMd.reset(new Metadata(*pMd));
+
+   unsigned long singleChannelSize = (unsigned long)width * height * byteDepth;
+   mm::FrameBuffer& frame = *frameArray_[insertIndex % size];
+   for (unsigned i=0; i<numChannels; i++)
+   {
+      mm::ImgBuffer* pImg = frame.FindImage(i);
+      if (!pImg)
+         return false;
+
+      // Only the producer touches imageNumbers_ in this mode
+      FrameMetadata md;
+      AddImageNumber(md, baseMd.get());
+      AddImageTags(md, baseMd.get(), width, height, byteDepth, nComponents);
+      pImg->SetMetadata(baseMd, md);
+      pImg->SetPixels(pixArray + i*singleChannelSize);
+   }
+
+   PublishFrame();
+   return true;
+}
+
+/**
+* Reserves the next free frame for zero-copy insertion and returns a pointer
+* to its (single-channel) pixel memory, or null if the buffer is full. The
+* caller must fill the pixels and then call CommitSlot() or AbandonSlot()
+* from the same thread; in locked mode other producers are held off until
+* then. A reservation that is still pending when the same thread reserves or
+* inserts again is abandoned. If the overflow policy discards the frame, the
+* returned memory is a scratch slot that CommitSlot() does not publish.
+*/
+unsigned char* CircularBuffer::AcquireSlot(unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents) throw (CMMError)
+{
+   if (!lockFree_)
+      g_insertLock.Lock();
+   ReleaseStaleSlot();
+
+   mm::ImgBuffer* pImg = 0;
+   bool compatible;
+   {
+      MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+      compatible = (width == width_ && height == height_ && byteDepth == pixDepth_);
+   }
+   pendingDropped_ = false;
+   if (compatible)
+   {
+      SlotStatus status = FindFreeSlot();
+      MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+      if (status == SlotFree)
+      {
+         const long long size = static_cast<long long>(frameArray_.size());
+         const long long insertIndex = insertIndex_.load(boost::memory_order_relaxed);
+         pImg = frameArray_[insertIndex % size]->FindImage(0);
+      }
+      else if (status == SlotDropNew)
+      {
+         if (!discardSlot_ || discardSlot_->Width() != width ||
+               discardSlot_->Height() != height || discardSlot_->Depth() != byteDepth)
+            discardSlot_.reset(new mm::ImgBuffer(width, height, byteDepth));
+         pImg = discardSlot_.get();
+         pendingDropped_ = true;
+      }
+   }
+
+   if (!pImg)
+   {
+      if (!lockFree_)
+         g_insertLock.Unlock();
+      if (!compatible)
+         throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+      return 0;
+   }
+
+   pendingSlot_ = pImg;
+   pendingComponents_ = nComponents;
+   return pImg->GetPixelsRW();
+}
+
+/**
+* Publishes the frame reserved by AcquireSlot(), attaching the metadata.
+*/
+bool CircularBuffer::CommitSlot(const Metadata* pMd)
+{
+   boost::shared_ptr<const Metadata> baseMd;
+   if (pMd)
+      baseMd.reset(new Metadata(*pMd));
+   return CommitSlot(FrameMetadata(), baseMd);
+}
+
+/**
+* Publishes the frame reserved by AcquireSlot(), attaching binary metadata
+* and (optionally) tags shared with other frames. The tags in md take
+* precedence over those in baseMd.
+*/
+bool CircularBuffer::CommitSlot(const FrameMetadata& md,
+      const boost::shared_ptr<const Metadata>& baseMd)
+{
+   mm::ImgBuffer* pImg = pendingSlot_;
+   if (!pImg)
+      return false;
+   pendingSlot_ = 0;
+
+   if (pendingDropped_)
+   {
+      pendingDropped_ = false;
+      CountDroppedFrame(GetCameraLabel(md, baseMd.get()));
+      if (!lockFree_)
+         g_insertLock.Unlock();
+      return true;
+   }
+
+   FrameMetadata frameMd(md);
+   {
+      MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+      AddImageNumber(frameMd, baseMd.get());
+   }
+   AddImageTags(frameMd, baseMd.get(), pImg->Width(), pImg->Height(), pImg->Depth(), pendingComponents_);
+   pImg->SetMetadata(baseMd, frameMd);
+
+   PublishFrame();
+   if (!lockFree_)
+      g_insertLock.Unlock();
+   return true;
+}
+
+/**
+* Releases the frame reserved by AcquireSlot() without inserting it.
+*/
+void CircularBuffer::AbandonSlot()
+{
+   if (!pendingSlot_)
+      return;
+   pendingSlot_ = 0;
+   pendingDropped_ = false;
+   if (!lockFree_)
+      g_insertLock.Unlock();
+}
+
+// Called by a producer that holds g_insertLock (or in lock-free mode). A
+// pending slot can then only belong to the calling thread, which has left
+// it neither committed nor abandoned; drop it and the lock it still holds.
+void CircularBuffer::ReleaseStaleSlot()
+{
+   if (pendingSlot_)
+      AbandonSlot();
+}
+
+/**
+* Removes the next frame from the buffer and returns it, pinned: its slot
+* will not be reused until the returned pointer (and all copies) are gone.
+* Returns null if the buffer is empty.
+*/
+boost::shared_ptr<mm::FrameBuffer> CircularBuffer::PopNextFrame()
+{
+   if (lockFree_)
+   {
+      long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+      for (;;)
+      {
+         if (insertIndex_.load(boost::memory_order_acquire) - saveIndex < 1)
+            return boost::shared_ptr<mm::FrameBuffer>();
+         // Pin the frame before handing the slot back to the producer
+         boost::shared_ptr<mm::FrameBuffer> frame =
+            frameArray_[saveIndex % frameArray_.size()];
+         if (saveIndex_.compare_exchange_weak(saveIndex, saveIndex + 1,
+                  boost::memory_order_acq_rel, boost::memory_order_acquire))
+         {
+            popSignal_.Notify();
+            return frame;
+         }
+      }
+   }
+
+   boost::shared_ptr<mm::FrameBuffer> frame;
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      if (insertIndex_ - saveIndex_ < 1)
+         return boost::shared_ptr<mm::FrameBuffer>();
+
+      frame = frameArray_[saveIndex_ % frameArray_.size()];
+      ++saveIndex_;
+   }
+   popSignal_.Notify();
+   return frame;
+}
+
+/**
+* Removes up to maxCount frames from the buffer in a single operation and
+* appends them, pinned, to frames. Returns the number of frames removed.
+*/
+unsigned CircularBuffer::PopNextFrames(unsigned maxCount,
+      std::vector< boost::shared_ptr<mm::FrameBuffer> >& frames)
+{
+   const size_t start = frames.size();
+   if (lockFree_)
+   {
+      long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+      for (;;)
+      {
+         long long count = insertIndex_.load(boost::memory_order_acquire) - saveIndex;
+         if (count > maxCount)
+            count = maxCount;
+         if (count < 1)
+            return 0;
+         // Pin the frames before handing the slots back to the producer
+         for (long long i = 0; i < count; ++i)
+            frames.push_back(frameArray_[(saveIndex + i) % frameArray_.size()]);
+         if (saveIndex_.compare_exchange_weak(saveIndex, saveIndex + count,
+                  boost::memory_order_acq_rel, boost::memory_order_acquire))
+         {
+            popSignal_.Notify();
+            return static_cast<unsigned>(count);
+         }
+         frames.resize(start);
+      }
+   }
+
+   long long count;
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      count = insertIndex_ - saveIndex_;
+      if (count > maxCount)
+         count = maxCount;
+      if (count < 1)
+         return 0;
+      for (long long i = 0; i < count; ++i)
+         frames.push_back(frameArray_[(saveIndex_ + i) % frameArray_.size()]);
+      saveIndex_ += count;
+   }
+   popSignal_.Notify();
+   return static_cast<unsigned>(count);
+}
+
+/**
+* Returns the frame that PopNextFrame() would return, without removing it, or
+* null if the buffer is empty. In lock-free mode, must only be called from the
+* consumer thread.
+*/
+boost::shared_ptr<mm::FrameBuffer> CircularBuffer::PeekNextFrame() const
+{
+   MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   if (insertIndex_.load(boost::memory_order_acquire) - saveIndex < 1)
+      return boost::shared_ptr<mm::FrameBuffer>();
+   return frameArray_[saveIndex % frameArray_.size()];
+}
+
+// True if the slot for the given index is referenced outside of the buffer.
+// Only the consumer can add a reference, and only to a slot that is not
+// free, so a false result stays valid for the producer.
+bool CircularBuffer::IsPinned(long long index) const
+{
+   return !frameArray_[index % frameArray_.size()].unique();
+}
+
+// Caller must hold g_bufferLock unless in lock-free mode.
+void CircularBuffer::AddImageNumber(FrameMetadata& md, const Metadata* baseMd)
+{
+   long& imageNumber = imageNumbers_[GetCameraLabel(md, baseMd)];
+   md.PutInteger(FrameMetadata::KeyImageNumber, imageNumber);
+   ++imageNumber;
+}
+
+std::string CircularBuffer::GetCameraLabel(const FrameMetadata& md, const Metadata* baseMd)
+{
+   FrameMetadata::Tag cameraTag;
+   if (md.FindTag(FrameMetadata::KeyCamera, cameraTag) &&
+         cameraTag.type == FrameMetadata::TypeString)
+      return cameraTag.stringValue;
+   if (baseMd && baseMd->HasTag("Camera"))
+      return baseMd->GetSingleTag("Camera").GetValue();
+   return std::string();
+}
+
+/**
+* Waits for, or makes, room for the next frame according to the overflow
+* policy. Called by the producer without holding g_bufferLock; in locked
+* mode the producer's g_insertLock is released while waiting. A slot pinned
+* by a FrameHandle is waited for up to the block timeout, whatever the
+* policy. SlotDropNew means that the new frame must be discarded (and counted
+* by the caller); SlotOverflow means that the overflow has been flagged.
+*/
+CircularBuffer::SlotStatus CircularBuffer::FindFreeSlot()
+{
+   MM::MMTime waitStart;
+   bool waiting = false;
+   for (;;)
+   {
+      // Read before checking, so that a pop in between is not missed
+      const unsigned long popGeneration = popSignal_.GetGeneration();
+      bool full;
+      {
+         MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+         const long long size = static_cast<long long>(frameArray_.size());
+         const long long insertIndex = insertIndex_.load(boost::memory_order_relaxed);
+         long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+         if (size == 0)
+         {
+            overflow_.store(true, boost::memory_order_release);
+            return SlotOverflow;
+         }
+         full = insertIndex - saveIndex >= size;
+         if (!full && !IsPinned(insertIndex))
+            return SlotFree;
+
+         // A slot that is merely pinned by a FrameHandle is not an overflow;
+         // it is waited for under every policy
+         if (full)
+         {
+            switch (overflowPolicy_)
+            {
+               case OverflowDropOldest:
+                  // Fails only if the consumer took the frame meanwhile
+                  if (saveIndex_.compare_exchange_strong(saveIndex, saveIndex + 1,
+                           boost::memory_order_acq_rel, boost::memory_order_acquire))
+                     CountDroppedFrame(*frameArray_[saveIndex % size]);
+                  continue;
+               case OverflowDropNewest:
+                  return SlotDropNew;
+               case OverflowBlock:
+                  break;
+               default:
+                  overflow_.store(true, boost::memory_order_release);
+                  return SlotOverflow;
+            }
+         }
+      }
+
+      // Back-pressure: wait for the consumer to pop a frame or release the
+      // pinned one. Releasing a FrameHandle is not signaled, so a pinned slot
+      // is polled.
+      const MM::MMTime now = GetMMTimeNow();
+      if (!waiting)
+      {
+         waitStart = now;
+         waiting = true;
+      }
+      long waitMs = blockTimeoutMs_ -
+         static_cast<long>((now - waitStart).getMsec());
+      if (waitMs <= 0 && now > waitStart)
+         return SlotDropNew; // Checked once more after the last wait
+      if (!full && waitMs > pinnedPollMs)
+         waitMs = pinnedPollMs;
+
+      // Other producers may insert (or time out) meanwhile
+      if (!lockFree_)
+         g_insertLock.Unlock();
+      popSignal_.WaitForChange(popGeneration, waitMs > 0 ? waitMs : 0);
+      if (!lockFree_)
+         g_insertLock.Lock();
+   }
+}
+
+void CircularBuffer::CountDroppedFrame(const std::string& camera)
+{
+   MMThreadGuard guard(g_bufferLock);
+   ++droppedFrames_[camera];
+}
+
+void CircularBuffer::CountDroppedFrame(const mm::FrameBuffer& frame)
+{
+   std::string camera;
+   const mm::ImgBuffer* img = frame.FindImage(0);
+   if (img)
+      camera = GetCameraLabel(img->GetFrameMetadata(), img->GetBaseMetadata());
+   CountDroppedFrame(camera);
+}
+
+void CircularBuffer::AddImageTags(FrameMetadata& md, const Metadata* baseMd, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents)
+{
+   if (!md.HasTag(FrameMetadata::KeyElapsedTimeMs) &&
+         !(baseMd && baseMd->HasTag(MM::g_Keyword_Elapsed_Time_ms)))
+   {
+      // if time tag was not supplied by the camera insert current timestamp
+      MM::MMTime timestamp = GetMMTimeNow();
+      md.PutDouble(FrameMetadata::KeyElapsedTimeMs, timestamp.getMsec());
+   }
+
+   md.PutInteger(FrameMetadata::KeyWidth, width);
+   md.PutInteger(FrameMetadata::KeyHeight, height);
+   const char* pixelType = "Unknown";
+   if (byteDepth == 1)
+      pixelType = "GRAY8";
+   else if (byteDepth == 2)
+      pixelType = "GRAY16";
+   else if (byteDepth == 4)
+   {
+      if (nComponents == 1)
+         pixelType = "GRAY32";
+      else
+         pixelType = "RGB32";
+   }
+   else if (byteDepth == 8)
+      pixelType = "RGB64";
+   md.PutString(FrameMetadata::KeyPixelType, pixelType);
+}
+
+// Makes the frame at insertIndex_ visible to the consumer.
+void CircularBuffer::PublishFrame()
+{
+   const double arrivalTime = GetMMTimeNow().getMsec();
+
+   if (lockFree_)
+   {
+      frameArray_[insertIndex_.load(boost::memory_order_relaxed) % frameArray_.size()]->
+         SetArrivalTime(arrivalTime);
+      ++imageCounter_;
+      const long long insertIndex =
+         insertIndex_.load(boost::memory_order_relaxed) + 1;
+      insertIndex_.store(insertIndex, boost::memory_order_release);
+      occupancy_.Set(insertIndex - saveIndex_.load(boost::memory_order_relaxed));
+   }
+   else
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      frameArray_[insertIndex_ % frameArray_.size()]->SetArrivalTime(arrivalTime);
+      imageCounter_++;
+      insertIndex_++;
+      if ((insertIndex_ - (long long)frameArray_.size()) > adjustThreshold && (saveIndex_- (long long)frameArray_.size()) > adjustThreshold)
+      {
+         // adjust buffer indices to avoid overflowing integer size
+         insertIndex_ -= adjustThreshold;
+         saveIndex_ -= adjustThreshold;
+      }
+      occupancy_.Set(insertIndex_ - saveIndex_);
+   }
+
+   // Outside of the buffer lock, so that woken consumers do not contend
+   if (frameSignal_)
+      frameSignal_->Notify();
+}
+ 
+
+const unsigned char* CircularBuffer::GetTopImage() const
+{
+   const mm::ImgBuffer* img = GetNthFromTopImageBuffer(0, 0);
+   if (!img)
+      return 0;
+   return img->GetPixels();
+}
+
+const mm::ImgBuffer* CircularBuffer::GetTopImageBuffer(unsigned channel) const
+{
+   return GetNthFromTopImageBuffer(0, channel);
+}
+
+const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(unsigned long n) const
+{
+   return GetNthFromTopImageBuffer(static_cast<long>(n), 0);
+}
+
+const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(long n,
+      unsigned channel) const
+{
+   MMThreadGuard guard(lockFree_ ? 0 : &g_bufferLock);
+
+   long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+   long long insertIndex = insertIndex_.load(boost::memory_order_acquire);
+   long long availableImages = insertIndex - saveIndex;
+   if (n + 1 > availableImages)
+      return 0;
+
+   long long targetIndex = insertIndex - n - 1L;
+   while (targetIndex < 0)
+      targetIndex += (long long) frameArray_.size();
+   targetIndex %= frameArray_.size();
+
+   return frameArray_[targetIndex]->FindImage(channel);
+}
+
+const unsigned char* CircularBuffer::GetNextImage()
+{
+   const mm::ImgBuffer* img = GetNextImageBuffer(0);
+   if (!img)
+      return 0;
+   return img->GetPixels();
+}
+
+const mm::ImgBuffer* CircularBuffer::GetNextImageBuffer(unsigned channel)
+{
+   if (lockFree_)
+   {
+      long long saveIndex = saveIndex_.load(boost::memory_order_acquire);
+      for (;;)
+      {
+         if (insertIndex_.load(boost::memory_order_acquire) - saveIndex < 1)
+            return 0;
+         // Fails (and reloads saveIndex) only if Clear() ran concurrently
+         if (saveIndex_.compare_exchange_weak(saveIndex, saveIndex + 1,
+                  boost::memory_order_acq_rel, boost::memory_order_acquire))
+            break;
+      }
+      popSignal_.Notify();
+      return frameArray_[saveIndex % frameArray_.size()]->FindImage(channel);
+   }
+
+   const mm::ImgBuffer* img;
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      long long availableImages = insertIndex_ - saveIndex_;
+      if (availableImages < 1)
+         return 0;
+
+      long long targetIndex = saveIndex_ % frameArray_.size();
+      ++saveIndex_;
+      img = frameArray_[targetIndex]->FindImage(channel);
+   }
+   popSignal_.Notify();
+   return img;
+}
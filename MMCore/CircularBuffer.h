@@ -1,92 +1,189 @@
-///////////////////////////////////////////////////////////////////////////////
-// FILE:          CircularBuffer.h
-// PROJECT:       Micro-Manager
-// SUBSYSTEM:     MMCore
-//-----------------------------------------------------------------------------
-// DESCRIPTION:   Generic implementation of the circular buffer
-//              
-// COPYRIGHT:     University of California, San Francisco, 2007,
-//                100X Imaging Inc, 2008
-//
-// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
-//                License text is included with the source distribution.
-//
-//                This file is distributed in the hope that it will be useful,
-//                but WITHOUT ANY WARRANTY; without even the implied warranty
-//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
-//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
-//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
-//
-// AUTHOR:        Nenad Amodaj, nenad@amodaj.com, 01/05/2007
-// 
-
-#pragma once
-
-#include "Error.h"
-#include "ErrorCodes.h"
-#include "FrameBuffer.h"
-
-#include "../MMDevice/DeviceThreads.h"
-#include "../MMDevice/MMDevice.h"
-
-#include <vector>
-
-#ifdef _MSC_VER
-#pragma warning( disable : 4290 ) // exception declaration warning
-#endif
-
-
-class CircularBuffer
-{
-public:
-   CircularBuffer(unsigned int memorySizeMB);
-   ~CircularBuffer();
-
-   unsigned GetMemorySizeMB() const { return memorySizeMB_; }
-
-   bool Initialize(unsigned channels, unsigned int xSize, unsigned int ySize, unsigned int pixDepth);
-   unsigned long GetSize() const;
-   unsigned long GetFreeSize() const;
-   unsigned long GetRemainingImageCount() const;
-
-   unsigned int Width() const {MMThreadGuard guard(g_bufferLock); return width_;}
-   unsigned int Height() const {MMThreadGuard guard(g_bufferLock); return height_;}
-   unsigned int Depth() const {MMThreadGuard guard(g_bufferLock); return pixDepth_;}
-
-   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
-   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
-    bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
-   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
-   const unsigned char* GetTopImage() const;
-   const unsigned char* GetNextImage();
-   const mm::ImgBuffer* GetTopImageBuffer(unsigned channel) const;
-   const mm::ImgBuffer* GetNthFromTopImageBuffer(unsigned long n) const;
-   const mm::ImgBuffer* GetNthFromTopImageBuffer(long n, unsigned channel) const;
-   const mm::ImgBuffer* GetNextImageBuffer(unsigned channel);
-   void Clear() {MMThreadGuard guard(g_bufferLock); insertIndex_=0; saveIndex_=0; overflow_ = false;}
-
-   bool Overflow() {MMThreadGuard guard(g_bufferLock); return overflow_;}
-
-   mutable MMThreadLock g_bufferLock;
-   mutable MMThreadLock g_insertLock;
-
-private:
-   unsigned int width_;
-   unsigned int height_;
-   unsigned int pixDepth_;
-   long imageCounter_;
-   std::map<std::string, long> imageNumbers_;
-
-   // Invariants:
-   // 0 <= saveIndex_ <= insertIndex_
-   // insertIndex_ - saveIndex_ <= frameArray_.size()
-   long insertIndex_;
-   long saveIndex_;
-
-   unsigned long memorySizeMB_;
-   unsigned int numChannels_;
-   bool overflow_;
-   std::vector<mm::FrameBuffer> frameArray_;
-};
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          CircularBuffer.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Generic implementation of the circular buffer
+//              
+// COPYRIGHT:     University of California, San Francisco, 2007,
+//                100X Imaging Inc, 2008
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+//
+// AUTHOR:        Nenad Amodaj, nenad@amodaj.com, 01/05/2007
+// 
+
+#pragma once
+
+#include "Error.h"
+#include "ErrorCodes.h"
+#include "FrameBuffer.h"
+#include "FrameSignal.h"
+#include "Metrics.h"
+#include "RingMemory.h"
+
+#include "../MMDevice/DeviceThreads.h"
+#include "../MMDevice/MMDevice.h"
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning( disable : 4290 ) // exception declaration warning
+#endif
+
+
+class CircularBuffer
+{
+public:
+   // What happens to a new frame when the buffer is full
+   enum OverflowPolicy
+   {
+      OverflowReport, // Reject the frame and set the overflow flag
+      OverflowDropOldest, // Discard the oldest unread frame to make room
+      OverflowDropNewest, // Discard the new frame
+      OverflowBlock // Wait for room; discard the new frame after a timeout
+   };
+
+   CircularBuffer(unsigned int memorySizeMB);
+   ~CircularBuffer();
+
+   unsigned GetMemorySizeMB() const { return memorySizeMB_; }
+
+   // Lock-free mode is only valid when exactly one thread inserts images and
+   // at most one thread pops them (other threads may still peek at the top
+   // image). Must not be changed while images are being inserted.
+   void SetLockFree(bool lockFree) {MMThreadGuard guard(g_bufferLock); lockFree_ = lockFree;}
+   bool IsLockFree() const {return lockFree_;}
+
+   // Options for the memory that backs the frame slots. Changing them
+   // discards the images and the memory; the new options take effect at the
+   // next Initialize().
+   void SetMemoryOptions(const mm::RingMemoryOptions& options);
+   mm::RingMemoryOptions GetMemoryOptions() const {MMThreadGuard guard(g_bufferLock); return memoryOptions_;}
+
+   // Must not be changed while images are being inserted. Frames discarded
+   // by the policy are counted per camera, and the insert functions report
+   // success for them. Whatever the policy, a slot still pinned by a
+   // FrameHandle delays the insert for up to blockTimeoutMs, after which the
+   // new frame is discarded.
+   void SetOverflowPolicy(OverflowPolicy policy, long blockTimeoutMs);
+   OverflowPolicy GetOverflowPolicy() const {return overflowPolicy_;}
+   long GetBlockTimeoutMs() const {return blockTimeoutMs_;}
+   unsigned long GetDroppedFrameCount(const std::string& camera) const;
+   unsigned long GetDroppedFrameCount() const;
+
+   // Notified after each frame is inserted; may be shared between buffers.
+   // Must not be changed while images are being inserted.
+   void SetFrameSignal(boost::shared_ptr<mm::FrameSignal> signal) {MMThreadGuard guard(g_bufferLock); frameSignal_ = signal;}
+
+   bool Initialize(unsigned channels, unsigned int xSize, unsigned int ySize, unsigned int pixDepth);
+   unsigned long GetSize() const;
+   unsigned long GetFreeSize() const;
+   unsigned long GetRemainingImageCount() const;
+   // Highest number of frames held since the last reset, as seen by the
+   // producer
+   long long GetPeakImageCount() const {return occupancy_.GetPeak();}
+   void ResetPeakImageCount() {occupancy_.Reset();}
+
+   unsigned int Width() const {MMThreadGuard guard(g_bufferLock); return width_;}
+   unsigned int Height() const {MMThreadGuard guard(g_bufferLock); return height_;}
+   unsigned int Depth() const {MMThreadGuard guard(g_bufferLock); return pixDepth_;}
+
+   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
+   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
+    bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
+   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
+
+   unsigned char* AcquireSlot(unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents) throw (CMMError);
+   bool CommitSlot(const Metadata* pMd);
+   bool CommitSlot(const FrameMetadata& md, const boost::shared_ptr<const Metadata>& baseMd);
+   void AbandonSlot();
+   unsigned char* GetPendingSlot() const {return pendingSlot_ ? pendingSlot_->GetPixelsRW() : 0;}
+
+   const unsigned char* GetTopImage() const;
+   const unsigned char* GetNextImage();
+   const mm::ImgBuffer* GetTopImageBuffer(unsigned channel) const;
+   const mm::ImgBuffer* GetNthFromTopImageBuffer(unsigned long n) const;
+   const mm::ImgBuffer* GetNthFromTopImageBuffer(long n, unsigned channel) const;
+   const mm::ImgBuffer* GetNextImageBuffer(unsigned channel);
+   boost::shared_ptr<mm::FrameBuffer> PopNextFrame();
+   unsigned PopNextFrames(unsigned maxCount, std::vector< boost::shared_ptr<mm::FrameBuffer> >& frames);
+   boost::shared_ptr<mm::FrameBuffer> PeekNextFrame() const;
+   void Clear();
+
+   bool Overflow() const {return overflow_.load(boost::memory_order_acquire);}
+
+   mutable MMThreadLock g_bufferLock;
+   mutable MMThreadLock g_insertLock;
+
+private:
+   unsigned int width_;
+   unsigned int height_;
+   unsigned int pixDepth_;
+   long imageCounter_;
+   std::map<std::string, long> imageNumbers_;
+   std::map<std::string, unsigned long> droppedFrames_; // Guarded by g_bufferLock
+
+   // Invariants:
+   // 0 <= saveIndex_ <= insertIndex_
+   // insertIndex_ - saveIndex_ <= frameArray_.size()
+   //
+   // In lock-free mode, insertIndex_ is written only by the producer thread
+   // (release) and saveIndex_ is advanced by compare-and-swap, so that Clear()
+   // can discard frames without a lock. The indices are 64-bit so that they
+   // never need to be rebased while both threads are running.
+   boost::atomic<long long> insertIndex_;
+   boost::atomic<long long> saveIndex_;
+   // Set by the producer after each frame; in locked mode also by Clear(),
+   // under g_bufferLock
+   mm::PeakGauge occupancy_;
+
+   unsigned long memorySizeMB_;
+   unsigned int numChannels_;
+   boost::atomic<bool> overflow_;
+   bool lockFree_;
+   mm::ImgBuffer* pendingSlot_; // Reserved by AcquireSlot(), owned by producer
+   unsigned int pendingComponents_;
+   bool pendingDropped_; // pendingSlot_ is discardSlot_
+   // Receives the pixels of a slot frame that the overflow policy discards
+   boost::shared_ptr<mm::ImgBuffer> discardSlot_;
+   OverflowPolicy overflowPolicy_;
+   long blockTimeoutMs_;
+   mm::RingMemoryOptions memoryOptions_;
+   // All frame slots live in this one mapping, which is reused across
+   // Initialize() calls unless frames from it are still pinned.
+   boost::shared_ptr<mm::RingMemory> memory_;
+   boost::shared_ptr<mm::FrameSignal> frameSignal_;
+   // Notified when the consumer frees slots; wakes producers blocked by
+   // OverflowBlock
+   mm::FrameSignal popSignal_;
+   // Frames are shared with FrameHandle; a slot whose frame is referenced
+   // elsewhere is pinned and will not be overwritten.
+   std::vector< boost::shared_ptr<mm::FrameBuffer> > frameArray_;
+
+   bool InsertLocked(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
+   bool InsertLockFree(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
+   void AddImageNumber(FrameMetadata& md, const Metadata* baseMd);
+   void AddImageTags(FrameMetadata& md, const Metadata* baseMd, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents);
+   void PublishFrame();
+   void ReleaseStaleSlot();
+
+   enum SlotStatus { SlotFree, SlotDropNew, SlotOverflow };
+   SlotStatus FindFreeSlot();
+   void CountDroppedFrame(const std::string& camera);
+   void CountDroppedFrame(const mm::FrameBuffer& frame);
+   static std::string GetCameraLabel(const FrameMetadata& md, const Metadata* baseMd);
+   bool IsPinned(long long index) const;
+};
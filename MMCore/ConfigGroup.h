@@ -27,6 +27,8 @@
 
 #include "Configuration.h"
 #include "Error.h"
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -44,6 +46,7 @@ public:
    void Define(const char* configName)
    {
       configs_[configName];
+      Modified();
    }
 
 	/**
@@ -52,7 +55,7 @@ public:
    void Define(const char* configName, const char* deviceLabel, const char* propName, const char* value)
    {
       PropertySetting setting(deviceLabel, propName, value);
-      configs_[configName].addSetting(setting);
+      AddSetting(configs_[configName], setting);
 	}
 
    /**
@@ -79,9 +82,15 @@ public:
       typename std::map<std::string, T>::const_iterator it = configs_.find(oldConfigName);
       if (it == configs_.end())
          return false;
+
+      // A preset of the new name is replaced
+      typename std::map<std::string, T>::iterator replaced = configs_.find(newConfigName);
+      if (replaced != configs_.end())
+         RemovePropertyRefs(replaced->second);
 	  
 	  configs_[newConfigName] = it->second;
       configs_.erase(it->first);
+      Modified();
       return true;
    }
 
@@ -94,10 +103,12 @@ public:
       if (strlen(configName) == 0)
          return true;
 
-      typename std::map<std::string, T>::const_iterator it = configs_.find(configName);
+      typename std::map<std::string, T>::iterator it = configs_.find(configName);
       if (it == configs_.end())
          return false;
+      RemovePropertyRefs(it->second);
       configs_.erase(configName);
+      Modified();
       return true;
    }
 
@@ -117,9 +128,37 @@ public:
 	  
 	  // Delete the specified property
       configs_[configName].deleteSetting(deviceLabel,propName);
+      RemovePropertyRef(PropertySetting::generateKey(deviceLabel, propName));
+      Modified();
 	  return true;
    }
 
+   /**
+    * Returns true if any preset includes the property. The key is generated
+    * by PropertySetting::generateKey().
+    */
+   bool IsPropertyIncluded(const std::string& key) const
+   {
+      return propertyRefs_.find(key) != propertyRefs_.end();
+   }
+
+   bool IsPropertyIncluded(const char* deviceLabel, const char* propName) const
+   {
+      return IsPropertyIncluded(PropertySetting::generateKey(deviceLabel, propName));
+   }
+
+   /**
+    * Returns the keys of all properties included in any preset.
+    */
+   std::vector<std::string> GetIncludedPropertyKeys() const
+   {
+      std::vector<std::string> keys;
+      for (std::map<std::string, int>::const_iterator it = propertyRefs_.begin();
+            it != propertyRefs_.end(); ++it)
+         keys.push_back(it->first);
+      return keys;
+   }
+
    /**
     * Returns a list of available configurations.
     */
@@ -138,11 +177,156 @@ public:
       return configs_.size() == 0;
    }
 
+   /**
+    * Returns the union of the properties of all presets (with empty values),
+    * in the order expected by FindMatchingPreset().
+    */
+   const std::vector<PropertySetting>& GetMatchProperties()
+   {
+      Compile();
+      return matchProperties_;
+   }
+
+   /**
+    * Returns the first preset (in name order) whose settings all equal the
+    * given values, or an empty string. values[i] is the value of
+    * GetMatchProperties()[i]; if known[i] is false, presets that include
+    * the property do not match.
+    */
+   std::string FindMatchingPreset(const std::vector<std::string>& values,
+         const std::vector<bool>& known)
+   {
+      Compile();
+      for (typename std::vector<CompiledPreset>::const_iterator
+            it = compiledPresets_.begin(), end = compiledPresets_.end();
+            it != end; ++it)
+      {
+         bool match = true;
+         for (size_t i = 0; match && i < it->values.size(); ++i)
+         {
+            const size_t index = it->values[i].first;
+            match = known[index] && values[index] == it->values[i].second;
+         }
+         if (match)
+            return it->name;
+      }
+      return "";
+   }
+
+   /*
+    * The matching preset for the state cache is memoized by the core (which
+    * guards these with its preset match lock). The memo is valid until the
+    * revision changes, which happens when one of the group's properties
+    * changes in the cache, or when the presets are edited.
+    */
+   unsigned long GetStateRevision() const { return stateRevision_; }
+   void InvalidateCachedMatch() { ++stateRevision_; }
+   bool GetCachedMatch(std::string& preset) const
+   {
+      if (cachedMatchRevision_ != stateRevision_)
+         return false;
+      preset = cachedMatch_;
+      return true;
+   }
+   // revision is the one read before the values were collected
+   void SetCachedMatch(const std::string& preset, unsigned long revision)
+   {
+      cachedMatch_ = preset;
+      cachedMatchRevision_ = revision;
+   }
+
 protected:
-   ConfigGroupBase() {}
+   ConfigGroupBase() :
+      compiled_(false),
+      stateRevision_(1),
+      cachedMatchRevision_(0)
+   {}
    virtual ~ConfigGroupBase() {}
 
+   // All settings must be added through this, to keep propertyRefs_ current
+   void AddSetting(T& config, const PropertySetting& setting)
+   {
+      if (!config.isPropertyIncluded(setting.getDeviceLabel().c_str(),
+               setting.getPropertyName().c_str()))
+         ++propertyRefs_[setting.getKey()];
+      config.addSetting(setting);
+      Modified();
+   }
+
    std::map<std::string, T> configs_;
+
+private:
+   struct CompiledPreset
+   {
+      std::string name;
+      // Index into matchProperties_, and the value
+      std::vector< std::pair<size_t, std::string> > values;
+   };
+
+   void Modified()
+   {
+      compiled_ = false;
+      InvalidateCachedMatch();
+   }
+
+   void Compile()
+   {
+      if (compiled_)
+         return;
+
+      matchProperties_.clear();
+      compiledPresets_.clear();
+      std::map<std::string, size_t> indices;
+      for (typename std::map<std::string, T>::const_iterator
+            it = configs_.begin(), end = configs_.end(); it != end; ++it)
+      {
+         CompiledPreset preset;
+         preset.name = it->first;
+         for (size_t i = 0; i < it->second.size(); ++i)
+         {
+            PropertySetting setting = it->second.getSetting(i);
+            std::map<std::string, size_t>::iterator index =
+               indices.find(setting.getKey());
+            if (index == indices.end())
+            {
+               index = indices.insert(std::make_pair(setting.getKey(),
+                        matchProperties_.size())).first;
+               matchProperties_.push_back(PropertySetting(
+                        setting.getDeviceLabel().c_str(),
+                        setting.getPropertyName().c_str(), ""));
+            }
+            preset.values.push_back(std::make_pair(index->second,
+                     setting.getPropertyValue()));
+         }
+         compiledPresets_.push_back(preset);
+      }
+      compiled_ = true;
+   }
+
+   void RemovePropertyRef(const std::string& key)
+   {
+      std::map<std::string, int>::iterator it = propertyRefs_.find(key);
+      if (it != propertyRefs_.end() && --it->second <= 0)
+         propertyRefs_.erase(it);
+   }
+
+   void RemovePropertyRefs(const T& config)
+   {
+      for (size_t i = 0; i < config.size(); ++i)
+         RemovePropertyRef(config.getSetting(i).getKey());
+   }
+
+   // Number of presets that include each property, so that the presets
+   // affected by a property change need not be searched
+   std::map<std::string, int> propertyRefs_;
+
+   bool compiled_;
+   std::vector<PropertySetting> matchProperties_;
+   std::vector<CompiledPreset> compiledPresets_;
+
+   unsigned long stateRevision_;
+   unsigned long cachedMatchRevision_;
+   std::string cachedMatch_;
 };
 
 
@@ -175,6 +359,7 @@ public:
    void Define(const char* groupName, const char* configName, const char* deviceLabel, const char* propName, const char* value)
    {
       groups_[groupName].Define(configName, deviceLabel, propName, value);
+      groupsByProperty_[PropertySetting::generateKey(deviceLabel, propName)].insert(groupName);
    }
 
    /**
@@ -230,7 +415,11 @@ public:
          std::map<std::string, ConfigGroup>::iterator it = groups_.find(groupName);
          if (it == groups_.end())
             return false; // group not found
-         if (it->second.Rename(oldConfigName, newConfigName))
+         // Renaming may replace a preset, removing its properties
+         IndexGroup(it, false);
+         const bool renamed = it->second.Rename(oldConfigName, newConfigName);
+         IndexGroup(it, true);
+         if (renamed)
          {
             // NOTE: changed to not remove empty groups, N.A. 1.31.2006
             // check if the config group is empty, and if so remove it
@@ -259,6 +448,7 @@ public:
          return false; // group not found
       if (it->second.Delete(configName, deviceLabel, propName))
       {
+         UnindexIfUnused(it, PropertySetting::generateKey(deviceLabel, propName));
          return true;
       }
       else
@@ -278,8 +468,14 @@ public:
       std::map<std::string, ConfigGroup>::iterator it = groups_.find(groupName);
       if (it == groups_.end())
          return false; // group not found
+      Configuration* config = it->second.Find(configName);
+      std::vector<std::string> keys;
+      for (size_t i = 0; config && i < config->size(); ++i)
+         keys.push_back(config->getSetting(i).getKey());
       if (it->second.Delete(configName))
       {
+         for (size_t i = 0; i < keys.size(); ++i)
+            UnindexIfUnused(it, keys[i]);
          // NOTE: changed to not remove empty groups, N.A. 1.31.2006
          // check if the config group is empty, and if so remove it
          //if (it->second.IsEmpty())
@@ -302,6 +498,7 @@ public:
       std::map<std::string, ConfigGroup>::iterator it = groups_.find(groupName);
       if (it != groups_.end())
       {
+         IndexGroup(it, false);
          groups_.erase(it->first);
          return true;
       }
@@ -322,8 +519,13 @@ public:
          std::map<std::string, ConfigGroup>::iterator it = groups_.find(oldGroupName);
          if (it != groups_.end())
          {
+            std::map<std::string, ConfigGroup>::iterator replaced = groups_.find(newGroupName);
+            if (replaced != groups_.end())
+               IndexGroup(replaced, false);
+            IndexGroup(it, false);
             groups_[newGroupName] = it->second;
             groups_.erase(it->first);
+            IndexGroup(groups_.find(newGroupName), true);
             return true;
          }
          return false; //not found
@@ -363,14 +565,93 @@ public:
       return confList;
    }
 
+   /**
+    * Returns the names of the groups that have a preset including the
+    * property.
+    */
+   std::vector<std::string> GetGroupsIncludingProperty(const char* deviceLabel, const char* propName) const
+   {
+      std::vector<std::string> groupList;
+      std::map<std::string, std::set<std::string> >::const_iterator it =
+         groupsByProperty_.find(PropertySetting::generateKey(deviceLabel, propName));
+      if (it != groupsByProperty_.end())
+         groupList.assign(it->second.begin(), it->second.end());
+      return groupList;
+   }
+
+   /**
+    * Finds a group by name.
+    */
+   ConfigGroup* FindGroup(const char* groupName)
+   {
+      std::map<std::string, ConfigGroup>::iterator it = groups_.find(groupName);
+      if (it == groups_.end())
+         return 0;
+      return &it->second;
+   }
+
+   /**
+    * Invalidates the memoized current preset of the groups that include the
+    * property (by setting key).
+    */
+   void InvalidateCachedMatches(const std::string& key)
+   {
+      std::map<std::string, std::set<std::string> >::const_iterator it =
+         groupsByProperty_.find(key);
+      if (it == groupsByProperty_.end())
+         return;
+      for (std::set<std::string>::const_iterator group = it->second.begin();
+            group != it->second.end(); ++group)
+         groups_[*group].InvalidateCachedMatch();
+   }
+
+   void InvalidateCachedMatches()
+   {
+      for (std::map<std::string, ConfigGroup>::iterator it = groups_.begin();
+            it != groups_.end(); ++it)
+         it->second.InvalidateCachedMatch();
+   }
+
    void Clear()
    {
       groups_.clear();
+      groupsByProperty_.clear();
    }
 
 
 private:
+   // Adds (or removes) the group to the index for all its properties
+   void IndexGroup(std::map<std::string, ConfigGroup>::iterator group, bool add)
+   {
+      std::vector<std::string> keys = group->second.GetIncludedPropertyKeys();
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         if (add)
+            groupsByProperty_[keys[i]].insert(group->first);
+         else
+            RemoveFromIndex(keys[i], group->first);
+      }
+   }
+
+   void UnindexIfUnused(std::map<std::string, ConfigGroup>::iterator group, const std::string& key)
+   {
+      if (!group->second.IsPropertyIncluded(key))
+         RemoveFromIndex(key, group->first);
+   }
+
+   void RemoveFromIndex(const std::string& key, const std::string& groupName)
+   {
+      std::map<std::string, std::set<std::string> >::iterator it = groupsByProperty_.find(key);
+      if (it == groupsByProperty_.end())
+         return;
+      it->second.erase(groupName);
+      if (it->second.empty())
+         groupsByProperty_.erase(it);
+   }
+
    std::map<std::string, ConfigGroup> groups_;
+   // Groups with a preset that includes each property (by setting key)
+   std::map<std::string, std::set<std::string> > groupsByProperty_;
 };
 
 /**
@@ -424,7 +705,7 @@ public:
    bool DefinePixelSize(const char* resolutionID, const char* deviceLabel, const char* propName, const char* value, double pixSizeUm)
    {
       PropertySetting setting(deviceLabel, propName, value);
-      configs_[resolutionID].addSetting(setting);
+      AddSetting(configs_[resolutionID], setting);
       if (configs_[resolutionID].getPixelSizeUm() == 0.0)
       {
          // this is the first setting, so it is OK to set pixel size
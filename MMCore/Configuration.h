@@ -46,12 +46,12 @@ struct PropertySetting
     * @param value 
     */
     PropertySetting(const char* deviceLabel, const char* prop, const char* value, bool readOnly = false) :
-      deviceLabel_(deviceLabel), propertyName_(prop), value_(value), readOnly_(readOnly)
+      deviceLabel_(deviceLabel), propertyName_(prop), value_(value), readOnly_(readOnly), stale_(false)
       {
         key_ = generateKey(deviceLabel, prop);
       }
 
-    PropertySetting() : readOnly_(false) {}
+    PropertySetting() : readOnly_(false), stale_(false) {}
     ~PropertySetting() {}
 
    /**
@@ -70,6 +70,12 @@ struct PropertySetting
     * Returns the property value.
     */
    std::string getPropertyValue() const {return value_;}
+   /**
+    * Returns true if the value was taken from the system state cache because
+    * the device could not be queried in time (see CMMCore::getSystemState()).
+    */
+   bool isStale() const {return stale_;}
+   void setStale(bool stale) {stale_ = stale;}
 
    std::string getKey() const {return key_;}
 
@@ -84,6 +90,7 @@ private:
    std::string value_;
    std::string key_;
    bool readOnly_;
+   bool stale_;
 };
 
 /**
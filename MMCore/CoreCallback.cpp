@@ -29,8 +29,12 @@
 #include "../MMDevice/DeviceUtils.h"
 #include "../MMDevice/ImgBuffer.h"
 #include "CircularBuffer.h"
+#include "ConfigGroup.h"
 #include "CoreCallback.h"
+#include "DeviceInitializer.h"
 #include "DeviceManager.h"
+#include "IdleSignal.h"
+#include "Metrics.h"
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <string>
@@ -79,9 +83,13 @@ CoreCallback::GetDevice(const MM::Device* caller, const char* label)
 
    try
    {
-      MM::Device* pDevice = core_->deviceManager_->GetDevice(label)->GetRawPtr();
+      boost::shared_ptr<DeviceInstance> device =
+         core_->deviceManager_->GetDevice(label);
+      MM::Device* pDevice = device->GetRawPtr();
       if (pDevice == caller)
          return 0;
+      // During initializeAllDevices(), let the device finish initializing
+      core_->deviceInitializer_->WaitForDevice(device);
       return pDevice;
    }
    catch (const CMMError&)
@@ -179,7 +187,10 @@ CoreCallback::GetParentHub(const MM::Device* caller) const
       return 0;
    }
    if (hubDevice)
+   {
+      core_->deviceInitializer_->WaitForDevice(hubDevice);
       return hubDevice->GetRawPtr();
+   }
    return 0;
 }
 
@@ -223,23 +234,75 @@ CoreCallback::AddCameraMetadata(const MM::Device* caller, const Metadata* pMd)
    std::string label = camera->GetLabel();
    newMD.put("Camera", label);
 
-   std::string serializedMD;
+   boost::shared_ptr<const Metadata> devMD;
    try
    {
-      serializedMD = camera->GetTags();
+      devMD = camera->GetTagsMetadata();
    }
    catch (const CMMError&)
    {
       return newMD;
    }
 
-   Metadata devMD;
-   devMD.Restore(serializedMD.c_str());
-   newMD.Merge(devMD);
+   newMD.Merge(*devMD);
 
    return newMD;
 }
 
+/**
+ * Returns the sequence buffer that receives the images of the calling camera:
+ * the camera's own buffer if it has one, otherwise the core's shared buffer.
+ */
+boost::shared_ptr<CircularBuffer>
+CoreCallback::GetSequenceBuffer(const MM::Device* caller)
+{
+   try
+   {
+      boost::shared_ptr<DeviceInstance> device =
+         core_->deviceManager_->GetDevice(caller);
+      if (device->GetType() == MM::CameraDevice)
+      {
+         boost::shared_ptr<CircularBuffer> buffer =
+            boost::static_pointer_cast<CameraInstance>(device)->GetSequenceBuffer();
+         if (buffer)
+            return buffer;
+      }
+   }
+   catch (const CMMError&)
+   {
+   }
+   return core_->cbuf_;
+}
+
+/**
+ * Counts a frame inserted by the calling camera, or rejected because the
+ * buffer was full, and records the time taken (since startUs; not recorded
+ * if negative).
+ */
+void
+CoreCallback::RecordFrameInsert(const MM::Device* caller, int result, long long startUs)
+{
+   boost::shared_ptr<DeviceInstance> camera;
+   try
+   {
+      camera = core_->deviceManager_->GetDevice(caller);
+   }
+   catch (const CMMError&)
+   {
+      return;
+   }
+   if (!camera)
+      return;
+
+   mm::DeviceMetrics& metrics = camera->GetMetrics();
+   if (startUs >= 0)
+      metrics.insertImageLatency.Record(mm::MonotonicMicroseconds() - startUs);
+   if (result == DEVICE_OK)
+      metrics.framesInserted.Add();
+   else if (result == DEVICE_BUFFER_OVERFLOW)
+      metrics.framesOverflowed.Add();
+}
+
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess)
 {
    Metadata md;
@@ -249,6 +312,7 @@ int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf
 
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd, bool doProcess)
 {
+   const long long startUs = mm::MonotonicMicroseconds();
    try 
    {
       Metadata md = AddCameraMetadata(caller, pMd);
@@ -261,10 +325,10 @@ int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf
             ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
          }
       }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, &md))
-         return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
+      const int ret = GetSequenceBuffer(caller)->InsertImage(buf, width, height, byteDepth, &md) ?
+         DEVICE_OK : DEVICE_BUFFER_OVERFLOW;
+      RecordFrameInsert(caller, ret, startUs);
+      return ret;
    }
    catch (CMMError& /*e*/)
    {
@@ -281,6 +345,7 @@ int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf
 
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd, bool doProcess)
 {
+   const long long startUs = mm::MonotonicMicroseconds();
    try 
    {
       Metadata md = AddCameraMetadata(caller, pMd);
@@ -293,10 +358,10 @@ int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf
             ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
          }
       }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, nComponents, &md))
-         return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
+      const int ret = GetSequenceBuffer(caller)->InsertImage(buf, width, height, byteDepth, nComponents, &md) ?
+         DEVICE_OK : DEVICE_BUFFER_OVERFLOW;
+      RecordFrameInsert(caller, ret, startUs);
+      return ret;
    }
    catch (CMMError& /*e*/)
    {
@@ -318,9 +383,9 @@ int CoreCallback::InsertImage(const MM::Device* caller, const ImgBuffer & imgBuf
       imgBuf.Height(), imgBuf.Depth(), &md);
 }
 
-void CoreCallback::ClearImageBuffer(const MM::Device* /*caller*/)
+void CoreCallback::ClearImageBuffer(const MM::Device* caller)
 {
-   core_->cbuf_->Clear();
+   GetSequenceBuffer(caller)->Clear();
 }
 
 bool CoreCallback::InitializeImageBuffer(unsigned channels, unsigned slices,
@@ -330,6 +395,9 @@ bool CoreCallback::InitializeImageBuffer(unsigned channels, unsigned slices,
    if (slices != 1)
       return false;
 
+   // There is no caller argument, so this always applies to the shared
+   // buffer; cameras with their own buffer have it initialized by the core
+   // when their sequence acquisition is started.
    return core_->cbuf_->Initialize(channels, w, h, pixDepth);
 }
 
@@ -341,6 +409,7 @@ int CoreCallback::InsertMultiChannel(const MM::Device* caller,
                               unsigned byteDepth,
                               Metadata* pMd)
 {
+   const long long startUs = mm::MonotonicMicroseconds();
    try
    {
       Metadata md = AddCameraMetadata(caller, pMd);
@@ -350,10 +419,10 @@ int CoreCallback::InsertMultiChannel(const MM::Device* caller,
       {
          ip->Process( const_cast<unsigned char*>(buf), width, height, byteDepth);
       }
-      if (core_->cbuf_->InsertMultiChannel(buf, numChannels, width, height, byteDepth, &md))
-         return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
+      const int ret = GetSequenceBuffer(caller)->InsertMultiChannel(buf, numChannels, width, height, byteDepth, &md) ?
+         DEVICE_OK : DEVICE_BUFFER_OVERFLOW;
+      RecordFrameInsert(caller, ret, startUs);
+      return ret;
    }
    catch (CMMError& /*e*/)
    {
@@ -362,6 +431,167 @@ int CoreCallback::InsertMultiChannel(const MM::Device* caller,
 
 }
 
+int CoreCallback::AcquireImageSlot(const MM::Device* caller,
+                                   unsigned width,
+                                   unsigned height,
+                                   unsigned byteDepth,
+                                   unsigned nComponents,
+                                   unsigned char** pixels)
+{
+   if (!pixels)
+      return DEVICE_INVALID_INPUT_PARAM;
+   *pixels = 0;
+
+   boost::shared_ptr<CircularBuffer> cbuf = GetSequenceBuffer(caller);
+   try
+   {
+      *pixels = cbuf->AcquireSlot(width, height, byteDepth, nComponents);
+   }
+   catch (CMMError& /*e*/)
+   {
+      return DEVICE_INCOMPATIBLE_IMAGE;
+   }
+   if (!*pixels)
+   {
+      RecordFrameInsert(caller, DEVICE_BUFFER_OVERFLOW, -1);
+      return DEVICE_BUFFER_OVERFLOW;
+   }
+
+   // Commit and abandon must reach this buffer even if the camera's buffer
+   // assignment changes in the meantime
+   MMThreadGuard guard(pendingSlotsLock_);
+   pendingSlots_[caller] = cbuf;
+   return DEVICE_OK;
+}
+
+/**
+ * Removes and returns the buffer in which the caller reserved a frame, or
+ * null if it has no reservation.
+ */
+boost::shared_ptr<CircularBuffer>
+CoreCallback::TakePendingSlotBuffer(const MM::Device* caller)
+{
+   MMThreadGuard guard(pendingSlotsLock_);
+   boost::shared_ptr<CircularBuffer> cbuf;
+   std::map< const MM::Device*, boost::shared_ptr<CircularBuffer> >::iterator it =
+      pendingSlots_.find(caller);
+   if (it != pendingSlots_.end())
+   {
+      cbuf = it->second;
+      pendingSlots_.erase(it);
+   }
+   return cbuf;
+}
+
+int CoreCallback::CommitImageSlot(const MM::Device* caller,
+                                  const char* serializedMetadata,
+                                  const bool doProcess)
+{
+   const long long startUs = mm::MonotonicMicroseconds();
+   boost::shared_ptr<CircularBuffer> cbuf = TakePendingSlotBuffer(caller);
+   if (!cbuf)
+      return DEVICE_ERR;
+   unsigned char* pixels = cbuf->GetPendingSlot();
+   if (!pixels)
+      return DEVICE_ERR;
+
+   // Every failure below must release the slot, which in locked mode also
+   // holds off all other producers
+   Metadata md;
+   try
+   {
+      if (serializedMetadata)
+         md.Restore(serializedMetadata);
+      md = AddCameraMetadata(caller, &md);
+
+      if (doProcess)
+      {
+         MM::ImageProcessor* ip = GetImageProcessor(caller);
+         if (NULL != ip)
+         {
+            ip->Process(pixels, cbuf->Width(), cbuf->Height(),
+                  cbuf->Depth());
+         }
+      }
+   }
+   catch (...)
+   {
+      cbuf->AbandonSlot();
+      return DEVICE_ERR;
+   }
+
+   if (!cbuf->CommitSlot(&md))
+      return DEVICE_ERR;
+   RecordFrameInsert(caller, DEVICE_OK, startUs);
+   return DEVICE_OK;
+}
+
+int CoreCallback::CommitImageSlot(const MM::Device* caller,
+                                  const FrameMetadata& md,
+                                  const bool doProcess)
+{
+   const long long startUs = mm::MonotonicMicroseconds();
+   boost::shared_ptr<CircularBuffer> cbuf = TakePendingSlotBuffer(caller);
+   if (!cbuf)
+      return DEVICE_ERR;
+   unsigned char* pixels = cbuf->GetPendingSlot();
+   if (!pixels)
+      return DEVICE_ERR;
+
+   // The camera's own tags are shared with the frame rather than merged
+   // into it, so no per-frame text conversion takes place. Every failure
+   // must release the slot, which in locked mode also holds off all other
+   // producers.
+   FrameMetadata frameMD(md);
+   boost::shared_ptr<const Metadata> cameraTags;
+   try
+   {
+      boost::shared_ptr<CameraInstance> camera =
+         boost::dynamic_pointer_cast<CameraInstance>(
+               core_->deviceManager_->GetDevice(caller));
+      if (!camera)
+      {
+         cbuf->AbandonSlot();
+         return DEVICE_ERR;
+      }
+      frameMD.PutString(FrameMetadata::KeyCamera, camera->GetLabel().c_str());
+      try
+      {
+         cameraTags = camera->GetTagsMetadata();
+      }
+      catch (const CMMError&)
+      {
+      }
+
+      if (doProcess)
+      {
+         MM::ImageProcessor* ip = GetImageProcessor(caller);
+         if (NULL != ip)
+         {
+            ip->Process(pixels, cbuf->Width(), cbuf->Height(),
+                  cbuf->Depth());
+         }
+      }
+   }
+   catch (...)
+   {
+      cbuf->AbandonSlot();
+      return DEVICE_ERR;
+   }
+
+   if (!cbuf->CommitSlot(frameMD, cameraTags))
+      return DEVICE_ERR;
+   RecordFrameInsert(caller, DEVICE_OK, startUs);
+   return DEVICE_OK;
+}
+
+void CoreCallback::AbandonImageSlot(const MM::Device* caller)
+{
+   boost::shared_ptr<CircularBuffer> cbuf = TakePendingSlotBuffer(caller);
+   if (cbuf)
+      cbuf->AbandonSlot();
+}
+
 int CoreCallback::AcqFinished(const MM::Device* caller, int /*statusCode*/)
 {
    boost::shared_ptr<DeviceInstance> camera;
@@ -470,61 +700,36 @@ int CoreCallback::OnPropertyChanged(const MM::Device* device, const char* propNa
       bool readOnly;
       device->GetPropertyReadOnly(propName, readOnly);
       const PropertySetting* ps = new PropertySetting(label, propName, value, readOnly);
-      {
-         MMThreadGuard scg(core_->stateCacheLock_);
-         core_->stateCache_.addSetting(*ps);
-      }
+      core_->updateStateCache(*ps);
       core_->externalCallback_->onPropertyChanged(label, propName, value);
 
-      // Find all configs that contain this property and callback to indicate 
-      // that the config group changed
-      // TODO: Assess whether performance is better by maintaining a map tying
-      // property to configurations
+      // Find all groups with a config that contains this property and
+      // callback to indicate that the config group changed. The groups keep
+      // an index of their properties, so this does not search the presets.
       std::vector<std::string> configGroups = 
-         core_->getAvailableConfigGroups ();
+         core_->configGroups_->GetGroupsIncludingProperty(label, propName);
       for (std::vector<std::string>::iterator it = configGroups.begin(); 
             it != configGroups.end(); ++it) 
       {
-         std::vector<std::string> configs = 
-            core_->getAvailableConfigs((*it).c_str());
-         bool found = false;
-         for (std::vector<std::string>::iterator itc = configs.begin();
-               itc != configs.end() && !found; itc++) 
-         {
-            Configuration config = 
-               core_->getConfigData((*it).c_str(), (*itc).c_str());
-            if (config.isPropertyIncluded(label, propName)) {
-               found = true;
-               // If we are part of this configuration, notify that it 
-               // was changed. Get the new config from cache rather 
-               // than by querying the hardware
-               std::string currentConfig = 
-                  core_->getCurrentConfigFromCache( (*it).c_str() );
-               OnConfigGroupChanged((*it).c_str(), currentConfig.c_str());
-            }
-         }
+         // Get the new config from cache rather than by querying the
+         // hardware
+         std::string currentConfig = 
+            core_->getCurrentConfigFromCache( (*it).c_str() );
+         OnConfigGroupChanged((*it).c_str(), currentConfig.c_str());
       }
-          
 
       // Check if pixel size was potentially affected.  If so, update from cache
-      std::vector<std::string> pixelSizeConfigs = core_->getAvailablePixelSizeConfigs();
-      bool found = false;
-      for (std::vector<std::string>::iterator itpsc = pixelSizeConfigs.begin();
-            itpsc != pixelSizeConfigs.end() && !found; itpsc++) 
+      if (core_->pixelSizeGroup_->IsPropertyIncluded(label, propName))
       {
-         Configuration pixelSizeConfig = core_->getPixelSizeConfigData( (*itpsc).c_str());
-         if (pixelSizeConfig.isPropertyIncluded(label, propName)) {
-            found = true;
-            double pixSizeUm;
-            try {
-               // update pixel size from cache
-               pixSizeUm = core_->getPixelSizeUm(true);
-            }
-            catch (CMMError ) {
-               pixSizeUm = 0.0;
-            }
-            OnPixelSizeChanged(pixSizeUm);
+         double pixSizeUm;
+         try {
+            // update pixel size from cache
+            pixSizeUm = core_->getPixelSizeUm(true);
          }
+         catch (CMMError ) {
+            pixSizeUm = 0.0;
+         }
+         OnPixelSizeChanged(pixSizeUm);
       }
    }
 
@@ -634,6 +839,14 @@ int CoreCallback::OnMagnifierChanged(const MM::Device* /* device */)
    return DEVICE_OK;
 }
 
+int CoreCallback::OnDeviceIdle(const MM::Device* /* device */)
+{
+   // Waiters re-check all the devices they wait for, so which device
+   // became idle does not matter
+   core_->idleSignal_->Notify();
+   return DEVICE_OK;
+}
+
 
 
 int CoreCallback::SetSerialProperties(const char* portName,
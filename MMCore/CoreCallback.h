@@ -93,6 +93,10 @@ public:
    /*Deprecated*/ int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd = 0, const bool doProcess = true);
 
    /*Deprecated*/ int InsertMultiChannel(const MM::Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* pMd = 0);
+   int AcquireImageSlot(const MM::Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char** pixels);
+   int CommitImageSlot(const MM::Device* caller, const char* serializedMetadata, const bool doProcess = true);
+   int CommitImageSlot(const MM::Device* caller, const FrameMetadata& md, const bool doProcess = true);
+   void AbandonImageSlot(const MM::Device* caller);
    void ClearImageBuffer(const MM::Device* caller);
    bool InitializeImageBuffer(unsigned channels, unsigned slices, unsigned int w, unsigned int h, unsigned int pixDepth);
 
@@ -122,6 +126,7 @@ public:
    int OnExposureChanged(const MM::Device* device, double newExposure);
    int OnSLMExposureChanged(const MM::Device* device, double newExposure);
    int OnMagnifierChanged(const MM::Device* device);
+   int OnDeviceIdle(const MM::Device* device);
 
 
    void NextPostedError(int& errorCode, char* pMessage, int maxlen, int& messageLength);
@@ -142,7 +147,14 @@ private:
    CMMCore* core_;
    MMThreadLock* pValueChangeLock_;
 
+   // Buffer in which each caller has reserved a frame (AcquireImageSlot())
+   MMThreadLock pendingSlotsLock_;
+   std::map< const MM::Device*, boost::shared_ptr<CircularBuffer> > pendingSlots_;
+
    Metadata AddCameraMetadata(const MM::Device* caller, const Metadata* pMd);
+   boost::shared_ptr<CircularBuffer> GetSequenceBuffer(const MM::Device* caller);
+   boost::shared_ptr<CircularBuffer> TakePendingSlotBuffer(const MM::Device* caller);
+   void RecordFrameInsert(const MM::Device* caller, int result, long long startUs);
 
    int OnConfigGroupChanged(const char* groupName, const char* newConfigName);
    int OnPixelSizeChanged(double newPixelSizeUm);
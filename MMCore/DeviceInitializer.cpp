@@ -0,0 +1,281 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          DeviceInitializer.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Initializes devices of different modules concurrently
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "DeviceInitializer.h"
+
+#include "CoreUtils.h"
+#include "DeviceManager.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <algorithm>
+
+
+namespace mm {
+
+namespace {
+
+bool IsHub(boost::shared_ptr<DeviceInstance> device)
+{
+   return device->GetType() == MM::HubDevice;
+}
+
+} // anonymous namespace
+
+
+DeviceInitializer::DeviceInitializer(logging::Logger logger) :
+   logger_(logger)
+{
+}
+
+void DeviceInitializer::InitializeAll(const DeviceList& devices,
+      DeviceList& initialized) throw (CMMError)
+{
+   DeviceList ports;
+   DeviceList others;
+   for (DeviceList::const_iterator it = devices.begin(), end = devices.end();
+         it != end; ++it)
+   {
+      if ((*it)->GetType() == MM::SerialDevice)
+         ports.push_back(*it);
+      else
+         others.push_back(*it);
+   }
+
+   DeviceList completed;
+   ErrorList errors;
+   RunPhase(ports, completed, errors);
+   if (errors.empty())
+      RunPhase(others, completed, errors);
+
+   // Report in the original order, regardless of completion order
+   std::set< boost::shared_ptr<DeviceInstance> > succeeded(completed.begin(),
+         completed.end());
+   initialized.clear();
+   for (DeviceList::const_iterator it = devices.begin(), end = devices.end();
+         it != end; ++it)
+   {
+      if (succeeded.count(*it))
+         initialized.push_back(*it);
+   }
+
+   if (!errors.empty())
+   {
+      std::string labels;
+      for (size_t i = 0; i < errors.size(); ++i)
+         labels += (i > 0 ? ", " : "") + errors[i].first;
+      throw CMMError("Failed to initialize " + ToString(errors.size()) +
+            " device(s) (" + labels + ")", ChainErrors(errors, 0));
+   }
+}
+
+// Chains the errors from index on, first one outermost
+CMMError DeviceInitializer::ChainErrors(const ErrorList& errors, size_t index)
+{
+   const std::string msg = "Failed to initialize device " +
+      ToQuotedString(errors[index].first);
+   const CMMError& error = *errors[index].second;
+   if (index + 1 == errors.size())
+      return CMMError(msg, error);
+   return CMMError(msg + ": " + error.getFullMsg(), error.getCode(),
+         ChainErrors(errors, index + 1));
+}
+
+void DeviceInitializer::Initialize(boost::shared_ptr<DeviceInstance> device)
+   throw (CMMError)
+{
+   const std::string label = device->GetLabel();
+   LOG_INFO(logger_) << "Will initialize device " << label;
+   const double startMs = GetMMTimeNow().getMsec();
+   device->Initialize();
+   const double elapsedMs = GetMMTimeNow().getMsec() - startMs;
+   LOG_INFO(logger_) << "Did initialize device " << label << " in " <<
+      elapsedMs << " ms";
+
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   timingsMs_[label] = elapsedMs;
+}
+
+void DeviceInitializer::WaitForDevice(boost::shared_ptr<DeviceInstance> device)
+{
+   const Module target = device->GetAdapterModule().get();
+   const std::string label = device->GetLabel();
+
+   boost::unique_lock<boost::mutex> lock(mutex_);
+   std::map<boost::thread::id, Module>::const_iterator worker =
+      workers_.find(boost::this_thread::get_id());
+   if (worker == workers_.end())
+      return;
+   const Module waiter = worker->second;
+
+   // Devices of our own module are initialized in order, as before. Waiting
+   // for the whole module (rather than just the device) ensures that the
+   // module's thread no longer calls into the adapter when we do.
+   if (target == waiter || !pending_.count(target))
+      return;
+   if (WouldDeadlock(waiter, target))
+   {
+      LOG_WARNING(logger_) << "Not waiting for the module of device " <<
+         label << " to be initialized, because it depends on the caller's "
+         "module";
+      return;
+   }
+
+   LOG_DEBUG(logger_) << "Waiting for the module of device " << label <<
+      " to be initialized";
+   waitingFor_[waiter] = target;
+   while (pending_.count(target))
+      doneCondVar_.wait(lock);
+   waitingFor_.erase(waiter);
+}
+
+bool DeviceInitializer::GetInitializationTimeMs(const std::string& label,
+      double& ms) const
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   std::map<std::string, double>::const_iterator it = timingsMs_.find(label);
+   if (it == timingsMs_.end())
+      return false;
+   ms = it->second;
+   return true;
+}
+
+void DeviceInitializer::RunPhase(const DeviceList& devices,
+      DeviceList& initialized, ErrorList& errors)
+{
+   if (devices.empty())
+      return;
+
+   // Group by module, keeping the order within each module
+   std::vector<Module> modules;
+   std::map<Module, DeviceList> byModule;
+   for (DeviceList::const_iterator it = devices.begin(), end = devices.end();
+         it != end; ++it)
+   {
+      const Module module = (*it)->GetAdapterModule().get();
+      if (!byModule.count(module))
+         modules.push_back(module);
+      byModule[module].push_back(*it);
+   }
+   for (std::map<Module, DeviceList>::iterator it = byModule.begin(),
+         end = byModule.end(); it != end; ++it)
+      std::stable_partition(it->second.begin(), it->second.end(), IsHub);
+
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      pending_.clear();
+      pending_.insert(modules.begin(), modules.end());
+   }
+
+   std::vector<DeviceList> moduleInitialized(modules.size());
+   std::vector<ErrorList> moduleErrors(modules.size());
+   boost::thread_group threads;
+   for (size_t i = 0; i < modules.size(); ++i)
+   {
+      threads.create_thread(boost::bind(&DeviceInitializer::InitializeModule,
+               this, modules[i], boost::cref(byModule[modules[i]]),
+               &moduleInitialized[i], &moduleErrors[i]));
+   }
+   threads.join_all();
+
+   for (size_t i = 0; i < modules.size(); ++i)
+   {
+      initialized.insert(initialized.end(), moduleInitialized[i].begin(),
+            moduleInitialized[i].end());
+      errors.insert(errors.end(), moduleErrors[i].begin(),
+            moduleErrors[i].end());
+   }
+}
+
+void DeviceInitializer::InitializeModule(Module module,
+      const DeviceList& devices, DeviceList* initialized, ErrorList* errors)
+{
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      workers_[boost::this_thread::get_id()] = module;
+   }
+
+   bool failed = false;
+   for (DeviceList::const_iterator it = devices.begin(), end = devices.end();
+         it != end; ++it)
+   {
+      // After a failure, the remaining devices of the module (which may
+      // depend on the failed one, e.g. its hub) are skipped
+      if (!failed)
+      {
+         try
+         {
+            DeviceModuleLockGuard guard(*it);
+            Initialize(*it);
+            initialized->push_back(*it);
+         }
+         catch (const CMMError& e)
+         {
+            LOG_ERROR(logger_) << "Failed to initialize device " <<
+               (*it)->GetLabel() << ": " << e.getFullMsg();
+            errors->push_back(std::make_pair((*it)->GetLabel(),
+                     boost::make_shared<CMMError>(e)));
+            failed = true;
+         }
+         catch (const std::exception& e)
+         {
+            LOG_ERROR(logger_) << "Failed to initialize device " <<
+               (*it)->GetLabel() << ": " << e.what();
+            errors->push_back(std::make_pair((*it)->GetLabel(),
+                     boost::make_shared<CMMError>(e.what())));
+            failed = true;
+         }
+         catch (...)
+         {
+            LOG_ERROR(logger_) << "Failed to initialize device " <<
+               (*it)->GetLabel() << ": unknown exception";
+            errors->push_back(std::make_pair((*it)->GetLabel(),
+                     boost::make_shared<CMMError>("Unknown exception")));
+            failed = true;
+         }
+      }
+   }
+
+   SetDone(module);
+}
+
+void DeviceInitializer::SetDone(Module module)
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   workers_.erase(boost::this_thread::get_id());
+   pending_.erase(module);
+   doneCondVar_.notify_all();
+}
+
+bool DeviceInitializer::WouldDeadlock(Module waiter, Module target) const
+{
+   // Follow the chain of waits starting at the target's module; each module
+   // has a single thread, so a module can wait for at most one other
+   for (std::map<Module, Module>::const_iterator it = waitingFor_.find(target);
+         it != waitingFor_.end(); it = waitingFor_.find(it->second))
+   {
+      if (it->second == waiter)
+         return true;
+   }
+   return false;
+}
+
+} // namespace mm
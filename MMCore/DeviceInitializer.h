@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          DeviceInitializer.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Initializes devices of different modules concurrently
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Devices/DeviceInstance.h"
+#include "Error.h"
+#include "Logging/Logger.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class LoadedDeviceAdapter;
+
+namespace mm {
+
+/**
+ * Calls Initialize() on a list of devices, using one thread per adapter
+ * module.
+ *
+ * Devices of one module are initialized in the given order (hubs first),
+ * since they share the module lock anyway. Serial ports are initialized
+ * before all other devices, which may need them in their Initialize().
+ *
+ * Some devices (e.g. the Utilities adapters) look up devices of other
+ * modules during Initialize(). Device callbacks call WaitForDevice() so that
+ * such a lookup waits until the other device's module has finished
+ * initializing, unless waiting would deadlock. The caller then uses the
+ * device without the other module's lock, so it must not return while that
+ * module's thread may still be calling into the adapter.
+ *
+ * The time taken by each device's Initialize() is recorded.
+ */
+class DeviceInitializer : boost::noncopyable
+{
+public:
+   explicit DeviceInitializer(logging::Logger logger);
+
+   // Sets initialized to the devices that were initialized successfully, in
+   // the given order. If any device fails, the errors of all failed devices
+   // are chained into the thrown CMMError (initialized is still set).
+   void InitializeAll(
+         const std::vector< boost::shared_ptr<DeviceInstance> >& devices,
+         std::vector< boost::shared_ptr<DeviceInstance> >& initialized)
+      throw (CMMError);
+
+   // Initializes one device, recording the time taken. The caller must hold
+   // the module lock.
+   void Initialize(boost::shared_ptr<DeviceInstance> device) throw (CMMError);
+
+   // If called from a thread of InitializeAll(), blocks while the device's
+   // module (if it is another one) is still being initialized
+   void WaitForDevice(boost::shared_ptr<DeviceInstance> device);
+
+   // Returns false if the device has not been initialized
+   bool GetInitializationTimeMs(const std::string& label, double& ms) const;
+
+private:
+   typedef LoadedDeviceAdapter* Module;
+   typedef std::vector< boost::shared_ptr<DeviceInstance> > DeviceList;
+   typedef std::vector< std::pair< std::string,
+           boost::shared_ptr<CMMError> > > ErrorList;
+
+   static CMMError ChainErrors(const ErrorList& errors, size_t index);
+
+   void RunPhase(const DeviceList& devices, DeviceList& initialized,
+         ErrorList& errors);
+   void InitializeModule(Module module, const DeviceList& devices,
+         DeviceList* initialized, ErrorList* errors);
+   void SetDone(Module module);
+   bool WouldDeadlock(Module waiter, Module target) const;
+
+   logging::Logger logger_;
+
+   mutable boost::mutex mutex_;
+   boost::condition_variable doneCondVar_;
+   std::set<Module> pending_; // Modules not yet done in this phase
+   std::map<boost::thread::id, Module> workers_;
+   std::map<Module, Module> waitingFor_; // Module threads blocked in waits
+   std::map<std::string, double> timingsMs_;
+};
+
+} // namespace mm
@@ -137,6 +137,26 @@ std::string CameraInstance::GetTags()
    return serializedMetadataBuf.Get();
 }
 
+/**
+ * Returns the camera's tags, parsed. Cameras insert images at high rates
+ * while their tags rarely change, so the parsed tags are only rebuilt when
+ * the serialized form differs from the previous call.
+ */
+boost::shared_ptr<const Metadata> CameraInstance::GetTagsMetadata()
+{
+   std::string serializedTags = GetTags();
+
+   boost::lock_guard<boost::mutex> lock(tagsMutex_);
+   if (!cachedTags_ || serializedTags != cachedSerializedTags_)
+   {
+      boost::shared_ptr<Metadata> tags(new Metadata());
+      tags->Restore(serializedTags.c_str());
+      cachedTags_ = tags;
+      cachedSerializedTags_.swap(serializedTags);
+   }
+   return cachedTags_;
+}
+
 void CameraInstance::AddTag(const char* key, const char* deviceLabel, const char* value) { return GetImpl()->AddTag(key, deviceLabel, value); }
 void CameraInstance::RemoveTag(const char* key) { return GetImpl()->RemoveTag(key); }
 int CameraInstance::IsExposureSequenceable(bool& isSequenceable) const { return GetImpl()->IsExposureSequenceable(isSequenceable); }
@@ -21,6 +21,13 @@
 
 #include "DeviceInstanceBase.h"
 
+#include "../../MMDevice/ImageMetadata.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CircularBuffer;
 
 class CameraInstance : public DeviceInstanceBase<MM::Camera>
 {
@@ -73,6 +80,7 @@ public:
    int PrepareSequenceAcqusition();
    bool IsCapturing();
    std::string GetTags();
+   boost::shared_ptr<const Metadata> GetTagsMetadata();
    void AddTag(const char* key, const char* deviceLabel, const char* value);
    void RemoveTag(const char* key);
    int IsExposureSequenceable(bool& isSequenceable) const;
@@ -82,4 +90,17 @@ public:
    int ClearExposureSequence();
    int AddToExposureSequence(double exposureTime_ms);
    int SendExposureSequence() const;
+
+   // Sequence buffer dedicated to this camera, or null if the camera inserts
+   // into the core's shared buffer. Must not be changed while capturing.
+   void SetSequenceBuffer(boost::shared_ptr<CircularBuffer> buffer) { sequenceBuffer_ = buffer; }
+   boost::shared_ptr<CircularBuffer> GetSequenceBuffer() const { return sequenceBuffer_; }
+
+private:
+   boost::shared_ptr<CircularBuffer> sequenceBuffer_;
+
+   // Parsed result of the last GetTags(), reused while the tags do not change
+   boost::mutex tagsMutex_;
+   std::string cachedSerializedTags_;
+   boost::shared_ptr<const Metadata> cachedTags_;
 };
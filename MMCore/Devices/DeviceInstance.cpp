@@ -149,7 +149,11 @@ std::string
 DeviceInstance::GetProperty(const std::string& name) const
 {
    DeviceStringBuffer valueBuf(this, "GetProperty");
-   int err = pImpl_->GetProperty(name.c_str(), valueBuf.GetBuffer());
+   int err;
+   {
+      mm::ScopedLatency latency(metrics_.getPropertyLatency);
+      err = pImpl_->GetProperty(name.c_str(), valueBuf.GetBuffer());
+   }
    ThrowIfError(err, "Cannot get value of property " +
          ToQuotedString(name));
    return valueBuf.Get();
@@ -162,7 +166,11 @@ DeviceInstance::SetProperty(const std::string& name,
    LOG_DEBUG(Logger()) << "Will set property \"" << name << "\" to \"" <<
       value << "\"";
 
-   int err = pImpl_->SetProperty(name.c_str(), value.c_str());
+   int err;
+   {
+      mm::ScopedLatency latency(metrics_.setPropertyLatency);
+      err = pImpl_->SetProperty(name.c_str(), value.c_str());
+   }
 
    ThrowIfError(err, "Cannot set property " + ToQuotedString(name) +
          " to " + ToQuotedString(value));
@@ -171,6 +179,34 @@ DeviceInstance::SetProperty(const std::string& name,
       value << "\"";
 }
 
+bool
+DeviceInstance::SetProperties(const std::vector<std::string>& names,
+      const std::vector<std::string>& values) const
+{
+   std::vector<const char*> namePtrs;
+   std::vector<const char*> valuePtrs;
+   for (size_t i = 0; i < names.size() && i < values.size(); ++i)
+   {
+      namePtrs.push_back(names[i].c_str());
+      valuePtrs.push_back(values[i].c_str());
+   }
+   if (namePtrs.empty())
+      return true;
+
+   LOG_DEBUG(Logger()) << "Will set " << namePtrs.size() << " properties";
+
+   int err = pImpl_->SetProperties(&namePtrs[0], &valuePtrs[0],
+         static_cast<unsigned>(namePtrs.size()));
+   if (err == DEVICE_UNSUPPORTED_COMMAND)
+      return false;
+
+   ThrowIfError(err, "Cannot set " + ToString(namePtrs.size()) +
+         " properties");
+
+   LOG_DEBUG(Logger()) << "Did set " << namePtrs.size() << " properties";
+   return true;
+}
+
 bool
 DeviceInstance::HasProperty(const std::string& name) const
 { return pImpl_->HasProperty(name.c_str()); }
@@ -22,6 +22,7 @@
 #include "../../MMDevice/MMDeviceConstants.h"
 #include "../Error.h"
 #include "../Logging/Logger.h"
+#include "../Metrics.h"
 
 #include <string>
 #include <vector>
@@ -71,6 +72,7 @@ private:
    DeleteDeviceFunction deleteFunction_;
    mm::logging::Logger deviceLogger_;
    mm::logging::Logger coreLogger_;
+   mutable mm::DeviceMetrics metrics_;
 
 public:
    boost::shared_ptr<LoadedDeviceAdapter> GetAdapterModule() const /* final */ { return adapter_; }
@@ -82,6 +84,9 @@ public:
    // need it for the few CoreCallback methods that return a device pointer.
    MM::Device* GetRawPtr() const /* final */ { return pImpl_; }
 
+   // Recorded from any thread without locking
+   mm::DeviceMetrics& GetMetrics() const /* final */ { return metrics_; }
+
    // Callback API
    int LogMessage(const char* msg, bool debugOnly);
 
@@ -174,6 +179,10 @@ private:
 public:
    std::string GetProperty(const std::string& name) const;
    void SetProperty(const std::string& name, const std::string& value) const;
+   // Returns false if the device does not support setting multiple
+   // properties at once
+   bool SetProperties(const std::vector<std::string>& names,
+         const std::vector<std::string>& values) const;
    bool HasProperty(const std::string& name) const;
 private:
    // Exposed through GetPropertyNames() only
@@ -21,10 +21,54 @@
 
 #include "SerialInstance.h"
 
+namespace
+{
+   const long long NoCommandSent = -1;
+}
+
 
 MM::PortType SerialInstance::GetPortType() const { return GetImpl()->GetPortType(); }
-int SerialInstance::SetCommand(const char* command, const char* term) { return GetImpl()->SetCommand(command, term); }
-int SerialInstance::GetAnswer(char* txt, unsigned maxChars, const char* term) { return GetImpl()->GetAnswer(txt, maxChars, term); }
-int SerialInstance::Write(const unsigned char* buf, unsigned long bufLen) { return GetImpl()->Write(buf, bufLen); }
-int SerialInstance::Read(unsigned char* buf, unsigned long bufLen, unsigned long& charsRead) { return GetImpl()->Read(buf, bufLen, charsRead); }
+
+int SerialInstance::SetCommand(const char* command, const char* term)
+{
+   CommandSent();
+   return GetImpl()->SetCommand(command, term);
+}
+
+int SerialInstance::GetAnswer(char* txt, unsigned maxChars, const char* term)
+{
+   int err = GetImpl()->GetAnswer(txt, maxChars, term);
+   if (err == DEVICE_OK)
+      AnswerReceived();
+   return err;
+}
+
+int SerialInstance::Write(const unsigned char* buf, unsigned long bufLen)
+{
+   CommandSent();
+   return GetImpl()->Write(buf, bufLen);
+}
+
+int SerialInstance::Read(unsigned char* buf, unsigned long bufLen, unsigned long& charsRead)
+{
+   int err = GetImpl()->Read(buf, bufLen, charsRead);
+   if (err == DEVICE_OK && charsRead > 0)
+      AnswerReceived();
+   return err;
+}
+
 int SerialInstance::Purge() { return GetImpl()->Purge(); }
+
+void SerialInstance::CommandSent()
+{
+   commandSentUs_.store(mm::MonotonicMicroseconds(),
+         boost::memory_order_relaxed);
+}
+
+void SerialInstance::AnswerReceived()
+{
+   const long long sentUs = commandSentUs_.exchange(NoCommandSent,
+         boost::memory_order_relaxed);
+   if (sentUs != NoCommandSent)
+      GetMetrics().serialRoundTrip.Record(mm::MonotonicMicroseconds() - sentUs);
+}
@@ -21,6 +21,8 @@
 
 #include "DeviceInstanceBase.h"
 
+#include <boost/atomic.hpp>
+
 
 class SerialInstance : public DeviceInstanceBase<MM::Serial>
 {
@@ -33,7 +35,8 @@ public:
          const std::string& label,
          mm::logging::Logger deviceLogger,
          mm::logging::Logger coreLogger) :
-      DeviceInstanceBase<MM::Serial>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger)
+      DeviceInstanceBase<MM::Serial>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger),
+      commandSentUs_(-1)
    {}
 
    MM::PortType GetPortType() const;
@@ -42,4 +45,12 @@ public:
    int Write(const unsigned char* buf, unsigned long bufLen);
    int Read(unsigned char* buf, unsigned long bufLen, unsigned long& charsRead);
    int Purge();
+
+private:
+   // The round trip, recorded in the metrics, runs from a SetCommand() or
+   // Write() to the first GetAnswer() or nonempty Read() that follows.
+   void CommandSent();
+   void AnswerReceived();
+
+   boost::atomic<long long> commandSentUs_; // -1 if no command pending
 };
@@ -17,6 +17,7 @@
 // NOTE:          Imported from ADVI for use in Micro-Manager
 
 #include "FrameBuffer.h"
+#include "RingMemory.h"
 
 #include <cmath>
 #include <cstring>
@@ -24,15 +25,22 @@
 namespace mm {
 
 ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth) :
-   pixels_(0), width_(xSize), height_(ySize), pixDepth_(pixDepth)
+   pixels_(0), ownsPixels_(true), width_(xSize), height_(ySize), pixDepth_(pixDepth)
 {
    pixels_ = new unsigned char[xSize * ySize * pixDepth];
    memset(pixels_, 0, xSize * ySize * pixDepth);
 }
 
+ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth,
+      unsigned char* pixels) :
+   pixels_(pixels), ownsPixels_(false), width_(xSize), height_(ySize), pixDepth_(pixDepth)
+{
+}
+
 ImgBuffer::~ImgBuffer()
 {
-   delete[] pixels_;
+   if (ownsPixels_)
+      delete[] pixels_;
 }
 
 const unsigned char* ImgBuffer::GetPixels() const
@@ -50,8 +58,10 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize, unsigned pixDepth)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ * pixDepth_ < xSize * ySize * pixDepth)
    {
-      delete[] pixels_;
+      if (ownsPixels_)
+         delete[] pixels_;
       pixels_ = new unsigned char [xSize * ySize * pixDepth];
+      ownsPixels_ = true;
    }
 
    width_ = xSize;
@@ -64,8 +74,10 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ < xSize * ySize)
    {
-      delete[] pixels_;
+      if (ownsPixels_)
+         delete[] pixels_;
       pixels_ = new unsigned char[xSize * ySize * pixDepth_];
+      ownsPixels_ = true;
    }
 
    width_ = xSize;
@@ -76,11 +88,29 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
 
 void ImgBuffer::SetMetadata(const Metadata& md)
 {
-   //metadata_ = md;
-   // Serialize/Restore instead of =operator used to avoid object new/delete
-   // issues across the DLL boundary (on Windows)
-   // TODO: this is inefficient and should be revised
-    metadata_.Restore(md.Serialize().c_str());
+   baseMetadata_.reset(new Metadata(md));
+   frameMetadata_.Clear();
+}
+
+/**
+ * Sets the metadata as a (shared, immutable) Metadata object plus a binary
+ * block whose tags take precedence. Neither is converted until
+ * GetMetadata() is called.
+ */
+void ImgBuffer::SetMetadata(const boost::shared_ptr<const Metadata>& baseMd,
+      const FrameMetadata& md)
+{
+   baseMetadata_ = baseMd;
+   frameMetadata_ = md;
+}
+
+Metadata ImgBuffer::GetMetadata() const
+{
+   Metadata md;
+   if (baseMetadata_)
+      md = *baseMetadata_;
+   md.Merge(frameMetadata_);
+   return md;
 }
 
 
@@ -93,6 +123,7 @@ FrameBuffer::FrameBuffer(unsigned xSize, unsigned ySize, unsigned byteDepth)
    width_ = xSize;
    height_ = ySize;
    depth_ = byteDepth;
+   arrivalTimeMs_ = 0.0;
 }
 
 FrameBuffer::FrameBuffer()
@@ -100,6 +131,7 @@ FrameBuffer::FrameBuffer()
    width_ = 0;
    height_ = 0;
    depth_ = 0;
+   arrivalTimeMs_ = 0.0;
 }
 
 FrameBuffer::~FrameBuffer()
@@ -115,6 +147,7 @@ void FrameBuffer::Clear()
       delete *it;
    }
    channels_.clear();
+   memory_.reset();
 }
 
 void FrameBuffer::Preallocate(unsigned channels)
@@ -127,6 +160,21 @@ void FrameBuffer::Preallocate(unsigned channels)
    }
 }
 
+/**
+ * Allocates the channels in externally owned memory, channelStride bytes
+ * apart starting at pixels. The frame keeps a reference to memory, so that
+ * the pixels stay valid for as long as the frame exists.
+ */
+void FrameBuffer::Preallocate(unsigned channels, unsigned char* pixels,
+      size_t channelStride, const boost::shared_ptr<RingMemory>& memory)
+{
+   Clear();
+   memory_ = memory;
+   channels_.resize(channels, 0);
+   for (unsigned i = 0; i < channels; i++)
+      channels_[i] = new ImgBuffer(width_, height_, depth_, pixels + i * channelStride);
+}
+
 void FrameBuffer::Resize(unsigned xSize, unsigned ySize, unsigned byteDepth)
 {
    Clear();
@@ -20,22 +20,30 @@
 
 #include "../MMDevice/ImageMetadata.h"
 
+#include <boost/shared_ptr.hpp>
+
 #include <string>
 #include <vector>
 #include <map>
 
 namespace mm {
 
+class RingMemory;
+
 class ImgBuffer
 {
    unsigned char* pixels_;
+   bool ownsPixels_;
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
-   Metadata metadata_;
+   boost::shared_ptr<const Metadata> baseMetadata_;
+   FrameMetadata frameMetadata_;
 
 public:
    ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth);
+   // Uses pixels owned by the caller (until resized to a larger size)
+   ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth, unsigned char* pixels);
    ~ImgBuffer();
 
    unsigned int Width() const {return width_;}
@@ -43,12 +51,17 @@ public:
    unsigned int Depth() const {return pixDepth_;}
    void SetPixels(const void* pixArray);
    const unsigned char* GetPixels() const;
+   unsigned char* GetPixelsRW() {return pixels_;}
 
    void Resize(unsigned xSize, unsigned ySize, unsigned pixDepth);
    void Resize(unsigned xSize, unsigned ySize);
 
    void SetMetadata(const Metadata& md);
-   const Metadata& GetMetadata() const {return metadata_;}
+   void SetMetadata(const boost::shared_ptr<const Metadata>& baseMd,
+         const FrameMetadata& md);
+   Metadata GetMetadata() const;
+   const FrameMetadata& GetFrameMetadata() const {return frameMetadata_;}
+   const Metadata* GetBaseMetadata() const {return baseMetadata_.get();}
 
 private:
    ImgBuffer& operator=(const ImgBuffer&);
@@ -59,9 +72,12 @@ class FrameBuffer
    // Holds null for any unallocated channels, and is as long as need to
    // contain the allocated channels.
    std::vector<ImgBuffer*> channels_;
+   // Keeps the pixel memory alive when the channels do not own it
+   boost::shared_ptr<RingMemory> memory_;
    unsigned int width_;
    unsigned int height_;
    unsigned int depth_;
+   double arrivalTimeMs_;
 
 public:
    FrameBuffer(unsigned xSize, unsigned ySize, unsigned byteDepth);
@@ -71,6 +87,8 @@ public:
    void Resize(unsigned xSize, unsigned ySize, unsigned pixDepth);
    void Clear();
    void Preallocate(unsigned channels);
+   void Preallocate(unsigned channels, unsigned char* pixels,
+         size_t channelStride, const boost::shared_ptr<RingMemory>& memory);
 
    ImgBuffer* FindImage(unsigned channel) const;
    const unsigned char* GetPixels(unsigned channel) const;
@@ -79,6 +97,10 @@ public:
    unsigned Height() const {return height_;}
    unsigned Depth() const {return depth_;}
 
+   // Core clock time at which the frame was placed in the buffer
+   void SetArrivalTime(double ms) {arrivalTimeMs_ = ms;}
+   double GetArrivalTime() const {return arrivalTimeMs_;}
+
 private:
    // The following line should be uncommented once we upgrade to
    // VC++ >= 2013. (Or operator= should be declared deleted, C++11-style.)
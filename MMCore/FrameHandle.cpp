@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameHandle.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Reference-counted handle to a frame in the circular buffer
+//
+// COPYRIGHT:     University of California, San Francisco, 2006-2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "FrameHandle.h"
+
+#include "FrameBuffer.h"
+
+#include <cstring>
+
+
+FrameHandle::FrameHandle() :
+   image_(0)
+{
+}
+
+FrameHandle::FrameHandle(boost::shared_ptr<mm::FrameBuffer> frame,
+      unsigned channel) :
+   frame_(frame),
+   image_(frame ? frame->FindImage(channel) : 0)
+{
+   if (!image_)
+      frame_.reset();
+}
+
+/**
+ * Unpins the frame. The handle is invalid afterwards.
+ */
+void FrameHandle::release()
+{
+   image_ = 0;
+   frame_.reset();
+}
+
+/**
+ * Returns the pixels of the frame, or null if the handle is invalid.
+ */
+void* FrameHandle::getPixels() const
+{
+   if (!image_)
+      return 0;
+   return image_->GetPixelsRW();
+}
+
+unsigned FrameHandle::getImageWidth() const
+{
+   return image_ ? image_->Width() : 0;
+}
+
+unsigned FrameHandle::getImageHeight() const
+{
+   return image_ ? image_->Height() : 0;
+}
+
+unsigned FrameHandle::getBytesPerPixel() const
+{
+   return image_ ? image_->Depth() : 0;
+}
+
+/**
+ * Returns 4 for RGB frames and 1 for grayscale frames (following the
+ * PixelType tag set by the circular buffer).
+ */
+unsigned FrameHandle::getNumberOfComponents() const
+{
+   if (!image_)
+      return 0;
+   FrameMetadata::Tag tag;
+   if (!image_->GetFrameMetadata().FindTag(FrameMetadata::KeyPixelType, tag) ||
+         tag.type != FrameMetadata::TypeString)
+      return 1;
+   if (strcmp(tag.stringValue, "RGB32") == 0 ||
+         strcmp(tag.stringValue, "RGB64") == 0)
+      return 4;
+   return 1;
+}
+
+long FrameHandle::getImageBufferSize() const
+{
+   if (!image_)
+      return 0;
+   return static_cast<long>(image_->Width()) * image_->Height() *
+      image_->Depth();
+}
+
+/**
+ * Returns a copy of the metadata attached to the frame.
+ */
+Metadata FrameHandle::getMetadata() const
+{
+   if (!image_)
+      return Metadata();
+   return image_->GetMetadata();
+}
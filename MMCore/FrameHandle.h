@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameHandle.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Reference-counted handle to a frame in the circular buffer
+//
+// COPYRIGHT:     University of California, San Francisco, 2006-2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+
+class Metadata;
+
+namespace mm {
+   class FrameBuffer;
+   class ImgBuffer;
+}
+
+
+/**
+ * A frame taken from the circular buffer, whose pixels are used in place.
+ *
+ * As long as a handle (or any copy of it) refers to a frame, the frame is
+ * pinned: the circular buffer will not overwrite it with a new image, and
+ * the pixel pointer remains valid even if the buffer is cleared, resized,
+ * or reallocated. A camera inserting into a buffer whose next slot is pinned
+ * sees the buffer as full, so handles should be released promptly.
+ */
+class FrameHandle
+{
+public:
+   FrameHandle();
+#ifndef SWIG
+   FrameHandle(boost::shared_ptr<mm::FrameBuffer> frame, unsigned channel);
+#endif
+
+   bool isValid() const {return image_ != 0;}
+   void release();
+
+   void* getPixels() const;
+   unsigned getImageWidth() const;
+   unsigned getImageHeight() const;
+   unsigned getBytesPerPixel() const;
+   unsigned getNumberOfComponents() const;
+   long getImageBufferSize() const;
+   Metadata getMetadata() const;
+
+private:
+   boost::shared_ptr<mm::FrameBuffer> frame_;
+   mm::ImgBuffer* image_;
+};
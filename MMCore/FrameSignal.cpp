@@ -0,0 +1,149 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameSignal.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Wakes up consumers when a frame is inserted into a circular
+//                buffer
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "FrameSignal.h"
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <stdint.h>
+#endif
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace mm {
+
+FrameSignal::FrameSignal() :
+   generation_(0),
+   waiters_(0),
+   descriptorOpen_(false),
+   descriptorSignaled_(false),
+   readFd_(-1),
+   writeFd_(-1)
+{
+}
+
+FrameSignal::~FrameSignal()
+{
+#ifndef WIN32
+   if (writeFd_ >= 0 && writeFd_ != readFd_)
+      close(writeFd_);
+   if (readFd_ >= 0)
+      close(readFd_);
+#endif
+}
+
+void FrameSignal::Notify()
+{
+   // Sequentially consistent, so that either we see the waiter or the
+   // waiter sees the new generation
+   generation_.fetch_add(1, boost::memory_order_seq_cst);
+   if (waiters_.load(boost::memory_order_seq_cst) > 0)
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      condVar_.notify_all();
+   }
+
+   if (descriptorOpen_.load(boost::memory_order_acquire) &&
+         !descriptorSignaled_.exchange(true, boost::memory_order_seq_cst))
+      WriteDescriptor();
+}
+
+bool FrameSignal::WaitForChange(unsigned long generation, long timeoutMs)
+{
+   const boost::system_time deadline = boost::get_system_time() +
+      boost::posix_time::milliseconds(timeoutMs > 0 ? timeoutMs : 0);
+
+   boost::unique_lock<boost::mutex> lock(mutex_);
+   waiters_.fetch_add(1, boost::memory_order_seq_cst);
+   bool changed = true;
+   while (GetGeneration() == generation)
+   {
+      if (!condVar_.timed_wait(lock, deadline))
+      {
+         changed = (GetGeneration() != generation);
+         break;
+      }
+   }
+   waiters_.fetch_sub(1, boost::memory_order_seq_cst);
+   return changed;
+}
+
+int FrameSignal::GetDescriptor()
+{
+   boost::lock_guard<boost::mutex> lock(descriptorMutex_);
+   if (descriptorOpen_.load(boost::memory_order_relaxed))
+      return readFd_;
+
+#if defined(__linux__)
+   readFd_ = writeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(WIN32)
+   int fds[2];
+   if (pipe(fds) == 0)
+   {
+      for (int i = 0; i < 2; ++i)
+      {
+         fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+         fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+      }
+      readFd_ = fds[0];
+      writeFd_ = fds[1];
+   }
+#endif
+   if (readFd_ >= 0)
+      descriptorOpen_.store(true, boost::memory_order_release);
+   return readFd_;
+}
+
+void FrameSignal::ResetDescriptor()
+{
+   if (!descriptorOpen_.load(boost::memory_order_acquire))
+      return;
+
+   // Drain before clearing the flag: a Notify() in between skips the write,
+   // but its frame is already published, so the caller's check will see it
+#if defined(__linux__)
+   uint64_t count;
+   (void)read(readFd_, &count, sizeof(count));
+#elif !defined(WIN32)
+   char bytes[64];
+   while (read(readFd_, bytes, sizeof(bytes)) > 0)
+      ;
+#endif
+   descriptorSignaled_.store(false, boost::memory_order_seq_cst);
+}
+
+void FrameSignal::WriteDescriptor()
+{
+#if defined(__linux__)
+   const uint64_t one = 1;
+   (void)write(writeFd_, &one, sizeof(one));
+#elif !defined(WIN32)
+   const char one = 1;
+   (void)write(writeFd_, &one, sizeof(one));
+#endif
+}
+
+} // namespace mm
@@ -0,0 +1,81 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameSignal.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Wakes up consumers when a frame is inserted into a circular
+//                buffer
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+namespace mm {
+
+/**
+ * Notification of new frames, shared by the circular buffers of the core.
+ *
+ * The producer calls Notify() after each frame is made visible. A consumer
+ * reads the generation, checks the buffers, and if they are empty waits for
+ * the generation to change; because the generation is incremented after the
+ * frame is published, no frame can be missed in between. Notify() does not
+ * take a lock unless a thread is actually waiting.
+ *
+ * For event loops, a file descriptor that becomes readable on Notify() is
+ * available on Linux (eventfd) and OS X (pipe). It is only created when
+ * first requested, so that producers do not make a system call per frame
+ * otherwise.
+ */
+class FrameSignal : boost::noncopyable
+{
+public:
+   FrameSignal();
+   ~FrameSignal();
+
+   unsigned long GetGeneration() const
+   { return generation_.load(boost::memory_order_seq_cst); }
+
+   void Notify();
+
+   // Waits until the generation differs from the given one. Returns false
+   // if timeoutMs elapsed first.
+   bool WaitForChange(unsigned long generation, long timeoutMs);
+
+   // Returns the descriptor, creating it if necessary; -1 if unsupported on
+   // this platform
+   int GetDescriptor();
+   // Makes the descriptor unreadable until the next Notify(). Check the
+   // buffers after calling this, not before.
+   void ResetDescriptor();
+
+private:
+   void WriteDescriptor();
+
+   boost::atomic<unsigned long> generation_;
+   boost::atomic<int> waiters_;
+   boost::mutex mutex_;
+   boost::condition_variable condVar_;
+
+   boost::mutex descriptorMutex_;
+   boost::atomic<bool> descriptorOpen_;
+   boost::atomic<bool> descriptorSignaled_;
+   int readFd_;
+   int writeFd_;
+};
+
+} // namespace mm
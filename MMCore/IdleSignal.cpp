@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          IdleSignal.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Wakes up threads waiting for devices to become non-busy
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "IdleSignal.h"
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+
+namespace mm {
+
+IdleSignal::IdleSignal() :
+   generation_(0)
+{
+}
+
+unsigned long IdleSignal::GetGeneration() const
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   return generation_;
+}
+
+void IdleSignal::Notify()
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   ++generation_;
+   condVar_.notify_all();
+}
+
+bool IdleSignal::WaitForChange(unsigned long generation, double timeoutMs)
+{
+   const boost::system_time deadline = boost::get_system_time() +
+      boost::posix_time::microseconds(timeoutMs > 0.0 ?
+            static_cast<long>(timeoutMs * 1000.0) : 0);
+
+   boost::unique_lock<boost::mutex> lock(mutex_);
+   while (generation_ == generation)
+   {
+      if (!condVar_.timed_wait(lock, deadline))
+         return generation_ != generation;
+   }
+   return true;
+}
+
+} // namespace mm
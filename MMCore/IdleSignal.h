@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          IdleSignal.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Wakes up threads waiting for devices to become non-busy
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+namespace mm {
+
+/**
+ * Notification that some device has become idle (MM::Core::OnDeviceIdle()).
+ *
+ * A waiter reads the generation, polls Busy() of the devices it waits for,
+ * and if any is still busy waits for the generation to change, with a
+ * timeout so that devices that never notify are still polled.
+ */
+class IdleSignal : boost::noncopyable
+{
+public:
+   IdleSignal();
+
+   unsigned long GetGeneration() const;
+   void Notify();
+
+   // Waits until the generation differs from the given one. Returns false
+   // if timeoutMs elapsed first.
+   bool WaitForChange(unsigned long generation, double timeoutMs);
+
+private:
+   mutable boost::mutex mutex_;
+   boost::condition_variable condVar_;
+   unsigned long generation_;
+};
+
+} // namespace mm
@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          LogDecoder.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   mmlogdecode: converts binary Core log files to text
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+// Usage: mmlogdecode FILE...
+//
+// Writes the entries of the given binary log files (see startBinaryLogFile())
+// to standard output, in the same text format as the primary log file. Give
+// rotated files oldest first (e.g. CoreLog.bin.2 CoreLog.bin.1 CoreLog.bin).
+
+#include "../Logging/BinaryLogFormat.h"
+#include "../Logging/GenericStreamSink.h"
+#include "../Logging/Metadata.h"
+#include "../Logging/MetadataFormatter.h"
+
+#include <fstream>
+#include <iostream>
+
+using namespace mm::logging;
+using namespace mm::logging::internal;
+
+namespace
+{
+
+typedef GenericPacketArray<Metadata> PacketArrayType;
+
+// Packets are written in batches of whole entries, so that lines split into
+// several packets are spliced correctly
+const size_t BatchPackets = 4096;
+
+void WriteBatch(PacketArrayType& packets)
+{
+   WritePacketsToStream<MetadataFormatter, Metadata>(std::cout,
+         packets.Begin(), packets.End(),
+         boost::shared_ptr< GenericEntryFilter<Metadata> >());
+   packets.Clear();
+}
+
+bool DecodeFile(const char* filename)
+{
+   std::ifstream file(filename, std::ios_base::in | std::ios_base::binary);
+   if (!file)
+   {
+      std::cerr << "mmlogdecode: cannot open " << filename << '\n';
+      return false;
+   }
+
+   BinaryLogReader reader(file);
+   if (!reader.ReadFileHeader())
+   {
+      std::cerr << "mmlogdecode: " << filename <<
+         " is not a binary log file written on this platform\n";
+      return false;
+   }
+
+   PacketArrayType batch;
+   PacketArrayType packet;
+   size_t batchSize = 0;
+   while (reader.ReadPacket(packet))
+   {
+      const PacketArrayType::LinePacketType& p = *packet.Begin();
+      if (batchSize >= BatchPackets &&
+            p.GetPacketState() == PacketStateEntryFirstLine)
+      {
+         WriteBatch(batch);
+         batchSize = 0;
+      }
+      batch.Append(p);
+      ++batchSize;
+      packet.Clear();
+   }
+   WriteBatch(batch);
+   return true;
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   if (argc < 2)
+   {
+      std::cerr << "Usage: mmlogdecode FILE...\n";
+      return 2;
+   }
+
+   bool ok = true;
+   for (int i = 1; i < argc; ++i)
+      ok = DecodeFile(argv[i]) && ok;
+   std::cout.flush();
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          LogFileArchiver.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Compresses and prunes rotated log files in the background
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "LogFileArchiver.h"
+
+#include <boost/bind.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#ifdef MMCORE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+
+namespace mm {
+
+LogFileArchiver::LogFileArchiver() :
+   stopRequested_(false)
+{
+}
+
+LogFileArchiver::~LogFileArchiver()
+{
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      stopRequested_ = true;
+      condVar_.notify_one();
+   }
+   if (thread_.joinable())
+      thread_.join();
+}
+
+bool LogFileArchiver::IsCompressionAvailable()
+{
+#ifdef MMCORE_HAVE_ZLIB
+   return true;
+#else
+   return false;
+#endif
+}
+
+void LogFileArchiver::Archive(const std::string& logFilename,
+      const std::string& rotatedFilename, bool compress, unsigned keepCount)
+{
+   Job job;
+   job.logFilename = logFilename;
+   job.rotatedFilename = rotatedFilename;
+   job.compress = compress;
+   job.keepCount = keepCount;
+
+   boost::lock_guard<boost::mutex> lock(mutex_);
+   jobs_.push_back(job);
+   if (!thread_.joinable())
+   {
+      boost::thread t(boost::bind(&LogFileArchiver::Run, this));
+      boost::swap(thread_, t);
+   }
+   condVar_.notify_one();
+}
+
+void LogFileArchiver::Run()
+{
+   LowerThreadPriority();
+
+   for (;;)
+   {
+      Job job;
+      {
+         boost::unique_lock<boost::mutex> lock(mutex_);
+         while (jobs_.empty() && !stopRequested_)
+            condVar_.wait(lock);
+         if (jobs_.empty())
+            return; // Stop requested and all work done
+         job = jobs_.front();
+         jobs_.pop_front();
+      }
+      Process(job);
+   }
+}
+
+void LogFileArchiver::Process(const Job& job)
+{
+   std::string archivedName = job.rotatedFilename;
+   if (job.compress && IsCompressionAvailable())
+   {
+      const std::string compressedName = job.rotatedFilename + ".gz";
+      if (Compress(job.rotatedFilename, compressedName))
+      {
+         std::remove(job.rotatedFilename.c_str());
+         archivedName = compressedName;
+      }
+      else
+      {
+         std::remove(compressedName.c_str());
+      }
+   }
+
+   std::deque<std::string>& archived = archived_[job.logFilename];
+   archived.push_back(archivedName);
+   while (job.keepCount > 0 && archived.size() > job.keepCount)
+   {
+      std::remove(archived.front().c_str());
+      archived.pop_front();
+   }
+}
+
+bool LogFileArchiver::Compress(const std::string& source,
+      const std::string& destination)
+{
+#ifdef MMCORE_HAVE_ZLIB
+   std::ifstream in(source.c_str(), std::ios_base::in | std::ios_base::binary);
+   if (!in)
+      return false;
+   gzFile out = gzopen(destination.c_str(), "wb");
+   if (!out)
+      return false;
+
+   std::vector<char> buffer(256 * 1024);
+   bool ok = true;
+   while (ok && in)
+   {
+      in.read(&buffer[0], buffer.size());
+      const std::streamsize n = in.gcount();
+      if (n > 0 && gzwrite(out, &buffer[0], static_cast<unsigned>(n)) !=
+            static_cast<int>(n))
+         ok = false;
+   }
+   if (in.bad())
+      ok = false;
+   if (gzclose(out) != Z_OK)
+      ok = false;
+   return ok;
+#else
+   (void)source;
+   (void)destination;
+   return false;
+#endif
+}
+
+// Best effort; compression should not compete with acquisition
+void LogFileArchiver::LowerThreadPriority()
+{
+#ifdef _WIN32
+   ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+   // On Linux, the nice value is per thread
+   ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 19);
+#elif defined(__APPLE__)
+   ::setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#endif
+}
+
+} // namespace mm
@@ -0,0 +1,83 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          LogFileArchiver.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Compresses and prunes rotated log files in the background
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+
+namespace mm {
+
+/**
+ * Takes care of log files after rotation, on a low-priority thread of its
+ * own: gzip-compresses them (if built with zlib) and deletes the oldest ones
+ * beyond the number to keep.
+ *
+ * Only files rotated during this session are counted for pruning. Queued
+ * work is finished before the destructor returns.
+ */
+class LogFileArchiver : boost::noncopyable
+{
+public:
+   LogFileArchiver();
+   ~LogFileArchiver();
+
+   static bool IsCompressionAvailable();
+
+   // logFilename identifies the log whose rotated files are counted
+   // together; keepCount 0 keeps all
+   void Archive(const std::string& logFilename,
+         const std::string& rotatedFilename, bool compress,
+         unsigned keepCount);
+
+private:
+   struct Job
+   {
+      std::string logFilename;
+      std::string rotatedFilename;
+      bool compress;
+      unsigned keepCount;
+   };
+
+   void Run();
+   void Process(const Job& job);
+   static bool Compress(const std::string& source,
+         const std::string& destination);
+   static void LowerThreadPriority();
+
+   boost::mutex mutex_;
+   boost::condition_variable condVar_;
+   std::deque<Job> jobs_;
+   bool stopRequested_;
+
+   // Accessed from the archiving thread: archived files of each log, oldest
+   // first
+   std::map< std::string, std::deque<std::string> > archived_;
+
+   boost::thread thread_; // Started on the first Archive()
+};
+
+} // namespace mm
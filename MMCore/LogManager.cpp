@@ -2,7 +2,9 @@
 
 #include "CoreUtils.h"
 #include "Error.h"
+#include "LogFileArchiver.h"
 
+#include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -38,10 +40,37 @@ LogManager::LogManager() :
    internalLogger_(loggingCore_->NewLogger("LogManager")),
    primaryLogLevel_(LogLevelInfo),
    usingStdErr_(false),
+   archiver_(boost::make_shared<LogFileArchiver>()),
    nextSecondaryHandle_(0)
 {}
 
 
+bool
+LogManager::ApplyRotation(boost::shared_ptr<LogSink> sink,
+      const std::string& filename, const LogRotationPolicy& policy)
+{
+   boost::shared_ptr<FileLogSink> fileSink =
+      boost::dynamic_pointer_cast<FileLogSink>(sink);
+   if (!fileSink)
+      return false;
+
+   if (!policy.IsEnabled())
+   {
+      fileSink->SetRotation(0, 0,
+            boost::function<void (const std::string&)>());
+      return true;
+   }
+
+   // The callback runs on the logging core's receive thread; handing the file
+   // to the archiver only queues it.
+   fileSink->SetRotation(static_cast<std::streamoff>(policy.maxBytes),
+         policy.maxAgeSeconds,
+         boost::bind(&LogFileArchiver::Archive, archiver_, filename, _1,
+            policy.compress, policy.keepCount));
+   return true;
+}
+
+
 void
 LogManager::SetUseStdErr(bool flag)
 {
@@ -121,6 +150,7 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
    }
 
    newSink->SetFilter(boost::make_shared<LevelFilter>(primaryLogLevel_));
+   ApplyRotation(newSink, primaryFilename_, primaryRotation_);
 
    if (!primaryFileSink_)
    {
@@ -218,6 +248,30 @@ LogManager::GetPrimaryLogLevel() const
 }
 
 
+void
+LogManager::SetPrimaryLogRotation(const LogRotationPolicy& policy)
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+
+   primaryRotation_ = policy;
+   if (primaryFileSink_)
+      ApplyRotation(primaryFileSink_, primaryFilename_, primaryRotation_);
+
+   if (policy.IsEnabled())
+   {
+      LOG_INFO(internalLogger_) << "Primary log file rotation set to " <<
+         policy.maxBytes << " bytes, " << policy.maxAgeSeconds <<
+         " s, keeping " << policy.keepCount <<
+         (policy.compress && LogFileArchiver::IsCompressionAvailable() ?
+          " (compressed)" : "");
+   }
+   else
+   {
+      LOG_INFO(internalLogger_) << "Primary log file rotation disabled";
+   }
+}
+
+
 LogManager::LogFileHandle
 LogManager::AddSecondaryLogFile(LogLevel level,
       const std::string& filename, bool truncate, SinkMode mode)
@@ -251,6 +305,41 @@ LogManager::AddSecondaryLogFile(LogLevel level,
 }
 
 
+LogManager::LogFileHandle
+LogManager::AddBinaryLogFile(LogLevel level, const std::string& filename,
+      size_t maxFileBytes, unsigned maxBackups)
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+
+   boost::shared_ptr<LogSink> sink;
+   try
+   {
+      sink = boost::make_shared<BinaryLogSink>(filename, maxFileBytes,
+            maxBackups);
+   }
+   catch (const CannotOpenFileException&)
+   {
+      LOG_ERROR(internalLogger_) << "Failed to open file " <<
+         filename << " as binary log file";
+      throw CMMError("Cannot open file " + ToQuotedString(filename));
+   }
+
+   sink->SetFilter(boost::make_shared<LevelFilter>(level));
+
+   LogFileHandle handle = nextSecondaryHandle_++;
+   secondaryLogFiles_.insert(std::make_pair(handle,
+            LogFileInfo(filename, sink, SinkModeAsynchronous)));
+
+   loggingCore_->AddSink(sink, SinkModeAsynchronous);
+
+   LOG_INFO(internalLogger_) << "Added binary log file " << filename <<
+      " with log level " << StringForLogLevel(level) <<
+      ", rotated at " << maxFileBytes << " bytes";
+
+   return handle;
+}
+
+
 void
 LogManager::RemoveSecondaryLogFile(LogManager::LogFileHandle handle)
 {
@@ -272,6 +361,69 @@ LogManager::RemoveSecondaryLogFile(LogManager::LogFileHandle handle)
 }
 
 
+void
+LogManager::SetSecondaryLogRotation(LogFileHandle handle,
+      const LogRotationPolicy& policy)
+{
+   boost::lock_guard<boost::mutex> lock(mutex_);
+
+   std::map<LogFileHandle, LogFileInfo>::iterator foundIt =
+      secondaryLogFiles_.find(handle);
+   if (foundIt == secondaryLogFiles_.end())
+   {
+      throw CMMError("No secondary log file with handle " +
+            ToString(handle));
+   }
+   if (!ApplyRotation(foundIt->second.sink_, foundIt->second.filename_,
+            policy))
+   {
+      throw CMMError("Cannot set rotation for log file " +
+            ToQuotedString(foundIt->second.filename_) +
+            " (binary log files are rotated by size only)");
+   }
+
+   LOG_INFO(internalLogger_) << "Set rotation for secondary log file " <<
+      foundIt->second.filename_;
+}
+
+
+void
+LogManager::SetAsyncFlushIntervalMs(unsigned ms)
+{
+   loggingCore_->SetAsyncFlushIntervalMs(ms);
+   LOG_INFO(internalLogger_) << "Set asynchronous log flush interval to " <<
+      ms << " ms";
+}
+
+
+unsigned long
+LogManager::GetDroppedEntryCount() const
+{
+   return loggingCore_->GetDroppedEntryCount();
+}
+
+
+size_t
+LogManager::GetQueuedPacketCount() const
+{
+   return loggingCore_->GetQueuedPacketCount();
+}
+
+
+size_t
+LogManager::GetPeakQueuedPacketCount() const
+{
+   return loggingCore_->GetPeakQueuedPacketCount();
+}
+
+
+void
+LogManager::ResetPeakQueuedPacketCount()
+{
+   loggingCore_->ResetPeakQueuedPacketCount();
+}
+
+
 Logger
 LogManager::NewLogger(const std::string& label)
 {
@@ -2,6 +2,7 @@
 
 #include "Logging/Logging.h"
 
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/mutex.hpp>
 
 #include <map>
@@ -10,6 +11,28 @@
 namespace mm
 {
 
+class LogFileArchiver;
+
+/**
+ * When to rotate a text log file, and what to do with the rotated files.
+ */
+struct LogRotationPolicy
+{
+   long long maxBytes; // 0 for no size limit
+   long maxAgeSeconds; // 0 for no age limit
+   unsigned keepCount; // Rotated files to keep; 0 to keep all
+   bool compress; // Ignored if built without zlib
+
+   LogRotationPolicy() :
+      maxBytes(0),
+      maxAgeSeconds(0),
+      keepCount(0),
+      compress(false)
+   {}
+
+   bool IsEnabled() const { return maxBytes > 0 || maxAgeSeconds > 0; }
+};
+
 /**
  * Facade to the logging subsystem.
  */
@@ -31,6 +54,10 @@ private:
 
    std::string primaryFilename_;
    boost::shared_ptr<logging::LogSink> primaryFileSink_;
+   LogRotationPolicy primaryRotation_;
+
+   // Compresses rotated files off the logging threads
+   boost::shared_ptr<LogFileArchiver> archiver_;
 
    LogFileHandle nextSecondaryHandle_;
    struct LogFileInfo
@@ -52,6 +79,10 @@ private:
    static const logging::SinkMode PrimarySinkMode =
       logging::SinkModeAsynchronous;
 
+   // Returns false if sink is not a text file sink
+   bool ApplyRotation(boost::shared_ptr<logging::LogSink> sink,
+         const std::string& filename, const LogRotationPolicy& policy);
+
 public:
    LogManager();
 
@@ -65,12 +96,27 @@ public:
    void SetPrimaryLogLevel(logging::LogLevel level);
    logging::LogLevel GetPrimaryLogLevel() const;
 
+   // Also applies to primary log files set later
+   void SetPrimaryLogRotation(const LogRotationPolicy& policy);
+
    LogFileHandle AddSecondaryLogFile(logging::LogLevel level,
          const std::string& filename, bool truncate = true,
          logging::SinkMode mode = logging::SinkModeAsynchronous);
+   // Binary log files are rotated when they reach maxFileBytes; they are
+   // removed with RemoveSecondaryLogFile()
+   LogFileHandle AddBinaryLogFile(logging::LogLevel level,
+         const std::string& filename, size_t maxFileBytes,
+         unsigned maxBackups);
    void RemoveSecondaryLogFile(LogFileHandle handle);
-   // We could add an atomic SwapSecondaryLogFile(handle, filename, truncate),
-   // nice for log rotation, but we don't need it now.
+   // Not applicable to binary log files, which rotate on their own
+   void SetSecondaryLogRotation(LogFileHandle handle,
+         const LogRotationPolicy& policy);
+
+   void SetAsyncFlushIntervalMs(unsigned ms);
+   unsigned long GetDroppedEntryCount() const;
+   size_t GetQueuedPacketCount() const;
+   size_t GetPeakQueuedPacketCount() const;
+   void ResetPeakQueuedPacketCount();
 
    logging::Logger NewLogger(const std::string& label);
 };
@@ -0,0 +1,179 @@
+// COPYRIGHT:     University of California, San Francisco, 2015,
+//                All Rights reserved
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "GenericLinePacket.h"
+#include "GenericPacketArray.h"
+#include "Metadata.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/gregorian/gregorian_types.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <cstring>
+#include <istream>
+#include <map>
+#include <string>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+// Layout of binary log files (written by BinaryLogSink, decoded by
+// mmlogdecode). All integers are in the byte order of the writing machine,
+// which the decoder checks against ByteOrderMark.
+//
+// The file starts with a BinaryLogFileHeader, followed by records. Each
+// record is a BinaryLogRecordHeader followed by textLength bytes of text (not
+// null-terminated). A record of type BinaryLogRecordEnd (all zero bytes)
+// marks the end of the data, so that a file that was not closed properly can
+// still be read up to the last record written.
+//
+// Logger (component) labels are written once per file, in a
+// BinaryLogRecordLoggerName record that assigns an id; line records refer to
+// the label by that id.
+
+const char BinaryLogMagic[8] = { 'M', 'M', 'B', 'I', 'N', 'L', 'O', 'G' };
+const boost::uint32_t BinaryLogVersion = 1;
+const boost::uint32_t BinaryLogByteOrderMark = 0x01020304;
+
+struct BinaryLogFileHeader
+{
+   char magic[8];
+   boost::uint32_t version;
+   boost::uint32_t byteOrderMark;
+   boost::uint32_t threadIdSize; // sizeof(ThreadIdType) of the writer
+   boost::uint32_t reserved;
+};
+
+enum BinaryLogRecordType
+{
+   BinaryLogRecordEnd = 0,
+   BinaryLogRecordLoggerName = 1,
+   BinaryLogRecordLine = 2,
+};
+
+struct BinaryLogRecordHeader
+{
+   boost::uint16_t type;
+   boost::uint16_t textLength;
+   boost::uint16_t loggerId;
+   boost::uint8_t level; // LogLevel
+   boost::uint8_t packetState; // PacketState
+   boost::uint64_t timestampUs; // Local time, microseconds since 1970
+   boost::uint64_t threadId; // ThreadIdType, in the leading bytes
+};
+
+
+inline boost::uint64_t
+BinaryLogTimestamp(TimestampType time)
+{
+   const TimestampType epoch(boost::gregorian::date(1970, 1, 1));
+   return static_cast<boost::uint64_t>((time - epoch).total_microseconds());
+}
+
+
+inline TimestampType
+TimestampFromBinaryLog(boost::uint64_t us)
+{
+   const TimestampType epoch(boost::gregorian::date(1970, 1, 1));
+   return epoch + boost::posix_time::microseconds(
+         static_cast<boost::int64_t>(us));
+}
+
+
+/**
+ * Reads the records of a binary log file back into line packets.
+ */
+class BinaryLogReader
+{
+   std::istream& stream_;
+   std::map<boost::uint16_t, std::string> loggerNames_;
+   char text_[GenericLinePacket<Metadata>::PacketTextLen + 1];
+
+public:
+   explicit BinaryLogReader(std::istream& stream) : stream_(stream) {}
+
+   // Returns false if the stream is not a binary log written on a machine
+   // compatible with this one
+   bool ReadFileHeader()
+   {
+      BinaryLogFileHeader header;
+      if (!stream_.read(reinterpret_cast<char*>(&header), sizeof(header)))
+         return false;
+      return std::memcmp(header.magic, BinaryLogMagic,
+               sizeof(BinaryLogMagic)) == 0 &&
+         header.version == BinaryLogVersion &&
+         header.byteOrderMark == BinaryLogByteOrderMark &&
+         header.threadIdSize == sizeof(ThreadIdType);
+   }
+
+   // Appends the next line packet to packets. Returns false at the end of
+   // the data (or if the file is truncated or corrupt).
+   bool ReadPacket(GenericPacketArray<Metadata>& packets)
+   {
+      for (;;)
+      {
+         BinaryLogRecordHeader record;
+         if (!stream_.read(reinterpret_cast<char*>(&record), sizeof(record)))
+            return false;
+         if (record.type == BinaryLogRecordEnd)
+            return false;
+
+         if (record.type == BinaryLogRecordLoggerName)
+         {
+            std::string name(record.textLength, '\0');
+            if (record.textLength > 0 &&
+                  !stream_.read(&name[0], record.textLength))
+               return false;
+            loggerNames_[record.loggerId] = name;
+            continue;
+         }
+         if (record.type != BinaryLogRecordLine)
+         {
+            // Unknown record type (from a later version)
+            if (!stream_.ignore(record.textLength))
+               return false;
+            continue;
+         }
+
+         if (record.textLength > sizeof(text_) - 1)
+            return false;
+         if (!stream_.read(text_, record.textLength))
+            return false;
+         text_[record.textLength] = '\0';
+
+         ThreadIdType tid;
+         std::memcpy(&tid, &record.threadId, sizeof(tid));
+         StampData stamp;
+         stamp.Set(TimestampFromBinaryLog(record.timestampUs), tid);
+
+         packets.AppendPacket(
+               static_cast<PacketState>(record.packetState),
+               LoggerData(loggerNames_[record.loggerId]),
+               EntryData(static_cast<LogLevel>(record.level)),
+               stamp, text_);
+         return true;
+      }
+   }
+};
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
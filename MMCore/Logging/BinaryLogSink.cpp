@@ -0,0 +1,235 @@
+// COPYRIGHT:     University of California, San Francisco, 2015,
+//                All Rights reserved
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "BinaryLogSink.h"
+
+#include "BinaryLogFormat.h"
+#include "GenericStreamSink.h"
+#include "MappedLogFile.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+namespace
+{
+   const size_t MinFileBytes = 64 * 1024;
+}
+
+BinaryLogSink::BinaryLogSink(const std::string& filename,
+      size_t maxFileBytes, unsigned maxBackups) :
+   filename_(filename),
+   maxFileBytes_(std::max(maxFileBytes, MinFileBytes)),
+   maxBackups_(maxBackups),
+   used_(0),
+   hadError_(false)
+{
+   OpenFile();
+}
+
+BinaryLogSink::~BinaryLogSink()
+{
+   CloseFile();
+}
+
+void
+BinaryLogSink::Consume(const PacketArrayType& packets)
+{
+   boost::shared_ptr< GenericEntryFilter<Metadata> > filter = GetFilter();
+
+   for (PacketArrayType::ConstIteratorType it = packets.Begin(),
+         end = packets.End(); it != end; ++it)
+   {
+      const Metadata& metadata = it->GetMetadataConstRef();
+      if (filter && !filter->Filter(metadata))
+         continue;
+
+      // Start a new file rather than splitting an entry, if possible
+      if (it->GetPacketState() == PacketStateEntryFirstLine && file_)
+      {
+         size_t entryBytes = 0;
+         PacketArrayType::ConstIteratorType entryEnd = it;
+         do
+         {
+            entryBytes += sizeof(BinaryLogRecordHeader) +
+               std::strlen(entryEnd->GetText());
+            ++entryEnd;
+         } while (entryEnd != end &&
+               entryEnd->GetPacketState() != PacketStateEntryFirstLine);
+         // Allow for the logger name record and the end marker
+         entryBytes += sizeof(BinaryLogRecordHeader) +
+            std::strlen(metadata.GetLoggerData().GetComponentLabel()) +
+            sizeof(BinaryLogRecordHeader);
+         if (used_ + entryBytes > maxFileBytes_ &&
+               used_ > sizeof(BinaryLogFileHeader))
+            Rotate();
+      }
+      if (!file_)
+         continue;
+
+      // A line whose logger cannot be named would be unreadable
+      boost::uint16_t loggerId;
+      if (!GetLoggerId(metadata.GetLoggerData().GetComponentLabel(),
+               loggerId))
+         continue;
+
+      BinaryLogRecordHeader record;
+      std::memset(&record, 0, sizeof(record));
+      record.type = BinaryLogRecordLine;
+      const char* text = it->GetText();
+      record.textLength = static_cast<boost::uint16_t>(std::strlen(text));
+      record.loggerId = loggerId;
+      record.level = static_cast<boost::uint8_t>(
+            metadata.GetEntryData().GetLevel());
+      record.packetState = static_cast<boost::uint8_t>(it->GetPacketState());
+      record.timestampUs =
+         BinaryLogTimestamp(metadata.GetStampData().GetTimestamp());
+      const ThreadIdType tid = metadata.GetStampData().GetThreadId();
+      std::memcpy(&record.threadId, &tid, sizeof(tid));
+
+      Append(&record, sizeof(record), text, record.textLength);
+   }
+
+   if (file_)
+      file_->SetUsedSize(used_);
+}
+
+void
+BinaryLogSink::OpenFile()
+{
+   file_.reset(new MappedLogFile(filename_, maxFileBytes_));
+   used_ = 0;
+   loggerIds_.clear();
+
+   BinaryLogFileHeader header;
+   std::memset(&header, 0, sizeof(header));
+   std::memcpy(header.magic, BinaryLogMagic, sizeof(header.magic));
+   header.version = BinaryLogVersion;
+   header.byteOrderMark = BinaryLogByteOrderMark;
+   header.threadIdSize = sizeof(ThreadIdType);
+   Append(&header, sizeof(header), 0, 0);
+   file_->SetUsedSize(used_);
+}
+
+void
+BinaryLogSink::CloseFile()
+{
+   if (file_)
+      file_->SetUsedSize(used_);
+   file_.reset();
+}
+
+void
+BinaryLogSink::Rotate()
+{
+   CloseFile();
+
+   if (maxBackups_ == 0)
+   {
+      std::remove(filename_.c_str());
+   }
+   else
+   {
+      const std::string prefix = filename_ + ".";
+      std::remove((prefix +
+               boost::lexical_cast<std::string>(maxBackups_)).c_str());
+      for (unsigned i = maxBackups_ - 1; i > 0; --i)
+      {
+         std::rename((prefix + boost::lexical_cast<std::string>(i)).c_str(),
+               (prefix + boost::lexical_cast<std::string>(i + 1)).c_str());
+      }
+      std::rename(filename_.c_str(), (prefix + "1").c_str());
+   }
+
+   try
+   {
+      OpenFile();
+   }
+   catch (const CannotOpenFileException&)
+   {
+      ReportError("cannot start new file");
+   }
+}
+
+// Returns false (dropping the record) if the file is full; callers rotate
+// beforehand when the record should fit
+bool
+BinaryLogSink::Append(const void* header, size_t headerSize,
+      const char* text, size_t textLength)
+{
+   // Keep room for the end marker (the zero-filled tail of the file)
+   if (used_ + headerSize + textLength + sizeof(BinaryLogRecordHeader) >
+         file_->GetSize())
+      return false;
+
+   unsigned char* p = file_->GetData() + used_;
+   std::memcpy(p, header, headerSize);
+   if (textLength > 0)
+      std::memcpy(p + headerSize, text, textLength);
+   used_ += headerSize + textLength;
+   return true;
+}
+
+bool
+BinaryLogSink::GetLoggerId(const char* label, boost::uint16_t& id)
+{
+   std::map<const char*, boost::uint16_t>::const_iterator found =
+      loggerIds_.find(label);
+   if (found != loggerIds_.end())
+   {
+      id = found->second;
+      return true;
+   }
+
+   // Only assign the id once the name is in the file, so that the name is
+   // written (with the same id) the next time if it does not fit now
+   id = static_cast<boost::uint16_t>(loggerIds_.size());
+
+   BinaryLogRecordHeader record;
+   std::memset(&record, 0, sizeof(record));
+   record.type = BinaryLogRecordLoggerName;
+   const size_t length = std::min<size_t>(std::strlen(label), 0xffff);
+   record.textLength = static_cast<boost::uint16_t>(length);
+   record.loggerId = id;
+   if (!Append(&record, sizeof(record), label, length))
+      return false;
+   loggerIds_.insert(std::make_pair(label, id));
+   return true;
+}
+
+void
+BinaryLogSink::ReportError(const char* what)
+{
+   if (!hadError_)
+   {
+      hadError_ = true;
+      std::cerr << "Logging: binary log file " << filename_ << ": " <<
+         what << '\n';
+   }
+}
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
@@ -0,0 +1,89 @@
+// COPYRIGHT:     University of California, San Francisco, 2015,
+//                All Rights reserved
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "GenericSink.h"
+#include "Metadata.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+class MappedLogFile;
+
+
+/**
+ * A sink writing fixed-layout binary records (see BinaryLogFormat.h) to a
+ * memory-mapped file, avoiding the cost of formatting text. The file can be
+ * converted to the usual text format with mmlogdecode.
+ *
+ * When the file reaches maxFileBytes, it is renamed to filename.1 (shifting
+ * older files to filename.2, etc., and deleting the oldest beyond
+ * maxBackups), and a new file is started.
+ */
+class BinaryLogSink : public GenericSink<Metadata>, boost::noncopyable
+{
+public:
+   typedef GenericSink<Metadata> Super;
+   typedef Super::PacketArrayType PacketArrayType;
+
+   // maxFileBytes is raised to 64 KiB if smaller. Throws
+   // CannotOpenFileException.
+   BinaryLogSink(const std::string& filename, size_t maxFileBytes,
+         unsigned maxBackups);
+   virtual ~BinaryLogSink();
+
+   virtual void Consume(const PacketArrayType& packets);
+
+private:
+   void OpenFile();
+   void CloseFile();
+   void Rotate();
+   bool Append(const void* header, size_t headerSize,
+         const char* text, size_t textLength);
+   // Returns false if the logger name record could not be written
+   bool GetLoggerId(const char* label, boost::uint16_t& id);
+   void ReportError(const char* what);
+
+   std::string filename_;
+   size_t maxFileBytes_;
+   unsigned maxBackups_;
+
+   boost::scoped_ptr<MappedLogFile> file_;
+   size_t used_;
+   // Component labels are interned, so the pointers identify them
+   std::map<const char*, boost::uint16_t> loggerIds_;
+   bool hadError_;
+};
+
+} // namespace internal
+
+
+typedef internal::BinaryLogSink BinaryLogSink;
+
+} // namespace logging
+} // namespace mm
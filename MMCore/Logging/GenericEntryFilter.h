@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <climits>
+
 
 namespace mm
 {
@@ -31,6 +33,10 @@ class GenericEntryFilter
 public:
    virtual ~GenericEntryFilter() {}
    virtual bool Filter(const TMetadata& metadata) const = 0;
+
+   // The lowest entry level that Filter() may accept. Filters that do not
+   // look at the level keep the default.
+   virtual int GetMinimumLevel() const { return INT_MIN; }
 };
 
 
@@ -16,9 +16,11 @@
 
 #pragma once
 
+#include <boost/atomic.hpp>
 #include <boost/function.hpp>
 #include <boost/utility.hpp>
 
+#include <climits>
 #include <sstream>
 #include <string>
 
@@ -31,23 +33,70 @@ namespace internal
 {
 
 
+/**
+ * The lowest entry level that any sink of a logging core may accept.
+ *
+ * Kept separately for synchronous and asynchronous sinks, because the two
+ * sink lists are changed under different mutexes.
+ */
+class EnabledLevelThreshold : boost::noncopyable
+{
+   boost::atomic<int> syncMinLevel_;
+   boost::atomic<int> asyncMinLevel_;
+
+public:
+   EnabledLevelThreshold() :
+      syncMinLevel_(INT_MAX),
+      asyncMinLevel_(INT_MAX)
+   {}
+
+   void SetSyncMinLevel(int level)
+   { syncMinLevel_.store(level, boost::memory_order_relaxed); }
+   void SetAsyncMinLevel(int level)
+   { asyncMinLevel_.store(level, boost::memory_order_relaxed); }
+
+   // A relaxed load is enough: an entry logged just as a sink is added may
+   // be dropped (or formatted in vain), as if logged slightly earlier.
+   bool IsEnabled(int level) const
+   {
+      return level >= syncMinLevel_.load(boost::memory_order_relaxed) ||
+         level >= asyncMinLevel_.load(boost::memory_order_relaxed);
+   }
+};
+
+
 template <typename TEntryData>
 class GenericLogger
 {
    boost::function<void (TEntryData, const char*)> impl_;
+   // Owned by the logging core, which impl_ keeps alive; null if unknown
+   const EnabledLevelThreshold* threshold_;
 
 public:
    typedef TEntryData EntryDataType;
 
-   GenericLogger(boost::function<void (TEntryData, const char*)> f) :
-      impl_(f)
+   GenericLogger(boost::function<void (TEntryData, const char*)> f,
+         const EnabledLevelThreshold* threshold = 0) :
+      impl_(f),
+      threshold_(threshold)
    {}
 
+   // False if no sink would accept an entry with this entry data. Used by
+   // the LOG_* macros to skip formatting disabled entries.
+   bool IsEnabled(TEntryData entryData) const
+   { return !threshold_ || threshold_->IsEnabled(entryData.GetLevel()); }
+
    void operator()(TEntryData entryData, const char* message) const
-   { impl_(entryData, message); }
+   {
+      if (IsEnabled(entryData))
+         impl_(entryData, message);
+   }
 
    void operator()(TEntryData entryData, const std::string& message) const
-   { impl_(entryData, message.c_str()); }
+   {
+      if (IsEnabled(entryData))
+         impl_(entryData, message.c_str());
+   }
 };
 
 
@@ -68,6 +68,9 @@ private:
 
    boost::mutex syncSinksMutex_; // Protect all access to synchronousSinks_
    std::vector< boost::shared_ptr<SinkType> > synchronousSinks_;
+   // Lets SendEntry() skip syncSinksMutex_ when there are no synchronous
+   // sinks (the usual case)
+   boost::atomic<bool> haveSynchronousSinks_;
 
    boost::mutex asyncQueueMutex_; // Protect start/stop and sinks change
    internal::GenericPacketQueue<TMetadata> asyncQueue_;
@@ -75,8 +78,14 @@ private:
    // _and_ the queue receive loop stopped.
    std::vector< boost::shared_ptr<SinkType> > asynchronousSinks_;
 
+   // Updated whenever sinks or their filters change; read without locking
+   // by loggers
+   EnabledLevelThreshold enabledLevels_;
+
 public:
-   GenericLoggingCore() { StartAsyncReceiveLoop(); }
+   GenericLoggingCore() :
+      haveSynchronousSinks_(false)
+   { StartAsyncReceiveLoop(); }
    ~GenericLoggingCore() { StopAsyncReceiveLoop(); }
 
    /**
@@ -90,9 +99,35 @@ public:
       // guaranteed to be safe to call at any time.
       return internal::GenericLogger<EntryDataType>(
             boost::bind(&GenericLoggingCore::SendEntryToShared,
-               this->shared_from_this(), metadata, _1, _2));
+               this->shared_from_this(), metadata, _1, _2),
+            &enabledLevels_);
    }
 
+   /**
+    * Set the interval at which entries for asynchronous sinks are collected
+    * (while entries are being logged).
+    */
+   void SetAsyncFlushIntervalMs(unsigned ms)
+   { asyncQueue_.SetFlushIntervalMs(ms); }
+
+   /**
+    * Get the number of entries that were not delivered to asynchronous sinks
+    * because the queue was full.
+    */
+   unsigned long GetDroppedEntryCount() const
+   { return asyncQueue_.GetDroppedEntryCount(); }
+
+   /**
+    * Get the number of packets (lines) waiting for the asynchronous sinks,
+    * and the highest such number since the last reset.
+    */
+   std::size_t GetQueuedPacketCount() const
+   { return asyncQueue_.GetQueuedPacketCount(); }
+   std::size_t GetPeakQueuedPacketCount() const
+   { return asyncQueue_.GetPeakQueuedPacketCount(); }
+   void ResetPeakQueuedPacketCount()
+   { asyncQueue_.ResetPeakQueuedPacketCount(); }
+
    /**
     * Add a synchronous or asynchronous sink.
     */
@@ -104,6 +139,7 @@ public:
          {
             boost::lock_guard<boost::mutex> lock(syncSinksMutex_);
             synchronousSinks_.push_back(sink);
+            UpdateSyncMinLevel();
             break;
          }
          case SinkModeAsynchronous:
@@ -111,6 +147,7 @@ public:
             boost::lock_guard<boost::mutex> lock(asyncQueueMutex_);
             StopAsyncReceiveLoop();
             asynchronousSinks_.push_back(sink);
+            UpdateAsyncMinLevel();
             StartAsyncReceiveLoop();
             break;
          }
@@ -135,6 +172,7 @@ public:
                      sink);
             if (it != synchronousSinks_.end())
                synchronousSinks_.erase(it);
+            UpdateSyncMinLevel();
             break;
          }
          case SinkModeAsynchronous:
@@ -146,6 +184,7 @@ public:
                      sink);
             if (it != asynchronousSinks_.end())
                asynchronousSinks_.erase(it);
+            UpdateAsyncMinLevel();
             StartAsyncReceiveLoop();
             break;
          }
@@ -168,10 +207,11 @@ public:
          SinkModePairIterator firstToAdd,
          SinkModePairIterator lastToAdd)
    {
-      // Lock both sink lists in the designated order. Since locking
-      // syncSinksMutex_ causes logging to block, subsequently draining the
-      // async queue by stopping the receive loop causes all sinks to
-      // synchronize (emit up to the same log entry).
+      // Lock both sink lists in the designated order. Locking
+      // syncSinksMutex_ blocks logging to synchronous sinks, and stopping the
+      // receive loop drains the async queue, so all sinks synchronize (emit
+      // up to the same log entry, give or take entries being logged
+      // concurrently, which go to either the old or the new sinks).
       boost::lock_guard<boost::mutex> lockSyncs(syncSinksMutex_);
       boost::lock_guard<boost::mutex> lockAsyncQ(asyncQueueMutex_);
       StopAsyncReceiveLoop();
@@ -209,6 +249,8 @@ public:
          }
       }
 
+      UpdateSyncMinLevel();
+      UpdateAsyncMinLevel();
       StartAsyncReceiveLoop();
    }
 
@@ -253,10 +295,35 @@ public:
             (*foundIt)->SetFilter(filter);
       }
 
+      UpdateSyncMinLevel();
+      UpdateAsyncMinLevel();
       StartAsyncReceiveLoop();
    }
 
 private:
+   static int
+   MinimumLevel(const std::vector< boost::shared_ptr<SinkType> >& sinks)
+   {
+      int minLevel = INT_MAX;
+      for (typename std::vector< boost::shared_ptr<SinkType> >::const_iterator
+            it = sinks.begin(), end = sinks.end(); it != end; ++it)
+      {
+         minLevel = (std::min)(minLevel, (*it)->GetMinimumLevel());
+      }
+      return minLevel;
+   }
+
+   // Call with syncSinksMutex_ held
+   void UpdateSyncMinLevel()
+   {
+      enabledLevels_.SetSyncMinLevel(MinimumLevel(synchronousSinks_));
+      haveSynchronousSinks_.store(!synchronousSinks_.empty());
+   }
+
+   // Call with asyncQueueMutex_ held
+   void UpdateAsyncMinLevel()
+   { enabledLevels_.SetAsyncMinLevel(MinimumLevel(asynchronousSinks_)); }
+
    // Static wrapper allowing the use of a shared_ptr for the target instance
    static void
    SendEntryToShared(boost::shared_ptr<GenericLoggingCore> self,
@@ -273,6 +340,7 @@ private:
       PacketArrayType packets;
       packets.AppendEntry(loggerData, entryData, stampData, entryText);
 
+      if (haveSynchronousSinks_.load(boost::memory_order_relaxed))
       {
          boost::lock_guard<boost::mutex> lock(syncSinksMutex_);
 
@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <iterator>
 
 namespace mm
@@ -50,6 +51,7 @@ public:
    template <typename TPacketIter>
    void Append(TPacketIter first, TPacketIter last)
    { std::copy(first, last, std::back_inserter(packets_)); }
+   void Append(const LinePacketType& packet) { packets_.push_back(packet); }
    bool IsEmpty() const { return packets_.empty(); }
    void Clear() { packets_.clear(); }
    void Swap(GenericPacketArray& other) { packets_.swap(other.packets_); }
@@ -58,6 +60,19 @@ public:
    ConstIteratorType Begin() const { return packets_.begin(); }
    ConstIteratorType End() const { return packets_.end(); }
 
+   // Appends a single packet, with text no longer than PacketTextLen
+   void AppendPacket(PacketState packetState,
+         typename TMetadata::LoggerDataType loggerData,
+         typename TMetadata::EntryDataType entryData,
+         typename TMetadata::StampDataType stampData,
+         const char* text)
+   {
+      packets_.emplace_back(packetState, loggerData, entryData, stampData);
+      char* buffer = packets_.back().GetTextBuffer();
+      std::strncpy(buffer, text, LinePacketType::PacketTextLen);
+      buffer[LinePacketType::PacketTextLen] = '\0';
+   }
+
    void AppendEntry(typename TMetadata::LoggerDataType loggerData,
          typename TMetadata::EntryDataType entryData,
          typename TMetadata::StampDataType stampData,
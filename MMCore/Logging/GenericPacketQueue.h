@@ -16,10 +16,22 @@
 
 #pragma once
 
+#include "GenericLinePacket.h"
+#include "GenericPacketArray.h"
+
+#include <boost/atomic.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/function.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/utility.hpp>
+
+#include <cstddef>
+#include <iterator>
+#include <new>
 
 
 namespace mm
@@ -29,38 +41,162 @@ namespace logging
 namespace internal
 {
 
+/**
+ * The queue for asynchronous sinks.
+ *
+ * Packets are sent into a fixed-size ring, without locking, by any number of
+ * threads, and received in batches by a single thread that runs the sinks.
+ * The packets of an entry occupy consecutive slots, so that entries are never
+ * interleaved or split between batches.
+ *
+ * If the ring does not have room for an entry, the entry is dropped (and
+ * counted) rather than blocking the sending thread.
+ */
 template <typename TMetadata>
-class GenericPacketQueue
+class GenericPacketQueue : boost::noncopyable
 {
    typedef GenericPacketArray<TMetadata> PacketArrayType;
+   typedef GenericLinePacket<TMetadata> LinePacketType;
+
+public:
+   static const std::size_t DefaultCapacity = 8192; // Packets; power of 2
+   static const unsigned DefaultFlushIntervalMs = 10;
 
 private:
-   // The "queue" for asynchronous sinks.
+   // A slot of the ring. The sequence number tells the state of the slot
+   // for ring position pos (with pos % capacity_ being this slot):
+   // sequence == pos: free; sequence == pos + 1: holds a sent packet.
+   struct Slot
+   {
+      boost::atomic<std::size_t> sequence;
+      std::size_t entryPackets; // Set in the first slot of an entry
+      typename boost::aligned_storage<sizeof(LinePacketType),
+               boost::alignment_of<LinePacketType>::value>::type storage;
+
+      LinePacketType* Packet()
+      { return static_cast<LinePacketType*>(static_cast<void*>(&storage)); }
+   };
+
+   const std::size_t capacity_;
+   boost::scoped_array<Slot> slots_;
+   boost::atomic<std::size_t> sendPos_;
+   std::size_t receivePos_; // Accessed from receiving thread (or stopped)
+   boost::atomic<std::size_t> collectedPos_; // receivePos_ after Collect()
+   boost::atomic<std::size_t> peakQueuedPackets_;
+
+   boost::atomic<unsigned long> droppedEntries_;
+   boost::atomic<unsigned> flushIntervalMs_;
+
+   // mutex_ and condVar_ are only used to sleep and wake the receiving
+   // thread; senders touch them only when the receiver is idle.
    boost::mutex mutex_;
    boost::condition_variable condVar_;
-   PacketArrayType queue_;
+   boost::atomic<bool> receiverIdle_;
+   bool shutdownRequested_; // Protected by mutex_
 
-   // Swapped with queue_ and accessed from receiving thread.
+   // Accessed from receiving thread.
    PacketArrayType received_;
 
-   bool shutdownRequested_; // Protected by mutex_
-
    // threadMutex_ protects the start/stop of loopThread_; it must be acquired
    // before mutex_.
    boost::mutex threadMutex_;
    boost::thread loopThread_; // Protected by threadMutex_
 
 public:
-   GenericPacketQueue() :
+   explicit GenericPacketQueue(std::size_t capacity = DefaultCapacity) :
+      capacity_(RoundUpToPowerOf2(capacity)),
+      slots_(new Slot[capacity_]),
+      sendPos_(0),
+      receivePos_(0),
+      collectedPos_(0),
+      peakQueuedPackets_(0),
+      droppedEntries_(0),
+      flushIntervalMs_(DefaultFlushIntervalMs),
+      receiverIdle_(false),
       shutdownRequested_(false)
-   {}
+   {
+      for (std::size_t i = 0; i < capacity_; ++i)
+         slots_[i].sequence.store(i, boost::memory_order_relaxed);
+   }
+
+   ~GenericPacketQueue()
+   {
+      ShutdownReceiveLoop();
+
+      // Destroy any packets that were never received
+      for (std::size_t pos = receivePos_; ; ++pos)
+      {
+         Slot& slot = slots_[pos & (capacity_ - 1)];
+         if (slot.sequence.load(boost::memory_order_acquire) != pos + 1)
+            break;
+         slot.Packet()->~LinePacketType();
+      }
+   }
+
+   // Interval at which the receiving thread collects packets while entries
+   // are being sent; a longer interval means fewer, larger batches
+   void SetFlushIntervalMs(unsigned ms)
+   { flushIntervalMs_.store(ms, boost::memory_order_relaxed); }
+   unsigned GetFlushIntervalMs() const
+   { return flushIntervalMs_.load(boost::memory_order_relaxed); }
 
+   // Number of entries dropped because the ring was full
+   unsigned long GetDroppedEntryCount() const
+   { return droppedEntries_.load(boost::memory_order_relaxed); }
+
+   // Packets in the ring, not yet collected by the receiving thread
+   std::size_t GetQueuedPacketCount() const
+   {
+      const std::size_t collected =
+         collectedPos_.load(boost::memory_order_relaxed);
+      const std::size_t sent = sendPos_.load(boost::memory_order_relaxed);
+      const std::ptrdiff_t queued = static_cast<std::ptrdiff_t>(sent - collected);
+      return queued > 0 ? static_cast<std::size_t>(queued) : 0;
+   }
+
+   // Highest GetQueuedPacketCount() seen by senders since the last reset
+   std::size_t GetPeakQueuedPacketCount() const
+   { return peakQueuedPackets_.load(boost::memory_order_relaxed); }
+   void ResetPeakQueuedPacketCount()
+   {
+      peakQueuedPackets_.store(GetQueuedPacketCount(),
+            boost::memory_order_relaxed);
+   }
+
+   // The packets should make up whole entries. Never blocks, except briefly
+   // to wake the receiving thread when it is idle.
    template <typename TPacketIter>
    void SendPackets(TPacketIter first, TPacketIter last)
    {
-      boost::lock_guard<boost::mutex> lock(mutex_);
-      queue_.Append(first, last);
-      condVar_.notify_one();
+      const std::size_t count = std::distance(first, last);
+      if (count == 0)
+         return;
+
+      std::size_t pos;
+      if (!Reserve(count, pos))
+      {
+         droppedEntries_.fetch_add(1, boost::memory_order_relaxed);
+         return;
+      }
+      UpdatePeakQueuedPackets(pos + count -
+            collectedPos_.load(boost::memory_order_relaxed));
+
+      for (std::size_t i = 0; first != last; ++first, ++i)
+      {
+         Slot& slot = slots_[(pos + i) & (capacity_ - 1)];
+         new (&slot.storage) LinePacketType(*first);
+         slot.entryPackets = (i == 0 ? count : 0);
+         slot.sequence.store(pos + i + 1, boost::memory_order_release);
+      }
+
+      // Pairs with the fence in WaitForPackets(): either the receiver sees
+      // our packets, or we see that it is idle and wake it.
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      if (receiverIdle_.load(boost::memory_order_relaxed))
+      {
+         boost::lock_guard<boost::mutex> lock(mutex_);
+         condVar_.notify_one();
+      }
    }
 
    void RunReceiveLoop(boost::function<void (PacketArrayType&)>
@@ -103,77 +239,130 @@ public:
    }
 
 private:
-   void ReceiveLoop(boost::function<void (PacketArrayType&)> consume)
+   static std::size_t RoundUpToPowerOf2(std::size_t n)
+   {
+      std::size_t p = 1;
+      while (p < n)
+         p <<= 1;
+      return p;
+   }
+
+   // Claims count consecutive slots starting at pos; false if full.
+   bool Reserve(std::size_t count, std::size_t& pos)
    {
-      // The loop operates in one of two modes: timed wait and untimed wait.
-      //
-      // When in timed wait mode, the loop unconditionally waits for a fixed
-      // interval before checking for data. If data is available, it is
-      // processed and the loop repeats an unconditional wait. If no data is
-      // available, the loop switches to untimed wait mode.
-      //
-      // In untimed wait mode, the loop waits on a condition variable until
-      // notification from the frontend. Once data is available, the loop
-      // switches back to timed wait mode.
-      //
-      // This way, data is processed in batches when logging occurs at high
-      // frequency, preventing thrashing between the frontend and backend
-      // threads and limiting the frequency of stream flushing.
-
-      bool timedWaitMode = true;
-      bool shuttingDown = false;
+      if (count > capacity_)
+         return false;
 
+      pos = sendPos_.load(boost::memory_order_relaxed);
       for (;;)
       {
-         if (timedWaitMode)
+         // Slots are freed in order, so if the last one is free, so are the
+         // ones before it.
+         const std::size_t lastPos = pos + count - 1;
+         Slot& last = slots_[lastPos & (capacity_ - 1)];
+         const std::size_t seq = last.sequence.load(boost::memory_order_acquire);
+         const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - lastPos);
+         if (diff == 0)
          {
-            // TODO Make interval configurable
-            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
-
-            {
-               boost::lock_guard<boost::mutex> lock(mutex_);
-               if (shutdownRequested_)
-               {
-                  shutdownRequested_ = false; // Allow for restarting
-                  shuttingDown = true;
-               }
-               if (!shuttingDown && queue_.IsEmpty())
-               {
-                  timedWaitMode = false;
-                  continue;
-               }
-               queue_.Swap(received_);
-            }
-            consume(received_);
-            received_.Clear();
+            if (sendPos_.compare_exchange_weak(pos, pos + count,
+                     boost::memory_order_relaxed))
+               return true;
+            // pos has been updated to the current value
+         }
+         else if (diff < 0)
+         {
+            return false; // Full
+         }
+         else
+         {
+            pos = sendPos_.load(boost::memory_order_relaxed);
+         }
+      }
+   }
+
+   void UpdatePeakQueuedPackets(std::size_t queued)
+   {
+      std::size_t peak = peakQueuedPackets_.load(boost::memory_order_relaxed);
+      while (queued > peak && static_cast<std::ptrdiff_t>(queued) > 0 &&
+            !peakQueuedPackets_.compare_exchange_weak(peak, queued,
+               boost::memory_order_relaxed))
+         ;
+   }
 
-            if (shuttingDown)
-               return;
+   bool HasCompleteEntry()
+   {
+      Slot& first = slots_[receivePos_ & (capacity_ - 1)];
+      if (first.sequence.load(boost::memory_order_acquire) != receivePos_ + 1)
+         return false;
+      const std::size_t lastPos = receivePos_ + first.entryPackets - 1;
+      Slot& last = slots_[lastPos & (capacity_ - 1)];
+      return last.sequence.load(boost::memory_order_acquire) == lastPos + 1;
+   }
+
+   // Moves all complete entries from the ring to received_
+   void Collect()
+   {
+      while (HasCompleteEntry())
+      {
+         const std::size_t count =
+            slots_[receivePos_ & (capacity_ - 1)].entryPackets;
+         for (std::size_t i = 0; i < count; ++i)
+         {
+            Slot& slot = slots_[receivePos_ & (capacity_ - 1)];
+            received_.Append(*slot.Packet());
+            slot.Packet()->~LinePacketType();
+            slot.sequence.store(receivePos_ + capacity_,
+                  boost::memory_order_release);
+            ++receivePos_;
          }
-         else // untimed wait mode
+      }
+      collectedPos_.store(receivePos_, boost::memory_order_relaxed);
+   }
+
+   // Returns true if shutdown was requested
+   bool WaitForPackets()
+   {
+      boost::unique_lock<boost::mutex> lock(mutex_);
+
+      // Let packets accumulate for the flush interval, so that they are
+      // processed in batches when logging occurs at high frequency,
+      // preventing thrashing between the frontend and backend threads and
+      // limiting the frequency of stream flushing.
+      const boost::system_time deadline = boost::get_system_time() +
+         boost::posix_time::milliseconds(GetFlushIntervalMs());
+      while (!shutdownRequested_ && condVar_.timed_wait(lock, deadline))
+         ;
+
+      // If nothing was sent, sleep until a sender wakes us.
+      if (!shutdownRequested_)
+      {
+         receiverIdle_.store(true, boost::memory_order_relaxed);
+         boost::atomic_thread_fence(boost::memory_order_seq_cst);
+         while (!shutdownRequested_ && !HasCompleteEntry())
+            condVar_.wait(lock);
+         receiverIdle_.store(false, boost::memory_order_relaxed);
+      }
+
+      const bool shutdown = shutdownRequested_;
+      shutdownRequested_ = false; // Allow for restarting
+      return shutdown;
+   }
+
+   void ReceiveLoop(boost::function<void (PacketArrayType&)> consume)
+   {
+      for (;;)
+      {
+         const bool shuttingDown = WaitForPackets();
+
+         Collect();
+         if (!received_.IsEmpty())
          {
-            {
-               boost::unique_lock<boost::mutex> lock(mutex_);
-               while (queue_.IsEmpty())
-               {
-                  condVar_.wait(lock);
-                  if (shutdownRequested_)
-                  {
-                     shutdownRequested_ = false; // Allow for restarting
-                     shuttingDown = true;
-                     break;
-                  }
-               }
-               queue_.Swap(received_);
-            }
             consume(received_);
             received_.Clear();
-
-            if (shuttingDown)
-               return;
-
-            timedWaitMode = true;
          }
+
+         if (shuttingDown)
+            return;
       }
    }
 };
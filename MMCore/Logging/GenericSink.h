@@ -52,6 +52,9 @@ public:
    // logger. See the LoggingCore member function AtomicSetSinkFilters().
    void SetFilter(boost::shared_ptr< GenericEntryFilter<TMetadata> > filter)
    { filter_ = filter; }
+
+   int GetMinimumLevel() const
+   { return filter_ ? filter_->GetMinimumLevel() : INT_MIN; }
 };
 
 
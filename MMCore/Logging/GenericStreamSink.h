@@ -18,12 +18,19 @@
 
 #include "GenericSink.h"
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/utility.hpp>
 
+#include <cstdio>
 #include <exception>
 #include <iostream>
 #include <fstream>
+#include <string>
 
 
 namespace mm
@@ -121,6 +128,15 @@ public:
 };
 
 
+/**
+ * A sink writing text to a file, optionally rotating it.
+ *
+ * When rotation is enabled, the file is renamed (to filename.YYYYMMDDThhmmss)
+ * once it reaches the maximum size or age, and a new file is started under
+ * the original name. Rotation takes place at the start of Consume(), between
+ * entries, so no entry is split or lost. The rotated file name is passed to
+ * a callback (e.g. for compression), which should return quickly.
+ */
 template <class TMetadata, class UFormatter>
 class GenericFileLogSink : public GenericSink<TMetadata>, boost::noncopyable
 {
@@ -128,13 +144,25 @@ class GenericFileLogSink : public GenericSink<TMetadata>, boost::noncopyable
    std::ofstream fileStream_;
    bool hadError_;
 
+   // The rotation settings may be changed while the sink is in use.
+   boost::mutex rotationMutex_;
+   std::streamoff maxBytes_; // 0 for no limit
+   long maxAgeSeconds_; // 0 for no limit
+   boost::function<void (const std::string&)> onRotated_;
+   bool rotationFailed_;
+   boost::posix_time::ptime openTime_;
+
 public:
    typedef GenericSink<TMetadata> Super;
    typedef typename Super::PacketArrayType PacketArrayType;
 
    GenericFileLogSink(const std::string& filename, bool append = false) :
       filename_(filename),
-      hadError_(false)
+      hadError_(false),
+      maxBytes_(0),
+      maxAgeSeconds_(0),
+      rotationFailed_(false),
+      openTime_(boost::posix_time::second_clock::local_time())
    {
       std::ios_base::openmode mode = std::ios_base::out;
       mode |= (append ? std::ios_base::app : std::ios_base::trunc);
@@ -142,10 +170,24 @@ public:
       fileStream_.open(filename_.c_str(), mode);
       if (!fileStream_)
          throw CannotOpenFileException();
+      if (append)
+         fileStream_.seekp(0, std::ios_base::end);
+   }
+
+   // Enables rotation if either limit is nonzero
+   void SetRotation(std::streamoff maxBytes, long maxAgeSeconds,
+         boost::function<void (const std::string&)> onRotated)
+   {
+      boost::lock_guard<boost::mutex> lock(rotationMutex_);
+      maxBytes_ = maxBytes;
+      maxAgeSeconds_ = maxAgeSeconds;
+      onRotated_ = onRotated;
    }
 
    virtual void Consume(const PacketArrayType& packets)
    {
+      RotateIfNeeded();
+
       WritePacketsToStream<UFormatter>(fileStream_,
             packets.Begin(), packets.End(), this->GetFilter());
       try
@@ -162,6 +204,58 @@ public:
          }
       }
    }
+
+private:
+   void RotateIfNeeded()
+   {
+      boost::function<void (const std::string&)> onRotated;
+      std::string rotatedName;
+      {
+         boost::lock_guard<boost::mutex> lock(rotationMutex_);
+         if (rotationFailed_ || (maxBytes_ == 0 && maxAgeSeconds_ == 0))
+            return;
+
+         const boost::posix_time::ptime now =
+            boost::posix_time::second_clock::local_time();
+         const bool tooBig = maxBytes_ > 0 &&
+            static_cast<std::streamoff>(fileStream_.tellp()) >= maxBytes_;
+         const bool tooOld = maxAgeSeconds_ > 0 &&
+            (now - openTime_).total_seconds() >= maxAgeSeconds_;
+         if (!tooBig && !tooOld)
+            return;
+
+         rotatedName = RotatedFilename(now);
+         fileStream_.close();
+         const bool renamed =
+            (std::rename(filename_.c_str(), rotatedName.c_str()) == 0);
+         fileStream_.clear();
+         fileStream_.open(filename_.c_str(), std::ios_base::out |
+               (renamed ? std::ios_base::trunc : std::ios_base::app));
+         openTime_ = now;
+         if (!renamed)
+         {
+            // E.g. the file is open elsewhere (on Windows). Keep appending
+            // rather than retrying for every batch.
+            rotationFailed_ = true;
+            std::cerr << "Logging: cannot rename file " << filename_ <<
+               " for rotation; rotation disabled\n";
+            return;
+         }
+         onRotated = onRotated_;
+      }
+      if (onRotated)
+         onRotated(rotatedName);
+   }
+
+   std::string RotatedFilename(boost::posix_time::ptime time) const
+   {
+      const std::string base = filename_ + "." +
+         boost::posix_time::to_iso_string(time);
+      std::string name = base;
+      for (int i = 1; std::ifstream(name.c_str()).good(); ++i)
+         name = base + "-" + boost::lexical_cast<std::string>(i);
+      return name;
+   }
 };
 
 
@@ -48,8 +48,13 @@ typedef internal::GenericLogStream<Logger> LogStream;
 // In C++ pre-11, the above statement will fail for some data types of x (e.g.
 // const char*). So, to make the left hand side of << an lvalue, we need to use
 // a trick.
+//
+// The level is checked first, so that entries that no sink would accept cost
+// a branch rather than a formatted string. (The if-else form keeps a
+// following 'else' of the caller from binding to the macro's 'if'.)
 
 #define LOG_WITH_LEVEL(logger, level) \
+   if (!(logger).IsEnabled(level)) {} else \
    for (::mm::logging::LogStream strm((logger), (level)); \
          !strm.Used(); strm.MarkUsed()) \
       strm
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "BinaryLogSink.h"
 #include "GenericStreamSink.h"
 #include "GenericEntryFilter.h"
 #include "GenericLoggingCore.h"
@@ -52,6 +53,8 @@ public:
 
    virtual bool Filter(const Metadata& metadata) const
    { return metadata.GetEntryData().GetLevel() >= minLevel_; }
+
+   virtual int GetMinimumLevel() const { return minLevel_; }
 };
 
 
@@ -0,0 +1,62 @@
+// COPYRIGHT:     University of California, San Francisco, 2015,
+//                All Rights reserved
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/utility.hpp>
+
+#include <cstddef>
+#include <string>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+/**
+ * A file of fixed size, created (or truncated) and mapped into memory for
+ * writing.
+ *
+ * On destruction, the file is unmapped and truncated to the size given by
+ * SetUsedSize(). Throws CannotOpenFileException if the file cannot be
+ * created or mapped.
+ */
+class MappedLogFile : boost::noncopyable
+{
+public:
+   MappedLogFile(const std::string& filename, size_t size);
+   ~MappedLogFile();
+
+   unsigned char* GetData() const { return data_; }
+   size_t GetSize() const { return size_; }
+   void SetUsedSize(size_t size) { usedSize_ = size; }
+
+private:
+#ifdef _WIN32
+   void* file_; // HANDLE
+   void* mapping_; // HANDLE
+#else
+   int fd_;
+#endif
+   unsigned char* data_;
+   size_t size_;
+   size_t usedSize_;
+};
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
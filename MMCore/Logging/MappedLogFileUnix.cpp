@@ -0,0 +1,72 @@
+// COPYRIGHT:     University of California, San Francisco, 2015,
+//                All Rights reserved
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#ifndef _WIN32 // whole file
+
+#include "MappedLogFile.h"
+
+#include "GenericStreamSink.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+MappedLogFile::MappedLogFile(const std::string& filename, size_t size) :
+   fd_(-1),
+   data_(0),
+   size_(size),
+   usedSize_(0)
+{
+   fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd_ < 0)
+      throw CannotOpenFileException();
+   if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+   {
+      ::close(fd_);
+      throw CannotOpenFileException();
+   }
+   void* p = ::mmap(0, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+   if (p == MAP_FAILED)
+   {
+      ::close(fd_);
+      throw CannotOpenFileException();
+   }
+   data_ = static_cast<unsigned char*>(p);
+}
+
+MappedLogFile::~MappedLogFile()
+{
+   ::munmap(data_, size_);
+   if (::ftruncate(fd_, static_cast<off_t>(usedSize_)) != 0)
+   {
+      // Nothing we can do; the file keeps its zero-filled tail, which
+      // readers treat as the end of the data.
+   }
+   ::close(fd_);
+}
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
+
+#endif // !_WIN32
@@ -0,0 +1,83 @@
+// COPYRIGHT:     University of California, San Francisco, 2015,
+//                All Rights reserved
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#ifdef _WIN32 // whole file
+
+#include "MappedLogFile.h"
+
+#include "GenericStreamSink.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+
+namespace mm
+{
+namespace logging
+{
+namespace internal
+{
+
+MappedLogFile::MappedLogFile(const std::string& filename, size_t size) :
+   file_(INVALID_HANDLE_VALUE),
+   mapping_(0),
+   data_(0),
+   size_(size),
+   usedSize_(0)
+{
+   HANDLE file = ::CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE,
+         FILE_SHARE_READ, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+   if (file == INVALID_HANDLE_VALUE)
+      throw CannotOpenFileException();
+
+   ULARGE_INTEGER mapSize;
+   mapSize.QuadPart = size_;
+   HANDLE mapping = ::CreateFileMappingA(file, 0, PAGE_READWRITE,
+         mapSize.HighPart, mapSize.LowPart, 0);
+   if (!mapping)
+   {
+      ::CloseHandle(file);
+      throw CannotOpenFileException();
+   }
+
+   void* p = ::MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size_);
+   if (!p)
+   {
+      ::CloseHandle(mapping);
+      ::CloseHandle(file);
+      throw CannotOpenFileException();
+   }
+
+   file_ = file;
+   mapping_ = mapping;
+   data_ = static_cast<unsigned char*>(p);
+}
+
+MappedLogFile::~MappedLogFile()
+{
+   ::UnmapViewOfFile(data_);
+   ::CloseHandle(static_cast<HANDLE>(mapping_));
+
+   LARGE_INTEGER end;
+   end.QuadPart = static_cast<LONGLONG>(usedSize_);
+   if (::SetFilePointerEx(static_cast<HANDLE>(file_), end, 0, FILE_BEGIN))
+      ::SetEndOfFile(static_cast<HANDLE>(file_));
+   ::CloseHandle(static_cast<HANDLE>(file_));
+}
+
+} // namespace internal
+} // namespace logging
+} // namespace mm
+
+#endif // _WIN32
@@ -99,6 +99,13 @@ public:
       tid_ = internal::GetTid();
    }
 
+   // For reading back stored entries
+   void Set(internal::TimestampType time, internal::ThreadIdType tid)
+   {
+      time_ = time;
+      tid_ = tid;
+   }
+
    internal::TimestampType GetTimestamp() const { return time_; }
    internal::ThreadIdType GetThreadId() const { return tid_; }
 };
@@ -42,24 +42,34 @@
 #include "../MMDevice/DeviceUtils.h"
 #include "../MMDevice/ImageMetadata.h"
 #include "../MMDevice/ModuleInterface.h"
+#include "AsyncSnap.h"
 #include "CircularBuffer.h"
 #include "ConfigGroup.h"
 #include "Configuration.h"
 #include "CoreCallback.h"
 #include "CoreProperty.h"
 #include "CoreUtils.h"
+#include "DeviceInitializer.h"
 #include "DeviceManager.h"
 #include "Devices/DeviceInstances.h"
+#include "FrameSignal.h"
 #include "Host.h"
+#include "IdleSignal.h"
 #include "LogManager.h"
 #include "MMCore.h"
+#include "Metrics.h"
 #include "MMEventCallback.h"
 #include "PluginManager.h"
+#include "StateCache.h"
+#include "SystemStateReader.h"
 
+#include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <algorithm>
 #include <assert.h>
+#include <cmath>
 #include <fstream>
 #include <set>
 #include <sstream>
@@ -106,7 +116,7 @@ using namespace std;
  * (Keep the 3 numbers on one line to make it easier to look at diffs when
  * merging/rebasing.)
  */
-const int MMCore_versionMajor = 8, MMCore_versionMinor = 6, MMCore_versionPatch = 0;
+const int MMCore_versionMajor = 8, MMCore_versionMinor = 9, MMCore_versionPatch = 0;
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -126,14 +136,20 @@ CMMCore::CMMCore() :
    pollingIntervalMs_(10),
    timeoutMs_(5000),
    autoShutter_(true),
+   pipelinedSnap_(false),
+   snapShutterUsers_(0),
+   nextAsyncSnapHandle_(1),
    callback_(0),
    configGroups_(0),
    properties_(0),
    externalCallback_(0),
    pixelSizeGroup_(0),
-   cbuf_(0),
+   frameSignal_(new mm::FrameSignal()),
+   idleSignal_(new mm::IdleSignal()),
    pluginManager_(new CPluginManager()),
    deviceManager_(new mm::DeviceManager()),
+   deviceInitializer_(new mm::DeviceInitializer(coreLogger_)),
+   stateCache_(new mm::StateCache()),
    pPostedErrorsLock_(NULL)
 {
    configGroups_ = new ConfigGroupCollection();
@@ -145,7 +161,8 @@ CMMCore::CMMCore() :
    callback_ = new CoreCallback(this);
 
    const unsigned seqBufMegabytes = (sizeof(void*) > 4) ? 250 : 25;
-   cbuf_ = new CircularBuffer(seqBufMegabytes);
+   cbuf_.reset(new CircularBuffer(seqBufMegabytes));
+   cbuf_->SetFrameSignal(frameSignal_);
 
    CreateCoreProperties();
 }
@@ -170,7 +187,6 @@ CMMCore::~CMMCore()
    delete callback_;
    delete configGroups_;
    delete properties_;
-   delete cbuf_;
    delete pixelSizeGroup_;
    delete pPostedErrorsLock_;
 
@@ -279,6 +295,40 @@ int CMMCore::startSecondaryLogFile(const char* filename, bool enableDebug,
 }
 
 
+/**
+ * Start capturing logging output into a binary log file.
+ *
+ * Binary log files hold unformatted records, which are much cheaper to write
+ * than text, making it affordable to keep debug logging on. Use the
+ * mmlogdecode program to convert them to the usual text format.
+ *
+ * @param filename The filename to which the log will be captured
+ * @param enableDebug Whether to include debug logging
+ * @param maxFileSize The size, in bytes, at which the file is renamed to
+ * filename.1 and a new file is started (minimum 64 KiB)
+ * @param maxBackups The number of renamed files to keep (filename.1 being
+ * the most recent)
+ * @returns A handle required when calling stopSecondaryLogFile().
+ */
+int CMMCore::startBinaryLogFile(const char* filename, bool enableDebug,
+      long maxFileSize, int maxBackups) throw (CMMError)
+{
+   if (!filename)
+      throw CMMError("Filename is null");
+   if (maxFileSize <= 0 || maxBackups < 0)
+      throw CMMError("Invalid binary log file size or number of backups");
+
+   using namespace mm::logging;
+   typedef mm::LogManager::LogFileHandle LogFileHandle;
+
+   LogFileHandle handle = logManager_->AddBinaryLogFile(
+            (enableDebug ? LogLevelTrace : LogLevelInfo),
+            filename, static_cast<size_t>(maxFileSize),
+            static_cast<unsigned>(maxBackups));
+   return static_cast<int>(handle);
+}
+
+
 /**
  * Stop capturing logging output into an additional file.
  *
@@ -292,6 +342,93 @@ void CMMCore::stopSecondaryLogFile(int handle) throw (CMMError)
 }
 
 
+namespace
+{
+
+mm::LogRotationPolicy MakeLogRotationPolicy(long maxFileSize,
+      int maxAgeSeconds, int keepCount, bool compress) throw (CMMError)
+{
+   if (maxFileSize < 0 || maxAgeSeconds < 0 || keepCount < 0)
+      throw CMMError("Invalid log rotation size, age, or count");
+
+   mm::LogRotationPolicy policy;
+   policy.maxBytes = maxFileSize;
+   policy.maxAgeSeconds = maxAgeSeconds;
+   policy.keepCount = static_cast<unsigned>(keepCount);
+   policy.compress = compress;
+   return policy;
+}
+
+} // anonymous namespace
+
+
+/**
+ * Set when the primary log file is rotated.
+ *
+ * When the file reaches maxFileSize bytes or has been written to for
+ * maxAgeSeconds, it is renamed to filename.YYYYMMDDThhmmss and a new file is
+ * started. Rotated files are compressed (to .gz, if compression is available
+ * in this build) on a low-priority background thread, and the oldest ones
+ * rotated in this session are deleted beyond keepCount.
+ *
+ * The setting remains in effect when the primary log file is changed.
+ *
+ * @param maxFileSize The size limit in bytes, or 0 for no size limit
+ * @param maxAgeSeconds The age limit in seconds, or 0 for no age limit
+ * @param keepCount The number of rotated files to keep, or 0 to keep all
+ * @param compress Whether to compress rotated files
+ */
+void CMMCore::setPrimaryLogRotation(long maxFileSize, int maxAgeSeconds,
+      int keepCount, bool compress) throw (CMMError)
+{
+   logManager_->SetPrimaryLogRotation(MakeLogRotationPolicy(maxFileSize,
+            maxAgeSeconds, keepCount, compress));
+}
+
+
+/**
+ * Set when a secondary log file is rotated.
+ *
+ * See setPrimaryLogRotation() for the meaning of the parameters. Binary log
+ * files, which are rotated by size on their own, cannot be set.
+ *
+ * @param handle The secondary log handle returned by startSecondaryLogFile().
+ */
+void CMMCore::setSecondaryLogRotation(int handle, long maxFileSize,
+      int maxAgeSeconds, int keepCount, bool compress) throw (CMMError)
+{
+   typedef mm::LogManager::LogFileHandle LogFileHandle;
+   logManager_->SetSecondaryLogRotation(static_cast<LogFileHandle>(handle),
+         MakeLogRotationPolicy(maxFileSize, maxAgeSeconds, keepCount,
+            compress));
+}
+
+
+/**
+ * Set how often log entries are written to the log files while logging is
+ * going on.
+ *
+ * Entries are collected in batches over this interval; a longer interval
+ * reduces the cost of writing the files. The default is 10 ms.
+ */
+void CMMCore::setLogFlushInterval(int intervalMs) throw (CMMError)
+{
+   if (intervalMs < 0)
+      throw CMMError("Log flush interval must not be negative");
+   logManager_->SetAsyncFlushIntervalMs(static_cast<unsigned>(intervalMs));
+}
+
+
+/**
+ * Get the number of log entries that were dropped because entries were
+ * logged faster than the log files could be written.
+ */
+long CMMCore::getDroppedLogEntryCount()
+{
+   return static_cast<long>(logManager_->GetDroppedEntryCount());
+}
+
+
 /*!
  Displays current user name.
  */
@@ -456,6 +593,64 @@ Configuration CMMCore::getSystemState()
    return config;
 }
 
+/**
+ * Returns the entire system state, querying the devices of different
+ * adapter modules concurrently.
+ *
+ * Each device is given deviceTimeoutMs to report all of its properties. For
+ * a device that takes longer (and for the devices of the same module that
+ * would be queried after it), the values from the system state cache are
+ * returned instead, and these settings are marked with
+ * PropertySetting::isStale(). A hung device thus delays the call by at most
+ * deviceTimeoutMs, although its module remains busy until it returns.
+ *
+ * @param deviceTimeoutMs   the time budget for each device, in milliseconds
+ * @return  Configuration object containing a collection of device-property-value triplets
+ */
+Configuration CMMCore::getSystemState(double deviceTimeoutMs)
+{
+   vector<string> labels = deviceManager_->GetDeviceList();
+   std::vector< boost::shared_ptr<DeviceInstance> > devices;
+   for (vector<string>::const_iterator i = labels.begin(), end = labels.end(); i != end; ++i)
+      devices.push_back(deviceManager_->GetDevice(*i));
+
+   std::vector<mm::SystemStateReader::DeviceState> states =
+      mm::SystemStateReader::Read(devices, deviceTimeoutMs);
+
+   const mm::StateCache::Snapshot cache = stateCache_->GetSnapshot();
+   Configuration config;
+   for (size_t i = 0; i < states.size(); ++i)
+   {
+      for (size_t j = 0; j < states[i].settings.size(); ++j)
+         config.addSetting(states[i].settings[j]);
+      if (states[i].complete)
+         continue;
+
+      LOG_WARNING(coreLogger_) << "Device " << labels[i] <<
+         " did not report its properties within " << deviceTimeoutMs <<
+         " ms; using cached values";
+      Configuration cached;
+      cache.GetDeviceSettings(labels[i], cached);
+      for (size_t j = 0; j < cached.size(); ++j)
+      {
+         PropertySetting setting = cached.getSetting(j);
+         setting.setStale(true);
+         config.addSetting(setting);
+      }
+   }
+
+   // add core properties
+   vector<string> coreProps = properties_->GetNames();
+   for (unsigned i=0; i < coreProps.size(); i++)
+   {
+      string name = coreProps[i];
+      string val = properties_->Get(name.c_str());
+      config.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, name.c_str(), val.c_str(), properties_->IsReadOnly(name.c_str())));
+   }
+
+   return config;
+}
+
 /**
  * Returns the entire system state, i.e. the collection of all property values from all devices.
  * This method will return cached values instead of querying each device
@@ -463,8 +658,43 @@ Configuration CMMCore::getSystemState()
  */
 Configuration CMMCore::getSystemStateCache() const
 {
-   MMThreadGuard scg(stateCacheLock_);
-   return stateCache_;
+   return stateCache_->GetSnapshot().GetConfiguration();
+}
+
+/**
+ * Returns the current version of the system state cache.
+ *
+ * The version increases whenever a value in the cache changes. Pass it to
+ * getSystemStateCacheChangesSince() later to obtain only the values that
+ * have changed in the meantime.
+ */
+unsigned long CMMCore::getSystemStateCacheVersion() const
+{
+   return stateCache_->GetVersion();
+}
+
+/**
+ * Returns the settings in the system state cache that changed after the
+ * given version.
+ *
+ * Applying the result to the state at that version yields the current state.
+ * Because the version is read separately, the result may also include
+ * changes made after a preceding call to getSystemStateCacheVersion(); these
+ * are harmless to apply twice. A version of 0 returns the whole cache.
+ *
+ * Throws MMERR_StateCacheChangesUnavailable if properties were removed from
+ * the cache since the given version (e.g. by updateSystemStateCache() after
+ * a device was unloaded); call getSystemStateCache() instead.
+ *
+ * @param version   a version returned by getSystemStateCacheVersion(), or 0
+ */
+Configuration CMMCore::getSystemStateCacheChangesSince(unsigned long version) const throw (CMMError)
+{
+   Configuration changes;
+   if (!stateCache_->GetSnapshot().GetChangesSince(version, changes))
+      throw CMMError(getCoreErrorText(MMERR_StateCacheChangesUnavailable),
+            MMERR_StateCacheChangesUnavailable);
+   return changes;
 }
 
 /**
@@ -803,6 +1033,12 @@ void CMMCore::unloadAllDevices() throw (CMMError)
       LOG_DEBUG(coreLogger_) << "Will unload all devices";
       deviceManager_->UnloadAllDevices();
       LOG_INFO(coreLogger_) << "Did unload all devices";
+
+      // The order learned by applyConfiguration() was for these devices
+      {
+         MMThreadGuard g(deferredSettingsLock_);
+         deferredSettings_.clear();
+      }
    
 	   properties_->Refresh();
 
@@ -840,6 +1076,9 @@ void CMMCore::reset() throw (CMMError)
    }
    catch (CMMError& ) {}
 
+   // asynchronous snaps must finish before their cameras go away
+   releaseAllAsyncSnaps();
+
    // unload devices
    unloadAllDevices();
 
@@ -859,30 +1098,46 @@ void CMMCore::reset() throw (CMMError)
  * Calls Initialize() method for each loaded device.
  * This method also initialized allowed values for core properties, based
  * on the collection of loaded devices.
+ *
+ * Devices from different adapter modules are initialized concurrently; the
+ * devices of each module are initialized in load order, with hubs first.
+ * Serial ports are initialized before all other devices. If any devices
+ * fail, the others are still initialized (except for the remaining devices
+ * of a failed device's module) and the errors are thrown together.
  */
 void CMMCore::initializeAllDevices() throw (CMMError)
 {
    vector<string> devices = deviceManager_->GetDeviceList();
    LOG_INFO(coreLogger_) << "Will initialize " << devices.size() << " devices";
 
+   std::vector< boost::shared_ptr<DeviceInstance> > pDevices;
    for (size_t i=0; i<devices.size(); i++)
    {
-      boost::shared_ptr<DeviceInstance> pDevice;
       try {
-         pDevice = deviceManager_->GetDevice(devices[i]);
+         pDevices.push_back(deviceManager_->GetDevice(devices[i]));
       }
       catch (CMMError& err) {
          logError(devices[i].c_str(), err.getMsg().c_str());
          throw;
       }
-      mm::DeviceModuleLockGuard guard(pDevice);
-      LOG_INFO(coreLogger_) << "Will initialize device " << devices[i];
-      pDevice->Initialize();
-      LOG_INFO(coreLogger_) << "Did initialize device " << devices[i];
+   }
 
-      assignDefaultRole(pDevice);
+   // Roles are assigned in load order, so that the last loaded device of
+   // each type is the default, as when devices were initialized one by one
+   std::vector< boost::shared_ptr<DeviceInstance> > initialized;
+   try {
+      deviceInitializer_->InitializeAll(pDevices, initialized);
+   }
+   catch (CMMError& err) {
+      logError("MMCore::initializeAllDevices", err.getMsg().c_str());
+      for (size_t i=0; i<initialized.size(); i++)
+         assignDefaultRole(initialized[i]);
+      throw;
    }
 
+   for (size_t i=0; i<initialized.size(); i++)
+      assignDefaultRole(initialized[i]);
+
    LOG_INFO(coreLogger_) << "Finished initializing " << devices.size() << " devices";
 
    updateCoreProperties();
@@ -925,13 +1180,28 @@ void CMMCore::initializeDevice(const char* label ///< the device to initialize
 
    mm::DeviceModuleLockGuard guard(pDevice);
 
-   LOG_INFO(coreLogger_) << "Will initialize device " << label;
-   pDevice->Initialize();
-   LOG_INFO(coreLogger_) << "Did initialize device " << label;
+   deviceInitializer_->Initialize(pDevice);
    
    updateCoreProperties();
 }
 
+/**
+ * Returns the time taken by the last Initialize() call of a device, which
+ * is also logged. Useful to find devices that slow down startup.
+ *
+ * @param label   the device label
+ * @return the time in milliseconds
+ */
+double CMMCore::getDeviceInitializationTime(const char* label) throw (CMMError)
+{
+   CheckDeviceLabel(label);
+   double ms;
+   if (!deviceInitializer_->GetInitializationTimeMs(label, ms))
+      throw CMMError("Device " + ToQuotedString(label) +
+            " has not been initialized");
+   return ms;
+}
+
 
 
 /**
@@ -941,9 +1211,11 @@ void CMMCore::updateSystemStateCache()
 {
    LOG_DEBUG(coreLogger_) << "Will update system state cache";
    Configuration wk = getSystemState();
+   stateCache_->Replace(wk);
    {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_ = wk;
+      MMThreadGuard scg(presetMatchLock_);
+      configGroups_->InvalidateCachedMatches();
+      pixelSizeGroup_->InvalidateCachedMatch();
    }
    LOG_INFO(coreLogger_) << "Did update system state cache";
 }
@@ -1176,16 +1448,57 @@ void CMMCore::waitForDevice(const char* label) throw (CMMError)
  */
 void CMMCore::waitForDevice(boost::shared_ptr<DeviceInstance> pDev) throw (CMMError)
 {
-   LOG_DEBUG(coreLogger_) << "Waiting for device " << pDev->GetLabel() << "...";
+   waitForDevices(std::vector< boost::shared_ptr<DeviceInstance> >(1, pDev));
+}
+
+/**
+ * Waits until all of the devices become non-busy, so that the wait takes as
+ * long as the slowest device rather than the sum of all of them. The timeout
+ * applies to the wait as a whole.
+ *
+ * The devices are polled with an interval that starts short and grows to
+ * pollingIntervalMs_; a device calling OnDeviceIdle() causes an immediate
+ * poll. The module lock is only held while polling, not while waiting.
+ */
+void CMMCore::waitForDevices(std::vector< boost::shared_ptr<DeviceInstance> > devices) throw (CMMError)
+{
+   std::sort(devices.begin(), devices.end());
+   devices.erase(std::unique(devices.begin(), devices.end()), devices.end());
+   if (devices.empty())
+      return;
+
+   if (devices.size() == 1)
+      LOG_DEBUG(coreLogger_) << "Waiting for device " << devices[0]->GetLabel() << "...";
+   else
+      LOG_DEBUG(coreLogger_) << "Waiting for " << devices.size() << " devices...";
 
+   const long long startUs = mm::MonotonicMicroseconds();
    MM::TimeoutMs timeout(GetMMTimeNow(),timeoutMs_);
-   mm::DeviceModuleLockGuard guard(pDev);
-   
-   while (pDev->Busy())
+   const double maxIntervalMs = std::max(1.0, static_cast<double>(pollingIntervalMs_));
+   double intervalMs = std::min(1.0, maxIntervalMs);
+   for (;;)
    {
+      // Read the generation before polling, so that a notification that
+      // arrives after the poll is not missed
+      const unsigned long generation = idleSignal_->GetGeneration();
+
+      std::vector< boost::shared_ptr<DeviceInstance> > busy;
+      for (size_t i = 0; i < devices.size(); ++i)
+      {
+         mm::DeviceModuleLockGuard guard(devices[i]);
+         if (devices[i]->Busy())
+            busy.push_back(devices[i]);
+         else
+            devices[i]->GetMetrics().waitLatency.Record(
+                  mm::MonotonicMicroseconds() - startUs);
+      }
+      devices.swap(busy);
+      if (devices.empty())
+         break;
+
       if (timeout.expired(GetMMTimeNow()))
       {
-         string label = pDev->GetLabel();
+         string label = devices[0]->GetLabel();
          std::ostringstream mez;
          mez << "wait timed out after " << timeoutMs_ << " ms. ";
          logError(label.c_str(), mez.str().c_str());
@@ -1194,9 +1507,10 @@ void CMMCore::waitForDevice(boost::shared_ptr<DeviceInstance> pDev) throw (CMMEr
                MMERR_DevicePollingTimeout);
       }
 
-     sleep(pollingIntervalMs_);
+      if (!idleSignal_->WaitForChange(generation, intervalMs))
+         intervalMs = std::min(2.0 * intervalMs, maxIntervalMs);
    }
-   LOG_DEBUG(coreLogger_) << "Finished waiting for device " << pDev->GetLabel();
+   LOG_DEBUG(coreLogger_) << "Finished waiting";
 }
 /**
  * Checks the busy status of the entire system. The system will report busy if any
@@ -1252,9 +1566,11 @@ bool CMMCore::deviceTypeBusy(MM::DeviceType devType) throw (CMMError)
  */
 void CMMCore::waitForDeviceType(MM::DeviceType devType) throw (CMMError)
 {
-   vector<string> devices = deviceManager_->GetDeviceList(devType);
-   for (size_t i=0; i<devices.size(); i++)
-      waitForDevice(devices[i].c_str());
+   vector<string> labels = deviceManager_->GetDeviceList(devType);
+   std::vector< boost::shared_ptr<DeviceInstance> > devices;
+   for (size_t i=0; i<labels.size(); i++)
+      devices.push_back(deviceManager_->GetDevice(labels[i]));
+   waitForDevices(devices);
 }
 
 /**
@@ -1269,8 +1585,14 @@ void CMMCore::waitForConfig(const char* group, const char* configName) throw (CM
 
    Configuration cfg = getConfigData(group, configName);
    try {
+      std::vector< boost::shared_ptr<DeviceInstance> > devices;
       for(size_t i=0; i<cfg.size(); i++)
-         waitForDevice(cfg.getSetting(i).getDeviceLabel().c_str());
+      {
+         const std::string label = cfg.getSetting(i).getDeviceLabel();
+         if (!IsCoreDeviceLabel(label.c_str()))
+            devices.push_back(deviceManager_->GetDevice(label));
+      }
+      waitForDevices(devices);
    } catch (CMMError& err) {
       // trap MM exceptions and keep quiet - this is not a good time to blow up
       logError("waitForConfig", err.getMsg().c_str());
@@ -1282,6 +1604,15 @@ void CMMCore::waitForConfig(const char* group, const char* configName) throw (CM
  */
 void CMMCore::waitForImageSynchro() throw (CMMError)
 {
+   std::vector< boost::shared_ptr<DeviceInstance> > devices;
+   {
+      // Shutter left closing by a pipelined snap
+      MMThreadGuard g(snapStateLock_);
+      boost::shared_ptr<DeviceInstance> shutter = closingShutter_.lock();
+      if (shutter)
+         devices.push_back(shutter);
+      closingShutter_.reset();
+   }
    for (std::vector< boost::weak_ptr<DeviceInstance> >::iterator
          it = imageSynchroDevices_.begin(), end = imageSynchroDevices_.end();
          it != end; ++it)
@@ -1289,9 +1620,10 @@ void CMMCore::waitForImageSynchro() throw (CMMError)
       boost::shared_ptr<DeviceInstance> device = it->lock();
       if (device)
       {
-         waitForDevice(device);
+         devices.push_back(device);
       }
    }
+   waitForDevices(devices);
 }
 
 /**
@@ -2274,11 +2606,33 @@ void CMMCore::loadXYStageSequence(const char* label,
 /**
  * Acquires a single image with current settings.
  * Snap is not allowed while the acquisition thread is run
+ *
+ * In pipelined mode (see setPipelinedSnap()), the auto-shutter is told to
+ * close but not waited for; the wait happens in the next
+ * waitForImageSynchro() (including the one at the start of the next snap).
  */
 void CMMCore::snapImage() throw (CMMError)
 {
    boost::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
    if (camera)
+   {
+      snapImage(camera);
+   }
+   else
+   {
+      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
+   }
+}
+
+/*
+ * The camera's module is only locked for the exposure (and, if frame is
+ * given, for copying the image into it), not while waiting for the shutter:
+ * concurrent snaps (see snapImageAsync()) share the auto-shutter, and may
+ * have to wait for one another to open it.
+ */
+void CMMCore::snapImage(boost::shared_ptr<CameraInstance> camera,
+      boost::shared_ptr<mm::FrameBuffer>* frame) throw (CMMError)
+{
    {
       if(camera->IsCapturing())
       {
@@ -2287,56 +2641,88 @@ void CMMCore::snapImage() throw (CMMError)
             ,MMERR_NotAllowedDuringSequenceAcquisition);
       }
 
-      mm::DeviceModuleLockGuard guard(camera);
-
       int ret = DEVICE_OK;
+      const double startMs = GetMMTimeNow().getMsec();
+      double phaseStartMs = startMs;
+      std::map<std::string, double> timings;
+      boost::shared_ptr<ShutterInstance> heldShutter;
       try {
 
          // wait for all synchronized devices to stop before taking an image
          waitForImageSynchro();
+         timings["ImageSynchro"] = GetMMTimeNow().getMsec() - phaseStartMs;
+         phaseStartMs = GetMMTimeNow().getMsec();
 
          // open the shutter
          boost::shared_ptr<ShutterInstance> shutter =
             currentShutterDevice_.lock();
-         if (autoShutter_ && shutter)
+         const bool useShutter = autoShutter_ && shutter;
+         if (useShutter)
          {
-            int sret = shutter->SetOpen(true);
-            if (DEVICE_OK != sret)
-            {
-               logError("CMMCore::snapImage", getDeviceErrorText(sret, shutter).c_str());
-               throw CMMError(getDeviceErrorText(sret, shutter).c_str(), MMERR_DEVICE_GENERIC);
-            }               
+            acquireSnapShutter(shutter);
+            heldShutter = shutter;
             waitForDevice(shutter);
          }
+         timings["ShutterOpen"] = GetMMTimeNow().getMsec() - phaseStartMs;
+         phaseStartMs = GetMMTimeNow().getMsec();
 
-         LOG_DEBUG(coreLogger_) << "Will snap image from current camera";
-         ret = camera->SnapImage();
-         if (ret == DEVICE_OK)
          {
-            LOG_DEBUG(coreLogger_) << "Did snap image from current camera";
+            mm::DeviceModuleLockGuard guard(camera);
+            LOG_DEBUG(coreLogger_) << "Will snap image from current camera";
+            ret = camera->SnapImage();
+            timings["Exposure"] = GetMMTimeNow().getMsec() - phaseStartMs;
+            phaseStartMs = GetMMTimeNow().getMsec();
+            if (ret == DEVICE_OK)
+            {
+               LOG_DEBUG(coreLogger_) << "Did snap image from current camera";
+               if (frame)
+                  *frame = copySnappedFrame(camera);
+            }
+            else
+            {
+               LOG_ERROR(coreLogger_) << "Failed to snap image from current camera";
+            }
          }
-         else
+
          {
-            LOG_ERROR(coreLogger_) << "Failed to snap image from current camera";
+            MMThreadGuard g(snapStateLock_);
+            everSnapped_ = true;
          }
 
-			everSnapped_ = true;
-
          // close the shutter
-         if (autoShutter_ && shutter)
+         if (useShutter)
          {
-            int sret  = shutter->SetOpen(false);
-            if (DEVICE_OK != sret)
+            heldShutter.reset();
+            if (releaseSnapShutter(shutter))
             {
-               logError("CMMCore::snapImage", getDeviceErrorText(sret, shutter).c_str());
-               throw CMMError(getDeviceErrorText(sret, shutter).c_str(), MMERR_DEVICE_GENERIC);
+               if (pipelinedSnap_)
+               {
+                  MMThreadGuard g(snapStateLock_);
+                  closingShutter_ = shutter;
+               }
+               else
+               {
+                  waitForDevice(shutter);
+               }
             }
-            waitForDevice(shutter);
+         }
+         timings["ShutterClose"] = GetMMTimeNow().getMsec() - phaseStartMs;
+         timings["Total"] = GetMMTimeNow().getMsec() - startMs;
+         LOG_DEBUG(coreLogger_) << "Snap phases (ms): image synchro " <<
+            timings["ImageSynchro"] << ", shutter open " <<
+            timings["ShutterOpen"] << ", exposure " <<
+            timings["Exposure"] << ", shutter close " <<
+            timings["ShutterClose"];
+         {
+            MMThreadGuard g(snapStateLock_);
+            lastSnapTimingsMs_.swap(timings);
          }
 		}catch( CMMError& e){
+         releaseSnapShutterUse(heldShutter);
 			throw e;
 		}
 		catch (...) {
+         releaseSnapShutterUse(heldShutter);
          logError("CMMCore::snapImage", getCoreErrorText(MMERR_UnhandledException).c_str());
          throw CMMError(getCoreErrorText(MMERR_UnhandledException).c_str(), MMERR_UnhandledException);
       }
@@ -2347,85 +2733,317 @@ void CMMCore::snapImage() throw (CMMError)
          throw CMMError(getDeviceErrorText(ret, camera).c_str(), MMERR_DEVICE_GENERIC);
       }
    }
-   else
+}
+
+// Registers a snap as a user of the auto-shutter, opening the shutter if
+// there was no other user. The count and the SetOpen() call are changed
+// under one lock, so that a concurrent snap cannot see the shutter as in use
+// before it has been told to open (it then waits for it with waitForDevice()).
+// If opening fails, the snap is not counted.
+void CMMCore::acquireSnapShutter(boost::shared_ptr<ShutterInstance> shutter) throw (CMMError)
+{
+   MMThreadGuard g(snapShutterLock_);
+   if (snapShutterUsers_ == 0)
    {
-      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
+      int ret;
+      {
+         mm::DeviceModuleLockGuard guard(shutter);
+         ret = shutter->SetOpen(true);
+      }
+      if (ret != DEVICE_OK)
+      {
+         logError("CMMCore::snapImage", getDeviceErrorText(ret, shutter).c_str());
+         throw CMMError(getDeviceErrorText(ret, shutter).c_str(), MMERR_DEVICE_GENERIC);
+      }
    }
+   ++snapShutterUsers_;
 }
 
+// Unregisters a snap as a user of the auto-shutter, closing the shutter if
+// it was the last user. Returns true if the shutter was closed.
+bool CMMCore::releaseSnapShutter(boost::shared_ptr<ShutterInstance> shutter) throw (CMMError)
+{
+   MMThreadGuard g(snapShutterLock_);
+   if (--snapShutterUsers_ > 0)
+      return false;
+   int ret;
+   {
+      mm::DeviceModuleLockGuard guard(shutter);
+      ret = shutter->SetOpen(false);
+   }
+   if (ret != DEVICE_OK)
+   {
+      logError("CMMCore::snapImage", getDeviceErrorText(ret, shutter).c_str());
+      throw CMMError(getDeviceErrorText(ret, shutter).c_str(), MMERR_DEVICE_GENERIC);
+   }
+   return true;
+}
 
-// Predicate used by assignImageSynchro() and removeImageSynchro()
-namespace
+// Drops a shutter use that a failed snap did not get to release (if
+// heldShutter is not null), closing the shutter if no other snap is using it
+void CMMCore::releaseSnapShutterUse(boost::shared_ptr<ShutterInstance> heldShutter)
 {
-   class DeviceWeakPtrInvalidOrMatches
+   if (!heldShutter)
+      return;
+   try
    {
-      boost::shared_ptr<DeviceInstance> theDevice_;
-   public:
-      explicit DeviceWeakPtrInvalidOrMatches(
-            boost::shared_ptr<DeviceInstance> theDevice) :
-         theDevice_(theDevice)
-      {}
+      releaseSnapShutter(heldShutter);
+   }
+   catch (const CMMError&)
+   {
+      // Already logged; the snap's own error is the one to report
+   }
+}
 
-      bool operator()(const boost::weak_ptr<DeviceInstance>& ptr)
-      {
-         boost::shared_ptr<DeviceInstance> aDevice = ptr.lock();
-         return (!aDevice || aDevice == theDevice_);
-      }
-   };
-} // anonymous namespace
+/**
+ * Starts acquiring a single image with the current camera, and returns
+ * without waiting for the exposure.
+ *
+ * The snap runs on a separate thread, in the same way as snapImage()
+ * (including the auto-shutter), and its image is copied out of the camera
+ * so that it is not overwritten by later snaps. Snaps of cameras in
+ * different device adapters can run at the same time; snaps of cameras in
+ * the same adapter take turns.
+ *
+ * @return a handle for waitForSnap(), getSnapImage(), and releaseSnap()
+ */
+long CMMCore::snapImageAsync() throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
+   if (!camera)
+      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
+   return snapImageAsync(camera->GetLabel().c_str());
+}
 
 /**
- * Add device to the image-synchro list. Image acquisition waits for all devices
- * in this list.
- * @param label   the device label
+ * Starts acquiring a single image with the given camera. See
+ * snapImageAsync().
+ *
+ * @param cameraLabel  the camera to snap with
  */
-void CMMCore::assignImageSynchro(const char* label) throw (CMMError)
+long CMMCore::snapImageAsync(const char* cameraLabel) throw (CMMError)
 {
-   boost::shared_ptr<DeviceInstance> device = deviceManager_->GetDevice(label);
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
 
-   imageSynchroDevices_.erase(std::remove_if(imageSynchroDevices_.begin(),
-            imageSynchroDevices_.end(), DeviceWeakPtrInvalidOrMatches(device)),
-         imageSynchroDevices_.end());
+   boost::shared_ptr<mm::AsyncSnap> snap(new mm::AsyncSnap(
+            boost::bind(&CMMCore::snapFrame, this, camera)));
 
-   imageSynchroDevices_.push_back(device);
-   LOG_DEBUG(coreLogger_) << "Added " << label << " to image-synchro list";
+   MMThreadGuard g(asyncSnapLock_);
+   long handle = nextAsyncSnapHandle_++;
+   asyncSnaps_[handle] = snap;
+   LOG_DEBUG(coreLogger_) << "Started asynchronous snap " << handle <<
+      " from camera " << cameraLabel;
+   return handle;
 }
 
 /**
- * Removes device from the image-synchro list.
- * @param label   the device label
+ * Returns true if the snap has finished (successfully or not).
  */
-void CMMCore::removeImageSynchro(const char* label) throw (CMMError)
+bool CMMCore::isSnapComplete(long handle) throw (CMMError)
 {
-   boost::shared_ptr<DeviceInstance> device = deviceManager_->GetDevice(label);
-   imageSynchroDevices_.erase(std::remove_if(imageSynchroDevices_.begin(),
-            imageSynchroDevices_.end(), DeviceWeakPtrInvalidOrMatches(device)),
-         imageSynchroDevices_.end());
-   LOG_DEBUG(coreLogger_) << "Removed " << label << " from image-synchro list";
+   return getAsyncSnap(handle)->IsDone();
 }
 
 /**
- * Clears the image synchro device list.
+ * Blocks until the snap has finished. Throws the error of the snap, if it
+ * failed.
  */
-void CMMCore::removeImageSynchroAll()
+void CMMCore::waitForSnap(long handle) throw (CMMError)
 {
-   imageSynchroDevices_.clear();
-   LOG_DEBUG(coreLogger_) << "Cleared image-synchro list";
+   getAsyncSnap(handle)->Wait();
 }
 
 /**
- * If this option is enabled Shutter automatically opens and closes when the image
- * is acquired.
- * @param state      true for enabled
+ * Returns the image of a channel acquired by the snap, waiting for the snap
+ * to finish if necessary.
+ *
+ * The image remains valid after releaseSnap().
+ *
+ * @param handle   the handle returned by snapImageAsync()
+ * @param channel  the camera channel
+ */
+FrameHandle CMMCore::getSnapImage(long handle, unsigned channel) throw (CMMError)
+{
+   FrameHandle image(getAsyncSnap(handle)->Wait(), channel);
+   if (!image.isValid())
+      throw CMMError(getCoreErrorText(MMERR_CameraBufferReadFailed).c_str(), MMERR_CameraBufferReadFailed);
+   return image;
+}
+
+/**
+ * Forgets the snap, waiting for it to finish if necessary. Images already
+ * obtained with getSnapImage() remain valid.
+ */
+void CMMCore::releaseSnap(long handle) throw (CMMError)
+{
+   boost::shared_ptr<mm::AsyncSnap> snap;
+   {
+      MMThreadGuard g(asyncSnapLock_);
+      std::map< long, boost::shared_ptr<mm::AsyncSnap> >::iterator it =
+         asyncSnaps_.find(handle);
+      if (it == asyncSnaps_.end())
+         throw CMMError(getCoreErrorText(MMERR_InvalidSnapHandle).c_str(), MMERR_InvalidSnapHandle);
+      snap = it->second;
+      asyncSnaps_.erase(it);
+   }
+   // Joined here (outside of the lock) if this is the last reference
+   snap.reset();
+}
+
+boost::shared_ptr<mm::AsyncSnap> CMMCore::getAsyncSnap(long handle) throw (CMMError)
+{
+   MMThreadGuard g(asyncSnapLock_);
+   std::map< long, boost::shared_ptr<mm::AsyncSnap> >::const_iterator it =
+      asyncSnaps_.find(handle);
+   if (it == asyncSnaps_.end())
+      throw CMMError(getCoreErrorText(MMERR_InvalidSnapHandle).c_str(), MMERR_InvalidSnapHandle);
+   return it->second;
+}
+
+void CMMCore::releaseAllAsyncSnaps()
+{
+   std::map< long, boost::shared_ptr<mm::AsyncSnap> > snaps;
+   {
+      MMThreadGuard g(asyncSnapLock_);
+      snaps.swap(asyncSnaps_);
+   }
+   // Each snap is joined as it is destroyed
+   snaps.clear();
+}
+
+// Runs on the thread of an AsyncSnap
+boost::shared_ptr<mm::FrameBuffer>
+CMMCore::snapFrame(boost::shared_ptr<CameraInstance> camera) throw (CMMError)
+{
+   // The image is copied while the camera's module is still locked after the
+   // exposure, so that another snap cannot replace it in between
+   boost::shared_ptr<mm::FrameBuffer> frame;
+   snapImage(camera, &frame);
+   return frame;
+}
+
+// Copies the images of the last snap; requires the camera's module lock
+boost::shared_ptr<mm::FrameBuffer>
+CMMCore::copySnappedFrame(boost::shared_ptr<CameraInstance> camera) throw (CMMError)
+{
+   const unsigned width = camera->GetImageWidth();
+   const unsigned height = camera->GetImageHeight();
+   const unsigned depth = camera->GetImageBytesPerPixel();
+   const unsigned nComponents = camera->GetNumberOfComponents();
+   const unsigned nChannels = camera->GetNumberOfChannels();
+
+   FrameMetadata md;
+   md.PutString(FrameMetadata::KeyCamera, camera->GetLabel().c_str());
+   md.PutDouble(FrameMetadata::KeyElapsedTimeMs, GetMMTimeNow().getMsec());
+   md.PutInteger(FrameMetadata::KeyWidth, width);
+   md.PutInteger(FrameMetadata::KeyHeight, height);
+   const char* pixelType = "Unknown";
+   if (depth == 1)
+      pixelType = "GRAY8";
+   else if (depth == 2)
+      pixelType = "GRAY16";
+   else if (depth == 4)
+      pixelType = (nComponents == 1) ? "GRAY32" : "RGB32";
+   else if (depth == 8)
+      pixelType = "RGB64";
+   md.PutString(FrameMetadata::KeyPixelType, pixelType);
+
+   boost::shared_ptr<ImageProcessorInstance> imageProcessor =
+      currentImageProcessor_.lock();
+
+   boost::shared_ptr<mm::FrameBuffer> frame(
+         new mm::FrameBuffer(width, height, depth));
+   for (unsigned ch = 0; ch < std::max(nChannels, 1u); ++ch)
+   {
+      const unsigned char* pixels = camera->GetImageBuffer(ch);
+      if (!pixels)
+      {
+         logError("CMMCore::snapImageAsync", getCoreErrorText(MMERR_CameraBufferReadFailed).c_str());
+         throw CMMError(getCoreErrorText(MMERR_CameraBufferReadFailed).c_str(), MMERR_CameraBufferReadFailed);
+      }
+      frame->SetPixels(ch, pixels);
+      mm::ImgBuffer* img = frame->FindImage(ch);
+      if (imageProcessor)
+      {
+         // Process the copy, leaving the camera's buffer as it was
+         imageProcessor->Process(img->GetPixelsRW(), width, height, depth);
+      }
+      img->SetMetadata(boost::shared_ptr<const Metadata>(), md);
+   }
+   return frame;
+}
+
+
+// Predicate used by assignImageSynchro() and removeImageSynchro()
+namespace
+{
+   class DeviceWeakPtrInvalidOrMatches
+   {
+      boost::shared_ptr<DeviceInstance> theDevice_;
+   public:
+      explicit DeviceWeakPtrInvalidOrMatches(
+            boost::shared_ptr<DeviceInstance> theDevice) :
+         theDevice_(theDevice)
+      {}
+
+      bool operator()(const boost::weak_ptr<DeviceInstance>& ptr)
+      {
+         boost::shared_ptr<DeviceInstance> aDevice = ptr.lock();
+         return (!aDevice || aDevice == theDevice_);
+      }
+   };
+} // anonymous namespace
+
+/**
+ * Add device to the image-synchro list. Image acquisition waits for all devices
+ * in this list.
+ * @param label   the device label
+ */
+void CMMCore::assignImageSynchro(const char* label) throw (CMMError)
+{
+   boost::shared_ptr<DeviceInstance> device = deviceManager_->GetDevice(label);
+
+   imageSynchroDevices_.erase(std::remove_if(imageSynchroDevices_.begin(),
+            imageSynchroDevices_.end(), DeviceWeakPtrInvalidOrMatches(device)),
+         imageSynchroDevices_.end());
+
+   imageSynchroDevices_.push_back(device);
+   LOG_DEBUG(coreLogger_) << "Added " << label << " to image-synchro list";
+}
+
+/**
+ * Removes device from the image-synchro list.
+ * @param label   the device label
+ */
+void CMMCore::removeImageSynchro(const char* label) throw (CMMError)
+{
+   boost::shared_ptr<DeviceInstance> device = deviceManager_->GetDevice(label);
+   imageSynchroDevices_.erase(std::remove_if(imageSynchroDevices_.begin(),
+            imageSynchroDevices_.end(), DeviceWeakPtrInvalidOrMatches(device)),
+         imageSynchroDevices_.end());
+   LOG_DEBUG(coreLogger_) << "Removed " << label << " from image-synchro list";
+}
+
+/**
+ * Clears the image synchro device list.
+ */
+void CMMCore::removeImageSynchroAll()
+{
+   imageSynchroDevices_.clear();
+   LOG_DEBUG(coreLogger_) << "Cleared image-synchro list";
+}
+
+/**
+ * If this option is enabled Shutter automatically opens and closes when the image
+ * is acquired.
+ * @param state      true for enabled
  */
 void CMMCore::setAutoShutter(bool state)
 {
    properties_->Set(MM::g_Keyword_CoreAutoShutter, state ? "1" : "0");
    autoShutter_ = state;
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoShutter, state ? "1" : "0"));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoShutter, state ? "1" : "0"));
    LOG_DEBUG(coreLogger_) << "Autoshutter turned " << (state ? "on" : "off");
 }
 
@@ -2437,6 +3055,48 @@ bool CMMCore::getAutoShutter()
    return autoShutter_;
 }
 
+/**
+ * If this option is enabled, snapImage() returns as soon as the exposure
+ * ends, without waiting for the auto-shutter to finish closing. The close
+ * then overlaps with image readout (getImage()) and with whatever the
+ * caller does next; the next waitForImageSynchro() or snapImage() waits for
+ * the shutter. Callers that need the shutter closed before moving on (e.g.
+ * to avoid bleaching) should call waitForImageSynchro().
+ * @param state      true for enabled
+ */
+void CMMCore::setPipelinedSnap(bool state)
+{
+   pipelinedSnap_ = state;
+   LOG_DEBUG(coreLogger_) << "Pipelined snap turned " << (state ? "on" : "off");
+}
+
+/**
+ * Returns the current setting of the pipelined snap option.
+ */
+bool CMMCore::getPipelinedSnap()
+{
+   return pipelinedSnap_;
+}
+
+/**
+ * Returns the time taken by a phase of the last successful snapImage().
+ *
+ * @param phase   one of "ImageSynchro", "ShutterOpen", "Exposure",
+ *                "ShutterClose" or "Total"
+ * @return the time in milliseconds
+ */
+double CMMCore::getLastSnapPhaseTime(const char* phase) throw (CMMError)
+{
+   if (!phase)
+      throw CMMError("Null snap phase name", MMERR_NullPointerException);
+   MMThreadGuard g(snapStateLock_);
+   std::map<std::string, double>::const_iterator it =
+      lastSnapTimingsMs_.find(phase);
+   if (it == lastSnapTimingsMs_.end())
+      throw CMMError("No timing for snap phase " + ToQuotedString(phase));
+   return it->second;
+}
+
 /**
 * Opens or closes the specified shutter.
 * @param  state     the desired state of the shutter (true for open)
@@ -2457,10 +3117,7 @@ void CMMCore::setShutterOpen(const char* shutterLabel, bool state) throw (CMMErr
 
       if (pShutter->HasProperty(MM::g_Keyword_State))
       {
-         {
-            MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(PropertySetting(shutterLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
-         }
+         updateStateCache(PropertySetting(shutterLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
       }
    }
 }
@@ -2527,7 +3184,12 @@ void* CMMCore::getImage() throw (CMMError)
       throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
    else
    {
-		if( ! everSnapped_)
+      bool everSnapped;
+      {
+         MMThreadGuard g(snapStateLock_);
+         everSnapped = everSnapped_;
+      }
+		if( ! everSnapped)
 		{
          logError("CMMCore::getImage()", getCoreErrorText(MMERR_InvalidImageSequence).c_str());
          throw CMMError(getCoreErrorText(MMERR_InvalidImageSequence).c_str(), MMERR_InvalidImageSequence);
@@ -2667,12 +3329,7 @@ void CMMCore::startSequenceAcquisition(long numImages, double intervalMs, bool s
 
 		try
 		{
-			if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-			{
-				logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-				throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-			}
-			cbuf_->Clear();
+			initializeSequenceBuffer(camera);
          mm::DeviceModuleLockGuard guard(camera);
 
          LOG_DEBUG(coreLogger_) << "Will start sequence acquisition from default camera";
@@ -2699,7 +3356,8 @@ void CMMCore::startSequenceAcquisition(long numImages, double intervalMs, bool s
  * Starts streaming camera sequence acquisition for a specified camera.
  * This command does not block the calling thread for the duration of the acquisition.
  * The difference between this method and the one with the same name but operating on the "default"
- * camera is that it does not automatically initialize the circular buffer.
+ * camera is that it does not automatically initialize the circular buffer, unless the camera
+ * has its own buffer (see enableCameraCircularBuffer()).
  */
 void CMMCore::startSequenceAcquisition(const char* label, long numImages, double intervalMs, bool stopOnOverflow) throw (CMMError)
 {
@@ -2710,6 +3368,20 @@ void CMMCore::startSequenceAcquisition(const char* label, long numImages, double
    if(pCam->IsCapturing())
       throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(), 
                      MMERR_NotAllowedDuringSequenceAcquisition);
+
+   if (pCam->GetSequenceBuffer())
+   {
+      try
+      {
+         initializeSequenceBuffer(pCam);
+      }
+      catch (const bad_alloc& ex)
+      {
+         ostringstream messs;
+         messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << endl;
+         throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
+      }
+   }
    
    LOG_DEBUG(coreLogger_) <<
       "Will start sequence acquisition from camera " << label;
@@ -2755,12 +3427,7 @@ void CMMCore::initializeCircularBuffer() throw (CMMError)
    if (camera)
    {
       mm::DeviceModuleLockGuard guard(camera);
-      if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-      {
-         logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-         throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-      }
-      cbuf_->Clear();
+      initializeSequenceBuffer(camera);
    }
    else
    {
@@ -2807,12 +3474,7 @@ void CMMCore::startContinuousSequenceAcquisition(double intervalMs) throw (CMMEr
             ,MMERR_NotAllowedDuringSequenceAcquisition);
       }
 
-      if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-      {
-         logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-         throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-      }
-      cbuf_->Clear();
+      initializeSequenceBuffer(camera);
       LOG_DEBUG(coreLogger_) << "Will start continuous sequence acquisition from current camera";
       int nRet = camera->StartSequenceAcquisition(intervalMs);
       if (nRet != DEVICE_OK)
@@ -2989,6 +3651,123 @@ void* CMMCore::popNextImageMD(Metadata& md) throw (CMMError)
    return popNextImageMD(0, 0, md);
 }
 
+/**
+ * Gets and removes the next image from the circular buffer, without copying.
+ *
+ * Unlike popNextImage(), whose pixels may be overwritten by the camera as
+ * soon as the next images arrive, the returned handle keeps the frame pinned
+ * in the buffer until the handle is released (or destroyed), so the pixels
+ * can be processed in place. While a frame is pinned, its slot is not reused;
+ * if the camera catches up with it, the buffer reports an overflow. Release
+ * handles as soon as the frame is no longer needed.
+ *
+ * @return a handle to the frame (channel 0)
+ */
+FrameHandle CMMCore::popNextFrameHandle() throw (CMMError)
+{
+   return popNextFrameHandle(0);
+}
+
+/**
+ * Gets and removes the next image from the circular buffer, without copying.
+ * See popNextFrameHandle().
+ *
+ * @param channel   the camera channel whose image should be returned
+ * @return a handle to the frame
+ */
+FrameHandle CMMCore::popNextFrameHandle(unsigned channel) throw (CMMError)
+{
+   return popFrameHandle(cbuf_, channel);
+}
+
+/**
+ * Gets and removes up to maxCount images from the circular buffer at once,
+ * without copying.
+ *
+ * This is equivalent to calling popNextFrameHandle() repeatedly, but takes
+ * the buffer lock (and, from Java or Python, crosses the language boundary)
+ * only once per batch. If the buffer is empty, waits for up to timeoutMs
+ * for an image to arrive. See popNextFrameHandle() for the lifetime of the
+ * handles.
+ *
+ * @param maxCount    the maximum number of images to return
+ * @param timeoutMs   how long to wait if the buffer is empty (0 to return
+ *                    immediately)
+ * @return handles to the frames (channel 0), oldest first; empty if no image
+ *         arrived within the timeout
+ */
+std::vector<FrameHandle> CMMCore::popNextFrameHandles(unsigned maxCount,
+      long timeoutMs) throw (CMMError)
+{
+   std::vector< boost::shared_ptr<mm::FrameBuffer> > frames;
+   frames.reserve(std::min<size_t>(maxCount, cbuf_->GetSize()));
+
+   if (cbuf_->PopNextFrames(maxCount, frames) == 0 && maxCount > 0 &&
+         timeoutMs > 0)
+   {
+      std::vector< boost::shared_ptr<CircularBuffer> > buffers(1, cbuf_);
+      if (waitForImageInBuffers(buffers, timeoutMs))
+         cbuf_->PopNextFrames(maxCount, frames);
+   }
+
+   std::vector<FrameHandle> handles;
+   handles.reserve(frames.size());
+   for (size_t i = 0; i < frames.size(); ++i)
+      handles.push_back(FrameHandle(frames[i], 0));
+   return handles;
+}
+
+/**
+ * Waits until an image is available in any circular buffer.
+ *
+ * Unlike polling getRemainingImageCount(), this sleeps until the camera
+ * inserts an image, and returns as soon as it does. This includes the
+ * buffers of cameras that have their own (see
+ * enableCameraCircularBuffer()). The image is not removed.
+ *
+ * This also resets the descriptor returned by
+ * getImageNotificationDescriptor().
+ *
+ * @param timeoutMs   the maximum time to wait (0 to only check)
+ * @return true if an image is available, false if the timeout elapsed
+ */
+bool CMMCore::waitForNextImage(long timeoutMs)
+{
+   // Reset before checking, so that an image inserted after the check makes
+   // the descriptor readable again
+   frameSignal_->ResetDescriptor();
+   return waitForImageInBuffers(getAllSequenceBuffers(), timeoutMs);
+}
+
+/**
+ * Returns a file descriptor that becomes readable when an image is inserted
+ * into any circular buffer, for use with select(), poll() or an event loop.
+ *
+ * When the descriptor is readable, call waitForNextImage() with a timeout of
+ * 0 (which resets it) and then retrieve the images. The descriptor may also
+ * become readable spuriously. It belongs to the core and must not be closed
+ * or read.
+ *
+ * @return the descriptor, or -1 on platforms that do not support it
+ *         (Windows)
+ */
+int CMMCore::getImageNotificationDescriptor()
+{
+   return frameSignal_->GetDescriptor();
+}
+
+FrameHandle CMMCore::popFrameHandle(boost::shared_ptr<CircularBuffer> buffer, unsigned channel) throw (CMMError)
+{
+   boost::shared_ptr<mm::FrameBuffer> frame = buffer->PopNextFrame();
+   if (!frame)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+
+   FrameHandle handle(frame, channel);
+   if (!handle.isValid())
+      throw CMMError("Requested channel is not present in the image");
+   return handle;
+}
+
 /**
  * Removes all images from the circular buffer.
  *
@@ -3006,12 +3785,42 @@ void CMMCore::clearCircularBuffer() throw (CMMError)
 void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
                                                ) throw (CMMError)
 {
-   delete cbuf_; // discard old buffer
+   std::vector< boost::shared_ptr<CameraInstance> > ownBufferCameras =
+      getCamerasWithOwnBuffer();
+   for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+   {
+      if (ownBufferCameras[i]->IsCapturing())
+         throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+               MMERR_NotAllowedDuringSequenceAcquisition);
+   }
+
+   const bool lockFree = cbuf_ && cbuf_->IsLockFree();
+   const mm::RingMemoryOptions memoryOptions =
+      cbuf_ ? cbuf_->GetMemoryOptions() : mm::RingMemoryOptions();
+   const CircularBuffer::OverflowPolicy overflowPolicy =
+      cbuf_ ? cbuf_->GetOverflowPolicy() : CircularBuffer::OverflowReport;
+   const long blockTimeoutMs = cbuf_ ? cbuf_->GetBlockTimeoutMs() : 0;
+   cbuf_.reset(); // discard old buffer
+   for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+      ownBufferCameras[i]->SetSequenceBuffer(boost::shared_ptr<CircularBuffer>());
    LOG_DEBUG(coreLogger_) << "Will set circular buffer size to " <<
       sizeMB << " MB";
 	try
 	{
-		cbuf_ = new CircularBuffer(sizeMB);
+		cbuf_.reset(new CircularBuffer(sizeMB));
+		cbuf_->SetLockFree(lockFree);
+      cbuf_->SetMemoryOptions(memoryOptions);
+      cbuf_->SetOverflowPolicy(overflowPolicy, blockTimeoutMs);
+      cbuf_->SetFrameSignal(frameSignal_);
+      for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+      {
+         boost::shared_ptr<CircularBuffer> buffer(new CircularBuffer(sizeMB));
+         buffer->SetLockFree(lockFree);
+         buffer->SetMemoryOptions(memoryOptions);
+         buffer->SetOverflowPolicy(overflowPolicy, blockTimeoutMs);
+         buffer->SetFrameSignal(frameSignal_);
+         ownBufferCameras[i]->SetSequenceBuffer(buffer);
+      }
 	}
 	catch(bad_alloc& ex)
 	{
@@ -3020,7 +3829,7 @@ void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
 		messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << endl;
 		throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
 	}
-	if (NULL == cbuf_) throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
+	if (!cbuf_) throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
 
 
 	try
@@ -3031,7 +3840,7 @@ void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
       if (camera)
 		{
          mm::DeviceModuleLockGuard guard(camera);
-         if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
+         if (!getSequenceBuffer(camera)->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
 				throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
 		}
 
@@ -3044,10 +3853,215 @@ void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
 		messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << endl;
 		throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
 	}
-	if (NULL == cbuf_)
+	if (!cbuf_)
       throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
 }
 
+/**
+ * Enables or disables the lock-free mode of the circular buffer.
+ *
+ * In lock-free mode, inserting and popping images does not take any lock,
+ * which reduces jitter at high frame rates. This mode is only correct when a
+ * single camera thread inserts images and a single thread pops them (using
+ * popNextImage() or popNextImageMD()); getLastImage() and related functions
+ * may still be called from other threads. Multi-camera setups that insert
+ * from more than one thread must use the default (locked) mode, unless each
+ * camera has its own buffer (see enableCameraCircularBuffer()). The setting
+ * applies to the shared buffer and to all camera buffers.
+ *
+ * The mode cannot be changed while a sequence acquisition is running.
+ *
+ * @param enable   true to use the lock-free mode
+ */
+void CMMCore::enableLockFreeCircularBuffer(bool enable) throw (CMMError)
+{
+   if (isSequenceRunning())
+   {
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+   }
+
+   cbuf_->SetLockFree(enable);
+   std::vector< boost::shared_ptr<CameraInstance> > ownBufferCameras =
+      getCamerasWithOwnBuffer();
+   for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+      ownBufferCameras[i]->GetSequenceBuffer()->SetLockFree(enable);
+   LOG_DEBUG(coreLogger_) << "Circular buffer lock-free mode " <<
+      (enable ? "enabled" : "disabled");
+}
+
+/**
+ * Returns whether the circular buffer is in lock-free mode.
+ * @see enableLockFreeCircularBuffer()
+ */
+bool CMMCore::isLockFreeCircularBufferEnabled() const
+{
+   return cbuf_ && cbuf_->IsLockFree();
+}
+
+/**
+ * Enables or disables the use of huge pages for the circular buffer memory.
+ *
+ * All frames of a circular buffer are kept in one contiguous block of
+ * memory, which is faulted in when the buffer is initialized so that no page
+ * faults occur during acquisition. With huge pages (enabled by default), the
+ * block uses fewer TLB entries. Explicit huge pages are used when the system
+ * provides them (Linux: a reserved hugetlbfs pool; Windows: the "Lock pages
+ * in memory" privilege); otherwise Linux transparent huge pages are
+ * requested, or normal pages are used.
+ *
+ * Changing this setting discards the images in the circular buffers. It
+ * cannot be changed while a sequence acquisition is running.
+ *
+ * @param enable   true to use huge pages when available
+ */
+void CMMCore::enableCircularBufferHugePages(bool enable) throw (CMMError)
+{
+   mm::RingMemoryOptions options = cbuf_->GetMemoryOptions();
+   options.useHugePages = enable;
+   setCircularBufferMemoryOptions(options);
+}
+
+bool CMMCore::isCircularBufferHugePagesEnabled() const
+{
+   return cbuf_ && cbuf_->GetMemoryOptions().useHugePages;
+}
+
+/**
+ * Enables or disables locking the circular buffer memory into RAM, so that
+ * it is never paged out. Locking is skipped if the operating system refuses
+ * it (e.g. because of RLIMIT_MEMLOCK on Linux, or the working set size on
+ * Windows).
+ *
+ * Changing this setting discards the images in the circular buffers. It
+ * cannot be changed while a sequence acquisition is running.
+ *
+ * @param enable   true to lock the memory
+ */
+void CMMCore::enableCircularBufferMemoryLocking(bool enable) throw (CMMError)
+{
+   mm::RingMemoryOptions options = cbuf_->GetMemoryOptions();
+   options.lockPages = enable;
+   setCircularBufferMemoryOptions(options);
+}
+
+bool CMMCore::isCircularBufferMemoryLockingEnabled() const
+{
+   return cbuf_ && cbuf_->GetMemoryOptions().lockPages;
+}
+
+/**
+ * Sets the NUMA node on which the circular buffer memory should be placed.
+ * This should be the node to which the camera's frame grabber or the
+ * processing threads are closest. The placement is a preference: memory
+ * comes from other nodes if the chosen one is full. Not supported on Mac OS.
+ *
+ * Changing this setting discards the images in the circular buffers. It
+ * cannot be changed while a sequence acquisition is running.
+ *
+ * @param node   the NUMA node number, or -1 for no preference (the default)
+ */
+void CMMCore::setCircularBufferNumaNode(int node) throw (CMMError)
+{
+   if (node < -1)
+      throw CMMError("Invalid NUMA node");
+   mm::RingMemoryOptions options = cbuf_->GetMemoryOptions();
+   options.numaNode = node;
+   setCircularBufferMemoryOptions(options);
+}
+
+int CMMCore::getCircularBufferNumaNode() const
+{
+   return cbuf_ ? cbuf_->GetMemoryOptions().numaNode : -1;
+}
+
+void CMMCore::setCircularBufferMemoryOptions(const mm::RingMemoryOptions& options) throw (CMMError)
+{
+   checkCircularBuffersIdle();
+
+   std::vector< boost::shared_ptr<CameraInstance> > ownBufferCameras =
+      getCamerasWithOwnBuffer();
+   cbuf_->SetMemoryOptions(options);
+   for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+      ownBufferCameras[i]->GetSequenceBuffer()->SetMemoryOptions(options);
+   LOG_DEBUG(coreLogger_) << "Circular buffer memory options: huge pages " <<
+      (options.useHugePages ? "on" : "off") << ", locking " <<
+      (options.lockPages ? "on" : "off") << ", NUMA node " << options.numaNode;
+}
+
+/**
+ * Sets what happens when a camera inserts an image into a full circular
+ * buffer.
+ *
+ * - "Overflow" (the default): the image is rejected and the buffer reports
+ *   an overflow (see isBufferOverflowed()). Depending on the camera, this
+ *   stops the acquisition or discards all images in the buffer.
+ * - "DropOldest": the oldest image not yet retrieved is discarded.
+ * - "DropNewest": the new image is discarded.
+ * - "Block": the camera thread waits for up to blockTimeoutMs for an image
+ *   to be retrieved; if none is, the new image is discarded.
+ *
+ * Discarded images are counted per camera (see getDroppedImageCount()). The
+ * policy applies to the shared and the per-camera buffers. It cannot be
+ * changed while a sequence acquisition is running.
+ *
+ * @param policy          "Overflow", "DropOldest", "DropNewest" or "Block"
+ * @param blockTimeoutMs  the maximum wait for the "Block" policy
+ */
+void CMMCore::setCircularBufferOverflowPolicy(const char* policy, long blockTimeoutMs) throw (CMMError)
+{
+   CircularBuffer::OverflowPolicy value;
+   if (policy && strcmp(policy, "Overflow") == 0)
+      value = CircularBuffer::OverflowReport;
+   else if (policy && strcmp(policy, "DropOldest") == 0)
+      value = CircularBuffer::OverflowDropOldest;
+   else if (policy && strcmp(policy, "DropNewest") == 0)
+      value = CircularBuffer::OverflowDropNewest;
+   else if (policy && strcmp(policy, "Block") == 0)
+      value = CircularBuffer::OverflowBlock;
+   else
+      throw CMMError("Invalid circular buffer overflow policy: " + ToQuotedString(policy));
+   if (blockTimeoutMs < 0)
+      throw CMMError("Invalid circular buffer block timeout");
+
+   checkCircularBuffersIdle();
+
+   cbuf_->SetOverflowPolicy(value, blockTimeoutMs);
+   std::vector< boost::shared_ptr<CameraInstance> > ownBufferCameras =
+      getCamerasWithOwnBuffer();
+   for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+      ownBufferCameras[i]->GetSequenceBuffer()->SetOverflowPolicy(value, blockTimeoutMs);
+   LOG_DEBUG(coreLogger_) << "Circular buffer overflow policy set to " << policy;
+}
+
+/**
+ * Returns the circular buffer overflow policy.
+ * @see setCircularBufferOverflowPolicy()
+ */
+std::string CMMCore::getCircularBufferOverflowPolicy() const
+{
+   switch (cbuf_->GetOverflowPolicy())
+   {
+      case CircularBuffer::OverflowDropOldest: return "DropOldest";
+      case CircularBuffer::OverflowDropNewest: return "DropNewest";
+      case CircularBuffer::OverflowBlock: return "Block";
+      default: return "Overflow";
+   }
+}
+
+/**
+ * Returns the number of images from the camera that were discarded by the
+ * overflow policy since the camera's buffer was last initialized (normally
+ * at the start of a sequence acquisition).
+ * @see setCircularBufferOverflowPolicy()
+ */
+long CMMCore::getDroppedImageCount(const char* cameraLabel) throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   return static_cast<long>(getSequenceBuffer(camera)->GetDroppedFrameCount(cameraLabel));
+}
+
 unsigned CMMCore::getCircularBufferMemoryFootprint()
 {
    if (cbuf_)
@@ -3072,21 +4086,237 @@ long CMMCore::getBufferTotalCapacity()
    {
       return cbuf_->GetSize();
    }
-   return 0;
+   return 0;
+}
+
+long CMMCore::getBufferFreeCapacity()
+{
+   if (cbuf_)
+   {
+      return cbuf_->GetFreeSize();
+   }
+   return 0;
+}
+
+bool CMMCore::isBufferOverflowed() const
+{
+   return cbuf_->Overflow();
+}
+
+/**
+ * Gives a camera its own circular buffer, or returns it to the shared one.
+ *
+ * By default, all cameras insert their images into a single circular buffer,
+ * which holds images of one size only. A camera with its own buffer can run
+ * a sequence acquisition at the same time as cameras of a different image
+ * size. The buffer uses the memory footprint and lock-free setting of the
+ * shared buffer, and is initialized from the camera's geometry whenever a
+ * sequence acquisition is started on that camera. Its images are retrieved
+ * with popNextCameraFrameHandle() or popNextTimeOrderedFrameHandle(); the
+ * functions that do not take a camera label only use the shared buffer.
+ *
+ * @param cameraLabel   the camera device
+ * @param enable        true to give the camera its own buffer
+ */
+void CMMCore::enableCameraCircularBuffer(const char* cameraLabel, bool enable) throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+
+   mm::DeviceModuleLockGuard guard(camera);
+   if (camera->IsCapturing())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   if (!enable)
+   {
+      camera->SetSequenceBuffer(boost::shared_ptr<CircularBuffer>());
+      LOG_DEBUG(coreLogger_) << "Camera " << cameraLabel <<
+         " now uses the shared circular buffer";
+      return;
+   }
+   if (camera->GetSequenceBuffer())
+      return;
+
+   try
+   {
+      boost::shared_ptr<CircularBuffer> buffer(new CircularBuffer(cbuf_->GetMemorySizeMB()));
+      buffer->SetLockFree(cbuf_->IsLockFree());
+      buffer->SetMemoryOptions(cbuf_->GetMemoryOptions());
+      buffer->SetOverflowPolicy(cbuf_->GetOverflowPolicy(), cbuf_->GetBlockTimeoutMs());
+      buffer->SetFrameSignal(frameSignal_);
+      camera->SetSequenceBuffer(buffer);
+   }
+   catch (const bad_alloc& ex)
+   {
+      ostringstream messs;
+      messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << endl;
+      throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
+   }
+   LOG_DEBUG(coreLogger_) << "Camera " << cameraLabel <<
+      " now uses its own circular buffer";
+}
+
+/**
+ * Returns whether the camera has its own circular buffer.
+ * @see enableCameraCircularBuffer()
+ */
+bool CMMCore::isCameraCircularBufferEnabled(const char* cameraLabel) throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   return camera->GetSequenceBuffer() != 0;
+}
+
+/**
+ * Returns the number of images in the circular buffer that the camera
+ * inserts into (its own buffer, or the shared one).
+ */
+long CMMCore::getRemainingImageCount(const char* cameraLabel) throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   return getSequenceBuffer(camera)->GetRemainingImageCount();
+}
+
+/**
+ * Removes all images from the circular buffer that the camera inserts into
+ * (its own buffer, or the shared one).
+ */
+void CMMCore::clearCircularBuffer(const char* cameraLabel) throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   getSequenceBuffer(camera)->Clear();
+}
+
+/**
+ * Gets and removes the next image from the circular buffer that the camera
+ * inserts into, without copying. See popNextFrameHandle().
+ *
+ * @param cameraLabel   the camera device
+ * @return a handle to the frame (channel 0)
+ */
+FrameHandle CMMCore::popNextCameraFrameHandle(const char* cameraLabel) throw (CMMError)
+{
+   boost::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   return popFrameHandle(getSequenceBuffer(camera), 0);
+}
+
+/**
+ * Gets and removes the earliest image from all circular buffers, without
+ * copying.
+ *
+ * Images are ordered by the time they were received by the core, which is
+ * comparable across cameras (unlike camera-supplied elapsed times). This
+ * merges the streams of cameras that have their own buffer with the shared
+ * buffer. See popNextFrameHandle().
+ *
+ * @return a handle to the frame (channel 0)
+ */
+FrameHandle CMMCore::popNextTimeOrderedFrameHandle() throw (CMMError)
+{
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers =
+      getAllSequenceBuffers();
+
+   boost::shared_ptr<CircularBuffer> earliest;
+   double earliestTime = 0.0;
+   for (size_t i = 0; i < buffers.size(); ++i)
+   {
+      boost::shared_ptr<mm::FrameBuffer> frame = buffers[i]->PeekNextFrame();
+      if (frame && (!earliest || frame->GetArrivalTime() < earliestTime))
+      {
+         earliest = buffers[i];
+         earliestTime = frame->GetArrivalTime();
+      }
+   }
+   if (!earliest)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+
+   return popFrameHandle(earliest, 0);
+}
+
+// Returns the buffer that the camera's images go to
+boost::shared_ptr<CircularBuffer> CMMCore::getSequenceBuffer(boost::shared_ptr<CameraInstance> camera)
+{
+   boost::shared_ptr<CircularBuffer> buffer = camera->GetSequenceBuffer();
+   return buffer ? buffer : cbuf_;
+}
+
+std::vector< boost::shared_ptr<CameraInstance> > CMMCore::getCamerasWithOwnBuffer()
+{
+   std::vector< boost::shared_ptr<CameraInstance> > cameras;
+   vector<string> labels = deviceManager_->GetDeviceList(MM::CameraDevice);
+   for (vector<string>::const_iterator it = labels.begin(), end = labels.end();
+         it != end; ++it)
+   {
+      boost::shared_ptr<CameraInstance> camera =
+         deviceManager_->GetDeviceOfType<CameraInstance>(*it);
+      if (camera->GetSequenceBuffer())
+         cameras.push_back(camera);
+   }
+   return cameras;
+}
+
+// The shared buffer followed by the buffers of cameras that have their own
+std::vector< boost::shared_ptr<CircularBuffer> > CMMCore::getAllSequenceBuffers()
+{
+   std::vector< boost::shared_ptr<CircularBuffer> > buffers;
+   buffers.push_back(cbuf_);
+   std::vector< boost::shared_ptr<CameraInstance> > ownBufferCameras =
+      getCamerasWithOwnBuffer();
+   for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+      buffers.push_back(ownBufferCameras[i]->GetSequenceBuffer());
+   return buffers;
+}
+
+// Waits until one of the buffers holds an image; returns false on timeout
+bool CMMCore::waitForImageInBuffers(const std::vector< boost::shared_ptr<CircularBuffer> >& buffers, long timeoutMs)
+{
+   const double deadline = GetMMTimeNow().getMsec() + (timeoutMs > 0 ? timeoutMs : 0);
+   for (;;)
+   {
+      // Read the generation first, so that a frame inserted after the check
+      // ends the wait
+      const unsigned long generation = frameSignal_->GetGeneration();
+      for (size_t i = 0; i < buffers.size(); ++i)
+      {
+         if (buffers[i]->GetRemainingImageCount() > 0)
+            return true;
+      }
+
+      const double remainingMs = deadline - GetMMTimeNow().getMsec();
+      if (remainingMs <= 0.0)
+         return false;
+      frameSignal_->WaitForChange(generation, static_cast<long>(ceil(remainingMs)));
+   }
 }
 
-long CMMCore::getBufferFreeCapacity()
+// Settings of the circular buffers may only change while no camera is
+// inserting images
+void CMMCore::checkCircularBuffersIdle() throw (CMMError)
 {
-   if (cbuf_)
-   {
-      return cbuf_->GetFreeSize();
-   }
-   return 0;
+   bool capturing = isSequenceRunning();
+   std::vector< boost::shared_ptr<CameraInstance> > ownBufferCameras =
+      getCamerasWithOwnBuffer();
+   for (size_t i = 0; i < ownBufferCameras.size(); ++i)
+      capturing = capturing || ownBufferCameras[i]->IsCapturing();
+   if (capturing)
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
 }
 
-bool CMMCore::isBufferOverflowed() const
+// Prepares the camera's buffer for a new sequence acquisition
+void CMMCore::initializeSequenceBuffer(boost::shared_ptr<CameraInstance> camera) throw (CMMError)
 {
-   return cbuf_->Overflow();
+   boost::shared_ptr<CircularBuffer> buffer = getSequenceBuffer(camera);
+   if (!buffer->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
+   {
+      logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
+   }
+   buffer->Clear();
 }
 
 /**
@@ -3176,10 +4406,7 @@ void CMMCore::setAutoFocusDevice(const char* autofocusLabel) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newAutofocusLabel = getAutoFocusDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoFocus, newAutofocusLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoFocus, newAutofocusLabel.c_str()));
 }
 
 /**
@@ -3243,10 +4470,7 @@ void CMMCore::setImageProcessorDevice(const char* procLabel) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newProcLabel = getImageProcessorDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreImageProcessor, newProcLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreImageProcessor, newProcLabel.c_str()));
 }
 
 /**
@@ -3267,10 +4491,7 @@ void CMMCore::setSLMDevice(const char* slmLabel) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newSLMLabel = getSLMDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreSLM, newSLMLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreSLM, newSLMLabel.c_str()));
 }
 
 
@@ -3292,10 +4513,7 @@ void CMMCore::setGalvoDevice(const char* galvoLabel) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newGalvoLabel = getGalvoDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreGalvo, newGalvoLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreGalvo, newGalvoLabel.c_str()));
 }
 
 /**
@@ -3314,10 +4532,7 @@ void CMMCore::setChannelGroup(const char* chGroup) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newChGroup = getChannelGroup();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreChannelGroup, newChGroup.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreChannelGroup, newChGroup.c_str()));
 }
 
 /**
@@ -3372,10 +4587,7 @@ void CMMCore::setShutterDevice(const char* shutterLabel) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newShutterLabel = getShutterDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreShutter, newShutterLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreShutter, newShutterLabel.c_str()));
 }
 
 /**
@@ -3397,10 +4609,7 @@ void CMMCore::setFocusDevice(const char* focusLabel) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newFocusLabel = getFocusDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreFocus, newFocusLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreFocus, newFocusLabel.c_str()));
 }
 
 /**
@@ -3420,10 +4629,7 @@ void CMMCore::setXYStageDevice(const char* xyDeviceLabel) throw (CMMError)
       LOG_INFO(coreLogger_) << "Default xy stage unset";
    }
    std::string newXYStageLabel = getXYStageDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreXYStage, newXYStageLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreXYStage, newXYStageLabel.c_str()));
 }
 
 /**
@@ -3459,10 +4665,7 @@ void CMMCore::setCameraDevice(const char* cameraLabel) throw (CMMError)
    }
    properties_->Refresh(); // TODO: more efficient
    std::string newCameraLabel = getCameraDevice();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreCamera, newCameraLabel.c_str()));
-   }
+   updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreCamera, newCameraLabel.c_str()));
 }
 
 /**
@@ -3563,10 +4766,7 @@ string CMMCore::getProperty(const char* label, const char* propName) throw (CMME
    // use the opportunity to update the cache
    // Note, stateCache is mutable so that we can update it from this const function
    PropertySetting s(label, propName, value.c_str());
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(s);
-   }
+   updateStateCache(s);
 
    return value;
 }
@@ -3585,15 +4785,12 @@ string CMMCore::getPropertyFromCache(const char* label, const char* propName) co
    CheckDeviceLabel(label);
    CheckPropertyName(propName);
 
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      if (!stateCache_.isPropertyIncluded(label, propName))
-         throw CMMError("Property " + ToQuotedString(propName) + " of device " +
-               ToQuotedString(label) + " not found in cache",
-               MMERR_PropertyNotInCache);
-      PropertySetting s = stateCache_.getSetting(label, propName);
-      return s.getPropertyValue();
-   }
+   std::string value;
+   if (!stateCache_->GetSnapshot().GetValue(label, propName, value))
+      throw CMMError("Property " + ToQuotedString(propName) + " of device " +
+            ToQuotedString(label) + " not found in cache",
+            MMERR_PropertyNotInCache);
+   return value;
 }
 
 /**
@@ -3616,10 +4813,7 @@ void CMMCore::setProperty(const char* label, const char* propName,
          propName << " = " << propValue;
 
       properties_->Execute(propName, propValue);
-      {
-         MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, propName, propValue));
-      }
+      updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, propName, propValue));
 
       LOG_DEBUG(coreLogger_) << "Did set Core property: " <<
          propName << " = " << propValue;
@@ -3632,10 +4826,7 @@ void CMMCore::setProperty(const char* label, const char* propName,
 
       pDevice->SetProperty(propName, propValue);
 
-      {
-         MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(label, propName, propValue));
-      }
+      updateStateCache(PropertySetting(label, propName, propValue));
    }
 }
 
@@ -4054,10 +5245,7 @@ void CMMCore::setExposure(const char* label, double dExp) throw (CMMError)
       pCamera->SetExposure(dExp);
       if (pCamera->HasProperty(MM::g_Keyword_Exposure))
       {
-         {
-            MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(PropertySetting(label, MM::g_Keyword_Exposure, CDeviceUtils::ConvertToString(dExp)));
-         }
+         updateStateCache(PropertySetting(label, MM::g_Keyword_Exposure, CDeviceUtils::ConvertToString(dExp)));
       }
    }
 
@@ -4135,7 +5323,7 @@ void CMMCore::setROI(int x, int y, int xSize, int ySize) throw (CMMError)
       // inconsistent with the current image size. There is no way to "fix"
       // popNextImage() to handle this correctly, so we need to make sure we
       // discard such images.
-      cbuf_->Clear();
+      getSequenceBuffer(camera)->Clear();
    }
    else
       throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
@@ -4214,7 +5402,7 @@ void CMMCore::setROI(const char* label, int x, int y, int xSize, int ySize) thro
      // inconsistent with the current image size. There is no way to "fix"
      // popNextImage() to handle this correctly, so we need to make sure we
      // discard such images.
-     cbuf_->Clear();
+     getSequenceBuffer(camera)->Clear();
   }
   else
      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
@@ -4273,7 +5461,7 @@ void CMMCore::clearROI() throw (CMMError)
       // inconsistent with the current image size. There is no way to "fix"
       // popNextImage() to handle this correctly, so we need to make sure we
       // discard such images.
-      cbuf_->Clear();
+      getSequenceBuffer(camera)->Clear();
    }
 }
 
@@ -4437,19 +5625,13 @@ void CMMCore::setState(const char* deviceLabel, long state) throw (CMMError)
 
    if (pStateDev->HasProperty(MM::g_Keyword_State))
    {
-      {
-         MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
-      }
+      updateStateCache(PropertySetting(deviceLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
    }
    if (pStateDev->HasProperty(MM::g_Keyword_Label))
    {
       std::string posLbl = pStateDev->GetPositionLabel(state);
 
-      {
-         MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_Label, posLbl.c_str()));
-      }
+      updateStateCache(PropertySetting(deviceLabel, MM::g_Keyword_Label, posLbl.c_str()));
    }
 
    LOG_DEBUG(coreLogger_) << "Did set " << deviceLabel << " to state " << state;
@@ -4508,19 +5690,13 @@ void CMMCore::setStateLabel(const char* deviceLabel, const char* stateLabel) thr
 
    if (pStateDev->HasProperty(MM::g_Keyword_Label))
    {
-      {
-         MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_Label, stateLabel));
-      }
+      updateStateCache(PropertySetting(deviceLabel, MM::g_Keyword_Label, stateLabel));
    }
    if (pStateDev->HasProperty(MM::g_Keyword_State))
    {
       long state = getStateFromLabel(deviceLabel, stateLabel);
-      {
-         MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_State,
-                  CDeviceUtils::ConvertToString(state)));
-      }
+      updateStateCache(PropertySetting(deviceLabel, MM::g_Keyword_State,
+               CDeviceUtils::ConvertToString(state)));
    }
 }
 
@@ -5027,23 +6203,7 @@ vector<string> CMMCore::getAvailablePixelSizeConfigs() const
  */
 string CMMCore::getCurrentConfig(const char* groupName) throw (CMMError)
 {
-   CheckConfigGroupName(groupName);
-
-   vector<string> cfgs = configGroups_->GetAvailableConfigs(groupName);
-   if (cfgs.empty())
-      return "";
-
-   Configuration curState = getConfigGroupState(groupName, false);
-
-   for (size_t i=0; i<cfgs.size(); i++)
-   {
-      Configuration* pCfg = configGroups_->Find(groupName, cfgs[i].c_str());
-      if (pCfg && curState.isConfigurationIncluded(*pCfg))
-         return cfgs[i];
-   }
-
-   // no match
-   return "";
+   return getCurrentConfig(groupName, false);
 }
 
 /**
@@ -5056,24 +6216,78 @@ string CMMCore::getCurrentConfig(const char* groupName) throw (CMMError)
  * @return The cache's current configuration preset name
  */
 string CMMCore::getCurrentConfigFromCache(const char* groupName) throw (CMMError)
+{
+   return getCurrentConfig(groupName, true);
+}
+
+/**
+ * Returns the first preset of the group that matches the current state (from
+ * the devices or from the cache).
+ *
+ * Each property of the group is read once, and matched against the group's
+ * precompiled presets. The result from the cache is memoized until one of
+ * the group's properties changes in the cache (see updateStateCache()).
+ */
+string CMMCore::getCurrentConfig(const char* groupName, bool fromCache) throw (CMMError)
 {
    CheckConfigGroupName(groupName);
 
-   vector<string> cfgs = configGroups_->GetAvailableConfigs(groupName);
-   if (cfgs.empty())
+   ConfigGroup* group = configGroups_->FindGroup(groupName);
+   if (!group || group->IsEmpty())
       return "";
 
-   Configuration curState = getConfigGroupState(groupName, true);
+   unsigned long revision = 0;
+   if (fromCache)
+   {
+      MMThreadGuard scg(presetMatchLock_);
+      std::string preset;
+      if (group->GetCachedMatch(preset))
+         return preset;
+      revision = group->GetStateRevision();
+   }
+
+   // Core properties are read from the core rather than from the state
+   // cache, so a match involving them cannot be memoized
+   bool memoize = fromCache;
+   const std::vector<PropertySetting>& properties = group->GetMatchProperties();
+   std::vector<std::string> values(properties.size());
+   std::vector<bool> known(properties.size(), true);
+   for (size_t i = 0; i < properties.size(); ++i)
+   {
+      const std::string device = properties[i].getDeviceLabel();
+      const std::string property = properties[i].getPropertyName();
+      if (fromCache)
+      {
+         if (device == MM::g_Keyword_CoreDevice)
+            memoize = false;
+         values[i] = getPropertyFromCache(device.c_str(), property.c_str());
+      }
+      else
+      {
+         values[i] = getProperty(device.c_str(), property.c_str());
+      }
+   }
 
-   for (size_t i=0; i<cfgs.size(); i++)
+   std::string preset = group->FindMatchingPreset(values, known);
+   if (memoize)
    {
-      Configuration* pCfg = configGroups_->Find(groupName, cfgs[i].c_str());
-      if (pCfg && curState.isConfigurationIncluded(*pCfg))
-         return cfgs[i];
+      MMThreadGuard scg(presetMatchLock_);
+      group->SetCachedMatch(preset, revision);
    }
+   return preset;
+}
 
-   // no match
-   return "";
+// Records a property value in the state cache, and invalidates the memoized
+// presets that depend on it. The cache is updated first, so that a preset
+// computed from the old value is not memoized.
+void CMMCore::updateStateCache(const PropertySetting& setting)
+{
+   if (!stateCache_->Set(setting))
+      return;
+   MMThreadGuard scg(presetMatchLock_);
+   configGroups_->InvalidateCachedMatches(setting.getKey());
+   if (pixelSizeGroup_->IsPropertyIncluded(setting.getKey()))
+      pixelSizeGroup_->InvalidateCachedMatch();
 }
 
 /**
@@ -5177,57 +6391,59 @@ string CMMCore::getCurrentPixelSizeConfig() throw (CMMError)
  **/
 string CMMCore::getCurrentPixelSizeConfig(bool cached) throw (CMMError)
 {
-   // get a list of configuration names
-   vector<string> cfgs = pixelSizeGroup_->GetAvailable();
-   if (cfgs.empty())
+   if (pixelSizeGroup_->IsEmpty())
       return "";
 
-   // create a union of configuration settings used in this group
-   // and obtain the current state of the system
-   Configuration curState;
-   for (size_t i=0; i<cfgs.size(); i++) {
-      PixelSizeConfiguration* cfgData = pixelSizeGroup_->Find(cfgs[i].c_str());
-      assert(cfgData);
-      for (size_t i=0; i < cfgData->size(); i++)
+   // See getCurrentConfig(const char*, bool) for the memoization
+   unsigned long revision = 0;
+   if (cached)
+   {
+      MMThreadGuard scg(presetMatchLock_);
+      std::string preset;
+      if (pixelSizeGroup_->GetCachedMatch(preset))
+         return preset;
+      revision = pixelSizeGroup_->GetStateRevision();
+   }
+
+   // obtain the current state of the union of configuration settings used
+   // in this group
+   const mm::StateCache::Snapshot cache = stateCache_->GetSnapshot();
+   const std::vector<PropertySetting>& properties = pixelSizeGroup_->GetMatchProperties();
+   std::vector<std::string> values(properties.size());
+   std::vector<bool> known(properties.size(), true);
+   for (size_t i = 0; i < properties.size(); ++i)
+   {
+      const std::string device = properties[i].getDeviceLabel();
+      const std::string property = properties[i].getPropertyName();
+      try
       {
-         PropertySetting cs = cfgData->getSetting(i); // config setting
-         if (!curState.isPropertyIncluded(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str()))
+         if (!cached)
          {
-            try
-            {
-				string value;
-				if (!cached)
-				{
-                   value = getProperty(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str());
-				}
-				else
-				{
-               MMThreadGuard scg(stateCacheLock_);
-               value = stateCache_.getSetting(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str()).getPropertyValue();
-				}
-               PropertySetting ss(cs.getDeviceLabel().c_str(), cs.getPropertyName().c_str(), value.c_str()); // state setting
-               curState.addSetting(ss);
-            }
-            catch (CMMError& err)
-            {
-               // just log error
-               logError("GetPixelSizeUm", err.getMsg().c_str());
-            }
+            values[i] = getProperty(device.c_str(), property.c_str());
+         }
+         else if (!cache.GetValue(device, property, values[i]))
+         {
+            throw CMMError("Property " + ToQuotedString(property) + " of device " +
+                  ToQuotedString(device) + " not found in cache",
+                  MMERR_PropertyNotInCache);
          }
       }
+      catch (CMMError& err)
+      {
+         // just log error
+         logError("GetPixelSizeUm", err.getMsg().c_str());
+         known[i] = false;
+      }
    }
 
    // check which one matches the current state
-   for (size_t i=0; i<cfgs.size(); i++)
+   std::string preset = pixelSizeGroup_->FindMatchingPreset(values, known);
+   if (cached)
    {
-      PixelSizeConfiguration* pCfg = pixelSizeGroup_->Find(cfgs[i].c_str());
-      if (pCfg && curState.isConfigurationIncluded(*pCfg))
-      {
-		 return cfgs[i];
-      }
+      MMThreadGuard scg(presetMatchLock_);
+      pixelSizeGroup_->SetCachedMatch(preset, revision);
    }
-
-   return "";
+   return preset;
 }
 
 /**
@@ -6449,6 +7665,11 @@ void CMMCore::saveSystemConfiguration(const char* fileName) throw (CMMError)
  */
 void CMMCore::loadSystemConfiguration(const char* fileName) throw (CMMError)
 {
+   {
+      MMThreadGuard g(deferredSettingsLock_);
+      deferredSettings_.clear();
+   }
+
    try
    {
       loadSystemConfigurationImpl(fileName);
@@ -7022,6 +8243,9 @@ void CMMCore::InitializeErrorMessages()
    errorText_[MMERR_NullPointerException] = "Null Pointer Exception.";
    errorText_[MMERR_CreatePeripheralFailed] = "Hub failed to create specified peripheral device.";
    errorText_[MMERR_BadAffineTransform] = "Bad affine transform.  Affine transforms need to have 6 numbers; 2 rows of 3 column.";
+   errorText_[MMERR_StateCacheChangesUnavailable] =
+      "Properties have been removed from the system state cache since the requested version.";
+   errorText_[MMERR_InvalidSnapHandle] = "Invalid or released snap handle.";
 }
 
 void CMMCore::CreateCoreProperties()
@@ -7166,15 +8390,32 @@ bool CMMCore::IsCoreDeviceLabel(const char* label) const throw (CMMError)
 
 /**
  * Set all properties in a configuration
- * Upon error, don't stop, but try to set all failed properties again
- * until all success or no more change takes place
- * If errors remain, throw an error 
+ *
+ * The settings of each device are sent as one batch (a single
+ * MM::Device::SetProperties() call if the device supports it), and devices
+ * of different adapter modules are set concurrently. Core settings are
+ * applied first.
+ *
+ * Upon error, don't stop, but try to set all failed properties again, one by
+ * one in the original order, until all succeed or no more change takes
+ * place. Settings that only succeed on retry are remembered and applied
+ * after the others in subsequent calls, so that the retry is not needed.
+ * If errors remain, throw an error.
  */
 void CMMCore::applyConfiguration(const Configuration& config) throw (CMMError)
 {
-   std::ostringstream sall;
-   bool error = false;
-   vector<PropertySetting> failedProps;
+   std::set<std::string> deferredKeys;
+   {
+      MMThreadGuard g(deferredSettingsLock_);
+      deferredKeys = deferredSettings_;
+   }
+
+   // Group the device settings into per-device batches, and the batches by
+   // module, keeping the order of first appearance
+   std::vector< std::vector<DeviceSettings> > moduleBatches;
+   std::map<LoadedDeviceAdapter*, size_t> moduleIndices;
+   std::map< std::string, std::pair<size_t, size_t> > batchIndices;
+   std::vector<PropertySetting> deferred;
    for (size_t i=0; i<config.size(); i++)
    {
       PropertySetting setting = config.getSetting(i);
@@ -7183,86 +8424,233 @@ void CMMCore::applyConfiguration(const Configuration& config) throw (CMMError)
       if (setting.getDeviceLabel().compare(MM::g_Keyword_CoreDevice) == 0)
       {
          properties_->Execute(setting.getPropertyName().c_str(), setting.getPropertyValue().c_str());
-         {
-            MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, setting.getPropertyName().c_str(), setting.getPropertyValue().c_str()));
-         }
+         updateStateCache(PropertySetting(MM::g_Keyword_CoreDevice, setting.getPropertyName().c_str(), setting.getPropertyValue().c_str()));
+         continue;
       }
-      else
+      if (deferredKeys.count(setting.getKey()))
+      {
+         deferred.push_back(setting);
+         continue;
+      }
+
+      std::map< std::string, std::pair<size_t, size_t> >::iterator found =
+         batchIndices.find(setting.getDeviceLabel());
+      if (found == batchIndices.end())
       {
-         // normal processing
          boost::shared_ptr<DeviceInstance> pDevice =
             deviceManager_->GetDevice(setting.getDeviceLabel());
-         mm::DeviceModuleLockGuard guard(pDevice);
-         try
-         {
-            pDevice->SetProperty(setting.getPropertyName(),
-                  setting.getPropertyValue());
-
-            {
-               MMThreadGuard scg(stateCacheLock_);
-               stateCache_.addSetting(setting);
-            }
-         }
-         catch (const CMMError&)
+         LoadedDeviceAdapter* module = pDevice->GetAdapterModule().get();
+         std::map<LoadedDeviceAdapter*, size_t>::iterator moduleIt =
+            moduleIndices.find(module);
+         if (moduleIt == moduleIndices.end())
          {
-            failedProps.push_back(setting);
-            error = true;
+            moduleIt = moduleIndices.insert(std::make_pair(module,
+                     moduleBatches.size())).first;
+            moduleBatches.push_back(std::vector<DeviceSettings>());
          }
+         std::vector<DeviceSettings>& batches = moduleBatches[moduleIt->second];
+         found = batchIndices.insert(std::make_pair(setting.getDeviceLabel(),
+                  std::make_pair(moduleIt->second, batches.size()))).first;
+         batches.push_back(DeviceSettings(pDevice,
+                  std::vector<PropertySetting>()));
+      }
+      moduleBatches[found->second.first][found->second.second].second.
+         push_back(setting);
+   }
+
+   // Apply the batches of each module in order, on a thread per module other
+   // than the first (which uses the calling thread)
+   std::vector< std::vector<PropertySetting> > moduleFailed(moduleBatches.size());
+   std::vector<std::string> moduleErrors(moduleBatches.size());
+   boost::thread_group threads;
+   for (size_t m = 1; m < moduleBatches.size(); ++m)
+   {
+      threads.create_thread(boost::bind(&CMMCore::applyModuleSettings, this,
+               &moduleBatches[m], &moduleFailed[m], &moduleErrors[m]));
+   }
+   if (!moduleBatches.empty())
+      applyModuleSettings(&moduleBatches[0], &moduleFailed[0], &moduleErrors[0]);
+   threads.join_all();
+
+   std::vector<PropertySetting> failedProps;
+   std::string errorString;
+   for (size_t m = 0; m < moduleBatches.size(); ++m)
+   {
+      failedProps.insert(failedProps.end(), moduleFailed[m].begin(),
+            moduleFailed[m].end());
+      if (!moduleErrors[m].empty())
+         errorString = moduleErrors[m];
+   }
+   if (failedProps.empty() && deferred.empty())
+      return;
+
+   // Retry the failed settings after the others, in the original order,
+   // together with those deferred from the start
+   std::set<std::string> retryKeys;
+   for (size_t i = 0; i < failedProps.size(); ++i)
+      retryKeys.insert(failedProps[i].getKey());
+   std::vector<PropertySetting> remaining;
+   for (size_t i=0; i<config.size(); i++)
+   {
+      PropertySetting setting = config.getSetting(i);
+      if (retryKeys.count(setting.getKey()) || deferredKeys.count(setting.getKey()))
+         remaining.push_back(setting);
+   }
+
+   for (;;)
+   {
+      std::vector<PropertySetting> failed;
+      errorString.clear();
+      for (size_t i = 0; i < remaining.size(); ++i)
+      {
+         applyDeviceSettings(
+               deviceManager_->GetDevice(remaining[i].getDeviceLabel()),
+               std::vector<PropertySetting>(1, remaining[i]),
+               &failed, &errorString);
+      }
+      if (failed.empty() || failed.size() == remaining.size())
+      {
+         remaining.swap(failed);
+         break;
       }
+      remaining.swap(failed);
    }
-   if (error) 
+
+   // Remember the settings that needed a retry
    {
-      string errorString;
-      while (failedProps.size() > (unsigned) applyProperties(failedProps, errorString) )
+      std::set<std::string> stillFailing;
+      for (size_t i = 0; i < remaining.size(); ++i)
+         stillFailing.insert(remaining[i].getKey());
+      MMThreadGuard g(deferredSettingsLock_);
+      for (std::set<std::string>::const_iterator it = retryKeys.begin(),
+            end = retryKeys.end(); it != end; ++it)
       {
-         if (failedProps.size() == 0)
-            return;
+         if (!stillFailing.count(*it))
+            deferredSettings_.insert(*it);
       }
+   }
 
+   if (!remaining.empty())
+   {
+      for (size_t i = 0; i < remaining.size(); ++i)
+         logError(remaining[i].getDeviceLabel().c_str(), errorString.c_str());
       throw CMMError(errorString.c_str(), MMERR_DEVICE_GENERIC);
    }
 }
 
 /*
  * Helper function for applyConfiguration
- * It is possible that setting certain properties failed because they are dependent
- * on other properties to be set first. As a workaround, continue to apply these failed
- * properties until there are none left or none succeed
- * returns number of properties successfully set
+ * Applies the batches of the devices of one module, in order
  */
-int CMMCore::applyProperties(vector<PropertySetting>& props, string& lastError)
+void CMMCore::applyModuleSettings(const std::vector<DeviceSettings>* batches,
+      std::vector<PropertySetting>* failed, std::string* lastError)
 {
-  // int succeeded = 0;
-   vector<PropertySetting> failedProps;
-   for (size_t i=0; i<props.size(); i++)
+   for (size_t i = 0; i < batches->size(); i++)
    {
-      // normal processing
-      boost::shared_ptr<DeviceInstance> pDevice =
-         deviceManager_->GetDevice(props[i].getDeviceLabel());
-      mm::DeviceModuleLockGuard guard(pDevice);
+      // This may run on a thread of its own, so nothing must escape
       try
       {
-         pDevice->SetProperty(props[i].getPropertyName(),
-               props[i].getPropertyValue());
+         applyDeviceSettings((*batches)[i].first, (*batches)[i].second,
+               failed, lastError);
+      }
+      catch (const CMMError& e)
+      {
+         failed->insert(failed->end(), (*batches)[i].second.begin(),
+               (*batches)[i].second.end());
+         *lastError = e.getFullMsg();
+      }
+      catch (const std::exception& e)
+      {
+         failed->insert(failed->end(), (*batches)[i].second.begin(),
+               (*batches)[i].second.end());
+         *lastError = e.what();
+      }
+      catch (...)
+      {
+         failed->insert(failed->end(), (*batches)[i].second.begin(),
+               (*batches)[i].second.end());
+         *lastError = getCoreErrorText(MMERR_UnhandledException);
+      }
+   }
+}
+
+/*
+ * Helper function for applyConfiguration
+ * Sets the given properties of one device, as a batch if the device supports
+ * it. Settings that fail are appended to failed, and the last error message
+ * is stored in lastError.
+ */
+void CMMCore::applyDeviceSettings(boost::shared_ptr<DeviceInstance> pDevice,
+      const std::vector<PropertySetting>& settings,
+      std::vector<PropertySetting>* failed, std::string* lastError)
+{
+   mm::DeviceModuleLockGuard guard(pDevice);
 
+   if (settings.size() > 1)
+   {
+      std::vector<std::string> names;
+      std::vector<std::string> values;
+      for (size_t i = 0; i < settings.size(); i++)
+      {
+         names.push_back(settings[i].getPropertyName());
+         values.push_back(settings[i].getPropertyValue());
+      }
+      try
+      {
+         if (pDevice->SetProperties(names, values))
          {
-            MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(props[i]);
+            for (size_t i = 0; i < settings.size(); i++)
+               updateStateCache(settings[i]);
+            return;
          }
       }
       catch (const CMMError& e)
       {
-         failedProps.push_back(props[i]);
-         std::string message = e.getFullMsg();
-         logError(props[i].getDeviceLabel().c_str(), message.c_str());
-         lastError = message;
+         // Find out which one failed
+         LOG_DEBUG(coreLogger_) << "Setting properties of " <<
+            pDevice->GetLabel() << " in one batch failed (" <<
+            e.getFullMsg() << "); will set them one by one";
+      }
+      catch (const std::exception& e)
+      {
+         LOG_DEBUG(coreLogger_) << "Setting properties of " <<
+            pDevice->GetLabel() << " in one batch failed (" <<
+            e.what() << "); will set them one by one";
+      }
+      catch (...)
+      {
+         LOG_DEBUG(coreLogger_) << "Setting properties of " <<
+            pDevice->GetLabel() << " in one batch failed; will set them "
+            "one by one";
       }
    }
-   props = failedProps;
-   return (int) failedProps.size();
-}
 
+   for (size_t i = 0; i < settings.size(); i++)
+   {
+      try
+      {
+         pDevice->SetProperty(settings[i].getPropertyName(),
+               settings[i].getPropertyValue());
+
+         updateStateCache(settings[i]);
+      }
+      catch (const CMMError& e)
+      {
+         failed->push_back(settings[i]);
+         *lastError = e.getFullMsg();
+      }
+      catch (const std::exception& e)
+      {
+         failed->push_back(settings[i]);
+         *lastError = e.what();
+      }
+      catch (...)
+      {
+         failed->push_back(settings[i]);
+         *lastError = getCoreErrorText(MMERR_UnhandledException);
+      }
+   }
+}
 
 
 
@@ -7498,4 +8886,186 @@ std::vector<std::string> CMMCore::getMACAddresses(void)
    return retv;
 }
 
+/**
+ * Returns a snapshot of the performance metrics as text, one metric per line
+ * (the name and the value, separated by a tab).
+ *
+ * The metrics are:
+ * - Core.Buffer.*: frames held in the shared circular buffer, its peak and
+ *   capacity; Device.<camera>.Buffer.* for cameras with their own buffer
+ * - Core.Logging.*: log lines waiting to be written, their peak, and entries
+ *   dropped because the queue was full
+ * - Device.<label>.GetPropertyLatency, SetPropertyLatency and WaitLatency
+ *   (time spent in waitForDevice() and similar) for each device
+ * - Device.<camera>.FramesInserted, FramesOverflowed (rejected because the
+ *   buffer was full), FramesDropped (by the overflow policy) and
+ *   InsertImageLatency
+ * - Device.<port>.SerialRoundTrip: from sending a command to receiving the
+ *   answer
+ *
+ * Latencies are histograms reported as .Count, .Mean, .P50, .P90, .P99 and
+ * .Max, in microseconds. Percentiles are upper bounds of power-of-2 buckets.
+ *
+ * The metrics are recorded without locking and are always on.
+ */
+std::string CMMCore::getPerformanceMetrics()
+{
+   mm::MetricValues values;
+   collectPerformanceMetrics(values);
+   return mm::FormatMetrics(values);
+}
+
+/**
+ * Returns the names of the performance metrics currently available.
+ * @see getPerformanceMetrics()
+ */
+std::vector<std::string> CMMCore::getPerformanceMetricNames()
+{
+   mm::MetricValues values;
+   collectPerformanceMetrics(values);
+   std::vector<std::string> names;
+   names.reserve(values.size());
+   for (mm::MetricValues::const_iterator it = values.begin(), end = values.end();
+         it != end; ++it)
+      names.push_back(it->first);
+   return names;
+}
+
+/**
+ * Returns the current value of a performance metric.
+ * @see getPerformanceMetrics()
+ */
+double CMMCore::getPerformanceMetric(const char* name) throw (CMMError)
+{
+   if (!name)
+      throw CMMError("Null performance metric name", MMERR_NullPointerException);
+   mm::MetricValues values;
+   collectPerformanceMetrics(values);
+   for (mm::MetricValues::const_iterator it = values.begin(), end = values.end();
+         it != end; ++it)
+   {
+      if (it->first == name)
+         return it->second;
+   }
+   throw CMMError("No performance metric named " + ToQuotedString(name));
+}
+
+/**
+ * Restarts the counters, histograms and peaks of the performance metrics.
+ * Dropped frame and log entry counts are not affected.
+ */
+void CMMCore::resetPerformanceMetrics()
+{
+   vector<string> labels = deviceManager_->GetDeviceList();
+   for (vector<string>::const_iterator it = labels.begin(), end = labels.end();
+         it != end; ++it)
+   {
+      boost::shared_ptr<DeviceInstance> device;
+      try
+      {
+         device = deviceManager_->GetDevice(*it);
+      }
+      catch (const CMMError&)
+      {
+         continue; // Unloaded since the list was taken
+      }
+      device->GetMetrics().Reset();
+
+      boost::shared_ptr<CameraInstance> camera =
+         boost::dynamic_pointer_cast<CameraInstance>(device);
+      if (camera)
+      {
+         boost::shared_ptr<CircularBuffer> ownBuffer =
+            camera->GetSequenceBuffer();
+         if (ownBuffer)
+            ownBuffer->ResetPeakImageCount();
+      }
+   }
+
+   if (cbuf_)
+      cbuf_->ResetPeakImageCount();
 
+   logManager_->ResetPeakQueuedPacketCount();
+
+   LOG_INFO(coreLogger_) << "Reset performance metrics";
+}
+
+void CMMCore::collectPerformanceMetrics(mm::MetricValues& values)
+{
+   using mm::AppendMetric;
+
+   if (cbuf_)
+   {
+      AppendMetric(values, "Core.Buffer.ImageCount",
+            static_cast<double>(cbuf_->GetRemainingImageCount()));
+      AppendMetric(values, "Core.Buffer.PeakImageCount",
+            static_cast<double>(cbuf_->GetPeakImageCount()));
+      AppendMetric(values, "Core.Buffer.Capacity",
+            static_cast<double>(cbuf_->GetSize()));
+   }
+
+   AppendMetric(values, "Core.Logging.QueuedLines",
+         static_cast<double>(logManager_->GetQueuedPacketCount()));
+   AppendMetric(values, "Core.Logging.PeakQueuedLines",
+         static_cast<double>(logManager_->GetPeakQueuedPacketCount()));
+   AppendMetric(values, "Core.Logging.DroppedEntries",
+         static_cast<double>(logManager_->GetDroppedEntryCount()));
+
+   vector<string> labels = deviceManager_->GetDeviceList();
+   for (vector<string>::const_iterator it = labels.begin(), end = labels.end();
+         it != end; ++it)
+   {
+      boost::shared_ptr<DeviceInstance> device;
+      try
+      {
+         device = deviceManager_->GetDevice(*it);
+      }
+      catch (const CMMError&)
+      {
+         continue; // Unloaded since the list was taken
+      }
+      const mm::DeviceMetrics& metrics = device->GetMetrics();
+      const std::string prefix = "Device." + *it + ".";
+
+      AppendMetric(values, prefix + "GetPropertyLatency",
+            metrics.getPropertyLatency);
+      AppendMetric(values, prefix + "SetPropertyLatency",
+            metrics.setPropertyLatency);
+      AppendMetric(values, prefix + "WaitLatency", metrics.waitLatency);
+
+      boost::shared_ptr<CameraInstance> camera =
+         boost::dynamic_pointer_cast<CameraInstance>(device);
+      if (camera)
+      {
+         AppendMetric(values, prefix + "FramesInserted",
+               static_cast<double>(metrics.framesInserted.Get()));
+         AppendMetric(values, prefix + "FramesOverflowed",
+               static_cast<double>(metrics.framesOverflowed.Get()));
+         boost::shared_ptr<CircularBuffer> buffer = getSequenceBuffer(camera);
+         if (buffer)
+         {
+            AppendMetric(values, prefix + "FramesDropped",
+                  static_cast<double>(buffer->GetDroppedFrameCount(*it)));
+         }
+         AppendMetric(values, prefix + "InsertImageLatency",
+               metrics.insertImageLatency);
+
+         boost::shared_ptr<CircularBuffer> ownBuffer =
+            camera->GetSequenceBuffer();
+         if (ownBuffer)
+         {
+            AppendMetric(values, prefix + "Buffer.ImageCount",
+                  static_cast<double>(ownBuffer->GetRemainingImageCount()));
+            AppendMetric(values, prefix + "Buffer.PeakImageCount",
+                  static_cast<double>(ownBuffer->GetPeakImageCount()));
+            AppendMetric(values, prefix + "Buffer.Capacity",
+                  static_cast<double>(ownBuffer->GetSize()));
+         }
+      }
+      else if (boost::dynamic_pointer_cast<SerialInstance>(device))
+      {
+         AppendMetric(values, prefix + "SerialRoundTrip",
+               metrics.serialRoundTrip);
+      }
+   }
+}
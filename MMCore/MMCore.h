@@ -60,6 +60,7 @@
 #include "CoreUtils.h"
 #include "Error.h"
 #include "ErrorCodes.h"
+#include "FrameHandle.h"
 #include "Logging/Logger.h"
 
 #include <boost/shared_ptr.hpp>
@@ -68,6 +69,7 @@
 #include <cstring>
 #include <deque>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -108,8 +110,15 @@ class XYStageInstance;
 class CMMCore;
 
 namespace mm {
+   class AsyncSnap;
+   class DeviceInitializer;
    class DeviceManager;
+   class FrameBuffer;
+   class FrameSignal;
+   class IdleSignal;
    class LogManager;
+   struct RingMemoryOptions;
+   class StateCache;
 } // namespace mm
 
 typedef unsigned int* imgRGB32;
@@ -149,6 +158,7 @@ public:
    void unloadAllDevices() throw (CMMError);
    void initializeAllDevices() throw (CMMError);
    void initializeDevice(const char* label) throw (CMMError);
+   double getDeviceInitializationTime(const char* label) throw (CMMError);
    void reset() throw (CMMError);
 
    void unloadLibrary(const char* moduleName) throw (CMMError);
@@ -160,6 +170,7 @@ public:
    std::string getVersionInfo() const;
    std::string getAPIVersionInfo() const;
    Configuration getSystemState();
+   Configuration getSystemState(double deviceTimeoutMs);
    void setSystemState(const Configuration& conf);
    Configuration getConfigState(const char* group, const char* config) throw (CMMError);
    Configuration getConfigGroupState(const char* group) throw (CMMError);
@@ -185,6 +196,15 @@ public:
    int startSecondaryLogFile(const char* filename, bool enableDebug,
          bool truncate = true, bool synchronous = false) throw (CMMError);
    void stopSecondaryLogFile(int handle) throw (CMMError);
+   int startBinaryLogFile(const char* filename, bool enableDebug,
+         long maxFileSize, int maxBackups) throw (CMMError);
+   void setPrimaryLogRotation(long maxFileSize, int maxAgeSeconds,
+         int keepCount, bool compress) throw (CMMError);
+   void setSecondaryLogRotation(int handle, long maxFileSize,
+         int maxAgeSeconds, int keepCount, bool compress) throw (CMMError);
+
+   void setLogFlushInterval(int intervalMs) throw (CMMError);
+   long getDroppedLogEntryCount();
 
    ///@}
 
@@ -285,6 +305,8 @@ public:
     */
    ///@{
    Configuration getSystemStateCache() const;
+   unsigned long getSystemStateCacheVersion() const;
+   Configuration getSystemStateCacheChangesSince(unsigned long version) const throw (CMMError);
    void updateSystemStateCache();
    std::string getPropertyFromCache(const char* deviceLabel,
          const char* propName) const throw (CMMError);
@@ -374,6 +396,12 @@ public:
    double getExposure(const char* label) throw (CMMError);
 
    void snapImage() throw (CMMError);
+   long snapImageAsync() throw (CMMError);
+   long snapImageAsync(const char* cameraLabel) throw (CMMError);
+   bool isSnapComplete(long handle) throw (CMMError);
+   void waitForSnap(long handle) throw (CMMError);
+   FrameHandle getSnapImage(long handle, unsigned channel) throw (CMMError);
+   void releaseSnap(long handle) throw (CMMError);
    void* getImage() throw (CMMError);
    void* getImage(unsigned numChannel) throw (CMMError);
 
@@ -392,6 +420,9 @@ public:
 
    void setAutoShutter(bool state);
    bool getAutoShutter();
+   void setPipelinedSnap(bool state);
+   bool getPipelinedSnap();
+   double getLastSnapPhaseTime(const char* phase) throw (CMMError);
    void setShutterOpen(bool state) throw (CMMError);
    bool getShutterOpen() throw (CMMError);
    void setShutterOpen(const char* shutterLabel, bool state) throw (CMMError);
@@ -418,6 +449,12 @@ public:
    void* getNBeforeLastImageMD(unsigned long n, Metadata& md)
       const throw (CMMError);
    void* popNextImageMD(Metadata& md) throw (CMMError);
+   FrameHandle popNextFrameHandle() throw (CMMError);
+   FrameHandle popNextFrameHandle(unsigned channel) throw (CMMError);
+   std::vector<FrameHandle> popNextFrameHandles(unsigned maxCount,
+         long timeoutMs) throw (CMMError);
+   bool waitForNextImage(long timeoutMs);
+   int getImageNotificationDescriptor();
 
    long getRemainingImageCount();
    long getBufferTotalCapacity();
@@ -427,6 +464,28 @@ public:
    unsigned getCircularBufferMemoryFootprint();
    void initializeCircularBuffer() throw (CMMError);
    void clearCircularBuffer() throw (CMMError);
+   void enableLockFreeCircularBuffer(bool enable) throw (CMMError);
+   bool isLockFreeCircularBufferEnabled() const;
+   void enableCircularBufferHugePages(bool enable) throw (CMMError);
+   bool isCircularBufferHugePagesEnabled() const;
+   void enableCircularBufferMemoryLocking(bool enable) throw (CMMError);
+   bool isCircularBufferMemoryLockingEnabled() const;
+   void setCircularBufferNumaNode(int node) throw (CMMError);
+   int getCircularBufferNumaNode() const;
+   void setCircularBufferOverflowPolicy(const char* policy,
+         long blockTimeoutMs = 1000) throw (CMMError);
+   std::string getCircularBufferOverflowPolicy() const;
+   long getDroppedImageCount(const char* cameraLabel) throw (CMMError);
+
+   void enableCameraCircularBuffer(const char* cameraLabel, bool enable)
+      throw (CMMError);
+   bool isCameraCircularBufferEnabled(const char* cameraLabel)
+      throw (CMMError);
+   long getRemainingImageCount(const char* cameraLabel) throw (CMMError);
+   void clearCircularBuffer(const char* cameraLabel) throw (CMMError);
+   FrameHandle popNextCameraFrameHandle(const char* cameraLabel)
+      throw (CMMError);
+   FrameHandle popNextTimeOrderedFrameHandle() throw (CMMError);
 
    bool isExposureSequenceable(const char* cameraLabel) throw (CMMError);
    void startExposureSequence(const char* cameraLabel) throw (CMMError);
@@ -627,6 +686,17 @@ public:
    std::vector<std::string> getLoadedPeripheralDevices(const char* hubLabel) throw (CMMError);
    ///@}
 
+   /** \name Performance metrics.
+    *
+    * Counters and latency histograms kept by the Core while it runs.
+    */
+   ///@{
+   std::string getPerformanceMetrics();
+   std::vector<std::string> getPerformanceMetricNames();
+   double getPerformanceMetric(const char* name) throw (CMMError);
+   void resetPerformanceMetrics();
+   ///@}
+
    /** \name Miscellaneous. */
    ///@{
    std::string getUserId() const;
@@ -648,7 +718,7 @@ private:
    mm::logging::Logger appLogger_;
    mm::logging::Logger coreLogger_;
 
-   bool everSnapped_;
+   bool everSnapped_; // Guarded by snapStateLock_
 
    boost::weak_ptr<CameraInstance> currentCameraDevice_;
    boost::weak_ptr<ShutterInstance> currentShutterDevice_;
@@ -663,23 +733,43 @@ private:
    long pollingIntervalMs_;
    long timeoutMs_;
    bool autoShutter_;
+   bool pipelinedSnap_;
+   // Shutter closed by a pipelined snapImage() but not yet waited for, and
+   // the duration of each phase of the last snap (in ms)
+   boost::weak_ptr<DeviceInstance> closingShutter_;
+   std::map<std::string, double> lastSnapTimingsMs_;
+   int snapShutterUsers_; // Snaps in progress that hold the auto-shutter open
+   MMThreadLock snapShutterLock_; // Held while changing snapShutterUsers_ and opening/closing the shutter
+   MMThreadLock snapStateLock_;
+   std::map< long, boost::shared_ptr<mm::AsyncSnap> > asyncSnaps_;
+   long nextAsyncSnapHandle_;
+   MMThreadLock asyncSnapLock_;
    MM::Core* callback_;                 // core services for devices
    ConfigGroupCollection* configGroups_;
    CorePropertyCollection* properties_;
    MMEventCallback* externalCallback_;  // notification hook to the higher layer (e.g. GUI)
    PixelSizeConfigGroup* pixelSizeGroup_;
-   CircularBuffer* cbuf_;
+   boost::shared_ptr<CircularBuffer> cbuf_; // Shared by cameras without their own buffer
+   boost::shared_ptr<mm::FrameSignal> frameSignal_; // Attached to all circular buffers
+   boost::shared_ptr<mm::IdleSignal> idleSignal_; // Notified by OnDeviceIdle()
 
    std::vector< boost::weak_ptr<DeviceInstance> > imageSynchroDevices_;
    boost::shared_ptr<CPluginManager> pluginManager_;
    boost::shared_ptr<mm::DeviceManager> deviceManager_;
+   boost::shared_ptr<mm::DeviceInitializer> deviceInitializer_;
    std::map<int, std::string> errorText_;
    CPropBlockMap propBlocks_;
 
-   // Must be unlocked when calling MMEventCallback or calling device methods
-   // or acquiring a module lock
-   mutable MMThreadLock stateCacheLock_;
-   mutable Configuration stateCache_; // Synchronized by stateCacheLock_
+   boost::shared_ptr<mm::StateCache> stateCache_;
+   // Guards the memoized current presets of the config groups (see
+   // getCurrentConfig(const char*, bool)). Must be unlocked when calling
+   // MMEventCallback or calling device methods or acquiring a module lock.
+   mutable MMThreadLock presetMatchLock_;
+
+   // Keys of settings that have failed unless applied after the other
+   // settings of a configuration (see applyConfiguration())
+   std::set<std::string> deferredSettings_;
+   MMThreadLock deferredSettingsLock_;
 
    MMThreadLock* pPostedErrorsLock_;
    mutable std::deque<std::pair< int, std::string> > postedErrors_;
@@ -699,9 +789,18 @@ private:
    bool IsCoreDeviceLabel(const char* label) const throw (CMMError);
 
    void applyConfiguration(const Configuration& config) throw (CMMError);
-   int applyProperties(std::vector<PropertySetting>& props, std::string& lastError);
+   typedef std::pair< boost::shared_ptr<DeviceInstance>,
+           std::vector<PropertySetting> > DeviceSettings;
+   void applyModuleSettings(const std::vector<DeviceSettings>* batches,
+         std::vector<PropertySetting>* failed, std::string* lastError);
+   void applyDeviceSettings(boost::shared_ptr<DeviceInstance> pDevice,
+         const std::vector<PropertySetting>& settings,
+         std::vector<PropertySetting>* failed, std::string* lastError);
    void waitForDevice(boost::shared_ptr<DeviceInstance> pDev) throw (CMMError);
+   void waitForDevices(std::vector< boost::shared_ptr<DeviceInstance> > devices) throw (CMMError);
    Configuration getConfigGroupState(const char* group, bool fromCache) throw (CMMError);
+   std::string getCurrentConfig(const char* groupName, bool fromCache) throw (CMMError);
+   void updateStateCache(const PropertySetting& setting);
    std::string getDeviceErrorText(int deviceCode, boost::shared_ptr<DeviceInstance> pDevice);
    std::string getDeviceName(boost::shared_ptr<DeviceInstance> pDev);
    void logError(const char* device, const char* msg);
@@ -709,6 +808,25 @@ private:
    void assignDefaultRole(boost::shared_ptr<DeviceInstance> pDev);
    void updateCoreProperty(const char* propName, MM::DeviceType devType) throw (CMMError);
    void loadSystemConfigurationImpl(const char* fileName) throw (CMMError);
+   boost::shared_ptr<CircularBuffer> getSequenceBuffer(boost::shared_ptr<CameraInstance> camera);
+   std::vector< boost::shared_ptr<CameraInstance> > getCamerasWithOwnBuffer();
+   std::vector< boost::shared_ptr<CircularBuffer> > getAllSequenceBuffers();
+   bool waitForImageInBuffers(const std::vector< boost::shared_ptr<CircularBuffer> >& buffers, long timeoutMs);
+   void initializeSequenceBuffer(boost::shared_ptr<CameraInstance> camera) throw (CMMError);
+   FrameHandle popFrameHandle(boost::shared_ptr<CircularBuffer> buffer, unsigned channel) throw (CMMError);
+   void setCircularBufferMemoryOptions(const mm::RingMemoryOptions& options) throw (CMMError);
+   void checkCircularBuffersIdle() throw (CMMError);
+   void snapImage(boost::shared_ptr<CameraInstance> camera,
+         boost::shared_ptr<mm::FrameBuffer>* frame = 0) throw (CMMError);
+   void acquireSnapShutter(boost::shared_ptr<ShutterInstance> shutter) throw (CMMError);
+   bool releaseSnapShutter(boost::shared_ptr<ShutterInstance> shutter) throw (CMMError);
+   void releaseSnapShutterUse(boost::shared_ptr<ShutterInstance> heldShutter);
+   boost::shared_ptr<mm::FrameBuffer> snapFrame(boost::shared_ptr<CameraInstance> camera) throw (CMMError);
+   boost::shared_ptr<mm::FrameBuffer> copySnappedFrame(boost::shared_ptr<CameraInstance> camera) throw (CMMError);
+   boost::shared_ptr<mm::AsyncSnap> getAsyncSnap(long handle) throw (CMMError);
+   void releaseAllAsyncSnaps();
+   void collectPerformanceMetrics(
+         std::vector< std::pair<std::string, double> >& values);
 };
 
 #endif //_MMCORE_H_
@@ -0,0 +1,260 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          Metrics.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Lock-free performance counters and latency histograms
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#include <pthread.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+
+namespace mm {
+
+long long MonotonicMicroseconds()
+{
+#ifdef _WIN32
+   LARGE_INTEGER count, frequency;
+   ::QueryPerformanceCounter(&count);
+   ::QueryPerformanceFrequency(&frequency);
+   return static_cast<long long>(count.QuadPart / frequency.QuadPart *
+         1000000 + count.QuadPart % frequency.QuadPart * 1000000 /
+         frequency.QuadPart);
+#elif defined(__APPLE__)
+   mach_timebase_info_data_t timebase;
+   ::mach_timebase_info(&timebase);
+   return static_cast<long long>(::mach_absolute_time() * timebase.numer /
+         timebase.denom / 1000);
+#else
+   timespec ts;
+   ::clock_gettime(CLOCK_MONOTONIC, &ts);
+   return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+unsigned CurrentMetricShard()
+{
+   std::size_t id = 0;
+#ifdef _WIN32
+   id = ::GetCurrentThreadId();
+#else
+   // pthread_t is opaque (an integer or a pointer)
+   const pthread_t self = ::pthread_self();
+   std::memcpy(&id, &self, std::min(sizeof(id), sizeof(self)));
+#endif
+   // Fibonacci hashing: the top bits of the product depend on all bits of
+   // the id
+   const std::size_t multiplier =
+      static_cast<std::size_t>(0x9E3779B97F4A7C15ULL);
+   return static_cast<unsigned>((id * multiplier) >>
+         (sizeof(std::size_t) * 8 - MetricShardBits));
+}
+
+
+MetricCounter::MetricCounter()
+{
+   Reset();
+}
+
+unsigned long long MetricCounter::Get() const
+{
+   unsigned long long total = 0;
+   for (unsigned i = 0; i < MetricShardCount; ++i)
+      total += shards_[i].value.load(boost::memory_order_relaxed);
+   return total;
+}
+
+// Increments made concurrently with Reset() may or may not be kept
+void MetricCounter::Reset()
+{
+   for (unsigned i = 0; i < MetricShardCount; ++i)
+      shards_[i].value.store(0, boost::memory_order_relaxed);
+}
+
+
+namespace {
+
+unsigned BucketForDuration(long long us)
+{
+   if (us < 1)
+      return 0;
+   // Bit length of us, by halving
+   unsigned long long v = static_cast<unsigned long long>(us);
+   unsigned bits = 1;
+   for (unsigned shift = 32; shift > 0; shift /= 2)
+   {
+      if (v >> shift)
+      {
+         v >>= shift;
+         bits += shift;
+      }
+   }
+   return std::min(bits, LatencyHistogram::BucketCount - 1);
+}
+
+} // anonymous namespace
+
+LatencyHistogram::LatencyHistogram()
+{
+   Reset();
+}
+
+void LatencyHistogram::Record(long long us)
+{
+   if (us < 0)
+      us = 0;
+   Shard& shard = shards_[CurrentMetricShard()];
+   shard.buckets[BucketForDuration(us)].fetch_add(1,
+         boost::memory_order_relaxed);
+   shard.count.fetch_add(1, boost::memory_order_relaxed);
+   shard.sumUs.fetch_add(static_cast<unsigned long long>(us),
+         boost::memory_order_relaxed);
+   long long max = shard.maxUs.load(boost::memory_order_relaxed);
+   while (us > max && !shard.maxUs.compare_exchange_weak(max, us,
+            boost::memory_order_relaxed))
+      ;
+}
+
+LatencyHistogram::Summary LatencyHistogram::GetSummary() const
+{
+   Summary summary;
+   summary.count = 0;
+   summary.buckets.assign(BucketCount, 0);
+   unsigned long long sumUs = 0;
+   long long maxUs = 0;
+   for (unsigned i = 0; i < MetricShardCount; ++i)
+   {
+      const Shard& shard = shards_[i];
+      for (unsigned b = 0; b < BucketCount; ++b)
+         summary.buckets[b] += shard.buckets[b].load(boost::memory_order_relaxed);
+      summary.count += shard.count.load(boost::memory_order_relaxed);
+      sumUs += shard.sumUs.load(boost::memory_order_relaxed);
+      maxUs = std::max(maxUs, shard.maxUs.load(boost::memory_order_relaxed));
+   }
+   summary.meanUs = summary.count > 0 ?
+      static_cast<double>(sumUs) / static_cast<double>(summary.count) : 0.0;
+   summary.maxUs = static_cast<double>(maxUs);
+   return summary;
+}
+
+void LatencyHistogram::Reset()
+{
+   for (unsigned i = 0; i < MetricShardCount; ++i)
+   {
+      Shard& shard = shards_[i];
+      for (unsigned b = 0; b < BucketCount; ++b)
+         shard.buckets[b].store(0, boost::memory_order_relaxed);
+      shard.count.store(0, boost::memory_order_relaxed);
+      shard.sumUs.store(0, boost::memory_order_relaxed);
+      shard.maxUs.store(0, boost::memory_order_relaxed);
+   }
+}
+
+double LatencyHistogram::Summary::PercentileUs(double fraction) const
+{
+   // The shards are read one after another, so the buckets may not add up
+   // to count exactly
+   unsigned long long total = 0;
+   for (size_t b = 0; b < buckets.size(); ++b)
+      total += buckets[b];
+   if (total == 0)
+      return 0.0;
+
+   const double target = fraction * static_cast<double>(total);
+   unsigned long long cumulative = 0;
+   for (size_t b = 0; b < buckets.size(); ++b)
+   {
+      cumulative += buckets[b];
+      if (static_cast<double>(cumulative) >= target)
+      {
+         if (b + 1 == buckets.size())
+            return maxUs;
+         const double upperBound =
+            static_cast<double>(1ULL << b); // 2^b; 1 for bucket 0
+         return std::min(upperBound, maxUs);
+      }
+   }
+   return maxUs;
+}
+
+
+void DeviceMetrics::Reset()
+{
+   getPropertyLatency.Reset();
+   setPropertyLatency.Reset();
+   waitLatency.Reset();
+   serialRoundTrip.Reset();
+   framesInserted.Reset();
+   framesOverflowed.Reset();
+   insertImageLatency.Reset();
+}
+
+
+void AppendMetric(MetricValues& values, const std::string& name,
+      double value)
+{
+   values.push_back(std::make_pair(name, value));
+}
+
+void AppendMetric(MetricValues& values, const std::string& name,
+      const LatencyHistogram& histogram)
+{
+   const LatencyHistogram::Summary summary = histogram.GetSummary();
+   AppendMetric(values, name + ".Count", static_cast<double>(summary.count));
+   if (summary.count == 0)
+      return;
+   AppendMetric(values, name + ".Mean", summary.meanUs);
+   AppendMetric(values, name + ".P50", summary.PercentileUs(0.5));
+   AppendMetric(values, name + ".P90", summary.PercentileUs(0.9));
+   AppendMetric(values, name + ".P99", summary.PercentileUs(0.99));
+   AppendMetric(values, name + ".Max", summary.maxUs);
+}
+
+void AppendMetric(MetricValues& values, const std::string& name,
+      const PeakGauge& gauge)
+{
+   AppendMetric(values, name + ".Current",
+         static_cast<double>(gauge.GetCurrent()));
+   AppendMetric(values, name + ".Peak", static_cast<double>(gauge.GetPeak()));
+}
+
+std::string FormatMetrics(const MetricValues& values)
+{
+   std::ostringstream strm;
+   strm.precision(12); // Keep large counts out of exponential notation
+   for (MetricValues::const_iterator it = values.begin(), end = values.end();
+         it != end; ++it)
+   {
+      strm << it->first << '\t' << it->second << '\n';
+   }
+   return strm.str();
+}
+
+} // namespace mm
@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          Metrics.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Lock-free performance counters and latency histograms
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/atomic.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mm {
+
+// Microseconds since an arbitrary point, from a monotonic clock
+long long MonotonicMicroseconds();
+
+// Recording threads are spread over this many shards (each on its own cache
+// line), so that threads recording the same metric rarely contend
+const unsigned MetricShardBits = 3;
+const unsigned MetricShardCount = 1 << MetricShardBits;
+
+// The shard for the calling thread
+unsigned CurrentMetricShard();
+
+/**
+ * An event counter. Add() is lock-free; Get() sums the shards.
+ */
+class MetricCounter : boost::noncopyable
+{
+public:
+   MetricCounter();
+
+   void Add(unsigned long long n = 1)
+   {
+      shards_[CurrentMetricShard()].value.fetch_add(n,
+            boost::memory_order_relaxed);
+   }
+
+   unsigned long long Get() const;
+   void Reset();
+
+private:
+   struct Shard
+   {
+      boost::atomic<unsigned long long> value;
+      char padding[64 - sizeof(boost::atomic<unsigned long long>)];
+   };
+   Shard shards_[MetricShardCount];
+};
+
+/**
+ * A histogram of durations, with power-of-2 buckets in microseconds.
+ * Record() is lock-free.
+ */
+class LatencyHistogram : boost::noncopyable
+{
+public:
+   // Bucket 0 holds durations under 1 us; bucket i holds [2^(i-1), 2^i) us;
+   // the last bucket has no upper bound.
+   static const unsigned BucketCount = 32;
+
+   struct Summary
+   {
+      unsigned long long count;
+      double meanUs;
+      double maxUs;
+      std::vector<unsigned long long> buckets;
+
+      // Upper bound of the bucket holding the given fraction of durations
+      // (e.g. 0.99), limited to the maximum
+      double PercentileUs(double fraction) const;
+   };
+
+   LatencyHistogram();
+
+   void Record(long long us);
+   Summary GetSummary() const;
+   void Reset();
+
+private:
+   struct Shard
+   {
+      boost::atomic<unsigned long long> buckets[BucketCount];
+      boost::atomic<unsigned long long> count;
+      boost::atomic<unsigned long long> sumUs;
+      boost::atomic<long long> maxUs;
+      char padding[64];
+   };
+   Shard shards_[MetricShardCount];
+};
+
+/**
+ * Records the time from construction to destruction into a histogram.
+ */
+class ScopedLatency : boost::noncopyable
+{
+   LatencyHistogram& histogram_;
+   const long long startUs_;
+
+public:
+   explicit ScopedLatency(LatencyHistogram& histogram) :
+      histogram_(histogram),
+      startUs_(MonotonicMicroseconds())
+   {}
+
+   ~ScopedLatency()
+   { histogram_.Record(MonotonicMicroseconds() - startUs_); }
+};
+
+/**
+ * A level (such as a buffer's occupancy) and its highest value. Not sharded:
+ * it is meant to be set by the one thread that changes the level.
+ */
+class PeakGauge : boost::noncopyable
+{
+   boost::atomic<long long> current_;
+   boost::atomic<long long> peak_;
+
+public:
+   PeakGauge() : current_(0), peak_(0) {}
+
+   void Set(long long value)
+   {
+      current_.store(value, boost::memory_order_relaxed);
+      long long peak = peak_.load(boost::memory_order_relaxed);
+      while (value > peak && !peak_.compare_exchange_weak(peak, value,
+               boost::memory_order_relaxed))
+         ;
+   }
+
+   long long GetCurrent() const
+   { return current_.load(boost::memory_order_relaxed); }
+   long long GetPeak() const
+   { return peak_.load(boost::memory_order_relaxed); }
+   // The peak restarts from the current level
+   void Reset()
+   { peak_.store(GetCurrent(), boost::memory_order_relaxed); }
+};
+
+/**
+ * The metrics kept for each device. Only those that apply to the type of the
+ * device are ever recorded.
+ */
+struct DeviceMetrics : boost::noncopyable
+{
+   LatencyHistogram getPropertyLatency;
+   LatencyHistogram setPropertyLatency;
+   LatencyHistogram waitLatency; // Time until no longer busy
+   LatencyHistogram serialRoundTrip; // Command sent to answer received
+   MetricCounter framesInserted;
+   MetricCounter framesOverflowed; // Rejected because the buffer was full
+   LatencyHistogram insertImageLatency;
+
+   void Reset();
+};
+
+/**
+ * Flat list of metric names and values, in the order collected.
+ */
+typedef std::vector< std::pair<std::string, double> > MetricValues;
+
+void AppendMetric(MetricValues& values, const std::string& name,
+      double value);
+// Appends the count and, if nonzero, the mean, percentiles and maximum (in
+// microseconds) under name.Count, name.Mean, etc.
+void AppendMetric(MetricValues& values, const std::string& name,
+      const LatencyHistogram& histogram);
+// Appends name.Current and name.Peak
+void AppendMetric(MetricValues& values, const std::string& name,
+      const PeakGauge& gauge);
+
+// One "name<tab>value" line per metric
+std::string FormatMetrics(const MetricValues& values);
+
+} // namespace mm
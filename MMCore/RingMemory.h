@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          RingMemory.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Contiguous, pre-faulted memory backing the circular buffer
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <boost/utility.hpp>
+
+#include <cstddef>
+
+namespace mm {
+
+struct RingMemoryOptions
+{
+   bool useHugePages;
+   bool lockPages;
+   int numaNode; // -1 for no preference
+
+   RingMemoryOptions() : useHugePages(true), lockPages(false), numaNode(-1) {}
+
+   bool operator==(const RingMemoryOptions& rhs) const
+   {
+      return useHugePages == rhs.useHugePages &&
+         lockPages == rhs.lockPages && numaNode == rhs.numaNode;
+   }
+   bool operator!=(const RingMemoryOptions& rhs) const
+   {
+      return !(*this == rhs);
+   }
+};
+
+/**
+ * A single anonymous mapping that holds all frame slots of a circular buffer.
+ *
+ * All pages are touched on construction, so that no page faults occur while
+ * a sequence acquisition is filling the buffer. Huge pages, page locking and
+ * NUMA placement are applied when the platform and the process privileges
+ * allow, and are silently skipped otherwise; only failure to map the memory
+ * at all is an error (std::bad_alloc).
+ */
+class RingMemory : boost::noncopyable
+{
+public:
+   RingMemory(size_t size, const RingMemoryOptions& options);
+   ~RingMemory();
+
+   unsigned char* GetData() const { return data_; }
+   size_t GetSize() const { return size_; }
+   const RingMemoryOptions& GetOptions() const { return options_; }
+
+   // Whether the mapping actually got huge pages, or was locked
+   bool IsHugePageBacked() const { return hugePages_; }
+   bool IsLocked() const { return locked_; }
+
+private:
+   void Prefault(size_t pageSize);
+
+   unsigned char* data_;
+   size_t size_;
+   size_t mappedSize_; // size_ rounded up to whole pages
+   bool hugePages_;
+   bool locked_;
+   RingMemoryOptions options_;
+};
+
+} // namespace mm
@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          RingMemoryUnix.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Contiguous, pre-faulted memory backing the circular buffer
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#if defined(__APPLE__) || defined(__linux__) // whole file
+
+#include "RingMemory.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#   include <sys/syscall.h>
+#endif
+
+#include <new>
+
+
+namespace mm {
+
+namespace {
+
+// The default huge page size on x86-64; other sizes are multiples of it
+const size_t hugePageSize = 2 << 20;
+
+size_t RoundUp(size_t size, size_t unit)
+{
+   return (size + unit - 1) / unit * unit;
+}
+
+#ifdef __linux__
+// Sets the NUMA policy of the range to prefer the given node, without
+// depending on libnuma. Must be called before the pages are touched.
+void PreferNode(void* addr, size_t size, int node)
+{
+#ifdef SYS_mbind
+   const int mpolPreferred = 1; // MPOL_PREFERRED
+   const size_t bitsPerLong = 8 * sizeof(unsigned long);
+   unsigned long nodeMask[1024 / (8 * sizeof(unsigned long))] = { 0 };
+   if (node < 0 || static_cast<size_t>(node) >= 1024)
+      return;
+   nodeMask[node / bitsPerLong] |= 1UL << (node % bitsPerLong);
+   syscall(SYS_mbind, addr, size, mpolPreferred, nodeMask,
+         static_cast<unsigned long>(1024), 0);
+#endif
+}
+#endif
+
+} // anonymous namespace
+
+
+RingMemory::RingMemory(size_t size, const RingMemoryOptions& options) :
+   data_(0),
+   size_(size),
+   mappedSize_(0),
+   hugePages_(false),
+   locked_(false),
+   options_(options)
+{
+   const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+   void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+   // Explicit huge pages only succeed if the administrator has reserved a
+   // pool (vm.nr_hugepages)
+   if (options.useHugePages)
+   {
+      mappedSize_ = RoundUp(size, hugePageSize);
+      p = mmap(0, mappedSize_, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+      hugePages_ = (p != MAP_FAILED);
+   }
+#endif
+   if (p == MAP_FAILED)
+   {
+      mappedSize_ = RoundUp(size, pageSize);
+      p = mmap(0, mappedSize_, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANON, -1, 0);
+      if (p == MAP_FAILED)
+         throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+      // Fall back to transparent huge pages
+      if (options.useHugePages)
+         hugePages_ = (madvise(p, mappedSize_, MADV_HUGEPAGE) == 0);
+#endif
+   }
+   data_ = static_cast<unsigned char*>(p);
+
+#ifdef __linux__
+   if (options.numaNode >= 0)
+      PreferNode(data_, mappedSize_, options.numaNode);
+#endif
+
+   // Locking also faults in all pages, but may fail due to RLIMIT_MEMLOCK
+   if (options.lockPages)
+      locked_ = (mlock(data_, mappedSize_) == 0);
+
+   Prefault(pageSize);
+}
+
+RingMemory::~RingMemory()
+{
+   if (locked_)
+      munlock(data_, mappedSize_);
+   munmap(data_, mappedSize_);
+}
+
+void RingMemory::Prefault(size_t pageSize)
+{
+   volatile unsigned char* bytes = data_;
+   for (size_t offset = 0; offset < mappedSize_; offset += pageSize)
+      bytes[offset] = 0;
+}
+
+} // namespace mm
+
+#endif // __APPLE__ || __linux__
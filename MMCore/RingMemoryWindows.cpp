@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          RingMemoryWindows.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Contiguous, pre-faulted memory backing the circular buffer
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#ifdef WIN32 // whole file
+
+#include "RingMemory.h"
+
+#include <windows.h>
+
+#include <new>
+
+
+namespace mm {
+
+namespace {
+
+size_t RoundUp(size_t size, size_t unit)
+{
+   return (size + unit - 1) / unit * unit;
+}
+
+} // anonymous namespace
+
+
+RingMemory::RingMemory(size_t size, const RingMemoryOptions& options) :
+   data_(0),
+   size_(size),
+   mappedSize_(0),
+   hugePages_(false),
+   locked_(false),
+   options_(options)
+{
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   const size_t pageSize = info.dwPageSize;
+   const DWORD node = options.numaNode >= 0 ?
+      static_cast<DWORD>(options.numaNode) : NUMA_NO_PREFERRED_NODE;
+
+   void* p = 0;
+   if (options.useHugePages)
+   {
+      // Requires the "Lock pages in memory" privilege, which is not granted
+      // by default
+      const SIZE_T largePageSize = GetLargePageMinimum();
+      if (largePageSize > 0)
+      {
+         mappedSize_ = RoundUp(size, largePageSize);
+         p = VirtualAllocExNuma(GetCurrentProcess(), 0, mappedSize_,
+               MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+         hugePages_ = (p != 0);
+      }
+   }
+   if (!p)
+   {
+      mappedSize_ = RoundUp(size, pageSize);
+      p = VirtualAllocExNuma(GetCurrentProcess(), 0, mappedSize_,
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+      if (!p)
+         throw std::bad_alloc();
+   }
+   data_ = static_cast<unsigned char*>(p);
+
+   // Large pages are never paged out; otherwise try to lock, which fails if
+   // the buffer exceeds the process's minimum working set
+   if (options.lockPages && !hugePages_)
+      locked_ = (VirtualLock(data_, mappedSize_) != FALSE);
+   else
+      locked_ = hugePages_;
+
+   Prefault(pageSize);
+}
+
+RingMemory::~RingMemory()
+{
+   if (locked_ && !hugePages_)
+      VirtualUnlock(data_, mappedSize_);
+   VirtualFree(data_, 0, MEM_RELEASE);
+}
+
+void RingMemory::Prefault(size_t pageSize)
+{
+   volatile unsigned char* bytes = data_;
+   for (size_t offset = 0; offset < mappedSize_; offset += pageSize)
+      bytes[offset] = 0;
+}
+
+} // namespace mm
+
+#endif // WIN32
@@ -0,0 +1,214 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          StateCache.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Cache of the last known values of device properties
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "StateCache.h"
+
+#include <boost/make_shared.hpp>
+
+#include <algorithm>
+
+
+namespace mm {
+
+StateCache::Snapshot::Snapshot() :
+   root_(boost::make_shared<Root>())
+{
+}
+
+unsigned long StateCache::Snapshot::GetVersion() const
+{
+   return root_->version;
+}
+
+bool StateCache::Snapshot::IsPropertyIncluded(const std::string& device,
+      const std::string& property) const
+{
+   std::string value;
+   return GetValue(device, property, value);
+}
+
+bool StateCache::Snapshot::GetValue(const std::string& device,
+      const std::string& property, std::string& value) const
+{
+   Table::const_iterator shard = root_->table.find(device);
+   if (shard == root_->table.end())
+      return false;
+   const std::map<std::string, Entry>& properties = shard->second->properties;
+   std::map<std::string, Entry>::const_iterator it = properties.find(property);
+   if (it == properties.end())
+      return false;
+   value = it->second.value;
+   return true;
+}
+
+Configuration StateCache::Snapshot::GetConfiguration() const
+{
+   Configuration config;
+   GetChangesSince(0, config);
+   return config;
+}
+
+void StateCache::Snapshot::GetDeviceSettings(const std::string& device,
+      Configuration& settings) const
+{
+   Table::const_iterator shard = root_->table.find(device);
+   if (shard == root_->table.end())
+      return;
+   const std::map<std::string, Entry>& properties = shard->second->properties;
+   for (std::map<std::string, Entry>::const_iterator it = properties.begin(),
+         end = properties.end(); it != end; ++it)
+   {
+      settings.addSetting(PropertySetting(device.c_str(), it->first.c_str(),
+               it->second.value.c_str(), it->second.readOnly));
+   }
+}
+
+bool StateCache::Snapshot::GetChangesSince(unsigned long version,
+      Configuration& changes) const
+{
+   if (version > 0 && version < root_->removalVersion)
+      return false;
+
+   for (Table::const_iterator shard = root_->table.begin(),
+         end = root_->table.end(); shard != end; ++shard)
+   {
+      if (shard->second->version <= version)
+         continue;
+      const std::map<std::string, Entry>& properties = shard->second->properties;
+      for (std::map<std::string, Entry>::const_iterator it = properties.begin(),
+            propEnd = properties.end(); it != propEnd; ++it)
+      {
+         if (it->second.version <= version)
+            continue;
+         changes.addSetting(PropertySetting(shard->first.c_str(),
+                  it->first.c_str(), it->second.value.c_str(),
+                  it->second.readOnly));
+      }
+   }
+   return true;
+}
+
+
+StateCache::StateCache() :
+   root_(boost::make_shared<Root>())
+{
+}
+
+StateCache::Snapshot StateCache::GetSnapshot() const
+{
+   return Snapshot(boost::atomic_load(&root_));
+}
+
+bool StateCache::Set(const PropertySetting& setting)
+{
+   const std::string device = setting.getDeviceLabel();
+   const std::string property = setting.getPropertyName();
+   const std::string value = setting.getPropertyValue();
+
+   boost::lock_guard<boost::mutex> lock(writeMutex_);
+   boost::shared_ptr<const Root> root = root_; // Only we write root_
+
+   boost::shared_ptr<DeviceState> shard;
+   Table::const_iterator oldShard = root->table.find(device);
+   if (oldShard != root->table.end())
+   {
+      const std::map<std::string, Entry>& properties = oldShard->second->properties;
+      std::map<std::string, Entry>::const_iterator it = properties.find(property);
+      if (it != properties.end() && it->second.value == value &&
+            it->second.readOnly == setting.getReadOnly())
+         return false;
+      shard = boost::make_shared<DeviceState>(*oldShard->second);
+   }
+   else
+   {
+      shard = boost::make_shared<DeviceState>();
+   }
+
+   boost::shared_ptr<Root> newRoot = boost::make_shared<Root>(*root);
+   newRoot->version = root->version + 1;
+   Entry& entry = shard->properties[property];
+   entry.value = value;
+   entry.readOnly = setting.getReadOnly();
+   entry.version = newRoot->version;
+   shard->version = newRoot->version;
+   newRoot->table[device] = shard;
+
+   boost::atomic_store(&root_, boost::shared_ptr<const Root>(newRoot));
+   return true;
+}
+
+void StateCache::Replace(const Configuration& state)
+{
+   boost::lock_guard<boost::mutex> lock(writeMutex_);
+   boost::shared_ptr<const Root> root = root_;
+
+   const unsigned long version = root->version + 1;
+   std::map<std::string, boost::shared_ptr<DeviceState> > shards;
+   size_t keptCount = 0; // Properties also in the old state
+   for (size_t i = 0; i < state.size(); ++i)
+   {
+      PropertySetting setting = state.getSetting(i);
+      const std::string device = setting.getDeviceLabel();
+      const std::string property = setting.getPropertyName();
+
+      boost::shared_ptr<DeviceState>& shard = shards[device];
+      if (!shard)
+         shard = boost::make_shared<DeviceState>();
+      Entry& entry = shard->properties[property];
+      entry.value = setting.getPropertyValue();
+      entry.readOnly = setting.getReadOnly();
+      entry.version = version;
+
+      // Keep the version of unchanged values
+      Table::const_iterator oldShard = root->table.find(device);
+      if (oldShard != root->table.end())
+      {
+         const std::map<std::string, Entry>& oldProperties =
+            oldShard->second->properties;
+         std::map<std::string, Entry>::const_iterator old =
+            oldProperties.find(property);
+         if (old != oldProperties.end())
+         {
+            ++keptCount;
+            if (old->second.value == entry.value &&
+                  old->second.readOnly == entry.readOnly)
+               entry.version = old->second.version;
+         }
+      }
+      shard->version = std::max(shard->version, entry.version);
+   }
+
+   size_t oldCount = 0;
+   for (Table::const_iterator it = root->table.begin(), end = root->table.end();
+         it != end; ++it)
+      oldCount += it->second->properties.size();
+
+   boost::shared_ptr<Root> newRoot = boost::make_shared<Root>();
+   newRoot->version = version;
+   newRoot->removalVersion = (keptCount < oldCount) ?
+      version : root->removalVersion;
+   for (std::map<std::string, boost::shared_ptr<DeviceState> >::const_iterator
+         it = shards.begin(), end = shards.end(); it != end; ++it)
+      newRoot->table[it->first] = it->second;
+
+   boost::atomic_store(&root_, boost::shared_ptr<const Root>(newRoot));
+}
+
+} // namespace mm
@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          StateCache.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Cache of the last known values of device properties
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Configuration.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <map>
+#include <string>
+
+namespace mm {
+
+/**
+ * The core's cache of property values (the "system state cache").
+ *
+ * The cache is a read-copy-update structure: the whole state is an immutable
+ * table of per-device shards, and a writer replaces the shard of one device
+ * and the table (which only holds pointers to the shards). Readers take an
+ * atomic reference to the current table and never wait for writers; writers
+ * wait only for each other.
+ *
+ * Every change increments the version of the cache, and each value records
+ * the version at which it last changed. A Snapshot is a cheap, consistent
+ * handle to the state at one version, and can list the values that changed
+ * since an earlier version without visiting unchanged devices.
+ */
+class StateCache : boost::noncopyable
+{
+public:
+   struct Entry
+   {
+      std::string value;
+      bool readOnly;
+      unsigned long version; // Version at which the value last changed
+   };
+   struct DeviceState
+   {
+      DeviceState() : version(0) {}
+      std::map<std::string, Entry> properties; // By name
+      unsigned long version; // Latest version of any of the properties
+   };
+   typedef std::map<std::string, boost::shared_ptr<const DeviceState> > Table;
+
+   class Snapshot
+   {
+   public:
+      Snapshot();
+
+      unsigned long GetVersion() const;
+      bool IsPropertyIncluded(const std::string& device,
+            const std::string& property) const;
+      bool GetValue(const std::string& device, const std::string& property,
+            std::string& value) const;
+      // All settings, ordered by device and property
+      Configuration GetConfiguration() const;
+      // Adds the settings that changed after the given version to changes.
+      // Returns false (adding nothing) if properties have since been removed
+      // from the cache, which a list of changes cannot express; version 0
+      // always succeeds and yields all settings.
+      bool GetChangesSince(unsigned long version, Configuration& changes) const;
+      // Adds the settings of one device to settings
+      void GetDeviceSettings(const std::string& device,
+            Configuration& settings) const;
+
+   private:
+      friend class StateCache;
+      struct Root
+      {
+         Root() : version(0), removalVersion(0) {}
+         Table table;
+         unsigned long version;
+         unsigned long removalVersion; // Last version that removed properties
+      };
+      explicit Snapshot(boost::shared_ptr<const Root> root) : root_(root) {}
+
+      boost::shared_ptr<const Root> root_;
+   };
+
+   StateCache();
+
+   Snapshot GetSnapshot() const;
+   unsigned long GetVersion() const { return GetSnapshot().GetVersion(); }
+
+   // Returns false if the setting was already in the cache with the same
+   // value (in which case the version is not incremented)
+   bool Set(const PropertySetting& setting);
+   // Replaces the whole state; values that did not change keep their version
+   void Replace(const Configuration& state);
+
+private:
+   typedef Snapshot::Root Root;
+
+   boost::mutex writeMutex_;
+   boost::shared_ptr<const Root> root_; // Accessed atomically
+};
+
+} // namespace mm
@@ -0,0 +1,187 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SystemStateReader.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Reads the properties of devices of different modules
+//                concurrently, with a time budget per device
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SystemStateReader.h"
+
+#include "CoreUtils.h"
+#include "DeviceManager.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <map>
+
+
+namespace mm {
+
+namespace {
+
+typedef std::vector< boost::shared_ptr<DeviceInstance> > DeviceList;
+
+// Shared between the caller and the module threads, which may outlive the
+// call if abandoned
+struct ReadState
+{
+   struct Module
+   {
+      Module() : current(0), currentStartMs(0.0), abandoned(false) {}
+      std::vector<size_t> devices; // Indices into results
+      size_t current; // Position in devices; devices.size() when done
+      double currentStartMs;
+      bool abandoned;
+   };
+
+   boost::mutex mutex;
+   boost::condition_variable condVar;
+   std::vector<Module> modules;
+   std::vector<SystemStateReader::DeviceState> results;
+};
+
+void ReadModule(boost::shared_ptr<ReadState> state, size_t moduleIndex,
+      DeviceList devices)
+{
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      {
+         boost::lock_guard<boost::mutex> lock(state->mutex);
+         ReadState::Module& module = state->modules[moduleIndex];
+         if (module.abandoned)
+            return;
+         module.current = i;
+         module.currentStartMs = GetMMTimeNow().getMsec();
+      }
+
+      boost::shared_ptr<DeviceInstance> pDev = devices[i];
+      const std::string label = pDev->GetLabel();
+      std::vector<PropertySetting> settings;
+      {
+         DeviceModuleLockGuard guard(pDev);
+         std::vector<std::string> propertyNames = pDev->GetPropertyNames();
+         for (std::vector<std::string>::const_iterator it = propertyNames.begin(),
+               end = propertyNames.end(); it != end; ++it)
+         {
+            // As in CMMCore::getSystemState(), errors leave the defaults
+            std::string val;
+            try
+            {
+               val = pDev->GetProperty(*it);
+            }
+            catch (const CMMError&)
+            {
+            }
+            bool readOnly = false;
+            try
+            {
+               readOnly = pDev->GetPropertyReadOnly(it->c_str());
+            }
+            catch (const CMMError&)
+            {
+            }
+            settings.push_back(PropertySetting(label.c_str(), it->c_str(),
+                     val.c_str(), readOnly));
+         }
+      }
+
+      boost::lock_guard<boost::mutex> lock(state->mutex);
+      ReadState::Module& module = state->modules[moduleIndex];
+      if (module.abandoned)
+         return;
+      SystemStateReader::DeviceState& result =
+         state->results[module.devices[i]];
+      result.settings.swap(settings);
+      result.complete = true;
+      state->condVar.notify_all();
+   }
+
+   boost::lock_guard<boost::mutex> lock(state->mutex);
+   state->modules[moduleIndex].current = devices.size();
+   state->condVar.notify_all();
+}
+
+} // anonymous namespace
+
+
+std::vector<SystemStateReader::DeviceState>
+SystemStateReader::Read(const DeviceList& devices, double deviceTimeoutMs)
+{
+   boost::shared_ptr<ReadState> state = boost::make_shared<ReadState>();
+   state->results.resize(devices.size());
+
+   std::vector<DeviceList> moduleDevices;
+   {
+      std::map<LoadedDeviceAdapter*, size_t> moduleIndices;
+      for (size_t i = 0; i < devices.size(); ++i)
+      {
+         LoadedDeviceAdapter* adapter = devices[i]->GetAdapterModule().get();
+         std::map<LoadedDeviceAdapter*, size_t>::iterator it =
+            moduleIndices.find(adapter);
+         if (it == moduleIndices.end())
+         {
+            it = moduleIndices.insert(std::make_pair(adapter,
+                     state->modules.size())).first;
+            state->modules.push_back(ReadState::Module());
+            moduleDevices.push_back(DeviceList());
+         }
+         state->modules[it->second].devices.push_back(i);
+         moduleDevices[it->second].push_back(devices[i]);
+      }
+   }
+
+   boost::unique_lock<boost::mutex> lock(state->mutex);
+   for (size_t m = 0; m < state->modules.size(); ++m)
+   {
+      state->modules[m].currentStartMs = GetMMTimeNow().getMsec();
+      boost::thread(boost::bind(&ReadModule, state, m,
+               moduleDevices[m])).detach();
+   }
+
+   for (;;)
+   {
+      // Abandon the modules whose current device is over budget, and find
+      // the earliest deadline among the others
+      const double nowMs = GetMMTimeNow().getMsec();
+      double nextDeadlineMs = -1.0;
+      for (size_t m = 0; m < state->modules.size(); ++m)
+      {
+         ReadState::Module& module = state->modules[m];
+         if (module.abandoned || module.current >= module.devices.size())
+            continue;
+         const double deadlineMs = module.currentStartMs + deviceTimeoutMs;
+         if (deadlineMs <= nowMs)
+            module.abandoned = true;
+         else if (nextDeadlineMs < 0.0 || deadlineMs < nextDeadlineMs)
+            nextDeadlineMs = deadlineMs;
+      }
+      if (nextDeadlineMs < 0.0)
+         break;
+
+      state->condVar.timed_wait(lock, boost::posix_time::microseconds(
+               static_cast<long>((nextDeadlineMs - nowMs) * 1000.0) + 1));
+   }
+
+   return state->results;
+}
+
+} // namespace mm
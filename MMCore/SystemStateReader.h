@@ -0,0 +1,59 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SystemStateReader.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Reads the properties of devices of different modules
+//                concurrently, with a time budget per device
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Configuration.h"
+#include "Devices/DeviceInstance.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+namespace mm {
+
+/**
+ * Reads all properties of a list of devices, using one thread per adapter
+ * module (devices of a module are read in order, under the module lock).
+ *
+ * A device call cannot be interrupted, so a device that takes longer than
+ * the budget is abandoned: its thread is detached and finishes (and
+ * releases the module lock) in the background, and its results, together
+ * with those of the devices of the same module not yet read, are discarded.
+ */
+class SystemStateReader
+{
+public:
+   struct DeviceState
+   {
+      DeviceState() : complete(false) {}
+      std::vector<PropertySetting> settings; // Those read so far
+      bool complete; // False if the device was abandoned or not reached
+   };
+
+   // Returns the state of each device, in the given order. Returns as soon
+   // as every device is either read or abandoned.
+   static std::vector<DeviceState> Read(
+         const std::vector< boost::shared_ptr<DeviceInstance> >& devices,
+         double deviceTimeoutMs);
+};
+
+} // namespace mm
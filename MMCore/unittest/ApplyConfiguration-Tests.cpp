@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include "MockCoreTest.h"
+
+#include <string>
+
+// Uses the Value/Limit properties and the SetLog of the mock generic device
+// (see MockDeviceAdapter.cpp)
+
+class ApplyConfigurationTest : public MockCoreTest
+{
+protected:
+   virtual void SetUp()
+   {
+      LoadDevices();
+   }
+
+   void LoadDevices()
+   {
+      Load("A1", "MockA");
+      Load("B1", "MockB");
+      core.initializeAllDevices();
+   }
+
+   // Value is set before Limit, so it only succeeds after Limit is raised
+   void DefineValueBeforeLimit()
+   {
+      core.defineConfig("G", "P", "A1", "Value", "15");
+      core.defineConfig("G", "P", "A1", "Limit", "20");
+   }
+
+   // Log entries since the given position
+   std::string LogSince(const char* label, size_t pos)
+   {
+      return core.getProperty(label, "SetLog").substr(pos);
+   }
+};
+
+
+TEST_F(ApplyConfigurationTest, SettingsOfDeviceAreSentAsOneBatch)
+{
+   core.setProperty("A1", "Batching", "1");
+   core.defineConfig("G", "P", "A1", "Limit", "20");
+   core.defineConfig("G", "P", "B1", "Value", "5");
+   core.defineConfig("G", "P", "A1", "Value", "15");
+
+   core.setConfig("G", "P");
+
+   EXPECT_EQ("{Limit=20;Value=15;}", core.getProperty("A1", "SetLog"));
+   EXPECT_EQ("Value=5;", core.getProperty("B1", "SetLog"));
+   EXPECT_EQ("15", core.getProperty("A1", "Value"));
+}
+
+TEST_F(ApplyConfigurationTest, SettingsOfDeviceKeepTheirOrder)
+{
+   core.defineConfig("G", "P", "A1", "Limit", "20");
+   core.defineConfig("G", "P", "B1", "Value", "5");
+   core.defineConfig("G", "P", "A1", "Value", "15");
+
+   core.setConfig("G", "P");
+
+   EXPECT_EQ("Limit=20;Value=15;", core.getProperty("A1", "SetLog"));
+   EXPECT_EQ("Value=5;", core.getProperty("B1", "SetLog"));
+}
+
+TEST_F(ApplyConfigurationTest, FailedSettingIsRetriedAndThenDeferred)
+{
+   DefineValueBeforeLimit();
+
+   core.setConfig("G", "P");
+   EXPECT_EQ("Value=15!;Limit=20;Value=15;", core.getProperty("A1", "SetLog"));
+
+   core.setProperty("A1", "Value", "0");
+   core.setProperty("A1", "Limit", "10");
+   const size_t pos = core.getProperty("A1", "SetLog").size();
+
+   // Now Value is set after the others, without failing first
+   core.setConfig("G", "P");
+   EXPECT_EQ("Limit=20;Value=15;", LogSince("A1", pos));
+}
+
+TEST_F(ApplyConfigurationTest, FailedBatchIsRetriedOneByOne)
+{
+   core.setProperty("A1", "Batching", "1");
+   DefineValueBeforeLimit();
+
+   core.setConfig("G", "P");
+   EXPECT_EQ("{Value=15!;}Value=15!;Limit=20;Value=15;",
+         core.getProperty("A1", "SetLog"));
+   EXPECT_EQ("15", core.getProperty("A1", "Value"));
+}
+
+TEST_F(ApplyConfigurationTest, SettingThatKeepsFailingIsReported)
+{
+   core.defineConfig("G", "P", "A1", "Value", "15");
+
+   EXPECT_THROW(core.setConfig("G", "P"), CMMError);
+   EXPECT_EQ("Value=15!;Value=15!;", core.getProperty("A1", "SetLog"));
+}
+
+TEST_F(ApplyConfigurationTest, DeferralIsForgottenOnUnload)
+{
+   DefineValueBeforeLimit();
+   core.setConfig("G", "P");
+
+   core.unloadAllDevices();
+   LoadDevices();
+   DefineValueBeforeLimit();
+
+   core.setConfig("G", "P");
+   EXPECT_EQ("Value=15!;Limit=20;Value=15;", core.getProperty("A1", "SetLog"));
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
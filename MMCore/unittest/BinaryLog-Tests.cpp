@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+
+#include "Logging/BinaryLogFormat.h"
+#include "Logging/Logging.h"
+
+#include <boost/make_shared.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace mm::logging;
+using namespace mm::logging::internal;
+
+namespace
+{
+   typedef GenericPacketArray<Metadata> PacketArray;
+
+   std::string FormatPackets(const PacketArray& packets)
+   {
+      std::ostringstream strm;
+      WritePacketsToStream<MetadataFormatter, Metadata>(strm,
+            packets.Begin(), packets.End(),
+            boost::shared_ptr<EntryFilter>());
+      return strm.str();
+   }
+
+   void AppendEntry(PacketArray& packets, const char* label, LogLevel level,
+         const std::string& text)
+   {
+      StampData stamp;
+      stamp.Stamp();
+      packets.AppendEntry(label, level, stamp, text.c_str());
+   }
+
+   PacketArray ReadFile(const std::string& filename)
+   {
+      PacketArray packets;
+      std::ifstream file(filename.c_str(),
+            std::ios_base::in | std::ios_base::binary);
+      BinaryLogReader reader(file);
+      EXPECT_TRUE(reader.ReadFileHeader());
+      while (reader.ReadPacket(packets))
+         ;
+      return packets;
+   }
+
+   const char* const TestFile = "BinaryLog-Tests.bin";
+}
+
+
+TEST(BinaryLogTests, DecodesToSameText)
+{
+   PacketArray packets;
+   AppendEntry(packets, "Core", LogLevelInfo, "One line");
+   AppendEntry(packets, "dev:Camera", LogLevelDebug,
+         "Two\nlines and a line longer than a packet: " +
+         std::string(300, 'x'));
+   AppendEntry(packets, "Core", LogLevelError, "Last");
+
+   {
+      BinaryLogSink sink(TestFile, 1024 * 1024, 0);
+      sink.Consume(packets);
+   }
+
+   PacketArray decoded = ReadFile(TestFile);
+   EXPECT_EQ(FormatPackets(packets), FormatPackets(decoded));
+   std::remove(TestFile);
+}
+
+
+TEST(BinaryLogTests, AppliesFilter)
+{
+   PacketArray packets;
+   AppendEntry(packets, "Core", LogLevelDebug, "Hidden");
+   AppendEntry(packets, "Core", LogLevelInfo, "Shown");
+
+   {
+      BinaryLogSink sink(TestFile, 1024 * 1024, 0);
+      sink.SetFilter(boost::make_shared<LevelFilter>(LogLevelInfo));
+      sink.Consume(packets);
+   }
+
+   PacketArray decoded = ReadFile(TestFile);
+   ASSERT_EQ(1, decoded.End() - decoded.Begin());
+   EXPECT_STREQ("Shown", decoded.Begin()->GetText());
+   std::remove(TestFile);
+}
+
+
+TEST(BinaryLogTests, RotatesAtMaximumSize)
+{
+   const std::string name(TestFile);
+   {
+      BinaryLogSink sink(name, 64 * 1024, 2);
+      for (int i = 0; i < 3000; ++i)
+      {
+         PacketArray packets;
+         AppendEntry(packets, "Core", LogLevelInfo, std::string(60, 'a'));
+         sink.Consume(packets);
+      }
+   }
+
+   // Each file holds whole, decodable entries
+   for (int i = 0; i < 3; ++i)
+   {
+      const std::string filename = (i == 0 ? name :
+            name + "." + (i == 1 ? "1" : "2"));
+      std::ifstream file(filename.c_str(), std::ios_base::binary);
+      ASSERT_TRUE(file.good()) << filename;
+      file.seekg(0, std::ios_base::end);
+      EXPECT_LE(file.tellg(), 64 * 1024);
+      file.close();
+
+      PacketArray decoded = ReadFile(filename);
+      EXPECT_FALSE(decoded.IsEmpty());
+      for (PacketArray::ConstIteratorType it = decoded.Begin();
+            it != decoded.End(); ++it)
+      {
+         EXPECT_STREQ("Core",
+               it->GetMetadataConstRef().GetLoggerData().GetComponentLabel());
+      }
+      std::remove(filename.c_str());
+   }
+   std::ifstream third((name + ".3").c_str());
+   EXPECT_FALSE(third.good());
+}
+
+
+TEST(BinaryLogTests, NoEntryIsLostOnRotation)
+{
+   const std::string name(TestFile);
+   const unsigned maxBackups = 30;
+   const int count = 6000;
+   {
+      BinaryLogSink sink(name, 64 * 1024, maxBackups);
+      for (int i = 0; i < count; ++i)
+      {
+         // Varying lengths, so that some entries end up just short of
+         // filling the file; a new logger each time, so that each entry
+         // also needs a logger name record
+         std::ostringstream text;
+         text << i << ' ' << std::string(i % 97, 'b');
+         std::ostringstream label;
+         label << "dev:" << i;
+         PacketArray packets;
+         AppendEntry(packets, label.str().c_str(), LogLevelInfo, text.str());
+         sink.Consume(packets);
+      }
+   }
+
+   // Read the files from oldest to newest
+   int expected = 0;
+   for (int i = maxBackups; i >= 0; --i)
+   {
+      std::ostringstream filename;
+      filename << name;
+      if (i > 0)
+         filename << '.' << i;
+      std::ifstream file(filename.str().c_str());
+      if (!file.good())
+         continue;
+      file.close();
+
+      PacketArray decoded = ReadFile(filename.str());
+      for (PacketArray::ConstIteratorType it = decoded.Begin();
+            it != decoded.End(); ++it)
+      {
+         int index = -1;
+         std::istringstream(it->GetText()) >> index;
+         EXPECT_EQ(expected, index);
+         expected = index + 1;
+      }
+      std::remove(filename.str().c_str());
+   }
+   EXPECT_EQ(count, expected);
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,78 @@
+// Producer/consumer throughput of the locked and lock-free modes of
+// CircularBuffer. This is not a pass/fail test; it prints the sustained frame
+// rate and overflow count of each mode for comparison.
+
+#include "CircularBuffer.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <iostream>
+#include <vector>
+
+
+namespace
+{
+
+const unsigned BenchWidth = 256;
+const unsigned BenchHeight = 256;
+const unsigned BenchFrames = 20000;
+
+void Produce(CircularBuffer* cb, unsigned* overflows)
+{
+   Metadata md;
+   md.put("Camera", "BenchCamera");
+   std::vector<unsigned char> pixels(BenchWidth * BenchHeight * 2);
+   for (unsigned i = 0; i < BenchFrames; )
+   {
+      if (cb->InsertImage(&pixels[0], BenchWidth, BenchHeight, 2, &md))
+         ++i;
+      else
+      {
+         ++*overflows;
+         boost::this_thread::yield();
+      }
+   }
+}
+
+double MeasureFramesPerSecond(bool lockFree, unsigned* overflows)
+{
+   CircularBuffer cb(64);
+   cb.SetLockFree(lockFree);
+   cb.Initialize(1, BenchWidth, BenchHeight, 2);
+
+   boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+   boost::thread producer(boost::bind(&Produce, &cb, overflows));
+   unsigned popped = 0;
+   while (popped < BenchFrames)
+   {
+      if (cb.GetNextImageBuffer(0))
+         ++popped;
+      else
+         boost::this_thread::yield();
+   }
+   producer.join();
+   boost::posix_time::time_duration elapsed =
+      boost::posix_time::microsec_clock::universal_time() - start;
+   return BenchFrames * 1e6 / elapsed.total_microseconds();
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+   unsigned lockedOverflows = 0, lockFreeOverflows = 0;
+   double locked = MeasureFramesPerSecond(false, &lockedOverflows);
+   double lockFree = MeasureFramesPerSecond(true, &lockFreeOverflows);
+
+   std::cout << "Sustained throughput, " << BenchWidth << "x" <<
+      BenchHeight << "x16-bit frames:\n" <<
+      "  locked:    " << locked << " fps (" << lockedOverflows <<
+      " overflows)\n" <<
+      "  lock-free: " << lockFree << " fps (" << lockFreeOverflows <<
+      " overflows)\n";
+   return 0;
+}
@@ -0,0 +1,629 @@
+#include <gtest/gtest.h>
+
+#include "CircularBuffer.h"
+#include "CoreUtils.h"
+#include "FrameHandle.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <cstring>
+#include <vector>
+
+#ifndef WIN32
+#include <poll.h>
+#endif
+
+
+namespace
+{
+
+Metadata CameraMetadata()
+{
+   Metadata md;
+   md.put("Camera", "TestCamera");
+   return md;
+}
+
+} // anonymous namespace
+
+
+class CircularBufferModeTest : public ::testing::TestWithParam<bool>
+{
+};
+
+
+TEST_P(CircularBufferModeTest, InsertAndPopInOrder)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 1));
+   ASSERT_LT(4u, cb.GetSize());
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(16 * 16);
+   for (unsigned char i = 0; i < 4; ++i)
+   {
+      pixels[0] = i;
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 16, 16, 1, &md));
+   }
+   EXPECT_EQ(4u, cb.GetRemainingImageCount());
+   EXPECT_EQ(3, cb.GetTopImage()[0]);
+
+   for (unsigned char i = 0; i < 4; ++i)
+   {
+      const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+      ASSERT_TRUE(img != 0);
+      EXPECT_EQ(i, img->GetPixels()[0]);
+      EXPECT_EQ(ToString(static_cast<int>(i)), img->GetMetadata().
+            GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+   }
+   EXPECT_TRUE(cb.GetNextImageBuffer(0) == 0);
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+}
+
+
+TEST_P(CircularBufferModeTest, OverflowAndClear)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 512, 512, 1));
+   const unsigned long size = cb.GetSize();
+   ASSERT_LT(0u, size);
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(512 * 512);
+   for (unsigned long i = 0; i < size; ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(0u, cb.GetFreeSize());
+
+   EXPECT_FALSE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_TRUE(cb.Overflow());
+
+   cb.Clear();
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_TRUE(cb.GetNextImageBuffer(0) == 0);
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_EQ(1u, cb.GetRemainingImageCount());
+}
+
+
+TEST_P(CircularBufferModeTest, RejectsIncompatibleImage)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 1));
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(32 * 32);
+   EXPECT_THROW(cb.InsertImage(&pixels[0], 32, 32, 1, &md), CMMError);
+}
+
+
+TEST_P(CircularBufferModeTest, SlotCommitAndAbandon)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 2));
+
+   unsigned char* slot = cb.AcquireSlot(16, 16, 2, 1);
+   ASSERT_TRUE(slot != 0);
+   EXPECT_TRUE(cb.GetPendingSlot() == slot);
+   slot[0] = 42;
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   Metadata md = CameraMetadata();
+   ASSERT_TRUE(cb.CommitSlot(&md));
+   EXPECT_TRUE(cb.GetPendingSlot() == 0);
+   EXPECT_FALSE(cb.CommitSlot(&md));
+
+   slot = cb.AcquireSlot(16, 16, 2, 1);
+   ASSERT_TRUE(slot != 0);
+   cb.AbandonSlot();
+   EXPECT_EQ(1u, cb.GetRemainingImageCount());
+
+   const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+   ASSERT_TRUE(img != 0);
+   EXPECT_EQ(42, img->GetPixels()[0]);
+   EXPECT_EQ("GRAY16", img->GetMetadata().GetSingleTag("PixelType").GetValue());
+   EXPECT_EQ("0", img->GetMetadata().
+         GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+}
+
+
+
+TEST_P(CircularBufferModeTest, StaleSlotIsAbandonedOnNextInsert)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 2));
+
+   // Reserved but never committed; reserving again must not keep the
+   // first reservation (or, in locked mode, a second lock count) alive
+   ASSERT_TRUE(cb.AcquireSlot(16, 16, 2, 1) != 0);
+   ASSERT_TRUE(cb.AcquireSlot(16, 16, 2, 1) != 0);
+   Metadata md = CameraMetadata();
+   ASSERT_TRUE(cb.CommitSlot(&md));
+
+   ASSERT_TRUE(cb.AcquireSlot(16, 16, 2, 1) != 0);
+   std::vector<unsigned char> pixels(16 * 16 * 2);
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 16, 16, 2, &md));
+   EXPECT_TRUE(cb.GetPendingSlot() == 0);
+   EXPECT_EQ(2u, cb.GetRemainingImageCount());
+
+   if (!GetParam())
+   {
+      // Another producer is not held off
+      boost::thread producer(boost::bind(&CircularBuffer::InsertImage, &cb,
+               &pixels[0], 16u, 16u, 2u, &md));
+      EXPECT_TRUE(producer.timed_join(boost::posix_time::seconds(10)));
+      EXPECT_EQ(3u, cb.GetRemainingImageCount());
+   }
+}
+
+TEST_P(CircularBufferModeTest, SlotCommitWithBinaryMetadata)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 1));
+
+   boost::shared_ptr<Metadata> cameraTags(new Metadata());
+   cameraTags->PutTag("Gain", "TestCamera", 3);
+   cameraTags->PutImageTag("Binning", 1);
+
+   FrameMetadata md;
+   md.PutString(FrameMetadata::KeyCamera, "TestCamera");
+   md.PutInteger(FrameMetadata::KeyBinning, 2);
+   md.PutDouble(FrameMetadata::KeyElapsedTimeMs, 12.5);
+   for (int i = 0; i < 2; ++i)
+   {
+      ASSERT_TRUE(cb.AcquireSlot(16, 16, 1, 1) != 0);
+      ASSERT_TRUE(cb.CommitSlot(md, cameraTags));
+   }
+
+   const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+   ASSERT_TRUE(img != 0);
+   EXPECT_EQ(cameraTags.get(), img->GetBaseMetadata());
+   FrameMetadata::Tag tag;
+   ASSERT_TRUE(img->GetFrameMetadata().FindTag(FrameMetadata::KeyWidth, tag));
+   EXPECT_EQ(16, tag.intValue);
+
+   Metadata all = img->GetMetadata();
+   EXPECT_EQ("TestCamera", all.GetSingleTag("Camera").GetValue());
+   EXPECT_EQ("3", all.GetSingleTag("TestCamera-Gain").GetValue());
+   EXPECT_EQ("2", all.GetSingleTag("Binning").GetValue());
+   EXPECT_EQ("12.5", all.GetSingleTag(MM::g_Keyword_Elapsed_Time_ms).GetValue());
+   EXPECT_EQ("GRAY8", all.GetSingleTag("PixelType").GetValue());
+   EXPECT_EQ("0", all.GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+
+   img = cb.GetNextImageBuffer(0);
+   ASSERT_TRUE(img != 0);
+   EXPECT_EQ("1", img->GetMetadata().
+         GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+}
+
+
+TEST_P(CircularBufferModeTest, SlotOverflowAndIncompatible)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 512, 512, 1));
+   const unsigned long size = cb.GetSize();
+
+   Metadata md = CameraMetadata();
+   for (unsigned long i = 0; i < size; ++i)
+   {
+      ASSERT_TRUE(cb.AcquireSlot(512, 512, 1, 1) != 0);
+      ASSERT_TRUE(cb.CommitSlot(&md));
+   }
+   EXPECT_TRUE(cb.AcquireSlot(512, 512, 1, 1) == 0);
+   EXPECT_TRUE(cb.Overflow());
+
+   EXPECT_THROW(cb.AcquireSlot(16, 16, 1, 1), CMMError);
+
+   // The buffer must not be left locked after a failed reservation
+   std::vector<unsigned char> pixels(512 * 512);
+   cb.Clear();
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+}
+
+
+TEST_P(CircularBufferModeTest, PinnedFrameIsNotOverwritten)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 512, 512, 1));
+   const unsigned long size = cb.GetSize();
+   ASSERT_LT(1u, size);
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(512 * 512);
+   pixels[0] = 7;
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+
+   FrameHandle handle(cb.PopNextFrame(), 0);
+   ASSERT_TRUE(handle.isValid());
+   EXPECT_EQ(512u, handle.getImageWidth());
+   EXPECT_EQ(512 * 512, handle.getImageBufferSize());
+   EXPECT_EQ("0", handle.getMetadata().
+         GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue());
+
+   // Fill the rest of the ring; the slot of the pinned frame comes next
+   pixels[0] = 8;
+   for (unsigned long i = 0; i < size - 1; ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   for (unsigned long i = 0; i < size - 1; ++i)
+      ASSERT_TRUE(cb.GetNextImageBuffer(0) != 0);
+
+   // The ring is not full, so the new frames are dropped rather than
+   // reported as an overflow
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   unsigned char* slot = cb.AcquireSlot(512, 512, 1, 1);
+   ASSERT_TRUE(slot != 0);
+   EXPECT_TRUE(cb.CommitSlot(&md));
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(2u, cb.GetDroppedFrameCount());
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_EQ(7, static_cast<unsigned char*>(handle.getPixels())[0]);
+
+   FrameHandle copy = handle;
+   handle.release();
+   EXPECT_FALSE(handle.isValid());
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_EQ(3u, cb.GetDroppedFrameCount());
+   copy.release();
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_EQ(3u, cb.GetDroppedFrameCount());
+   EXPECT_EQ(1u, cb.GetRemainingImageCount());
+}
+
+namespace
+{
+
+void ReleaseAfter(FrameHandle* handle, long delayMs)
+{
+   boost::this_thread::sleep(boost::posix_time::milliseconds(delayMs));
+   handle->release();
+}
+
+} // anonymous namespace
+
+TEST_P(CircularBufferModeTest, InsertWaitsForPinnedSlot)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   cb.SetOverflowPolicy(CircularBuffer::OverflowReport, 10000);
+   ASSERT_TRUE(cb.Initialize(1, 512, 512, 1));
+   const unsigned long size = cb.GetSize();
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(512 * 512);
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   FrameHandle handle(cb.PopNextFrame(), 0);
+   for (unsigned long i = 0; i < size - 1; ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   for (unsigned long i = 0; i < size - 1; ++i)
+      ASSERT_TRUE(cb.GetNextImageBuffer(0) != 0);
+
+   // The insert goes ahead once the handle is released
+   boost::thread releaser(boost::bind(&ReleaseAfter, &handle, 50));
+   pixels[0] = 9;
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   releaser.join();
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(0u, cb.GetDroppedFrameCount());
+   const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+   ASSERT_TRUE(img != 0);
+   EXPECT_EQ(9, img->GetPixels()[0]);
+
+   // A full ring is still reported
+   cb.SetOverflowPolicy(CircularBuffer::OverflowReport, 0);
+   for (unsigned long i = 0; i < size; ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_FALSE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_TRUE(cb.Overflow());
+}
+
+
+TEST_P(CircularBufferModeTest, HandleOutlivesReallocation)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 1));
+   EXPECT_FALSE(FrameHandle(cb.PopNextFrame(), 0).isValid());
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(16 * 16, 3);
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 16, 16, 1, &md));
+   FrameHandle handle(cb.PopNextFrame(), 0);
+   ASSERT_TRUE(handle.isValid());
+   EXPECT_FALSE(FrameHandle(cb.PopNextFrame(), 0).isValid());
+
+   ASSERT_TRUE(cb.Initialize(1, 32, 32, 2));
+   EXPECT_EQ(16u, handle.getImageWidth());
+   EXPECT_EQ(1u, handle.getBytesPerPixel());
+   EXPECT_EQ(3, static_cast<unsigned char*>(handle.getPixels())[255]);
+}
+
+
+TEST_P(CircularBufferModeTest, PopNextFramesInBatches)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 1));
+
+   std::vector< boost::shared_ptr<mm::FrameBuffer> > frames;
+   EXPECT_EQ(0u, cb.PopNextFrames(3, frames));
+   EXPECT_TRUE(frames.empty());
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(16 * 16);
+   for (unsigned char i = 0; i < 5; ++i)
+   {
+      pixels[0] = i;
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 16, 16, 1, &md));
+   }
+
+   EXPECT_EQ(3u, cb.PopNextFrames(3, frames));
+   EXPECT_EQ(2u, cb.GetRemainingImageCount());
+   EXPECT_EQ(2u, cb.PopNextFrames(3, frames));
+   EXPECT_EQ(0u, cb.PopNextFrames(3, frames));
+   ASSERT_EQ(5u, frames.size());
+   for (unsigned char i = 0; i < 5; ++i)
+   {
+      FrameHandle handle(frames[i], 0);
+      ASSERT_TRUE(handle.isValid());
+      EXPECT_EQ(i, static_cast<unsigned char*>(handle.getPixels())[0]);
+   }
+}
+
+
+namespace
+{
+
+void InsertAfterDelay(CircularBuffer* cb, long delayMs)
+{
+   boost::this_thread::sleep(boost::posix_time::milliseconds(delayMs));
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(16 * 16);
+   cb->InsertImage(&pixels[0], 16, 16, 1, &md);
+}
+
+bool IsReadable(int fd)
+{
+#ifndef WIN32
+   pollfd pfd = { fd, POLLIN, 0 };
+   return poll(&pfd, 1, 0) == 1;
+#else
+   return false;
+#endif
+}
+
+} // anonymous namespace
+
+TEST_P(CircularBufferModeTest, FrameSignalWakesWaiter)
+{
+   boost::shared_ptr<mm::FrameSignal> signal(new mm::FrameSignal());
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   cb.SetFrameSignal(signal);
+   ASSERT_TRUE(cb.Initialize(1, 16, 16, 1));
+
+   const int fd = signal->GetDescriptor();
+#ifndef WIN32
+   ASSERT_LE(0, fd);
+   EXPECT_FALSE(IsReadable(fd));
+#endif
+
+   unsigned long generation = signal->GetGeneration();
+   EXPECT_FALSE(signal->WaitForChange(generation, 20));
+
+   boost::thread producer(boost::bind(InsertAfterDelay, &cb, 50));
+   EXPECT_TRUE(signal->WaitForChange(generation, 10000));
+   producer.join();
+   EXPECT_EQ(1u, cb.GetRemainingImageCount());
+   EXPECT_NE(generation, signal->GetGeneration());
+
+#ifndef WIN32
+   EXPECT_TRUE(IsReadable(fd));
+   signal->ResetDescriptor();
+   EXPECT_FALSE(IsReadable(fd));
+   InsertAfterDelay(&cb, 0);
+   EXPECT_TRUE(IsReadable(fd));
+#endif
+}
+
+
+TEST_P(CircularBufferModeTest, PeekAndArrivalTimeAcrossBuffers)
+{
+   // Two cameras of different sizes, each with its own buffer
+   CircularBuffer small(1), large(1);
+   small.SetLockFree(GetParam());
+   large.SetLockFree(GetParam());
+   ASSERT_TRUE(small.Initialize(1, 16, 16, 1));
+   ASSERT_TRUE(large.Initialize(1, 64, 64, 2));
+   EXPECT_FALSE(small.PeekNextFrame());
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(64 * 64 * 2, 1);
+   ASSERT_TRUE(small.InsertImage(&pixels[0], 16, 16, 1, &md));
+   boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   ASSERT_TRUE(large.InsertImage(&pixels[0], 64, 64, 2, &md));
+   boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   ASSERT_TRUE(small.InsertImage(&pixels[0], 16, 16, 1, &md));
+
+   boost::shared_ptr<mm::FrameBuffer> first = small.PeekNextFrame();
+   ASSERT_TRUE(first);
+   EXPECT_EQ(first, small.PeekNextFrame());
+   EXPECT_EQ(2u, small.GetRemainingImageCount());
+   ASSERT_TRUE(large.PeekNextFrame());
+   EXPECT_LT(first->GetArrivalTime(), large.PeekNextFrame()->GetArrivalTime());
+
+   EXPECT_EQ(first, small.PopNextFrame());
+   ASSERT_TRUE(small.PeekNextFrame());
+   EXPECT_LT(large.PeekNextFrame()->GetArrivalTime(),
+         small.PeekNextFrame()->GetArrivalTime());
+   EXPECT_EQ(64u, FrameHandle(large.PopNextFrame(), 0).getImageWidth());
+   EXPECT_EQ(16u, FrameHandle(small.PopNextFrame(), 0).getImageWidth());
+   EXPECT_FALSE(small.PeekNextFrame());
+}
+
+
+TEST_P(CircularBufferModeTest, SlotsAreContiguousAndReused)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   ASSERT_TRUE(cb.Initialize(2, 10, 10, 1));
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(2 * 10 * 10, 5);
+   ASSERT_TRUE(cb.InsertMultiChannel(&pixels[0], 2, 10, 10, 1, &md));
+   ASSERT_TRUE(cb.InsertMultiChannel(&pixels[0], 2, 10, 10, 1, &md));
+   const unsigned char* first = cb.GetTopImageBuffer(0)->GetPixels();
+   const unsigned char* second = cb.GetNthFromTopImageBuffer(1, 0)->GetPixels();
+   const unsigned char* secondChannel1 = cb.GetNthFromTopImageBuffer(1, 1)->GetPixels();
+
+   // Channels are cache-line aligned, slots follow each other
+   EXPECT_EQ(128, secondChannel1 - second);
+   EXPECT_EQ(256, first - second);
+   EXPECT_EQ(5, secondChannel1[99]);
+
+   // A new geometry reuses the same memory
+   ASSERT_TRUE(cb.Initialize(1, 20, 20, 1));
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 20, 20, 1, &md));
+   EXPECT_EQ(second, cb.GetTopImageBuffer(0)->GetPixels());
+
+   // Changing the memory options discards the images
+   mm::RingMemoryOptions options;
+   options.useHugePages = false;
+   options.lockPages = true;
+   cb.SetMemoryOptions(options);
+   EXPECT_EQ(0u, cb.GetRemainingImageCount());
+   EXPECT_THROW(cb.InsertImage(&pixels[0], 20, 20, 1, &md), CMMError);
+   ASSERT_TRUE(cb.Initialize(1, 20, 20, 1));
+   EXPECT_TRUE(cb.InsertImage(&pixels[0], 20, 20, 1, &md));
+}
+
+
+TEST_P(CircularBufferModeTest, OverflowPolicyDropOldest)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   cb.SetOverflowPolicy(CircularBuffer::OverflowDropOldest, 0);
+   ASSERT_TRUE(cb.Initialize(1, 512, 512, 1));
+   const unsigned long size = cb.GetSize();
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(512 * 512);
+   for (unsigned long i = 0; i < size + 2; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   }
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(size, cb.GetRemainingImageCount());
+   EXPECT_EQ(2u, cb.GetDroppedFrameCount("TestCamera"));
+   EXPECT_EQ(0u, cb.GetDroppedFrameCount("OtherCamera"));
+   EXPECT_EQ(2, cb.GetNextImageBuffer(0)->GetPixels()[0]);
+
+   // A slot reserved for zero-copy insertion also makes room
+   ASSERT_TRUE(cb.AcquireSlot(512, 512, 1, 1) != 0);
+   ASSERT_TRUE(cb.CommitSlot(&md));
+   EXPECT_EQ(2u, cb.GetDroppedFrameCount("TestCamera"));
+   ASSERT_TRUE(cb.AcquireSlot(512, 512, 1, 1) != 0);
+   ASSERT_TRUE(cb.CommitSlot(&md));
+   EXPECT_EQ(3u, cb.GetDroppedFrameCount("TestCamera"));
+   EXPECT_EQ(4, cb.GetNextImageBuffer(0)->GetPixels()[0]);
+}
+
+TEST_P(CircularBufferModeTest, OverflowPolicyDropNewestAndBlock)
+{
+   CircularBuffer cb(1);
+   cb.SetLockFree(GetParam());
+   cb.SetOverflowPolicy(CircularBuffer::OverflowDropNewest, 0);
+   ASSERT_TRUE(cb.Initialize(1, 512, 512, 1));
+   const unsigned long size = cb.GetSize();
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(512 * 512);
+   for (unsigned long i = 0; i < size + 1; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   }
+   unsigned char* slot = cb.AcquireSlot(512, 512, 1, 1);
+   ASSERT_TRUE(slot != 0);
+   slot[0] = 99;
+   ASSERT_TRUE(cb.CommitSlot(&md));
+   EXPECT_FALSE(cb.Overflow());
+   EXPECT_EQ(2u, cb.GetDroppedFrameCount());
+   EXPECT_EQ(size, cb.GetRemainingImageCount());
+   EXPECT_EQ(0, cb.GetNextImageBuffer(0)->GetPixels()[0]);
+
+   // Blocking: the insert waits until the consumer pops a frame
+   cb.SetOverflowPolicy(CircularBuffer::OverflowBlock, 10000);
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   boost::thread consumer(boost::bind(&CircularBuffer::GetNextImageBuffer, &cb, 0u));
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   consumer.join();
+   EXPECT_EQ(2u, cb.GetDroppedFrameCount());
+
+   // ... and gives up after the timeout
+   cb.SetOverflowPolicy(CircularBuffer::OverflowBlock, 20);
+   ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+   EXPECT_EQ(3u, cb.GetDroppedFrameCount());
+   EXPECT_FALSE(cb.Overflow());
+}
+
+
+namespace
+{
+
+void LockAndUnlock(MMThreadLock* lock)
+{
+   lock->Lock();
+   lock->Unlock();
+}
+
+} // anonymous namespace
+
+TEST(CircularBufferTest, BlockedProducerDoesNotHoldInsertLock)
+{
+   CircularBuffer cb(1);
+   cb.SetOverflowPolicy(CircularBuffer::OverflowBlock, 10000);
+   ASSERT_TRUE(cb.Initialize(1, 512, 512, 1));
+
+   Metadata md = CameraMetadata();
+   std::vector<unsigned char> pixels(512 * 512);
+   for (unsigned long i = 0; i < cb.GetSize(); ++i)
+      ASSERT_TRUE(cb.InsertImage(&pixels[0], 512, 512, 1, &md));
+
+   boost::thread producer(boost::bind(&CircularBuffer::InsertImage, &cb,
+            &pixels[0], 512u, 512u, 1u, &md));
+   boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+
+   // While the producer waits for room, other producers can get in
+   boost::thread locker(boost::bind(LockAndUnlock, &cb.g_insertLock));
+   EXPECT_TRUE(locker.timed_join(boost::posix_time::seconds(5)));
+
+   // The pop wakes the producer long before its timeout
+   ASSERT_TRUE(cb.GetNextImageBuffer(0) != 0);
+   EXPECT_TRUE(producer.timed_join(boost::posix_time::seconds(5)));
+   EXPECT_EQ(cb.GetSize(), cb.GetRemainingImageCount());
+   EXPECT_EQ(0u, cb.GetDroppedFrameCount());
+   if (locker.joinable())
+      locker.join();
+}
+
+
+INSTANTIATE_TEST_CASE_P(LockedAndLockFree, CircularBufferModeTest,
+      ::testing::Values(false, true));
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+
+#include "ConfigGroup.h"
+
+#include <string>
+#include <vector>
+
+
+TEST(ConfigGroupTests, IndexFollowsDefineAndDelete)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Channel", "GFP", "Filter", "Label", "2");
+   groups.Define("Channel", "GFP", "Shutter", "State", "1");
+   groups.Define("Objective", "10x", "Nosepiece", "Label", "10x");
+
+   std::vector<std::string> affected =
+      groups.GetGroupsIncludingProperty("Filter", "Label");
+   ASSERT_EQ(1u, affected.size());
+   EXPECT_EQ("Channel", affected[0]);
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Filter", "State").empty());
+
+   // Still referenced by DAPI
+   EXPECT_TRUE(groups.Delete("Channel", "GFP", "Filter", "Label"));
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Filter", "Label").size());
+   EXPECT_TRUE(groups.Delete("Channel", "DAPI"));
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Filter", "Label").empty());
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Shutter", "State").size());
+
+   EXPECT_TRUE(groups.Delete("Channel"));
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Shutter", "State").empty());
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Nosepiece", "Label").size());
+
+   groups.Clear();
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Nosepiece", "Label").empty());
+}
+
+TEST(ConfigGroupTests, IndexFollowsRename)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Channel", "GFP", "Shutter", "State", "1");
+   groups.Define("Light", "On", "Lamp", "State", "1");
+
+   EXPECT_TRUE(groups.RenameGroup("Channel", "Channels"));
+   std::vector<std::string> affected =
+      groups.GetGroupsIncludingProperty("Filter", "Label");
+   ASSERT_EQ(1u, affected.size());
+   EXPECT_EQ("Channels", affected[0]);
+
+   // Renaming onto an existing preset replaces it
+   EXPECT_TRUE(groups.RenameConfig("Channels", "DAPI", "GFP"));
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Filter", "Label").size());
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Shutter", "State").empty());
+
+   // Renaming onto an existing group replaces it
+   EXPECT_TRUE(groups.RenameGroup("Light", "Channels"));
+   EXPECT_TRUE(groups.GetGroupsIncludingProperty("Filter", "Label").empty());
+   EXPECT_EQ(1u, groups.GetGroupsIncludingProperty("Lamp", "State").size());
+}
+
+TEST(ConfigGroupTests, PixelSizePresets)
+{
+   PixelSizeConfigGroup pixelSizes;
+   EXPECT_FALSE(pixelSizes.IsPropertyIncluded("Nosepiece", "Label"));
+   pixelSizes.DefinePixelSize("10x", "Nosepiece", "Label", "10x", 0.65);
+   pixelSizes.DefinePixelSize("20x", "Nosepiece", "Label", "20x", 0.325);
+   EXPECT_TRUE(pixelSizes.IsPropertyIncluded("Nosepiece", "Label"));
+   EXPECT_TRUE(pixelSizes.Delete("10x"));
+   EXPECT_TRUE(pixelSizes.IsPropertyIncluded("Nosepiece", "Label"));
+   EXPECT_TRUE(pixelSizes.Delete("20x", "Nosepiece", "Label"));
+   EXPECT_FALSE(pixelSizes.IsPropertyIncluded("Nosepiece", "Label"));
+}
+
+TEST(ConfigGroupTests, MatchPresets)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Channel", "GFP", "Filter", "Label", "2");
+   groups.Define("Channel", "GFP", "Shutter", "State", "1");
+   ConfigGroup* group = groups.FindGroup("Channel");
+   ASSERT_TRUE(group != 0);
+
+   const std::vector<PropertySetting>& properties = group->GetMatchProperties();
+   ASSERT_EQ(2u, properties.size());
+   std::vector<std::string> values(2);
+   std::vector<bool> known(2, true);
+   for (size_t i = 0; i < properties.size(); ++i)
+   {
+      if (properties[i].getDeviceLabel() == "Filter")
+         values[i] = "2";
+      else
+         values[i] = "1";
+   }
+   EXPECT_EQ("GFP", group->FindMatchingPreset(values, known));
+
+   // An unknown value only fails the presets that include the property
+   for (size_t i = 0; i < properties.size(); ++i)
+      known[i] = (properties[i].getDeviceLabel() == "Filter");
+   EXPECT_EQ("", group->FindMatchingPreset(values, known));
+   for (size_t i = 0; i < properties.size(); ++i)
+   {
+      if (properties[i].getDeviceLabel() == "Filter")
+         values[i] = "1";
+   }
+   EXPECT_EQ("DAPI", group->FindMatchingPreset(values, known));
+}
+
+TEST(ConfigGroupTests, CachedMatchInvalidation)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Filter", "Label", "1");
+   groups.Define("Objective", "10x", "Nosepiece", "Label", "10x");
+   ConfigGroup* channel = groups.FindGroup("Channel");
+   ConfigGroup* objective = groups.FindGroup("Objective");
+
+   std::string preset;
+   EXPECT_FALSE(channel->GetCachedMatch(preset));
+   channel->SetCachedMatch("DAPI", channel->GetStateRevision());
+   objective->SetCachedMatch("10x", objective->GetStateRevision());
+   ASSERT_TRUE(channel->GetCachedMatch(preset));
+   EXPECT_EQ("DAPI", preset);
+
+   // Only the group including the property is invalidated
+   groups.InvalidateCachedMatches(PropertySetting::generateKey("Filter", "Label"));
+   EXPECT_FALSE(channel->GetCachedMatch(preset));
+   EXPECT_TRUE(objective->GetCachedMatch(preset));
+
+   // A result computed before an invalidation is not memoized
+   const unsigned long revision = channel->GetStateRevision();
+   groups.InvalidateCachedMatches(PropertySetting::generateKey("Filter", "Label"));
+   channel->SetCachedMatch("DAPI", revision);
+   EXPECT_FALSE(channel->GetCachedMatch(preset));
+
+   // Editing presets invalidates
+   groups.Define("Objective", "20x", "Nosepiece", "Label", "20x");
+   EXPECT_FALSE(objective->GetCachedMatch(preset));
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include "MockCoreTest.h"
+
+#include <string>
+
+// Devices of the MockA and MockB modules (see MockDeviceAdapter.cpp) are
+// initialized concurrently by initializeAllDevices().
+
+typedef MockCoreTest DeviceInitializerTest;
+
+
+TEST_F(DeviceInitializerTest, WaitsForWholeModuleOfDependency)
+{
+   Load("A1", "MockA");
+   Load("B1", "MockB");
+   Load("B2", "MockB");
+   core.setProperty("A1", "DependsOn", "B1");
+   core.setProperty("B2", "InitDelayMs", "200");
+
+   core.initializeAllDevices();
+
+   // A1 got to use B1 only after the whole of MockB was initialized
+   EXPECT_EQ("0", core.getProperty("A1", "PeerPendingInits"));
+}
+
+TEST_F(DeviceInitializerTest, CycleDoesNotDeadlock)
+{
+   Load("A1", "MockA");
+   Load("B1", "MockB");
+   core.setProperty("A1", "DependsOn", "B1");
+   core.setProperty("B1", "DependsOn", "A1");
+   core.setProperty("A1", "InitDelayMs", "50");
+   core.setProperty("B1", "InitDelayMs", "50");
+
+   core.initializeAllDevices();
+
+   // One of them waited for the other; the other saw the cycle and went
+   // ahead without waiting
+   std::string a = core.getProperty("A1", "PeerPendingInits");
+   std::string b = core.getProperty("B1", "PeerPendingInits");
+   EXPECT_TRUE((a == "0" && b == "1") || (a == "1" && b == "0")) <<
+      "A1: " << a << ", B1: " << b;
+}
+
+TEST_F(DeviceInitializerTest, ErrorsOfAllModulesAreReported)
+{
+   Load("A1", "MockA");
+   Load("A2", "MockA");
+   Load("B1", "MockB");
+   Load("B2", "MockB");
+   core.setProperty("A1", "FailInit", "1");
+   core.setProperty("B2", "FailInit", "1");
+   core.setProperty("B2", "InitDelayMs", "50");
+
+   try
+   {
+      core.initializeAllDevices();
+      FAIL() << "Expected initialization to fail";
+   }
+   catch (const CMMError& e)
+   {
+      const std::string msg = e.getFullMsg();
+      EXPECT_NE(std::string::npos, msg.find("A1")) << msg;
+      EXPECT_NE(std::string::npos, msg.find("B2")) << msg;
+      EXPECT_EQ(std::string::npos, msg.find("A2")) << msg;
+   }
+
+   // Devices after a failed one in the same module are skipped
+   EXPECT_FALSE(core.hasProperty("A2", "PeerPendingInits"));
+   EXPECT_TRUE(core.hasProperty("B1", "PeerPendingInits"));
+}
+
+TEST_F(DeviceInitializerTest, WaitEndsWhenDependencyModuleFails)
+{
+   Load("A1", "MockA");
+   Load("B1", "MockB");
+   Load("B2", "MockB");
+   core.setProperty("A1", "DependsOn", "B2");
+   core.setProperty("B1", "FailInit", "1");
+   core.setProperty("B1", "InitDelayMs", "50");
+
+   EXPECT_THROW(core.initializeAllDevices(), CMMError);
+
+   // A1 went ahead once MockB was done, with B1 failed and B2 skipped
+   EXPECT_EQ("2", core.getProperty("A1", "PeerPendingInits"));
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
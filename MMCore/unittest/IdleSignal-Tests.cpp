@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include "IdleSignal.h"
+#include "MockCoreTest.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+
+namespace {
+
+void NotifyAfter(mm::IdleSignal* signal, long delayMs)
+{
+   boost::this_thread::sleep(boost::posix_time::milliseconds(delayMs));
+   signal->Notify();
+}
+
+} // anonymous namespace
+
+
+TEST(IdleSignalTest, NotifyWakesWaiter)
+{
+   mm::IdleSignal signal;
+   const unsigned long generation = signal.GetGeneration();
+   boost::thread notifier(boost::bind(&NotifyAfter, &signal, 20));
+
+   const double startMs = NowMs();
+   EXPECT_TRUE(signal.WaitForChange(generation, 5000.0));
+   EXPECT_LT(NowMs() - startMs, 1000.0);
+   EXPECT_NE(generation, signal.GetGeneration());
+   notifier.join();
+}
+
+TEST(IdleSignalTest, NotifyBeforeWaitIsNotMissed)
+{
+   mm::IdleSignal signal;
+   const unsigned long generation = signal.GetGeneration();
+   signal.Notify();
+
+   const double startMs = NowMs();
+   EXPECT_TRUE(signal.WaitForChange(generation, 5000.0));
+   EXPECT_LT(NowMs() - startMs, 1000.0);
+}
+
+TEST(IdleSignalTest, TimesOutWithoutNotify)
+{
+   mm::IdleSignal signal;
+   const double startMs = NowMs();
+   EXPECT_FALSE(signal.WaitForChange(signal.GetGeneration(), 50.0));
+   EXPECT_GE(NowMs() - startMs, 45.0);
+}
+
+
+class WaitForDevicesTest : public MockCoreTest
+{
+protected:
+   virtual void SetUp()
+   {
+      Load("A1", "MockA");
+      Load("B1", "MockB");
+      core.initializeAllDevices();
+   }
+};
+
+TEST_F(WaitForDevicesTest, ReturnsWhenDeviceNotifiesIdle)
+{
+   core.setProperty("A1", "NotifyIdle", "1");
+   core.setProperty("A1", "BusyMs", "100");
+   EXPECT_TRUE(core.deviceBusy("A1"));
+
+   core.waitForDevice("A1");
+   EXPECT_FALSE(core.deviceBusy("A1"));
+}
+
+TEST_F(WaitForDevicesTest, WaitsForSlowestDevice)
+{
+   core.setProperty("A1", "BusyMs", "50");
+   core.setProperty("B1", "BusyMs", "150");
+
+   core.waitForSystem();
+   EXPECT_FALSE(core.deviceBusy("A1"));
+   EXPECT_FALSE(core.deviceBusy("B1"));
+}
+
+TEST_F(WaitForDevicesTest, TimesOut)
+{
+   core.setTimeoutMs(200);
+   core.setProperty("B1", "BusyMs", "-1");
+
+   const double startMs = NowMs();
+   try
+   {
+      core.waitForDevice("B1");
+      FAIL() << "Expected the wait to time out";
+   }
+   catch (const CMMError& e)
+   {
+      EXPECT_EQ(MMERR_DevicePollingTimeout, e.getCode());
+   }
+   const double elapsedMs = NowMs() - startMs;
+   EXPECT_GE(elapsedMs, 190.0);
+   EXPECT_LT(elapsedMs, 2000.0);
+
+   core.setProperty("B1", "BusyMs", "0");
+   core.waitForDevice("B1");
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
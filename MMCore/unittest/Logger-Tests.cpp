@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include "LogFileArchiver.h"
 #include "Logging/Logging.h"
 
 #include <boost/bind.hpp>
@@ -7,6 +8,9 @@
 #include <boost/make_shared.hpp>
 #include <boost/thread.hpp>
 
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -56,6 +60,225 @@ TEST(LoggerTests, BasicLogStream)
 }
 
 
+namespace
+{
+   int CountEvaluation(int* count)
+   {
+      ++*count;
+      return *count;
+   }
+}
+
+
+TEST(LoggerTests, DisabledLevelIsNotFormatted)
+{
+   boost::shared_ptr<LoggingCore> c =
+      boost::make_shared<LoggingCore>();
+
+   Logger lgr = c->NewLogger("mylabel");
+   int count = 0;
+
+   // No sinks: nothing is enabled
+   LOG_FATAL(lgr) << CountEvaluation(&count);
+   EXPECT_EQ(0, count);
+
+   boost::shared_ptr<LogSink> sink = boost::make_shared<StdErrLogSink>();
+   sink->SetFilter(boost::make_shared<LevelFilter>(LogLevelInfo));
+   c->AddSink(sink, SinkModeSynchronous);
+
+   EXPECT_FALSE(lgr.IsEnabled(LogLevelDebug));
+   EXPECT_TRUE(lgr.IsEnabled(LogLevelInfo));
+   LOG_DEBUG(lgr) << CountEvaluation(&count);
+   EXPECT_EQ(0, count);
+   LOG_INFO(lgr) << CountEvaluation(&count);
+   EXPECT_EQ(1, count);
+
+   // An unfiltered asynchronous sink enables all levels
+   boost::shared_ptr<LogSink> asyncSink = boost::make_shared<StdErrLogSink>();
+   c->AddSink(asyncSink, SinkModeAsynchronous);
+   EXPECT_TRUE(lgr.IsEnabled(LogLevelTrace));
+
+   c->RemoveSink(asyncSink, SinkModeAsynchronous);
+   EXPECT_FALSE(lgr.IsEnabled(LogLevelTrace));
+
+   // A dangling else must bind to the caller's if
+   bool elseTaken = false;
+   if (count == 0)
+      LOG_INFO(lgr) << "not reached";
+   else
+      elseTaken = true;
+   EXPECT_TRUE(elseTaken);
+}
+
+
+namespace
+{
+   typedef internal::GenericPacketArray<Metadata> PacketArray;
+
+   class PacketCollector
+   {
+   public:
+      boost::mutex mutex_;
+      std::vector<std::string> firstLines_;
+      size_t packetCount_;
+
+      PacketCollector() : packetCount_(0) {}
+
+      void Consume(PacketArray& packets)
+      {
+         boost::lock_guard<boost::mutex> lock(mutex_);
+         for (PacketArray::ConstIteratorType it = packets.Begin();
+               it != packets.End(); ++it)
+         {
+            if (it->GetPacketState() == internal::PacketStateEntryFirstLine)
+               firstLines_.push_back(it->GetText());
+            ++packetCount_;
+         }
+      }
+   };
+
+   PacketArray MakeEntry(const char* text)
+   {
+      StampData stamp;
+      stamp.Stamp();
+      PacketArray packets;
+      packets.AppendEntry("label", LogLevelInfo, stamp, text);
+      return packets;
+   }
+
+   void SendRepeatedly(internal::GenericPacketQueue<Metadata>* queue,
+         const PacketArray* entry, unsigned count)
+   {
+      for (unsigned i = 0; i < count; ++i)
+         queue->SendPackets(entry->Begin(), entry->End());
+   }
+}
+
+
+TEST(LoggerTests, PacketQueueDropsWhenFull)
+{
+   internal::GenericPacketQueue<Metadata> queue(8);
+   PacketArray entry = MakeEntry("line 1\nline 2\nline 3");
+
+   // Without a receiver, two 3-line entries fit in 8 slots
+   for (int i = 0; i < 4; ++i)
+      queue.SendPackets(entry.Begin(), entry.End());
+   EXPECT_EQ(2u, queue.GetDroppedEntryCount());
+
+   PacketCollector collector;
+   queue.RunReceiveLoop(
+         boost::bind(&PacketCollector::Consume, &collector, _1));
+   queue.ShutdownReceiveLoop();
+   EXPECT_EQ(2u, collector.firstLines_.size());
+   EXPECT_EQ(6u, collector.packetCount_);
+
+   // Slots are reused after being received
+   queue.SendPackets(entry.Begin(), entry.End());
+   EXPECT_EQ(2u, queue.GetDroppedEntryCount());
+}
+
+
+TEST(LoggerTests, PacketQueueManySenders)
+{
+   internal::GenericPacketQueue<Metadata> queue;
+   queue.SetFlushIntervalMs(1);
+   PacketCollector collector;
+   queue.RunReceiveLoop(
+         boost::bind(&PacketCollector::Consume, &collector, _1));
+
+   PacketArray entry = MakeEntry("first\nsecond");
+   std::vector< boost::shared_ptr<boost::thread> > threads;
+   for (unsigned i = 0; i < 8; ++i)
+   {
+      threads.push_back(boost::make_shared<boost::thread>(
+               &SendRepeatedly, &queue, &entry, 100));
+   }
+   for (unsigned i = 0; i < threads.size(); ++i)
+      threads[i]->join();
+   queue.ShutdownReceiveLoop();
+
+   EXPECT_EQ(0u, queue.GetDroppedEntryCount());
+   ASSERT_EQ(800u, collector.firstLines_.size());
+   EXPECT_EQ(1600u, collector.packetCount_);
+   for (unsigned i = 0; i < collector.firstLines_.size(); ++i)
+      EXPECT_EQ("first", collector.firstLines_[i]);
+}
+
+
+namespace
+{
+   void RecordFilename(std::vector<std::string>* names,
+         const std::string& name)
+   {
+      names->push_back(name);
+   }
+
+   std::string ReadWholeFile(const std::string& filename)
+   {
+      std::ifstream file(filename.c_str());
+      return std::string(std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>());
+   }
+
+   bool FileExists(const std::string& filename)
+   {
+      return std::ifstream(filename.c_str()).good();
+   }
+}
+
+
+TEST(LoggerTests, FileSinkRotatesBySize)
+{
+   const std::string filename = "Logger-Tests-rotation.log";
+   std::vector<std::string> rotated;
+   {
+      FileLogSink sink(filename);
+      sink.SetRotation(1, 0, boost::bind(&RecordFilename, &rotated, _1));
+      sink.Consume(MakeEntry("first")); // Empty file is not rotated
+      sink.Consume(MakeEntry("second"));
+   }
+
+   ASSERT_EQ(1u, rotated.size());
+   EXPECT_NE(std::string::npos, ReadWholeFile(rotated[0]).find("first"));
+   const std::string current = ReadWholeFile(filename);
+   EXPECT_NE(std::string::npos, current.find("second"));
+   EXPECT_EQ(std::string::npos, current.find("first"));
+
+   std::remove(rotated[0].c_str());
+   std::remove(filename.c_str());
+}
+
+
+TEST(LoggerTests, ArchiverKeepsNewestFiles)
+{
+   const bool compress = mm::LogFileArchiver::IsCompressionAvailable();
+   const std::string suffix = compress ? ".gz" : "";
+   std::vector<std::string> names;
+   {
+      mm::LogFileArchiver archiver;
+      for (int i = 0; i < 3; ++i)
+      {
+         names.push_back("Logger-Tests-archive.log." +
+               boost::lexical_cast<std::string>(i));
+         std::ofstream(names[i].c_str()) << "entry " << i << '\n';
+         archiver.Archive("Logger-Tests-archive.log", names[i], true, 2);
+      }
+   } // Waits for the queued files
+
+   EXPECT_FALSE(FileExists(names[0]));
+   EXPECT_FALSE(FileExists(names[0] + suffix));
+   for (int i = 1; i < 3; ++i)
+   {
+      EXPECT_TRUE(FileExists(names[i] + suffix));
+      if (compress)
+      {
+         EXPECT_FALSE(FileExists(names[i]));
+      }
+      std::remove((names[i] + suffix).c_str());
+   }
+}
+
+
 class LoggerTestThreadFunc
 {
    unsigned n_;
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include "Metrics.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+using namespace mm;
+
+
+namespace
+{
+   void AddRepeatedly(MetricCounter* counter, unsigned count)
+   {
+      for (unsigned i = 0; i < count; ++i)
+         counter->Add();
+   }
+}
+
+
+TEST(MetricsTests, CounterSumsThreads)
+{
+   MetricCounter counter;
+   std::vector< boost::shared_ptr<boost::thread> > threads;
+   for (unsigned i = 0; i < 8; ++i)
+   {
+      threads.push_back(boost::make_shared<boost::thread>(
+               &AddRepeatedly, &counter, 10000));
+   }
+   for (unsigned i = 0; i < threads.size(); ++i)
+      threads[i]->join();
+   EXPECT_EQ(80000u, counter.Get());
+
+   counter.Reset();
+   EXPECT_EQ(0u, counter.Get());
+}
+
+
+TEST(MetricsTests, HistogramSummary)
+{
+   LatencyHistogram histogram;
+   EXPECT_EQ(0u, histogram.GetSummary().count);
+
+   for (int i = 0; i < 98; ++i)
+      histogram.Record(10); // Bucket [8, 16)
+   histogram.Record(0);
+   histogram.Record(5000); // Bucket [4096, 8192)
+
+   const LatencyHistogram::Summary summary = histogram.GetSummary();
+   EXPECT_EQ(100u, summary.count);
+   EXPECT_DOUBLE_EQ((98 * 10 + 5000) / 100.0, summary.meanUs);
+   EXPECT_DOUBLE_EQ(5000.0, summary.maxUs);
+   EXPECT_DOUBLE_EQ(16.0, summary.PercentileUs(0.5));
+   EXPECT_DOUBLE_EQ(16.0, summary.PercentileUs(0.99));
+   EXPECT_DOUBLE_EQ(5000.0, summary.PercentileUs(1.0));
+}
+
+
+TEST(MetricsTests, HistogramLongDurations)
+{
+   LatencyHistogram histogram;
+   const long long hour = 3600LL * 1000 * 1000;
+   histogram.Record(hour);
+   EXPECT_DOUBLE_EQ(static_cast<double>(hour),
+         histogram.GetSummary().PercentileUs(0.5));
+}
+
+
+TEST(MetricsTests, PeakGauge)
+{
+   PeakGauge gauge;
+   gauge.Set(3);
+   gauge.Set(7);
+   gauge.Set(2);
+   EXPECT_EQ(2, gauge.GetCurrent());
+   EXPECT_EQ(7, gauge.GetPeak());
+   gauge.Reset();
+   EXPECT_EQ(2, gauge.GetPeak());
+}
+
+
+TEST(MetricsTests, FormatHistogram)
+{
+   LatencyHistogram histogram;
+   MetricValues values;
+   AppendMetric(values, "Empty", histogram);
+   ASSERT_EQ(1u, values.size());
+   EXPECT_EQ("Empty.Count\t0\n", FormatMetrics(values));
+
+   histogram.Record(100);
+   values.clear();
+   AppendMetric(values, "Lat", histogram);
+   ASSERT_EQ(6u, values.size());
+   EXPECT_EQ("Lat.P99", values[4].first);
+   EXPECT_DOUBLE_EQ(100.0, values[5].second);
+
+   values.clear();
+   AppendMetric(values, "Count", 12345678.0);
+   EXPECT_EQ("Count\t12345678\n", FormatMetrics(values));
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
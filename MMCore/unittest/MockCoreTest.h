@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include "MMCore.h"
+
+#include <string>
+#include <vector>
+
+// Base of the tests that drive a CMMCore with devices of the MockA and MockB
+// modules (see MockDeviceAdapter.cpp), loaded from MOCK_ADAPTER_DIR
+
+inline double NowMs()
+{
+   return GetMMTimeNow().getMsec();
+}
+
+class MockCoreTest : public ::testing::Test
+{
+protected:
+   CMMCore core;
+
+   MockCoreTest()
+   {
+      core.setDeviceAdapterSearchPaths(
+            std::vector<std::string>(1, MOCK_ADAPTER_DIR));
+   }
+
+   void Load(const char* label, const char* module,
+         const char* device = "Generic")
+   {
+      core.loadDevice(label, module, device);
+   }
+};
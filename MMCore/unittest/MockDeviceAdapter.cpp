@@ -0,0 +1,496 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MockDeviceAdapter.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore unit tests
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Device adapter used by the MMCore unit tests. It is built
+//                as more than one module (MockA, MockB), so that tests can
+//                exercise the interaction between modules.
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "../../MMDevice/DeviceBase.h"
+#include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/ModuleInterface.h"
+
+#include <cstring>
+#include <string>
+
+
+namespace {
+
+const char* g_GenericName = "Generic";
+const char* g_CameraName = "Camera";
+const char* g_ShutterName = "Shutter";
+
+// Devices of this module created but not yet initialized
+MMThreadLock g_moduleLock;
+long g_pendingInits = 0;
+
+long GetPendingInits()
+{
+   MMThreadGuard g(g_moduleLock);
+   return g_pendingInits;
+}
+
+void AddPendingInits(long n)
+{
+   MMThreadGuard g(g_moduleLock);
+   g_pendingInits += n;
+}
+
+
+class MockGeneric;
+
+// Calls OnDeviceIdle() once the device has stopped being busy
+class IdleNotifier : public MMDeviceThreadBase
+{
+public:
+   IdleNotifier(MockGeneric* device, long delayMs) :
+      device_(device), delayMs_(delayMs)
+   {}
+   int svc();
+
+private:
+   MockGeneric* device_;
+   long delayMs_;
+};
+
+
+/**
+ * Generic device whose initialization can be delayed, made to fail, or made
+ * to look at another device (pre-init property DependsOn), recording how
+ * many devices of that device's module were still uninitialized at the time
+ * (read-only property PeerPendingInits).
+ *
+ * Setting BusyMs makes the device busy for that long (forever if negative);
+ * if NotifyIdle is 1, it then calls OnDeviceIdle().
+ *
+ * Setting Value fails if it would exceed Limit. Successful sets of Value and
+ * Limit are recorded in SetLog as "Name=value;" (failed ones as
+ * "Name=value!;"), and a SetProperties() call (only supported if Batching is
+ * 1) as "{...}".
+ *
+ * Reading Slow takes GetDelayMs; reading Broken fails if FailGet is 1.
+ */
+class MockGeneric : public CGenericBase<MockGeneric>
+{
+public:
+   MockGeneric() :
+      initialized_(false),
+      busyForever_(false),
+      notifier_(0)
+   {
+      CreateStringProperty("DependsOn", "", false, 0, true);
+      CreateIntegerProperty("InitDelayMs", 0, false, 0, true);
+      CreateIntegerProperty("FailInit", 0, false, 0, true);
+      CreateIntegerProperty("ModulePendingInits", 0, true,
+            new CPropertyAction(this, &MockGeneric::OnModulePendingInits));
+      CreateIntegerProperty("BusyMs", 0, false,
+            new CPropertyAction(this, &MockGeneric::OnBusyMs));
+      CreateIntegerProperty("NotifyIdle", 0, false);
+      CreateIntegerProperty("Limit", 10, false,
+            new CPropertyAction(this, &MockGeneric::OnLimit));
+      CreateIntegerProperty("Value", 0, false,
+            new CPropertyAction(this, &MockGeneric::OnValue));
+      CreateIntegerProperty("Batching", 0, false);
+      CreateStringProperty("SetLog", "", true,
+            new CPropertyAction(this, &MockGeneric::OnSetLog));
+      CreateIntegerProperty("GetDelayMs", 0, false);
+      CreateStringProperty("Slow", "slow", true,
+            new CPropertyAction(this, &MockGeneric::OnSlow));
+      CreateIntegerProperty("FailGet", 0, false);
+      CreateStringProperty("Broken", "broken", true,
+            new CPropertyAction(this, &MockGeneric::OnBroken));
+      AddPendingInits(1);
+   }
+
+   ~MockGeneric()
+   {
+      JoinNotifier();
+      if (!initialized_)
+         AddPendingInits(-1);
+   }
+
+   int Initialize()
+   {
+      if (initialized_)
+         return DEVICE_OK;
+
+      long delayMs = 0;
+      GetProperty("InitDelayMs", delayMs);
+      if (delayMs > 0)
+         CDeviceUtils::SleepMs(delayMs);
+
+      long fail = 0;
+      GetProperty("FailInit", fail);
+      if (fail)
+         return DEVICE_ERR;
+
+      char peerLabel[MM::MaxStrLength];
+      GetProperty("DependsOn", peerLabel);
+      std::string peerPending = "-1";
+      if (strlen(peerLabel) > 0)
+      {
+         MM::Device* peer = GetDevice(peerLabel);
+         char value[MM::MaxStrLength];
+         if (peer && peer->GetProperty("ModulePendingInits", value) == DEVICE_OK)
+            peerPending = value;
+      }
+      CreateStringProperty("PeerPendingInits", peerPending.c_str(), true);
+
+      initialized_ = true;
+      AddPendingInits(-1);
+      return DEVICE_OK;
+   }
+
+   int Shutdown() { return DEVICE_OK; }
+   void GetName(char* name) const
+   { CDeviceUtils::CopyLimitedString(name, g_GenericName); }
+   bool Busy()
+   {
+      return busyForever_ || GetCurrentMMTime() < busyUntil_;
+   }
+
+   int NotifyIdle() { return OnDeviceIdle(); }
+
+   int SetProperties(const char* const* names, const char* const* values,
+         unsigned count)
+   {
+      long batching = 0;
+      GetProperty("Batching", batching);
+      if (!batching)
+         return DEVICE_UNSUPPORTED_COMMAND;
+
+      setLog_ += "{";
+      int ret = DEVICE_OK;
+      for (unsigned i = 0; i < count && ret == DEVICE_OK; ++i)
+         ret = SetProperty(names[i], values[i]);
+      setLog_ += "}";
+      return ret;
+   }
+
+   int OnModulePendingInits(MM::PropertyBase* pProp, MM::ActionType eAct)
+   {
+      if (eAct == MM::BeforeGet)
+         pProp->Set(GetPendingInits());
+      return DEVICE_OK;
+   }
+
+   int OnBusyMs(MM::PropertyBase* pProp, MM::ActionType eAct)
+   {
+      if (eAct == MM::AfterSet)
+      {
+         long busyMs;
+         pProp->Get(busyMs);
+         busyForever_ = (busyMs < 0);
+         busyUntil_ = GetCurrentMMTime() + MM::MMTime(busyMs * 1000.0);
+
+         long notify = 0;
+         GetProperty("NotifyIdle", notify);
+         JoinNotifier();
+         if (notify && !busyForever_)
+         {
+            notifier_ = new IdleNotifier(this, busyMs);
+            notifier_->activate();
+         }
+      }
+      return DEVICE_OK;
+   }
+
+   int OnLimit(MM::PropertyBase* pProp, MM::ActionType eAct)
+   {
+      if (eAct == MM::AfterSet)
+         LogSet(pProp, true);
+      return DEVICE_OK;
+   }
+
+   int OnValue(MM::PropertyBase* pProp, MM::ActionType eAct)
+   {
+      if (eAct == MM::AfterSet)
+      {
+         long value;
+         pProp->Get(value);
+         long limit = 0;
+         GetProperty("Limit", limit);
+         LogSet(pProp, value <= limit);
+         if (value > limit)
+            return DEVICE_INVALID_PROPERTY_VALUE;
+      }
+      return DEVICE_OK;
+   }
+
+   int OnSetLog(MM::PropertyBase* pProp, MM::ActionType eAct)
+   {
+      if (eAct == MM::BeforeGet)
+         pProp->Set(setLog_.c_str());
+      return DEVICE_OK;
+   }
+
+   int OnSlow(MM::PropertyBase*, MM::ActionType eAct)
+   {
+      if (eAct == MM::BeforeGet)
+      {
+         long delayMs = 0;
+         GetProperty("GetDelayMs", delayMs);
+         if (delayMs > 0)
+            CDeviceUtils::SleepMs(delayMs);
+      }
+      return DEVICE_OK;
+   }
+
+   int OnBroken(MM::PropertyBase*, MM::ActionType eAct)
+   {
+      if (eAct == MM::BeforeGet)
+      {
+         long fail = 0;
+         GetProperty("FailGet", fail);
+         if (fail)
+            return DEVICE_ERR;
+      }
+      return DEVICE_OK;
+   }
+
+private:
+   void LogSet(MM::PropertyBase* pProp, bool ok)
+   {
+      std::string value;
+      pProp->Get(value);
+      setLog_ += pProp->GetName() + "=" + value + (ok ? ";" : "!;");
+   }
+
+   void JoinNotifier()
+   {
+      if (notifier_)
+      {
+         notifier_->wait();
+         delete notifier_;
+         notifier_ = 0;
+      }
+   }
+
+   bool initialized_;
+   bool busyForever_;
+   MM::MMTime busyUntil_;
+   IdleNotifier* notifier_;
+   std::string setLog_;
+};
+
+int IdleNotifier::svc()
+{
+   CDeviceUtils::SleepMs(delayMs_);
+   device_->NotifyIdle();
+   return 0;
+}
+
+
+
+/**
+ * Shutter that takes ActuationMs to open or close, during which it is busy
+ * and keeps its previous state. The state actually reached is available as
+ * the read-only property PhysicallyOpen. SetOpen() itself can be made to
+ * take SetOpenDelayMs, and opening to fail (FailOpen).
+ */
+class MockShutter : public CShutterBase<MockShutter>
+{
+public:
+   MockShutter() :
+      previousOpen_(false),
+      targetOpen_(false)
+   {
+      CreateIntegerProperty("ActuationMs", 0, false);
+      CreateIntegerProperty("SetOpenDelayMs", 0, false);
+      CreateIntegerProperty("FailOpen", 0, false);
+      CreateIntegerProperty("PhysicallyOpen", 0, true,
+            new CPropertyAction(this, &MockShutter::OnPhysicallyOpen));
+   }
+
+   int Initialize() { return DEVICE_OK; }
+   int Shutdown() { return DEVICE_OK; }
+   void GetName(char* name) const
+   { CDeviceUtils::CopyLimitedString(name, g_ShutterName); }
+
+   bool Busy()
+   {
+      MMThreadGuard g(stateLock_);
+      return GetCurrentMMTime() < doneTime_;
+   }
+
+   int SetOpen(bool open)
+   {
+      long delayMs = 0;
+      GetProperty("SetOpenDelayMs", delayMs);
+      if (delayMs > 0)
+         CDeviceUtils::SleepMs(delayMs);
+      long fail = 0;
+      GetProperty("FailOpen", fail);
+      if (open && fail)
+         return DEVICE_ERR;
+
+      long actuationMs = 0;
+      GetProperty("ActuationMs", actuationMs);
+      MMThreadGuard g(stateLock_);
+      previousOpen_ = IsPhysicallyOpen();
+      targetOpen_ = open;
+      doneTime_ = GetCurrentMMTime() + MM::MMTime(actuationMs * 1000.0);
+      return DEVICE_OK;
+   }
+
+   int GetOpen(bool& open)
+   {
+      MMThreadGuard g(stateLock_);
+      open = IsPhysicallyOpen();
+      return DEVICE_OK;
+   }
+
+   int Fire(double) { return DEVICE_UNSUPPORTED_COMMAND; }
+
+   // May be called (by cameras) from any thread
+   int OnPhysicallyOpen(MM::PropertyBase* pProp, MM::ActionType eAct)
+   {
+      if (eAct == MM::BeforeGet)
+      {
+         MMThreadGuard g(stateLock_);
+         pProp->Set(IsPhysicallyOpen() ? 1L : 0L);
+      }
+      return DEVICE_OK;
+   }
+
+private:
+   // Requires stateLock_
+   bool IsPhysicallyOpen()
+   {
+      return GetCurrentMMTime() < doneTime_ ? previousOpen_ : targetOpen_;
+   }
+
+   MMThreadLock stateLock_;
+   bool previousOpen_;
+   bool targetOpen_;
+   MM::MMTime doneTime_;
+};
+
+
+/**
+ * 8-bit camera whose snap takes the exposure time, and whose image records
+ * the conditions of the snap: pixel 0 counts the snaps, pixel 1 is 1 if the
+ * shutter named by ShutterLabel was open both at the start and at the end
+ * of the exposure (0 if not, 2 if there is no shutter), and pixel 2 is the
+ * exposure in ms.
+ */
+class MockCamera : public CCameraBase<MockCamera>
+{
+public:
+   MockCamera() :
+      exposureMs_(10.0),
+      snapCount_(0)
+   {
+      memset(image_, 0, sizeof(image_));
+      CreateStringProperty("ShutterLabel", "", false);
+      CreateIntegerProperty(MM::g_Keyword_Binning, 1, false);
+   }
+
+   int Initialize() { return DEVICE_OK; }
+   int Shutdown() { return DEVICE_OK; }
+   void GetName(char* name) const
+   { CDeviceUtils::CopyLimitedString(name, g_CameraName); }
+   bool Busy() { return false; }
+
+   int SnapImage()
+   {
+      const bool openAtStart = IsShutterOpen();
+      CDeviceUtils::SleepMs(static_cast<long>(exposureMs_ + 0.5));
+      const bool openAtEnd = IsShutterOpen();
+
+      char shutterLabel[MM::MaxStrLength];
+      GetProperty("ShutterLabel", shutterLabel);
+      memset(image_, 0, sizeof(image_));
+      image_[0] = static_cast<unsigned char>(++snapCount_);
+      if (strlen(shutterLabel) == 0)
+         image_[1] = 2;
+      else
+         image_[1] = (openAtStart && openAtEnd) ? 1 : 0;
+      image_[2] = static_cast<unsigned char>(exposureMs_ + 0.5);
+      return DEVICE_OK;
+   }
+
+   const unsigned char* GetImageBuffer() { return image_; }
+   unsigned GetImageWidth() const { return Size; }
+   unsigned GetImageHeight() const { return Size; }
+   unsigned GetImageBytesPerPixel() const { return 1; }
+   unsigned GetBitDepth() const { return 8; }
+   long GetImageBufferSize() const { return Size * Size; }
+   double GetExposure() const { return exposureMs_; }
+   void SetExposure(double exp) { exposureMs_ = exp; }
+   int SetROI(unsigned, unsigned, unsigned, unsigned)
+   { return DEVICE_UNSUPPORTED_COMMAND; }
+   int GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySize)
+   {
+      x = y = 0;
+      xSize = ySize = Size;
+      return DEVICE_OK;
+   }
+   int ClearROI() { return DEVICE_OK; }
+   int GetBinning() const { return 1; }
+   int SetBinning(int binSize)
+   { return binSize == 1 ? DEVICE_OK : DEVICE_UNSUPPORTED_COMMAND; }
+   int IsExposureSequenceable(bool& seq) const { seq = false; return DEVICE_OK; }
+
+private:
+   static const unsigned Size = 16;
+
+   bool IsShutterOpen()
+   {
+      char shutterLabel[MM::MaxStrLength];
+      GetProperty("ShutterLabel", shutterLabel);
+      if (strlen(shutterLabel) == 0)
+         return false;
+      MM::Device* shutter = GetDevice(shutterLabel);
+      char value[MM::MaxStrLength];
+      return shutter &&
+         shutter->GetProperty("PhysicallyOpen", value) == DEVICE_OK &&
+         strcmp(value, "1") == 0;
+   }
+
+   unsigned char image_[Size * Size];
+   double exposureMs_;
+   long snapCount_;
+};
+
+} // anonymous namespace
+
+
+MODULE_API void InitializeModuleData()
+{
+   RegisterDevice(g_GenericName, MM::GenericDevice, "Mock generic device");
+   RegisterDevice(g_CameraName, MM::CameraDevice, "Mock camera");
+   RegisterDevice(g_ShutterName, MM::ShutterDevice, "Mock shutter");
+}
+
+MODULE_API MM::Device* CreateDevice(const char* deviceName)
+{
+   if (deviceName == 0)
+      return 0;
+   if (strcmp(deviceName, g_GenericName) == 0)
+      return new MockGeneric();
+   if (strcmp(deviceName, g_CameraName) == 0)
+      return new MockCamera();
+   if (strcmp(deviceName, g_ShutterName) == 0)
+      return new MockShutter();
+   return 0;
+}
+
+MODULE_API void DeleteDevice(MM::Device* pDevice)
+{
+   delete pDevice;
+}
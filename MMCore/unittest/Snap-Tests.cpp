@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include "MockCoreTest.h"
+
+// Snaps with the mock camera and shutter (see MockDeviceAdapter.cpp). The
+// camera records in its image whether the shutter was open during the
+// exposure, and the shutter takes ActuationMs to open or close.
+
+class SnapTest : public MockCoreTest
+{
+protected:
+   virtual void SetUp()
+   {
+      Load("Camera", "MockA", "Camera");
+      Load("Shutter", "MockB", "Shutter");
+      core.setProperty("Camera", "ShutterLabel", "Shutter");
+      core.setProperty("Shutter", "ActuationMs", "50");
+      core.initializeAllDevices();
+      core.setCameraDevice("Camera");
+      core.setShutterDevice("Shutter");
+      core.setAutoShutter(true);
+   }
+
+   const unsigned char* Pixels()
+   {
+      return static_cast<const unsigned char*>(core.getImage());
+   }
+
+   bool ShutterPhysicallyOpen()
+   {
+      return core.getProperty("Shutter", "PhysicallyOpen") == "1";
+   }
+};
+
+
+TEST_F(SnapTest, ShutterIsOpenDuringExposure)
+{
+   core.setExposure(20.0);
+   core.snapImage();
+
+   const unsigned char* pixels = Pixels();
+   EXPECT_EQ(1, pixels[0]);
+   EXPECT_EQ(1, pixels[1]);
+   EXPECT_EQ(20, pixels[2]);
+
+   // Not pipelined: the shutter has finished closing
+   EXPECT_FALSE(core.deviceBusy("Shutter"));
+   EXPECT_FALSE(ShutterPhysicallyOpen());
+}
+
+TEST_F(SnapTest, PipelinedSnapsKeepOrderAndState)
+{
+   core.setPipelinedSnap(true);
+   const int exposures[] = { 10, 30, 5, 20 };
+   for (int i = 0; i < 4; ++i)
+   {
+      core.setExposure(exposures[i]);
+      core.snapImage();
+
+      // The shutter is still closing while the image is read out
+      EXPECT_TRUE(core.deviceBusy("Shutter")) << "snap " << i;
+      EXPECT_LT(core.getLastSnapPhaseTime("ShutterClose"), 40.0);
+
+      const unsigned char* pixels = Pixels();
+      EXPECT_EQ(i + 1, pixels[0]) << "snap " << i;
+      EXPECT_EQ(1, pixels[1]) << "snap " << i;
+      EXPECT_EQ(exposures[i], pixels[2]) << "snap " << i;
+   }
+
+   core.waitForImageSynchro();
+   EXPECT_FALSE(core.deviceBusy("Shutter"));
+   EXPECT_FALSE(ShutterPhysicallyOpen());
+   EXPECT_FALSE(core.getShutterOpen());
+}
+
+TEST_F(SnapTest, ShutterNotUsedWithoutAutoShutter)
+{
+   core.setAutoShutter(false);
+   core.setPipelinedSnap(true);
+   core.snapImage();
+
+   EXPECT_EQ(0, Pixels()[1]);
+   EXPECT_FALSE(core.deviceBusy("Shutter"));
+}
+
+TEST_F(SnapTest, FailedShutterOpenIsNotCounted)
+{
+   core.setProperty("Shutter", "FailOpen", "1");
+   EXPECT_THROW(core.snapImage(), CMMError);
+
+   // Had the failed snap stayed registered as a shutter user, this one would
+   // not open the shutter
+   core.setProperty("Shutter", "FailOpen", "0");
+   core.snapImage();
+   EXPECT_EQ(1, Pixels()[1]);
+   EXPECT_FALSE(ShutterPhysicallyOpen());
+}
+
+
+// Two cameras in different modules, so that their snaps can overlap. The
+// shutter is in the same module as one of the cameras.
+class ConcurrentSnapTest : public MockCoreTest
+{
+protected:
+   virtual void SetUp()
+   {
+      Load("CameraA", "MockA", "Camera");
+      Load("CameraB", "MockB", "Camera");
+      Load("Shutter", "MockA", "Shutter");
+      core.setProperty("CameraA", "ShutterLabel", "Shutter");
+      core.setProperty("CameraB", "ShutterLabel", "Shutter");
+      core.setProperty("Shutter", "ActuationMs", "20");
+      // A slow SetOpen() leaves time for the other snap to see the shutter
+      // in use before it is open
+      core.setProperty("Shutter", "SetOpenDelayMs", "100");
+      core.initializeAllDevices();
+      core.setCameraDevice("CameraA");
+      core.setShutterDevice("Shutter");
+      core.setAutoShutter(true);
+   }
+
+   unsigned char ShutterPixel(long handle)
+   {
+      FrameHandle image = core.getSnapImage(handle, 0);
+      return static_cast<const unsigned char*>(image.getPixels())[1];
+   }
+};
+
+TEST_F(ConcurrentSnapTest, AsyncSnapsShareShutter)
+{
+   long a = core.snapImageAsync("CameraA");
+   long b = core.snapImageAsync("CameraB");
+
+   EXPECT_EQ(1, ShutterPixel(a));
+   EXPECT_EQ(1, ShutterPixel(b));
+   core.releaseSnap(a);
+   core.releaseSnap(b);
+
+   core.waitForImageSynchro();
+   EXPECT_EQ("0", core.getProperty("Shutter", "PhysicallyOpen"));
+}
+
+TEST_F(ConcurrentSnapTest, SyncSnapSharesShutterWithAsyncSnap)
+{
+   long b = core.snapImageAsync("CameraB");
+   core.snapImage();
+
+   EXPECT_EQ(1, static_cast<const unsigned char*>(core.getImage())[1]);
+   EXPECT_EQ(1, ShutterPixel(b));
+   core.releaseSnap(b);
+
+   core.waitForImageSynchro();
+   EXPECT_EQ("0", core.getProperty("Shutter", "PhysicallyOpen"));
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
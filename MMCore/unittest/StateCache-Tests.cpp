@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include "StateCache.h"
+
+#include <string>
+
+
+TEST(StateCacheTests, SetIncrementsVersion)
+{
+   mm::StateCache cache;
+   EXPECT_EQ(0u, cache.GetVersion());
+   EXPECT_TRUE(cache.Set(PropertySetting("Camera", "Exposure", "10")));
+   EXPECT_EQ(1u, cache.GetVersion());
+
+   // Setting the same value is not a change
+   EXPECT_FALSE(cache.Set(PropertySetting("Camera", "Exposure", "10")));
+   EXPECT_EQ(1u, cache.GetVersion());
+
+   EXPECT_TRUE(cache.Set(PropertySetting("Camera", "Exposure", "20")));
+   EXPECT_EQ(2u, cache.GetVersion());
+
+   std::string value;
+   EXPECT_TRUE(cache.GetSnapshot().GetValue("Camera", "Exposure", value));
+   EXPECT_EQ("20", value);
+   EXPECT_FALSE(cache.GetSnapshot().GetValue("Camera", "Binning", value));
+   EXPECT_FALSE(cache.GetSnapshot().IsPropertyIncluded("Stage", "Exposure"));
+}
+
+TEST(StateCacheTests, SnapshotIsUnaffectedByLaterChanges)
+{
+   mm::StateCache cache;
+   cache.Set(PropertySetting("Camera", "Exposure", "10"));
+   const mm::StateCache::Snapshot snapshot = cache.GetSnapshot();
+
+   cache.Set(PropertySetting("Camera", "Exposure", "20"));
+   cache.Set(PropertySetting("Stage", "Position", "0"));
+
+   std::string value;
+   EXPECT_EQ(1u, snapshot.GetVersion());
+   EXPECT_TRUE(snapshot.GetValue("Camera", "Exposure", value));
+   EXPECT_EQ("10", value);
+   EXPECT_FALSE(snapshot.IsPropertyIncluded("Stage", "Position"));
+   EXPECT_EQ(1u, snapshot.GetConfiguration().size());
+   EXPECT_EQ(2u, cache.GetSnapshot().GetConfiguration().size());
+
+   Configuration stage;
+   cache.GetSnapshot().GetDeviceSettings("Stage", stage);
+   ASSERT_EQ(1u, stage.size());
+   EXPECT_EQ("Position", stage.getSetting(0).getPropertyName());
+   EXPECT_FALSE(stage.getSetting(0).isStale());
+}
+
+TEST(StateCacheTests, ReplaceDropsMissingProperties)
+{
+   mm::StateCache cache;
+   cache.Set(PropertySetting("Camera", "Exposure", "10"));
+   cache.Set(PropertySetting("Stage", "Position", "0"));
+
+   Configuration state;
+   state.addSetting(PropertySetting("Camera", "Exposure", "10"));
+   state.addSetting(PropertySetting("Camera", "Binning", "2"));
+   cache.Replace(state);
+
+   const mm::StateCache::Snapshot snapshot = cache.GetSnapshot();
+   EXPECT_EQ(3u, snapshot.GetVersion());
+   EXPECT_TRUE(snapshot.IsPropertyIncluded("Camera", "Binning"));
+   EXPECT_FALSE(snapshot.IsPropertyIncluded("Stage", "Position"));
+   EXPECT_EQ(2u, snapshot.GetConfiguration().size());
+}
+
+TEST(StateCacheTests, ChangesSinceVersion)
+{
+   mm::StateCache cache;
+   cache.Set(PropertySetting("Camera", "Exposure", "10"));
+   cache.Set(PropertySetting("Stage", "Position", "0"));
+   const unsigned long version = cache.GetVersion();
+
+   Configuration changes;
+   EXPECT_TRUE(cache.GetSnapshot().GetChangesSince(version, changes));
+   EXPECT_EQ(0u, changes.size());
+
+   cache.Set(PropertySetting("Stage", "Position", "5"));
+   EXPECT_TRUE(cache.GetSnapshot().GetChangesSince(version, changes));
+   ASSERT_EQ(1u, changes.size());
+   EXPECT_EQ("5", changes.getSetting("Stage", "Position").getPropertyValue());
+
+   // Replacing with equal values keeps their versions
+   Configuration state = cache.GetSnapshot().GetConfiguration();
+   cache.Replace(state);
+   changes = Configuration();
+   EXPECT_TRUE(cache.GetSnapshot().GetChangesSince(version, changes));
+   EXPECT_EQ(1u, changes.size());
+
+   // Removals cannot be expressed as changes, except from version 0
+   const unsigned long beforeRemoval = cache.GetVersion();
+   Configuration reduced;
+   reduced.addSetting(PropertySetting("Camera", "Exposure", "10"));
+   cache.Replace(reduced);
+   changes = Configuration();
+   EXPECT_FALSE(cache.GetSnapshot().GetChangesSince(beforeRemoval, changes));
+   EXPECT_TRUE(cache.GetSnapshot().GetChangesSince(cache.GetVersion(), changes));
+   EXPECT_TRUE(cache.GetSnapshot().GetChangesSince(0, changes));
+   EXPECT_EQ(1u, changes.size());
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include "Configuration.h"
+#include "MockCoreTest.h"
+
+#include <string>
+
+// Tests of CMMCore::getSystemState(double), which reads the devices of
+// different modules concurrently (see SystemStateReader.h)
+
+namespace {
+
+// Counts the settings of a device, and how many of them are stale
+void CountSettings(const Configuration& config, const std::string& label,
+      size_t& total, size_t& stale)
+{
+   total = stale = 0;
+   for (size_t i = 0; i < config.size(); ++i)
+   {
+      PropertySetting setting = config.getSetting(i);
+      if (setting.getDeviceLabel() != label)
+         continue;
+      ++total;
+      if (setting.isStale())
+         ++stale;
+   }
+}
+
+} // anonymous namespace
+
+
+class SystemStateReaderTest : public MockCoreTest
+{
+protected:
+   virtual void SetUp()
+   {
+      Load("A1", "MockA");
+      Load("B1", "MockB");
+      Load("B2", "MockB");
+      core.initializeAllDevices();
+      core.updateSystemStateCache();
+   }
+
+   virtual void TearDown()
+   {
+      // Blocks (on the module lock) until an abandoned read has finished,
+      // so that it is done before the devices go away
+      core.setProperty("B1", "GetDelayMs", "0");
+   }
+};
+
+
+TEST_F(SystemStateReaderTest, ModulesAreReadConcurrently)
+{
+   core.setProperty("A1", "GetDelayMs", "150");
+   core.setProperty("B1", "GetDelayMs", "150");
+
+   const double startMs = NowMs();
+   Configuration state = core.getSystemState(5000.0);
+   const double elapsedMs = NowMs() - startMs;
+
+   // One after the other would take at least 300 ms
+   EXPECT_LT(elapsedMs, 290.0);
+   const char* labels[] = { "A1", "B1", "B2" };
+   for (size_t i = 0; i < 3; ++i)
+   {
+      size_t total, stale;
+      CountSettings(state, labels[i], total, stale);
+      EXPECT_GT(total, 0u) << labels[i];
+      EXPECT_EQ(0u, stale) << labels[i];
+   }
+}
+
+TEST_F(SystemStateReaderTest, SlowDeviceIsReportedFromCache)
+{
+   core.setProperty("B1", "GetDelayMs", "500");
+
+   const double startMs = NowMs();
+   Configuration state = core.getSystemState(100.0);
+   const double elapsedMs = NowMs() - startMs;
+   EXPECT_LT(elapsedMs, 400.0);
+
+   size_t total, stale;
+   CountSettings(state, "A1", total, stale);
+   EXPECT_GT(total, 0u);
+   EXPECT_EQ(0u, stale);
+
+   // B1 ran out of time, and B2 (same module, after B1) was not reached;
+   // both come from the cache
+   CountSettings(state, "B1", total, stale);
+   EXPECT_GT(total, 0u);
+   EXPECT_EQ(total, stale);
+   CountSettings(state, "B2", total, stale);
+   EXPECT_GT(total, 0u);
+   EXPECT_EQ(total, stale);
+}
+
+TEST_F(SystemStateReaderTest, FailedPropertyDoesNotAffectOthers)
+{
+   core.setProperty("A1", "Value", "7");
+   core.setProperty("A1", "FailGet", "1");
+
+   Configuration state = core.getSystemState(5000.0);
+
+   size_t total, stale;
+   CountSettings(state, "A1", total, stale);
+   EXPECT_EQ(0u, stale);
+   EXPECT_TRUE(state.isPropertyIncluded("A1", "Broken"));
+   EXPECT_EQ("", state.getSetting("A1", "Broken").getPropertyValue());
+   EXPECT_EQ("7", state.getSetting("A1", "Value").getPropertyValue());
+   EXPECT_EQ("broken", state.getSetting("B1", "Broken").getPropertyValue());
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -556,6 +556,116 @@
 }
 
 
+// Java typemap
+// map the pixels of a FrameHandle to a direct java.nio.ByteBuffer (in native
+// byte order) without copying them. The ByteBuffer is returned inside a
+// FrameHandle.PixelBuffer, which holds its own copy of the handle, so the
+// frame stays pinned for as long as the PixelBuffer is reachable (even if
+// the original handle is released or garbage collected). The ByteBuffer must
+// not be kept without its PixelBuffer.
+
+%{
+typedef void* FramePixelBuffer;
+%}
+typedef void* FramePixelBuffer;
+
+%copyctor FrameHandle;
+
+%typemap(jni) FramePixelBuffer        "jobject"
+%typemap(jtype) FramePixelBuffer      "java.nio.ByteBuffer"
+%typemap(jstype) FramePixelBuffer     "FrameHandle.PixelBuffer"
+%typemap(javaout) FramePixelBuffer {
+   java.nio.ByteBuffer buffer = $jnicall;
+   if (buffer == null)
+      return null;
+   return new FrameHandle.PixelBuffer(new FrameHandle(this),
+         buffer.order(java.nio.ByteOrder.nativeOrder()));
+}
+%typemap(out) FramePixelBuffer
+{
+   $result = 0;
+   if (result != 0)
+   {
+      $result = JCALL2(NewDirectByteBuffer, jenv, result, (arg1)->getImageBufferSize());
+   }
+}
+
+%typemap(javacode) FrameHandle %{
+   /**
+    * The pixels of a frame, mapped without copying, together with the
+    * handle that keeps them valid.
+    */
+   public static final class PixelBuffer {
+      private final FrameHandle handle_;
+      private final java.nio.ByteBuffer buffer_;
+
+      PixelBuffer(FrameHandle handle, java.nio.ByteBuffer buffer) {
+         handle_ = handle;
+         buffer_ = buffer;
+      }
+
+      // Only valid while this PixelBuffer is reachable
+      public java.nio.ByteBuffer getBuffer() { return buffer_; }
+      public FrameHandle getHandle() { return handle_; }
+   }
+%}
+
+%extend FrameHandle {
+   FramePixelBuffer getPixelBuffer() { return $self->getPixels(); }
+}
+
+
+// Java typemap
+// return a batch of FrameHandles as a FrameHandle[], built in one native call
+// (a vector proxy would cross JNI for every element)
+
+%typemap(jni) std::vector<FrameHandle>        "jobjectArray"
+%typemap(jtype) std::vector<FrameHandle>      "FrameHandle[]"
+%typemap(jstype) std::vector<FrameHandle>     "FrameHandle[]"
+%typemap(javaout) std::vector<FrameHandle> {
+   return $jnicall;
+}
+%typemap(out) std::vector<FrameHandle>
+{
+   // The frames have already been taken from the buffer, so any failure
+   // must be reported to Java rather than silently dropping them
+   const std::vector<FrameHandle>& handles = $1;
+   jclass handleClass = jenv->FindClass("mmcorej/FrameHandle");
+   if (!handleClass)
+   {
+      jenv->ExceptionClear();
+      SWIG_JavaThrowException(jenv, SWIG_JavaRuntimeException, "Cannot find class mmcorej.FrameHandle");
+      return $null;
+   }
+   // The SWIG proxy constructor FrameHandle(long cPtr, boolean cMemoryOwn)
+   jmethodID constructor = jenv->GetMethodID(handleClass, "<init>", "(JZ)V");
+   if (!constructor)
+   {
+      jenv->ExceptionClear();
+      SWIG_JavaThrowException(jenv, SWIG_JavaRuntimeException, "Cannot find the constructor of mmcorej.FrameHandle");
+      return $null;
+   }
+
+   $result = jenv->NewObjectArray((jsize) handles.size(), handleClass, 0);
+   if (!$result)
+      return $null; // OutOfMemoryError pending
+   for (size_t i = 0; i < handles.size(); ++i)
+   {
+      jlong cPtr = 0;
+      *(FrameHandle **)&cPtr = new FrameHandle(handles[i]);
+      jobject handle = jenv->NewObject(handleClass, constructor, cPtr, JNI_TRUE);
+      if (!handle)
+      {
+         // Exception pending
+         delete *(FrameHandle **)&cPtr;
+         return $null;
+      }
+      jenv->SetObjectArrayElement($result, (jsize) i, handle);
+      jenv->DeleteLocalRef(handle);
+   }
+}
+
+
 %typemap(jni) imgRGB32 "jintArray"
 %typemap(jtype) imgRGB32      "int[]"
 %typemap(jstype) imgRGB32     "int[]"
@@ -638,6 +748,10 @@
 %}
 
 %typemap(javacode) CMMCore %{
+   // State cache version of the last image tagged with a state delta
+   private long taggedImageStateVersion_ = 0;
+   private final Object taggedImageStateLock_ = new Object();
+
    private JSONObject metadataToMap(Metadata md) {
       JSONObject tags = new JSONObject();
       for (String key:md.GetKeys()) {
@@ -699,7 +813,11 @@
    }
 
    private TaggedImage createTaggedImage(Object pixels, Metadata md, int cameraChannelIndex) throws java.lang.Exception {
-      TaggedImage image = createTaggedImage(pixels, md);
+      return createTaggedImage(pixels, md, cameraChannelIndex, false);
+   }
+
+   private TaggedImage createTaggedImage(Object pixels, Metadata md, int cameraChannelIndex, boolean stateDelta) throws java.lang.Exception {
+      TaggedImage image = createTaggedImage(pixels, md, stateDelta);
       JSONObject tags = image.tags;
       
       if (!tags.has("CameraChannelIndex")) {
@@ -717,9 +835,38 @@
    }
 
    private TaggedImage createTaggedImage(Object pixels, Metadata md) throws java.lang.Exception {
+      return createTaggedImage(pixels, md, false);
+   }
+
+   /*
+    * With stateDelta, only the state cache values that changed since the
+    * previous image tagged this way are added, together with the
+    * StateCacheVersion of this image and the StateCacheBaseVersion that the
+    * changes apply to. A base version of 0 means the full state is attached.
+    */
+   private TaggedImage createTaggedImage(Object pixels, Metadata md, boolean stateDelta) throws java.lang.Exception {
       JSONObject tags = metadataToMap(md);
       PropertySetting setting;
-      Configuration config = getSystemStateCache();
+      Configuration config = null;
+      if (stateDelta) {
+         synchronized (taggedImageStateLock_) {
+            // Read the version first; changes made in between are harmlessly
+            // repeated in the next delta
+            long version = getSystemStateCacheVersion();
+            long base = taggedImageStateVersion_;
+            try {
+               config = getSystemStateCacheChangesSince(base);
+            } catch (Exception e) {
+               base = 0;
+               config = getSystemStateCacheChangesSince(0);
+            }
+            taggedImageStateVersion_ = version;
+            tags.put("StateCacheVersion", version);
+            tags.put("StateCacheBaseVersion", base);
+         }
+      } else {
+         config = getSystemStateCache();
+      }
       for (int i = 0; i < config.size(); ++i) {
          setting = config.getSetting(i);
          String key = setting.getDeviceLabel() + "-" + setting.getPropertyName();
@@ -789,6 +936,32 @@
       return popNextTaggedImage(0);
    }
 
+   /*
+    * Pops the next image, attaching only the system state changes since the
+    * previous image popped with stateDelta set (see StateCacheVersion and
+    * StateCacheBaseVersion in the tags). Images must be processed in order to
+    * reconstruct the state; the first one carries the full state.
+    */
+   public TaggedImage popNextTaggedImage(int cameraChannelIndex, boolean stateDelta) throws java.lang.Exception {
+      Metadata md = new Metadata();
+      Object pixels = popNextImageMD(cameraChannelIndex, 0, md);
+      return createTaggedImage(pixels, md, cameraChannelIndex, stateDelta);
+   }
+
+   public TaggedImage popNextTaggedImage(boolean stateDelta) throws java.lang.Exception {
+      return popNextTaggedImage(0, stateDelta);
+   }
+
+   /*
+    * Makes the next image popped with stateDelta carry the full state, e.g.
+    * when starting a new acquisition.
+    */
+   public void resetTaggedImageStateDelta() {
+      synchronized (taggedImageStateLock_) {
+         taggedImageStateVersion_ = 0;
+      }
+   }
+
    // convenience functions follow
    
    /*
@@ -884,6 +1057,7 @@
 %{
 #include "../MMDevice/MMDeviceConstants.h"
 #include "../MMCore/Configuration.h"
+#include "../MMCore/FrameHandle.h"
 #include "../MMDevice/ImageMetadata.h"
 #include "../MMCore/MMEventCallback.h"
 #include "../MMCore/MMCore.h"
@@ -1059,6 +1233,7 @@ namespace std {
 
 %include "../MMDevice/MMDeviceConstants.h"
 %include "../MMCore/Configuration.h"
+%include "../MMCore/FrameHandle.h"
 %include "../MMCore/MMCore.h"
 %include "../MMDevice/ImageMetadata.h"
 %include "../MMCore/MMEventCallback.h"
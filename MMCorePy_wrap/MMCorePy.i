@@ -97,6 +97,77 @@ import_array();
 }
 
 
+// Map the pixels of a FrameHandle to a numpy array without copying them. The
+// array holds its own reference to the frame, which therefore stays pinned in
+// the circular buffer for as long as the array is alive.
+%{
+typedef void* FramePixelArray;
+%}
+typedef void* FramePixelArray;
+
+%typemap(out) FramePixelArray
+{
+   npy_intp dims[2];
+   dims[0] = (arg1)->getImageHeight();
+   dims[1] = (arg1)->getImageWidth();
+
+   int typenum = -1;
+   switch ((arg1)->getBytesPerPixel())
+   {
+      case 1: typenum = NPY_UINT8; break;
+      case 2: typenum = NPY_UINT16; break;
+      case 4: typenum = NPY_UINT32; break;
+      case 8: typenum = NPY_UINT64; break;
+   }
+   if (result == 0 || typenum < 0)
+   {
+      PyErr_SetString(PyExc_ValueError, "Frame handle is invalid or has an unsupported pixel type");
+      SWIG_fail;
+   }
+
+   PyObject * numpyArray = PyArray_SimpleNewFromData(2, dims, typenum, result);
+   if (!numpyArray)
+      SWIG_fail;
+   PyObject * owner = SWIG_NewPointerObj(new FrameHandle(*arg1), $descriptor(FrameHandle *), SWIG_POINTER_OWN);
+   // PyArray_SetBaseObject() steals the reference to owner, even on failure
+   if (!owner || PyArray_SetBaseObject((PyArrayObject *) numpyArray, owner) < 0)
+   {
+      Py_DECREF(numpyArray);
+      SWIG_fail;
+   }
+   $result = numpyArray;
+}
+
+%extend FrameHandle {
+   FramePixelArray getPixelArray() { return $self->getPixels(); }
+}
+
+
+// Return a batch of FrameHandles as a list, converted in one call
+%typemap(out) std::vector<FrameHandle>
+{
+   // The frames have already been taken from the buffer; on failure the
+   // pending MemoryError reports their loss
+   const std::vector<FrameHandle>& handles = $1;
+   $result = PyList_New(handles.size());
+   if (!$result)
+      SWIG_fail;
+   for (size_t i = 0; i < handles.size(); ++i)
+   {
+      FrameHandle * copy = new FrameHandle(handles[i]);
+      PyObject * handle = SWIG_NewPointerObj(copy, $descriptor(FrameHandle *), SWIG_POINTER_OWN);
+      if (!handle)
+      {
+         delete copy;
+         Py_DECREF($result);
+         $result = 0;
+         SWIG_fail;
+      }
+      PyList_SET_ITEM($result, i, handle);
+   }
+}
+
+
 %typemap(out) unsigned int*
 {
    //Here we assume we are getting RGBA (32 bits).
@@ -215,6 +286,7 @@ PyObject *setSLMImage_pywrap(const char* slmLabel, char *pixels, int receivedLen
 #include "../MMDevice/MMDeviceConstants.h"
 #include "../MMCore/Error.h"
 #include "../MMCore/Configuration.h"
+#include "../MMCore/FrameHandle.h"
 #include "../MMDevice/ImageMetadata.h"
 #include "../MMCore/MMEventCallback.h"
 #include "../MMCore/MMCore.h"
@@ -278,6 +350,7 @@ namespace std {
 %include "../MMDevice/MMDeviceConstants.h"
 %include "../MMCore/Error.h"
 %include "../MMCore/Configuration.h"
+%include "../MMCore/FrameHandle.h"
 %include "../MMCore/MMCore.h"
 %include "../MMDevice/ImageMetadata.h"
 %include "../MMCore/MMEventCallback.h"
@@ -36,6 +36,7 @@
 
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 
 #include <string>
 #include <vector>
@@ -519,6 +520,15 @@ public:
       return ret;
    }
 
+   /**
+   * Sets several properties at once. Override to set them more efficiently
+   * than one by one; by default the Core calls SetProperty() for each.
+   */
+   virtual int SetProperties(const char* const* /*names*/, const char* const* /*values*/, unsigned /*count*/)
+   {
+      return DEVICE_UNSUPPORTED_COMMAND;
+   }
+
    /**
    * Checks if device supports a given property.
    */
@@ -1120,6 +1130,16 @@ protected:
       return DEVICE_NO_CALLBACK_REGISTERED;
    }
 
+   /**
+    * Signals that the device has become non-busy (see MM::Core).
+    */
+   int OnDeviceIdle()
+   {
+      if (callback_)
+         return callback_->OnDeviceIdle(this);
+      return DEVICE_NO_CALLBACK_REGISTERED;
+   }
+
    /**
    * Gets the system ticks in microseconds.
    * OBSOLETE, use GetCurrentTime()
@@ -1534,20 +1554,28 @@ protected:
    {
       char label[MM::MaxStrLength];
       this->GetLabel(label);
-      Metadata md;
-      md.put("Camera", label);
-      int ret = GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-         GetImageHeight(), GetImageBytesPerPixel(),
-         md.Serialize().c_str());
+      FrameMetadata md;
+      md.PutString(FrameMetadata::KeyCamera, label);
+
+      // Copy the image straight into the circular buffer's frame memory
+      unsigned width = GetImageWidth();
+      unsigned height = GetImageHeight();
+      unsigned byteDepth = GetImageBytesPerPixel();
+      unsigned char* slot = 0;
+      int ret = GetCoreCallback()->AcquireImageSlot(this, width, height,
+         byteDepth, GetNumberOfComponents(), &slot);
       if (!stopWhenCBOverflows_ && ret == DEVICE_BUFFER_OVERFLOW)
       {
          // do not stop on overflow - just reset the buffer
          GetCoreCallback()->ClearImageBuffer(this);
-         return GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-            GetImageHeight(), GetImageBytesPerPixel(),
-            md.Serialize().c_str());
-      } else
+         ret = GetCoreCallback()->AcquireImageSlot(this, width, height,
+            byteDepth, GetNumberOfComponents(), &slot);
+      }
+      if (ret != DEVICE_OK)
          return ret;
+
+      memcpy(slot, GetImageBuffer(), width * height * byteDepth);
+      return GetCoreCallback()->CommitImageSlot(this, md);
    }
 
    virtual double GetIntervalMs() {return thd_->GetIntervalMs();}
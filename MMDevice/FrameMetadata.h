@@ -0,0 +1,313 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameMetadata.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMDevice - Device adapter kit
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Compact binary metadata passed along with each image
+//
+// COPYRIGHT:     University of California, San Francisco, 2015
+//
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "MMDeviceConstants.h"
+
+#include <cstring>
+
+
+/**
+ * Binary metadata for a single image.
+ *
+ * Unlike Metadata, a FrameMetadata never allocates memory: tags are packed
+ * into a fixed-size array, numeric values are kept in binary form, and the
+ * standard image keys are stored as a one-byte id. Because all member
+ * functions are inline and the data consists of plain bytes, it can be
+ * passed between a device adapter and the core by reference
+ * (MM::Core::CommitImageSlot()) without being serialized.
+ *
+ * Tags are appended in order; if the same tag is put more than once, the
+ * last value wins. The Put functions return false if the block is full.
+ * Use Metadata::Merge() to convert to a Metadata object.
+ */
+class FrameMetadata
+{
+public:
+   enum { Capacity = 2048 };
+
+   enum ValueType
+   {
+      TypeInteger = 1,
+      TypeDouble = 2,
+      TypeString = 3
+   };
+
+   /**
+    * Interned keys. The numbering is part of the device interface; only
+    * append to this list.
+    */
+   enum Key
+   {
+      KeyCustom = 0,
+      KeyCamera,
+      KeyImageNumber,
+      KeyElapsedTimeMs,
+      KeyStartTimeMs,
+      KeyWidth,
+      KeyHeight,
+      KeyPixelType,
+      KeyBinning,
+      KeyROIX,
+      KeyROIY,
+      KeyCount
+   };
+
+   /**
+    * A tag read from the block. The strings point into the block (or to
+    * static key names) and are valid as long as the block is not modified.
+    */
+   struct Tag
+   {
+      ValueType type;
+      Key key;
+      const char* name;
+      const char* device; // "_" for image tags
+      long long intValue;
+      double doubleValue;
+      const char* stringValue;
+   };
+
+   FrameMetadata() : size_(0), count_(0) {}
+
+   FrameMetadata(const FrameMetadata& other) :
+      size_(other.size_), count_(other.count_)
+   {
+      memcpy(data_, other.data_, size_);
+   }
+
+   FrameMetadata& operator=(const FrameMetadata& rhs)
+   {
+      if (this != &rhs)
+      {
+         size_ = rhs.size_;
+         count_ = rhs.count_;
+         memcpy(data_, rhs.data_, size_);
+      }
+      return *this;
+   }
+
+   void Clear() {size_ = 0; count_ = 0;}
+   unsigned GetCount() const {return count_;}
+   unsigned GetSize() const {return size_;}
+
+   static const char* GetKeyName(Key key)
+   {
+      switch (key)
+      {
+         case KeyCamera: return "Camera";
+         case KeyImageNumber: return MM::g_Keyword_Metadata_ImageNumber;
+         case KeyElapsedTimeMs: return MM::g_Keyword_Elapsed_Time_ms;
+         case KeyStartTimeMs: return MM::g_Keyword_Metadata_StartTime;
+         case KeyWidth: return "Width";
+         case KeyHeight: return "Height";
+         case KeyPixelType: return "PixelType";
+         case KeyBinning: return MM::g_Keyword_Binning;
+         case KeyROIX: return MM::g_Keyword_Metadata_ROI_X;
+         case KeyROIY: return MM::g_Keyword_Metadata_ROI_Y;
+         default: return 0;
+      }
+   }
+
+   /**
+    * Returns the interned key for an image tag name, or KeyCustom.
+    */
+   static Key InternKey(const char* name)
+   {
+      for (int k = KeyCustom + 1; k < KeyCount; ++k)
+      {
+         if (strcmp(name, GetKeyName(static_cast<Key>(k))) == 0)
+            return static_cast<Key>(k);
+      }
+      return KeyCustom;
+   }
+
+   bool PutInteger(Key key, long long value)
+   {
+      return PutValue(key, 0, "_", TypeInteger, &value, sizeof(value));
+   }
+
+   bool PutDouble(Key key, double value)
+   {
+      return PutValue(key, 0, "_", TypeDouble, &value, sizeof(value));
+   }
+
+   bool PutString(Key key, const char* value)
+   {
+      return PutValue(key, 0, "_", TypeString, value, strlen(value) + 1);
+   }
+
+   /*
+    * The following put a tag by name, for the given device (or an image tag
+    * if device is "_").
+    */
+   bool PutInteger(const char* name, long long value, const char* device = "_")
+   {
+      return PutValue(KeyCustom, name, device, TypeInteger, &value, sizeof(value));
+   }
+
+   bool PutDouble(const char* name, double value, const char* device = "_")
+   {
+      return PutValue(KeyCustom, name, device, TypeDouble, &value, sizeof(value));
+   }
+
+   bool PutString(const char* name, const char* value, const char* device = "_")
+   {
+      return PutValue(KeyCustom, name, device, TypeString, value, strlen(value) + 1);
+   }
+
+   /**
+    * Reads the tag at offset (start with 0) and advances offset to the next
+    * tag. Returns false when there are no more tags.
+    */
+   bool NextTag(unsigned& offset, Tag& tag) const
+   {
+      if (offset >= size_)
+         return false;
+
+      const char* p = data_ + offset;
+      tag.type = static_cast<ValueType>(*p++);
+      tag.key = static_cast<Key>(*p++);
+      if (tag.key == KeyCustom)
+      {
+         tag.name = p;
+         p += strlen(p) + 1;
+      }
+      else
+      {
+         tag.name = GetKeyName(tag.key);
+      }
+      tag.device = p;
+      p += strlen(p) + 1;
+
+      tag.intValue = 0;
+      tag.doubleValue = 0.0;
+      tag.stringValue = 0;
+      switch (tag.type)
+      {
+         case TypeInteger:
+            memcpy(&tag.intValue, p, sizeof(tag.intValue));
+            p += sizeof(tag.intValue);
+            break;
+         case TypeDouble:
+            memcpy(&tag.doubleValue, p, sizeof(tag.doubleValue));
+            p += sizeof(tag.doubleValue);
+            break;
+         case TypeString:
+            tag.stringValue = p;
+            p += strlen(p) + 1;
+            break;
+      }
+
+      offset = static_cast<unsigned>(p - data_);
+      return true;
+   }
+
+   /**
+    * Finds the (last) value of an interned image tag.
+    */
+   bool FindTag(Key key, Tag& tag) const
+   {
+      bool found = false;
+      Tag t;
+      unsigned offset = 0;
+      while (NextTag(offset, t))
+      {
+         if (t.key == key)
+         {
+            tag = t;
+            found = true;
+         }
+      }
+      return found;
+   }
+
+   /**
+    * Finds the (last) value of a tag by name.
+    */
+   bool FindTag(const char* name, Tag& tag, const char* device = "_") const
+   {
+      bool found = false;
+      Tag t;
+      unsigned offset = 0;
+      while (NextTag(offset, t))
+      {
+         if (strcmp(t.name, name) == 0 && strcmp(t.device, device) == 0)
+         {
+            tag = t;
+            found = true;
+         }
+      }
+      return found;
+   }
+
+   bool HasTag(Key key) const {Tag t; return FindTag(key, t);}
+   bool HasTag(const char* name, const char* device = "_") const
+   {
+      Tag t;
+      return FindTag(name, t, device);
+   }
+
+private:
+   // Layout of each tag: type (1 byte), key id (1 byte), name (only for
+   // KeyCustom, null-terminated), device (null-terminated), value (8 bytes
+   // for numbers, null-terminated for strings). Numbers are unaligned and
+   // must be accessed with memcpy.
+   bool PutValue(Key key, const char* name, const char* device,
+         ValueType type, const void* value, size_t valueSize)
+   {
+      if (key == KeyCustom && strcmp(device, "_") == 0)
+      {
+         Key interned = InternKey(name);
+         if (interned != KeyCustom)
+         {
+            key = interned;
+            name = 0;
+         }
+      }
+
+      const size_t nameSize = name ? strlen(name) + 1 : 0;
+      const size_t deviceSize = strlen(device) + 1;
+      const size_t tagSize = 2 + nameSize + deviceSize + valueSize;
+      if (tagSize > Capacity - size_)
+         return false;
+
+      char* p = data_ + size_;
+      *p++ = static_cast<char>(type);
+      *p++ = static_cast<char>(key);
+      if (name)
+      {
+         memcpy(p, name, nameSize);
+         p += nameSize;
+      }
+      memcpy(p, device, deviceSize);
+      p += deviceSize;
+      memcpy(p, value, valueSize);
+
+      size_ += static_cast<unsigned>(tagSize);
+      ++count_;
+      return true;
+   }
+
+   unsigned size_;
+   unsigned count_;
+   char data_[Capacity];
+};
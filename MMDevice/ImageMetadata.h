@@ -30,6 +30,9 @@
 #endif
 
 #include "MMDeviceConstants.h"
+#ifndef SWIG
+#include "FrameMetadata.h"
+#endif
 
 #include <string>
 #include <vector>
@@ -38,6 +41,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // MetadataError
 // -------------
@@ -86,27 +93,24 @@ class MetadataArrayTag;
 class MetadataTag
 {
 public:
-   MetadataTag() : name_("undefined"), deviceLabel_("undefined"), readOnly_(false) {}
+   MetadataTag() : name_("undefined"), deviceLabel_("undefined"), readOnly_(false)
+   {
+      UpdateQualifiedName();
+   }
    MetadataTag(const char* name, const char* device, bool readOnly) :
-      name_(name), deviceLabel_(device), readOnly_(readOnly) {}
+      name_(name), deviceLabel_(device), readOnly_(readOnly)
+   {
+      UpdateQualifiedName();
+   }
    virtual ~MetadataTag() {}
 
    const std::string& GetDevice() const {return deviceLabel_;}
    const std::string& GetName() const {return name_;}
-   const std::string GetQualifiedName() const
-   {
-      std::stringstream os;
-      if (deviceLabel_.compare("_") != 0)
-      {
-         os << deviceLabel_ << "-";
-      }
-      os << name_;
-      return os.str();
-   }
+   const std::string& GetQualifiedName() const {return qualifiedName_;}
    const bool IsReadOnly() const  {return readOnly_;}
 
-   void SetDevice(const char* device) {deviceLabel_ = device;}
-   void SetName(const char* name) {name_ = name;}
+   void SetDevice(const char* device) {deviceLabel_ = device; UpdateQualifiedName();}
+   void SetName(const char* name) {name_ = name; UpdateQualifiedName();}
    void SetReadOnly(bool ro) {readOnly_ = ro;}
 
    /**
@@ -136,8 +140,17 @@ public:
    virtual bool Restore(const char* stream) = 0;
 
 private:
+   void UpdateQualifiedName()
+   {
+      if (deviceLabel_.compare("_") != 0)
+         qualifiedName_ = deviceLabel_ + "-" + name_;
+      else
+         qualifiedName_ = name_;
+   }
+
    std::string name_;
    std::string deviceLabel_;
+   std::string qualifiedName_;
    bool readOnly_;
 };
 
@@ -262,57 +275,68 @@ private:
 
 /**
  * Container for all metadata associated with a single image.
+ *
+ * Copies share the same tags until one of them is modified (copy-on-write),
+ * so copying and assigning Metadata objects is cheap.
  */
 class Metadata
 {
 public:
 
-   Metadata() {} // empty constructor
+   Metadata() : store_(0) {} // empty constructor
 
    ~Metadata() // destructor
    {
       Clear();
    }
 
-   Metadata(const Metadata& original) // copy constructor
+   Metadata(const Metadata& original) : // copy constructor
+      store_(original.store_)
    {
-      for (TagIterator it = original.tags_.begin(); it != original.tags_.end(); it++)
-      {
-         SetTag(*it->second);
-      }
+      if (store_)
+         store_->AddRef();
    }
 
    void Clear() {
-      for (TagIterator it=tags_.begin(); it != tags_.end(); it++)
-         delete it->second;
-      tags_.clear();
+      if (store_ && store_->Release())
+         delete store_;
+      store_ = 0;
    }
 
    std::vector<std::string> GetKeys() const
    {
       std::vector<std::string> keyList;
-      for (TagIterator it = tags_.begin(), end = tags_.end(); it != end; ++it)
+      if (!store_)
+         return keyList;
+      for (TagIterator it = store_->tags.begin(), end = store_->tags.end(); it != end; ++it)
          keyList.push_back(it->first);
       return keyList;
    }
 
-   bool HasTag(const char* key)
+   bool HasTag(const char* key) const
    {
-      TagIterator it = tags_.find(key);
-      if (it != tags_.end())
-         return true;
-      else
+      if (!store_)
          return false;
+      return store_->tags.find(key) != store_->tags.end();
    }
-   
+
+#ifndef SWIG
+   // Returned references remain valid until this object is modified
+   const MetadataSingleTag& GetSingleTag(const char* key) const throw (MetadataKeyError)
+#else
    MetadataSingleTag GetSingleTag(const char* key) const throw (MetadataKeyError)
+#endif
    {
       MetadataTag* tag = FindTag(key);
       const MetadataSingleTag* stag = tag->ToSingleTag();
       return *stag;
    }
 
+#ifndef SWIG
+   const MetadataArrayTag& GetArrayTag(const char* key) const throw (MetadataKeyError)
+#else
    MetadataArrayTag GetArrayTag(const char* key) const throw (MetadataKeyError)
+#endif
    {
       MetadataTag* tag = FindTag(key);
       const MetadataArrayTag* atag = tag->ToArrayTag();
@@ -321,19 +345,26 @@ public:
 
    void SetTag(MetadataTag& tag)
    {
+      // Clone first: tag may belong to this object
       MetadataTag* newTag = tag.Clone();
-      RemoveTag(tag.GetQualifiedName().c_str());
-      tags_.insert(std::make_pair(tag.GetQualifiedName(), newTag));
+      TagMap& tags = MutableTags();
+      std::pair<TagMap::iterator, bool> inserted =
+         tags.insert(std::make_pair(newTag->GetQualifiedName(), newTag));
+      if (!inserted.second)
+      {
+         delete inserted.first->second;
+         inserted.first->second = newTag;
+      }
    }
 
    void RemoveTag(const char* key)
    {
-      TagIterator it = tags_.find(key);
-      if (it != tags_.end())
-      {
-         delete it->second;
-         tags_.erase(key);
-      }
+      if (!HasTag(key))
+         return;
+      TagMap& tags = MutableTags();
+      TagMap::iterator it = tags.find(key);
+      delete it->second;
+      tags.erase(it);
    }
 
    /*
@@ -370,31 +401,68 @@ public:
 #ifndef SWIG
    Metadata& operator=(const Metadata& rhs)
    {
+      if (rhs.store_)
+         rhs.store_->AddRef();
       Clear();
-      
-      for (TagIterator it=rhs.tags_.begin(); it != rhs.tags_.end(); it++)
-      {
-         SetTag(*it->second);
-      }
-
+      store_ = rhs.store_;
       return *this;
    }
 #endif
 
    void Merge(const Metadata& newTags)
    {     
-      for (TagIterator it=newTags.tags_.begin(); it != newTags.tags_.end(); it++)
+      if (!newTags.store_ || newTags.store_ == store_)
+         return;
+      if (!store_)
+      {
+         *this = newTags;
+         return;
+      }
+      for (TagIterator it=newTags.store_->tags.begin(); it != newTags.store_->tags.end(); it++)
       {
          SetTag(*it->second);
       }
    }
 
+#ifndef SWIG
+   /*
+    * Adds the tags of a binary FrameMetadata block, converting the values to
+    * text.
+    */
+   void Merge(const FrameMetadata& block)
+   {
+      FrameMetadata::Tag tag;
+      unsigned offset = 0;
+      while (block.NextTag(offset, tag))
+      {
+         MetadataSingleTag st(tag.name, tag.device, true);
+         if (tag.type == FrameMetadata::TypeString)
+         {
+            st.SetValue(tag.stringValue);
+         }
+         else
+         {
+            std::ostringstream os;
+            os.precision(15);
+            if (tag.type == FrameMetadata::TypeInteger)
+               os << tag.intValue;
+            else
+               os << tag.doubleValue;
+            st.SetValue(os.str().c_str());
+         }
+         SetTag(st);
+      }
+   }
+#endif
+
    std::string Serialize() const
    {
       std::ostringstream os;
 
-      os << tags_.size();
-      for (TagIterator it = tags_.begin(); it != tags_.end(); it++)
+      os << (store_ ? store_->tags.size() : 0);
+      if (!store_)
+         return os.str();
+      for (TagIterator it = store_->tags.begin(); it != store_->tags.end(); it++)
       {
          std::string id("s");
          if (it->second->ToArrayTag())
@@ -437,6 +505,9 @@ public:
       std::istringstream is(stream);
       size_t sz;
       is >> sz;
+      if (!is || sz == 0)
+         return true;
+      TagMap& tags = MutableTags();
 
       for (size_t i=0; i<sz; i++)
       {
@@ -456,7 +527,7 @@ public:
             ms.SetValue(readLine(is).c_str());
 
             MetadataTag* newTag = ms.Clone();
-            tags_.insert(std::make_pair(ms.GetQualifiedName(), newTag));
+            tags.insert(std::make_pair(ms.GetQualifiedName(), newTag));
          }
          else if (id.compare("a") == 0)
          {
@@ -473,7 +544,7 @@ public:
             }
 
             MetadataTag* newTag = as.Clone();
-            tags_.insert(std::make_pair(as.GetQualifiedName(), newTag));
+            tags.insert(std::make_pair(as.GetQualifiedName(), newTag));
          }
          else
          {
@@ -487,8 +558,10 @@ public:
    {
       std::ostringstream os;
 
-      os << tags_.size();
-      for (TagIterator it = tags_.begin(); it != tags_.end(); it++)
+      os << (store_ ? store_->tags.size() : 0);
+      if (!store_)
+         return os.str();
+      for (TagIterator it = store_->tags.begin(); it != store_->tags.end(); it++)
       {
          std::string id("s");
          if (it->second->ToArrayTag())
@@ -501,17 +574,78 @@ public:
    }
 
 private:
+   typedef std::map<std::string, MetadataTag*> TagMap;
+   typedef TagMap::const_iterator TagIterator;
+
+   // Tags shared by copies of a Metadata object. The reference count is
+   // atomic because copies may be used (and destroyed) by different threads;
+   // the tags themselves are only modified while the count is 1.
+   struct TagStore
+   {
+      TagStore() : refCount(1) {}
+      ~TagStore()
+      {
+         for (TagIterator it = tags.begin(); it != tags.end(); it++)
+            delete it->second;
+      }
+
+      void AddRef()
+      {
+#ifdef _MSC_VER
+         _InterlockedIncrement(&refCount);
+#else
+         __sync_add_and_fetch(&refCount, 1);
+#endif
+      }
+
+      // Returns true if this was the last reference
+      bool Release()
+      {
+#ifdef _MSC_VER
+         return _InterlockedDecrement(&refCount) == 0;
+#else
+         return __sync_sub_and_fetch(&refCount, 1) == 0;
+#endif
+      }
+
+      volatile long refCount;
+      TagMap tags;
+
+   private:
+      TagStore(const TagStore&);
+      TagStore& operator=(const TagStore&);
+   };
+
+   // Returns the tags for modification, cloning them first if shared
+   TagMap& MutableTags()
+   {
+      if (!store_)
+      {
+         store_ = new TagStore();
+      }
+      else if (store_->refCount != 1)
+      {
+         TagStore* copy = new TagStore();
+         for (TagIterator it = store_->tags.begin(); it != store_->tags.end(); it++)
+            copy->tags.insert(std::make_pair(it->first, it->second->Clone()));
+         Clear();
+         store_ = copy;
+      }
+      return store_->tags;
+   }
+
    MetadataTag* FindTag(const char* key) const
    {
-      TagIterator it = tags_.find(key);
-      if (it != tags_.end())
-         return it->second;
-      else
-         throw MetadataKeyError();
+      if (store_)
+      {
+         TagIterator it = store_->tags.find(key);
+         if (it != store_->tags.end())
+            return it->second;
+      }
+      throw MetadataKeyError();
    }
 
-   std::map<std::string, MetadataTag*> tags_;
-   typedef std::map<std::string, MetadataTag*>::const_iterator TagIterator;
+   TagStore* store_;
 };
 
 #endif //_IMAGE_METADATA_H_
@@ -27,7 +27,7 @@
 // Header version
 // If any of the class definitions changes, the interface version
 // must be incremented
-#define DEVICE_INTERFACE_VERSION 68
+#define DEVICE_INTERFACE_VERSION 73
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -245,6 +245,14 @@ namespace MM {
       virtual unsigned GetNumberOfProperties() const = 0;
       virtual int GetProperty(const char* name, char* value) const = 0;  
       virtual int SetProperty(const char* name, const char* value) = 0;
+      /**
+       * Sets several properties at once, e.g. with a single controller
+       * command, in the given order. Return DEVICE_UNSUPPORTED_COMMAND (the
+       * default) to have the Core call SetProperty() for each instead. On
+       * any other error the Core also falls back to SetProperty(), to find
+       * out which property failed.
+       */
+      virtual int SetProperties(const char* const* names, const char* const* values, unsigned count) = 0;
       virtual bool HasProperty(const char* name) const = 0;
       virtual bool GetPropertyName(unsigned idx, char* name) const = 0;
       virtual int GetPropertyReadOnly(const char* name, bool& readOnly) const = 0;
@@ -1282,6 +1290,13 @@ namespace MM {
        * Magnifiers can use this to signal changes in magnification
        */
       virtual int OnMagnifierChanged(const Device* caller) = 0;
+      /**
+       * A device whose Busy() status changes asynchronously (e.g. a stage
+       * that reports the end of a move) can call this when it becomes idle,
+       * so that the Core's waits return immediately instead of at the next
+       * poll. Optional: devices that never call it are still polled.
+       */
+      virtual int OnDeviceIdle(const Device* caller) = 0;
 
       virtual unsigned long GetClockTicksUs(const Device* caller) = 0;
       virtual MM::MMTime GetCurrentMMTime() = 0;
@@ -1298,6 +1313,33 @@ namespace MM {
       virtual bool InitializeImageBuffer(unsigned channels, unsigned slices, unsigned int w, unsigned int h, unsigned int pixDepth) = 0;
       /// \deprecated Use the other forms instead.
       virtual int InsertMultiChannel(const Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* md = 0) = 0;
+      /**
+       * Zero-copy alternative to InsertImage(): reserves the next frame of
+       * the sequence buffer and sets *pixels to its memory (width * height *
+       * byteDepth bytes), to be filled in place by the camera. Returns
+       * DEVICE_BUFFER_OVERFLOW if the buffer is full, or
+       * DEVICE_INCOMPATIBLE_IMAGE if the buffer was initialized for a
+       * different image size. After a successful call, the same thread must
+       * call CommitImageSlot() or AbandonImageSlot() before any other image
+       * is inserted; other cameras sharing the buffer may be held off until
+       * then. A reservation still pending when the same thread reserves or
+       * inserts again is abandoned.
+       */
+      virtual int AcquireImageSlot(const Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char** pixels) = 0;
+      /**
+       * Inserts the frame reserved by AcquireImageSlot() into the sequence
+       * buffer, with the given metadata.
+       */
+      virtual int CommitImageSlot(const Device* caller, const char* serializedMetadata, const bool doProcess = true) = 0;
+      /**
+       * Same as above, but takes binary metadata, which avoids serializing
+       * and parsing text for every frame.
+       */
+      virtual int CommitImageSlot(const Device* caller, const FrameMetadata& md, const bool doProcess = true) = 0;
+      /**
+       * Releases the frame reserved by AcquireImageSlot() without inserting it.
+       */
+      virtual void AbandonImageSlot(const Device* caller) = 0;
 
       // autofocus
       // TODO This interface needs improvement: the caller pointer should be
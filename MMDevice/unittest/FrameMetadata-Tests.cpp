@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include "ImageMetadata.h"
+
+#include <string>
+
+
+TEST(FrameMetadataTests, PutAndFind)
+{
+   FrameMetadata md;
+   EXPECT_EQ(0u, md.GetCount());
+
+   ASSERT_TRUE(md.PutInteger(FrameMetadata::KeyImageNumber, 42));
+   ASSERT_TRUE(md.PutDouble("Exposure", 1.5, "Camera1"));
+   ASSERT_TRUE(md.PutString("PixelType", "GRAY16"));
+   ASSERT_TRUE(md.PutInteger(FrameMetadata::KeyImageNumber, 43));
+   EXPECT_EQ(4u, md.GetCount());
+
+   FrameMetadata::Tag tag;
+   ASSERT_TRUE(md.FindTag(FrameMetadata::KeyImageNumber, tag));
+   EXPECT_EQ(FrameMetadata::TypeInteger, tag.type);
+   EXPECT_EQ(43, tag.intValue);
+
+   // Well-known keys put by name are interned
+   ASSERT_TRUE(md.FindTag(FrameMetadata::KeyPixelType, tag));
+   EXPECT_STREQ("GRAY16", tag.stringValue);
+
+   ASSERT_TRUE(md.FindTag("Exposure", tag, "Camera1"));
+   EXPECT_EQ(FrameMetadata::TypeDouble, tag.type);
+   EXPECT_DOUBLE_EQ(1.5, tag.doubleValue);
+   EXPECT_FALSE(md.HasTag("Exposure"));
+
+   FrameMetadata copy(md);
+   md.Clear();
+   EXPECT_FALSE(md.HasTag(FrameMetadata::KeyImageNumber));
+   EXPECT_TRUE(copy.HasTag(FrameMetadata::KeyImageNumber));
+}
+
+
+TEST(FrameMetadataTests, FullBlockRejectsTags)
+{
+   FrameMetadata md;
+   const std::string longValue(FrameMetadata::Capacity / 4, 'x');
+   unsigned n = 0;
+   while (md.PutString("Key", longValue.c_str()))
+      ++n;
+   EXPECT_EQ(3u, n);
+   EXPECT_EQ(3u, md.GetCount());
+   EXPECT_TRUE(md.PutInteger(FrameMetadata::KeyWidth, 512));
+}
+
+
+TEST(FrameMetadataTests, MergeIntoMetadata)
+{
+   FrameMetadata block;
+   block.PutInteger(FrameMetadata::KeyWidth, 512);
+   block.PutDouble(FrameMetadata::KeyElapsedTimeMs, 1234.25);
+   block.PutString("Mode", "Fast", "Camera1");
+
+   Metadata md;
+   md.PutImageTag("Width", 256);
+   md.PutImageTag("Other", "kept");
+   md.Merge(block);
+
+   EXPECT_EQ("512", md.GetSingleTag("Width").GetValue());
+   EXPECT_EQ("1234.25", md.GetSingleTag(MM::g_Keyword_Elapsed_Time_ms).GetValue());
+   EXPECT_EQ("Fast", md.GetSingleTag("Camera1-Mode").GetValue());
+   EXPECT_EQ("kept", md.GetSingleTag("Other").GetValue());
+}
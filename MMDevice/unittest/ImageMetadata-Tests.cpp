@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include "ImageMetadata.h"
+
+
+TEST(ImageMetadataTests, CopiesAreIndependent)
+{
+   Metadata md;
+   md.PutImageTag("A", 1);
+   md.PutTag("B", "Dev", "x");
+
+   Metadata copy(md);
+   Metadata assigned;
+   assigned = md;
+   EXPECT_EQ(&md.GetSingleTag("A"), &copy.GetSingleTag("A"));
+
+   copy.PutImageTag("A", 2);
+   assigned.RemoveTag("Dev-B");
+
+   EXPECT_EQ("1", md.GetSingleTag("A").GetValue());
+   EXPECT_EQ("x", md.GetSingleTag("Dev-B").GetValue());
+   EXPECT_EQ("2", copy.GetSingleTag("A").GetValue());
+   EXPECT_EQ("x", copy.GetSingleTag("Dev-B").GetValue());
+   EXPECT_FALSE(assigned.HasTag("Dev-B"));
+   EXPECT_TRUE(assigned.HasTag("A"));
+
+   md.Clear();
+   EXPECT_FALSE(md.HasTag("A"));
+   EXPECT_EQ("2", copy.GetSingleTag("A").GetValue());
+}
+
+
+TEST(ImageMetadataTests, SetTagFromSelfAndMergeSelf)
+{
+   Metadata md;
+   md.PutImageTag("A", 1);
+   Metadata copy(md);
+
+   MetadataSingleTag& tag = const_cast<MetadataSingleTag&>(md.GetSingleTag("A"));
+   md.SetTag(tag);
+   md.Merge(md);
+   md.Merge(copy);
+   EXPECT_EQ(1u, md.GetKeys().size());
+   EXPECT_EQ("1", md.GetSingleTag("A").GetValue());
+}
+
+
+TEST(ImageMetadataTests, QualifiedNameAndSerialization)
+{
+   MetadataSingleTag tag("Exposure", "Camera", true);
+   EXPECT_EQ("Camera-Exposure", tag.GetQualifiedName());
+   tag.SetDevice("_");
+   EXPECT_EQ("Exposure", tag.GetQualifiedName());
+
+   Metadata md;
+   EXPECT_FALSE(md.HasTag("Exposure"));
+   EXPECT_THROW(md.GetSingleTag("Exposure"), MetadataKeyError);
+   EXPECT_EQ("0", md.Serialize());
+
+   tag.SetValue("10");
+   md.SetTag(tag);
+   md.PutTag("Gain", "Camera", 2);
+   Metadata restored;
+   ASSERT_TRUE(restored.Restore(md.Serialize().c_str()));
+   EXPECT_EQ("10", restored.GetSingleTag("Exposure").GetValue());
+   EXPECT_EQ("2", restored.GetSingleTag("Camera-Gain").GetValue());
+}